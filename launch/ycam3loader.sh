@@ -17,6 +17,11 @@ if [ "$unit" = "" ]
 then
   unit=m
 fi
+launch=$3
+if [ "$launch" = "" ]
+then
+  launch=ycam3s
+fi
 
 roscd rovi
 rosparam load yaml/ycam3$res.yaml
@@ -45,6 +50,6 @@ script/gvload.js $res "$guid"
 script/p2qmatrix.py $unit
 script/cam_prm_reader.py "$guid" $res
 
-roslaunch launch/ycam3s.launch
+roslaunch launch/$launch.launch
 pkill camnode
 echo -n 'y' | rosnode cleanup
@@ -0,0 +1,42 @@
+#!/bin/bash
+
+# 保存したパターン画像の一覧をgenpc_bench --goldenで順に確認します.
+# 一覧の1行: <ダンプディレクトリ> <基準ファイルのディレクトリ> <パラメータyaml> [<パラメータyaml> ...]  (#以降はコメント)
+# 使い方: genpc_regression.sh <一覧> [genpc_benchのオプション(--update-golden, --max-regression など)]
+
+list=$1
+if [ "$list" = "" ]
+then
+  echo "usage: $0 <list> [genpc_bench options]" >&2
+  exit 2
+fi
+shift
+opts=("$@")
+
+failed=0
+while read -r line
+do
+  line=${line%%#*}
+  set -- $line
+  if [ $# -lt 3 ]
+  then
+    continue
+  fi
+  dump=$1
+  golden=$2
+  shift 2
+  echo "=== $dump" >&2
+  rosrun rovi genpc_bench --golden "$golden" "${opts[@]}" "$dump" "$@" < /dev/null
+  ret=$?
+  if [ $ret -ne 0 ]
+  then
+    echo "=== $dump failed. status=$ret" >&2
+    failed=$((failed+1))
+  fi
+done < "$list"
+
+if [ $failed -ne 0 ]
+then
+  echo "$failed dump(s) failed" >&2
+  exit 1
+fi
@@ -12,6 +12,7 @@
 #include <math.h>
 
 #include "Aravis.h"
+#include "YCAM3DEmulator.hpp"
 
 using namespace std;
 
@@ -179,32 +180,16 @@ Aravis::~Aravis()
 	destroy();
 }
 
-bool Aravis::openCamera(const char *name, const int packet_size)
+//name or ip addressのカメラを開く
+ArvCamera *Aravis::open_device(const char *name)
 {
-	*name_='\0';
-	dprintf("*** open camera [%s]",name ? name : "");
-	
-	//2020/09/18 add by hato -------------------- start --------------------
-	m_expsr_tm_lv = -1;
-	if( ! m_expsr_tm_lv_setting_ ){
-		dprintf("error: exposure time level setting is null.");
-		return false;
-	}
-	const int cur_expsr_tm_lv = m_expsr_tm_lv_setting_->default_lv;
-	const ExposureTimeLevelSetting::Param * exp_tm_lv_param = m_expsr_tm_lv_setting_->get_param(cur_expsr_tm_lv);
-	if( ! exp_tm_lv_param ){
-		dprintf("error: exposure time level param is null.");
-		return false;
-	}
-	//2020/09/18 add by hato --------------------  end  --------------------
-	
 	//
 	ArvInterface *arvif=arv_gv_interface_get_instance();
 	arv_interface_update_device_list(arvif);
 	const int ndev=arv_interface_get_n_devices(arvif);
 	if(ndev<=0){
 		dprintf(" error: no available cameras");
-		return false;
+		return nullptr;
 	}
 	dprintf(" number of available device = %d",ndev);
 	dprintf(" --------------------");
@@ -236,10 +221,43 @@ bool Aravis::openCamera(const char *name, const int packet_size)
 		}
 		dprintf(" open device [%s]",camera_name);
 	}
-	camera_ = arv_camera_new(camera_name);
-	if(camera_){
+	ArvCamera *camera = arv_camera_new(camera_name);
+	if(!camera) dprintf("error: arv_camera_new");
+	return camera;
+}
+
+bool Aravis::openCamera(const char *name, const int packet_size)
+{
+	*name_='\0';
+	dprintf("*** open camera [%s]",name ? name : "");
+	
+	//2020/09/18 add by hato -------------------- start --------------------
+	m_expsr_tm_lv = -1;
+	if( ! m_expsr_tm_lv_setting_ ){
+		dprintf("error: exposure time level setting is null.");
+		return false;
+	}
+	const int cur_expsr_tm_lv = m_expsr_tm_lv_setting_->default_lv;
+	const ExposureTimeLevelSetting::Param * exp_tm_lv_param = m_expsr_tm_lv_setting_->get_param(cur_expsr_tm_lv);
+	if( ! exp_tm_lv_param ){
+		dprintf("error: exposure time level param is null.");
+		return false;
+	}
+	//2020/09/18 add by hato --------------------  end  --------------------
+	
+	bool connected=false;
+	int pktsz=0;
+	if(emulator_){
+		snprintf(name_,sizeof(name_),"emulator");
+		connected=emulator_->connect();
+	}
+	else{
+		camera_ = open_device(name);
+		connected=(camera_!=nullptr);
+	}
+	if(connected){
 		
-		device_=arv_camera_get_device(camera_);
+		if(camera_) device_=arv_camera_get_device(camera_);
 		
 		//2020/09/25 add by hato -------------------- start --------------------
 		uart_flush();
@@ -247,24 +265,32 @@ bool Aravis::openCamera(const char *name, const int packet_size)
 		
 		set_node_int("Width", width_);
 		set_node_int("Height", height_);
-		int x,y;
-		arv_camera_get_region(camera_, &x, &y, &width_, &height_);
-		dprintf(" vendor name  = %s", arv_camera_get_vendor_name(camera_));
-		dprintf(" model name   = %s", arv_camera_get_model_name(camera_));
-		dprintf(" device id    = %s", arv_camera_get_device_id(camera_));
-		dprintf(" region       = %d %d %d %d", x, y, width_, height_);
-		dprintf(" pixel format = %s", arv_camera_get_pixel_format_as_string(camera_));
-		//帯域計算
-		if(packet_size){
-			arv_camera_gv_set_packet_size(camera_, packet_size);	//GevSCPSPacketSize
+		if(emulator_){
+			width_=emulator_->width();
+			height_=emulator_->height();
+			dprintf(" model name   = emulator");
+			dprintf(" region       = %d %d %d %d", 0, 0, width_, height_);
 		}
 		else{
-			//2020/09/11 modified by hato -------------------- start --------------------
-			arv_camera_gv_set_packet_size(camera_,8192);
-			//2020/09/11 modified by hato --------------------  end  --------------------
+			int x,y;
+			arv_camera_get_region(camera_, &x, &y, &width_, &height_);
+			dprintf(" vendor name  = %s", arv_camera_get_vendor_name(camera_));
+			dprintf(" model name   = %s", arv_camera_get_model_name(camera_));
+			dprintf(" device id    = %s", arv_camera_get_device_id(camera_));
+			dprintf(" region       = %d %d %d %d", x, y, width_, height_);
+			dprintf(" pixel format = %s", arv_camera_get_pixel_format_as_string(camera_));
+			//帯域計算
+			if(packet_size){
+				arv_camera_gv_set_packet_size(camera_, packet_size);	//GevSCPSPacketSize
+			}
+			else{
+				//2020/09/11 modified by hato -------------------- start --------------------
+				arv_camera_gv_set_packet_size(camera_,8192);
+				//2020/09/11 modified by hato --------------------  end  --------------------
+			}
+			pktsz = arv_camera_gv_get_packet_size(camera_);
+			dprintf(" packet_size  = %d",pktsz);
 		}
-		const int pktsz = arv_camera_gv_get_packet_size(camera_);
-		dprintf(" packet_size  = %d",pktsz);
 		
 		//2020/09/14 add by hato -------------------- start --------------------
 		dprintf(" --------------------");
@@ -315,7 +341,7 @@ bool Aravis::openCamera(const char *name, const int packet_size)
 		//2020/09/14 add by hato --------------------  end  --------------------
 		
 		dprintf(" --------------------");
-		if(1 < ncam_){
+		if(1 < ncam_ && camera_){
 			const double trans_time_min = pktsz / (100.0 * 1024.0 * 1024.0);	//最短転送時間 1Gbps=100MB/s(10bits/byte)
 			const double trans_time_exp=trans_time_min*ncam_;	//期待転送時間
 			double delay_time=trans_time_exp-trans_time_min;
@@ -350,8 +376,8 @@ bool Aravis::openCamera(const char *name, const int packet_size)
 		uart_flush();
 		//2020/09/25 add by hato --------------------  end  --------------------
 	}
-	else dprintf("error: arv_camera_new");
-	lost_ = camera_ ? false : true;
+	else if(emulator_) dprintf("error: emulator connect");
+	lost_ = connected ? false : true;
 	
 	//2020/11/09 add by hato -------------------- start --------------------
 	//高速撮影版しか対応しない。
@@ -367,6 +393,14 @@ bool Aravis::openCamera(const char *name, const int packet_size)
 //nbuf: バッファ数
 bool Aravis::openStream(int nbuf)
 {
+	if(emulator_){
+		payload_ = width_ * height_;
+		return emulator_->start_stream(
+			[this](const bool complete, const uint8_t *data, const size_t size){
+				on_frame(complete ? ARV_BUFFER_STATUS_SUCCESS : ARV_BUFFER_STATUS_MISSING_PACKETS, data, size);
+			},
+			[this](){ on_lost(); });
+	}
 	if(!camera_){
 		dprintf("error: camera [%s] not opened",name_);
 		return false;
@@ -414,6 +448,9 @@ void Aravis::destroy()
 		g_object_unref(camera_);
 		camera_=0;
 	}
+	if(emulator_){
+		emulator_->disconnect();
+	}
 	lost_=true;
 }
 
@@ -469,6 +506,7 @@ bool Aravis::capture(unsigned char *data, float timeout_sec)
 
 void Aravis::setPacketDelay(int64_t delay)
 {
+	if(!camera_)return;
 	arv_camera_gv_set_packet_delay(camera_, delay);
 }
 
@@ -596,18 +634,9 @@ void Aravis::on_new_buffer(ArvStream *stream, void *arg)
 
 	buffer = arv_stream_try_pop_buffer(stream);
 	if (buffer) {
-		a->buffer_status_ = arv_buffer_get_status(buffer);
-		if (a->buffer_status_ == ARV_BUFFER_STATUS_SUCCESS){
-    		size_t size;
-	    	const void *img = arv_buffer_get_data(buffer, &size);
-			if (a->out_) memcpy(a->out_, img, size);
-			if (a->on_image_) (*a->on_image_)(a->camno_, a->frame_index_, a->width_, a->height_, a->color_, a->out_);
-			++a->frame_index_;
-		}
-		else {
-			if (a->buffer_status_==ARV_BUFFER_STATUS_TIMEOUT) dprintf("timeout");
-			else dprintf("[%s] buffer error %d",a->name_,a->buffer_status_);
-		}
+		size_t size = 0;
+		const void *img = arv_buffer_get_data(buffer, &size);
+		a->on_frame_locked(arv_buffer_get_status(buffer), img, size);
 		arv_stream_push_buffer (stream, buffer);
 	}
 	else{	//ここは通らないかも
@@ -618,19 +647,52 @@ void Aravis::on_new_buffer(ArvStream *stream, void *arg)
 	pthread_cond_signal(&a->cap_cond_);
 }
 
+//疑似デバイスからの画像
+void Aravis::on_frame(ArvBufferStatus status, const void *img, size_t size)
+{
+	pthread_mutex_lock(&cap_mutex_);
+	on_frame_locked(status, img, size);
+	pthread_mutex_unlock(&cap_mutex_);
+	pthread_cond_signal(&cap_cond_);
+}
+
+//cap_mutex_をロックして呼ぶ
+void Aravis::on_frame_locked(ArvBufferStatus status, const void *img, size_t size)
+{
+	buffer_status_ = status;
+	if (buffer_status_ == ARV_BUFFER_STATUS_SUCCESS){
+		if (out_) memcpy(out_, img, size);
+		if (on_image_) (*on_image_)(camno_, frame_index_, width_, height_, color_, out_);
+		++frame_index_;
+	}
+	else {
+		if (buffer_status_==ARV_BUFFER_STATUS_TIMEOUT) dprintf("timeout");
+		else dprintf("[%s] buffer error %d",name_,buffer_status_);
+	}
+}
+
 void Aravis::on_control_lost(ArvGvDevice *gv_device, void *arg)
 {
-	Aravis *a=(Aravis*)arg;
-	dprintf("error: control lost: %s",a->name_);
-	a->lost_=true;
-	if(a->on_lost_){
-		(*a->on_lost_)(a->camno_);
+	((Aravis*)arg)->on_lost();
+}
+
+void Aravis::on_lost()
+{
+	dprintf("error: control lost: %s",name_);
+	lost_=true;
+	if(on_lost_){
+		(*on_lost_)(camno_);
 	}
 }
 
 
 uint32_t Aravis::reg_read(uint64_t reg)
 {
+	if (emulator_) {
+		uint32_t value;
+		if (!emulator_->read_register(reg, &value)) value = (uint32_t)-1;
+		return value;
+	}
 	GError *err = nullptr;
 	uint32_t value;
 	bool ret = arv_device_read_register(device_, reg, &value, &err);
@@ -644,6 +706,9 @@ uint32_t Aravis::reg_read(uint64_t reg)
 
 bool Aravis::reg_write(uint64_t reg, int value)
 {
+	if (emulator_) {
+		return emulator_->write_register(reg, value);
+	}
 	GError *err = nullptr;
 	bool ret = arv_device_write_register(device_, reg, value, &err);
 	if (err) {
@@ -804,6 +869,7 @@ string Aravis::get_node_str(const char *feature)
 {
 	GError *err = nullptr;
 	string ret;
+	if (emulator_) return ret;
 	ArvGcNode *node = arv_device_get_feature(device_, feature);
 	if (node && ARV_IS_GC_STRING(node)){
 		ret = arv_gc_string_get_value(ARV_GC_STRING(node), &err);
@@ -819,6 +885,10 @@ int64_t Aravis::get_node_int(const char *feature)
 {
 	GError *err = nullptr;
 	int64_t ret = -1;
+	if (emulator_) {
+		emulator_->get_node_int(feature, &ret);
+		return ret;
+	}
 	ArvGcNode *node = arv_device_get_feature(device_, feature);
 	if (node && ARV_IS_GC_INTEGER_NODE(node)){
 		ret = arv_gc_integer_get_value(ARV_GC_INTEGER(node), &err);
@@ -834,6 +904,7 @@ bool Aravis::set_node_int(const char *feature, int64_t value)
 {
 	GError *err = nullptr;
 	bool ret = false;
+	if (emulator_) return emulator_->set_node_int(feature, value);
 	ArvGcNode *node = arv_device_get_feature(device_, feature);
 	if (node && ARV_IS_GC_INTEGER_NODE(node)){
 		arv_gc_integer_set_value(ARV_GC_INTEGER(node), value, &err);
@@ -850,6 +921,7 @@ double Aravis::get_node_float(const char *feature)
 {
 	GError *err = nullptr;
 	double ret = NAN;
+	if (emulator_) return ret;
 	ArvGcNode *node = arv_device_get_feature(device_, feature);
 	if (node && ARV_IS_GC_FLOAT_NODE(node)){
 		ret = arv_gc_float_get_value(ARV_GC_FLOAT(node), &err);
@@ -865,6 +937,10 @@ string Aravis::get_description(const char *feature)
 {
 	GError *err = nullptr;
 	string ret;
+	if (emulator_) {
+		emulator_->get_description(feature, &ret);
+		return ret;
+	}
 	ArvGcNode *node = arv_device_get_feature(device_, feature);
 	if (node){
 		ret = arv_gc_feature_node_get_description(ARV_GC_FEATURE_NODE(node), &err);
@@ -886,6 +962,11 @@ void Aravis::addCallbackLost(OnLostCamera *onLost)
 {
 	on_lost_ = onLost;
 }
+
+void Aravis::setEmulator(const std::shared_ptr<YCAM3DEmulator> &emulator)
+{
+	emulator_ = emulator;
+}
 //2020/10/09 modified by hato -------------------- start --------------------
 //bool Aravis::trigger(YCAM_PROJ_MODE mode)
 bool Aravis::trigger(YCAM_PROJ_MODE mode)
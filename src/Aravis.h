@@ -1,11 +1,14 @@
 #pragma once
 #include <arv.h>
 #include <stdint.h>
+#include <memory>
 #include <string>
 #include <sstream>
 
 #include "YCAM3D.h"
 
+class YCAM3DEmulator;
+
 
 //2020/09/15 add by hato -------------------- start --------------------
 namespace aravis{
@@ -126,9 +129,16 @@ class Aravis
 	YCAM_PROJ_PTN cur_proj_ptn_;
 	//2020/11/05 add by hato --------------------  end  --------------------
 	
+	//疑似デバイス. 設定されている時はカメラの代わりに使う
+	std::shared_ptr<YCAM3DEmulator> emulator_;
+	
 	//Aravis control
+	ArvCamera *open_device(const char *name);
 	static void on_new_buffer(ArvStream *stream, void *arg);
 	static void on_control_lost(ArvGvDevice *gv_device, void *arg);
+	void on_frame(ArvBufferStatus status, const void *img, size_t size);
+	void on_frame_locked(ArvBufferStatus status, const void *img, size_t size);
+	void on_lost();
 
 	//PROJ
 	bool uart_write(const char *cmd);
@@ -262,4 +272,9 @@ public:
 	* @param[in] onLost コールバック関数
 	*/
 	void addCallbackLost(OnLostCamera *onLost);
+	/**
+	* @brief 疑似デバイスの設定. openCamera()の前に設定するとカメラの代わりに使います
+	* @param[in] emulator 疑似デバイス
+	*/
+	void setEmulator(const std::shared_ptr<YCAM3DEmulator> &emulator);
 };
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <geometry_msgs/Point32.h>
+
+/**
+ * base64文字列(1点 = x,y,z float 12byte = 16文字)を点列にします. floats2pcの/base64用.
+ */
+void base64decode(const std::string& input, std::vector<geometry_msgs::Point32>& out);
@@ -0,0 +1,398 @@
+#include "CameraReplay.hpp"
+
+#include <algorithm>
+#include <map>
+#include <cstring>
+#include <ros/ros.h>
+#include "ElapsedTimer.hpp"
+#include "Trace.hpp"
+
+#define LOG_HEADER "(camera:replay) "
+
+namespace {
+	//左右それぞれの画像の幅と高さ
+	const std::map<std::string,std::pair<int,int>> YCAM_RES_SIZE_MAP = { {"SXGA",{1280,1024}},{"VGA",{640,480}} };
+
+	//Aravis.cppのEXPOSURE_TIME_LV_SETTING_SXGA/VGAと同じ
+	const int EXPOSURE_TIME_LV_MIN = 0;
+	const int EXPOSURE_TIME_LV_MAX = 6;
+	const int EXPOSURE_TIME_LV_DEFAULT = 1;
+
+	//captseq.logに撮影時刻が無い時の間隔. YCAM3Dの既定のフレームレート(60fps)
+	const int FRAME_INTERVAL_DEFAULT = 17; //ms
+
+	const int CAMERA_IMG_COLOR_CH = 1;
+	const int BLACK_CAPT_FRAME_INDEX = 0;
+	const int STROBE_CAPT_FRAME_INDEX = 1;
+}
+
+CameraReplay::CameraReplay(const std::string &dump_dir,const int interval_ms):
+	m_dump_dir(dump_dir),
+	m_interval_ms(interval_ms),
+	m_open_stat(false),
+	m_busy(false),
+	m_abort(false),
+	m_next_set(0),
+	m_expsr_lv(EXPOSURE_TIME_LV_DEFAULT),
+	m_gain_d(camera::ycam3d::CAM_DIGITAL_GAIN_DEFAULT),
+	m_gain_a(camera::ycam3d::CAM_ANALOG_GAIN_DEFAULT),
+	m_proj_intensity(camera::ycam3d::PROJ_INTENSITY_DEFAULT)
+{
+}
+
+CameraReplay::~CameraReplay(){
+	close();
+}
+
+bool CameraReplay::init(const std::string &camera_res){
+	std::map<std::string,std::pair<int,int>>::const_iterator ite = YCAM_RES_SIZE_MAP.find(camera_res);
+	if( ite == YCAM_RES_SIZE_MAP.end() ){
+		ROS_ERROR(LOG_HEADER"error:camera resolution value not found.");
+		return false;
+	}
+
+	ElapsedTimer tmr;
+	std::string error;
+	if( ! m_dump.load(m_dump_dir,&error) ){
+		ROS_ERROR(LOG_HEADER"error:%s",error.c_str());
+		return false;
+	}else if( m_dump.width != ite->second.first || m_dump.height != ite->second.second ){
+		ROS_ERROR(LOG_HEADER"error:pattern image size is different from camera resolution. size=%dx%d, resolution=%s",
+			m_dump.width,m_dump.height,camera_res.c_str());
+		return false;
+	}else if( m_dump.frames_per_set() <= STROBE_CAPT_FRAME_INDEX ){
+		ROS_ERROR(LOG_HEADER"error:pattern image is too few. frames=%d",m_dump.frames_per_set());
+		return false;
+	}
+
+	ROS_INFO(LOG_HEADER"pattern images loaded. dir=%s, capt_num=%d, frames=%d, size=%dx%d, proc_tm=%d ms",
+		m_dump_dir.c_str(),(int)m_dump.sets.size(),m_dump.frames_per_set(),m_dump.width,m_dump.height,tmr.elapsed_ms());
+	if( m_interval_ms >= 0 ){
+		ROS_INFO(LOG_HEADER"frame interval=%d ms",m_interval_ms);
+	}else if( m_dump.has_stamps() ){
+		ROS_INFO(LOG_HEADER"frame interval=recorded");
+	}else{
+		ROS_WARN(LOG_HEADER"captseq.log has no capture time. frame interval=%d ms",FRAME_INTERVAL_DEFAULT);
+	}
+	return true;
+}
+
+int CameraReplay::width()const{
+	if( m_dump.sets.empty() ){
+		return -1;
+	}
+	return m_dump.width * 2;
+}
+
+int CameraReplay::height()const{
+	if( m_dump.sets.empty() ){
+		return -1;
+	}
+	return m_dump.height;
+}
+
+bool CameraReplay::is_open()const{
+	return m_open_stat.load();
+}
+
+void CameraReplay::open(){
+	{
+		std::lock_guard<std::mutex> locker(m_abort_mutex);
+		m_abort = false;
+	}
+	m_open_stat.store( ! m_dump.sets.empty() );
+	ROS_INFO(LOG_HEADER"camera open finished. result=%d",m_open_stat.load());
+
+	if( m_callback_cam_open_finished ){
+		m_callback_cam_open_finished(m_open_stat.load());
+	}
+}
+
+void CameraReplay::close(){
+	{
+		std::lock_guard<std::mutex> locker(m_abort_mutex);
+		m_abort = true;
+	}
+	m_abort_cond.notify_all();
+	{
+		std::lock_guard<std::mutex> locker(m_thread_mutex);
+		if( m_capture_thread.joinable() ){
+			m_capture_thread.join();
+		}
+	}
+
+	if( ! m_open_stat.exchange(false) ){
+		return;
+	}
+	if( m_callback_cam_closed ){
+		m_callback_cam_closed();
+	}
+}
+
+bool CameraReplay::is_auto_connect_running(){
+	return false;
+}
+
+bool CameraReplay::is_busy(){
+	return m_busy.load();
+}
+
+void CameraReplay::set_capture_timeout_period(const int timeout){
+	//再生は必ず画像が揃うので使わない
+}
+
+void CameraReplay::set_trigger_timeout_period(const int timeout){
+	//再生は必ず画像が揃うので使わない
+}
+
+bool CameraReplay::start_capture_thread(std::function<void()> func){
+	std::lock_guard<std::mutex> locker(m_thread_mutex);
+	if( m_capture_thread.get_id() == std::this_thread::get_id() ){
+		ROS_ERROR(LOG_HEADER"error:capture requested from capture thread.");
+		return false;
+	}
+	//実機と同じく、前の撮影が終わるのを待ってから始める
+	if( m_capture_thread.joinable() ){
+		m_capture_thread.join();
+	}
+	m_busy.store(true);
+	m_capture_thread = std::thread([this,func](){
+		thread_local bool trace_named=false;
+		if( ! trace_named ){
+			Trace::set_thread_name("ycam3d:replay");
+			trace_named=true;
+		}
+		func();
+		m_busy.store(false);
+	});
+	return true;
+}
+
+int CameraReplay::frame_interval_ms(const int n,const int i)const{
+	if( m_interval_ms >= 0 ){
+		return m_interval_ms;
+	}else if( ! m_dump.has_stamps() ){
+		return FRAME_INTERVAL_DEFAULT;
+	}
+	const std::vector<double> &stamps = m_dump.stamps[n];
+	if( i > 0 ){
+		return (int)((stamps[i] - stamps[i - 1]) * 1000 + 0.5);
+	}
+	//先頭の画像は撮影中の平均の間隔で待つ
+	if( stamps.size() < 2 ){
+		return FRAME_INTERVAL_DEFAULT;
+	}
+	return (int)((stamps.back() - stamps.front()) * 1000 / (stamps.size() - 1) + 0.5);
+}
+
+bool CameraReplay::wait_frame(const int interval_ms){
+	std::unique_lock<std::mutex> locker(m_abort_mutex);
+	m_abort_cond.wait_for(locker,std::chrono::milliseconds(std::max(interval_ms,0)),[this](){ return m_abort; });
+	return ! m_abort;
+}
+
+void CameraReplay::to_camera_image(const cv::Mat &img,camera::ycam3d::CameraImage *cam_img)const{
+	*cam_img = camera::ycam3d::CameraImage(img.cols,img.rows,img.cols * CAMERA_IMG_COLOR_CH,CAMERA_IMG_COLOR_CH);
+	cam_img->dt = std::chrono::system_clock::now();
+	if( cam_img->alloc() ){
+		memcpy(cam_img->data.data(),img.data,cam_img->byte_count());
+		cam_img->result = true;
+	}
+}
+
+bool CameraReplay::capture(const bool strobe){
+	if( ! is_open() ){
+		ROS_ERROR(LOG_HEADER"error:camera is not opened");
+		return false;
+	}
+
+	return start_capture_thread([this,strobe](){
+		ElapsedTimer capt_tmr;
+		const int n = m_next_set % m_dump.sets.size();
+		const int idx = strobe ? STROBE_CAPT_FRAME_INDEX : BLACK_CAPT_FRAME_INDEX;
+
+		const bool aborted = ! wait_frame(frame_interval_ms(n,idx));
+
+		camera::ycam3d::CameraImage img_l;
+		camera::ycam3d::CameraImage img_r;
+		to_camera_image(m_dump.sets[n][idx * 2],&img_l);
+		to_camera_image(m_dump.sets[n][idx * 2 + 1],&img_r);
+		if( m_callback_capt_img_recv ){
+			m_callback_capt_img_recv( ! aborted, capt_tmr.elapsed_ms(), img_l, img_r, false, m_expsr_lv);
+		}
+	});
+}
+
+bool CameraReplay::capture_pattern(const bool multi,const bool ptnCangeWaitShort){
+	if( ! is_open() ){
+		ROS_ERROR(LOG_HEADER"error:camera is not opened");
+		return false;
+	}
+
+	return start_capture_thread([this,multi](){
+		ElapsedTimer capt_tmr;
+		TraceSpan trace_span("capture_pattern");
+		//HDRの撮影回数と保存した撮影数が違っても、保存した撮影を順番に繰り返す
+		const int n = m_next_set++ % m_dump.sets.size();
+		const int captNum = m_dump.frames_per_set();
+		ROS_INFO(LOG_HEADER"pattern capture start. multi=%d, capt=%d, capture_num=%d",multi,n,captNum);
+
+		std::vector<camera::ycam3d::CameraImage> imgs_l(captNum);
+		std::vector<camera::ycam3d::CameraImage> imgs_r(captNum);
+		bool result=true;
+		TraceSpan trace_wait("capture_wait");
+		for( int i = 0 ; i < captNum ; ++i ){
+			if( ! wait_frame(frame_interval_ms(n,i)) ){
+				ROS_ERROR(LOG_HEADER"pattern capture aborted. idx=%d",i);
+				result=false;
+				break;
+			}
+			to_camera_image(m_dump.sets[n][i * 2],&imgs_l[i]);
+			to_camera_image(m_dump.sets[n][i * 2 + 1],&imgs_r[i]);
+			if( m_callback_ptn_frame_recv ){
+				m_callback_ptn_frame_recv(i, captNum, imgs_l[i], imgs_r[i]);
+			}
+		}
+		trace_wait.end();
+		ROS_INFO(LOG_HEADER"pattern capture finished. result=%d, elapsed=%d ms",result,capt_tmr.elapsed_ms());
+
+		if( m_callback_trig_img_recv ){
+			m_callback_trig_img_recv(result, capt_tmr.elapsed_ms(), imgs_l, imgs_r, false, m_expsr_lv);
+		}
+	});
+}
+
+void CameraReplay::start_auto_connect(const std::string ipaddr){
+	ROS_INFO(LOG_HEADER"replay camera. dir=%s",m_dump_dir.c_str());
+	//実機と同じく、接続完了は別スレッドから通知する
+	start_capture_thread([this](){
+		open();
+	});
+}
+
+bool CameraReplay::get_exposure_time_level_default(int *val)const{
+	*val = EXPOSURE_TIME_LV_DEFAULT;
+	return true;
+}
+
+bool CameraReplay::get_exposure_time_level_min(int *val)const{
+	*val = EXPOSURE_TIME_LV_MIN;
+	return true;
+}
+
+bool CameraReplay::get_exposure_time_level_max(int *val)const{
+	*val = EXPOSURE_TIME_LV_MAX;
+	return true;
+}
+
+bool CameraReplay::get_exposure_time_level(int *val){
+	*val = m_expsr_lv;
+	return true;
+}
+
+bool CameraReplay::set_exposure_time_level(const int val){
+	if( val < EXPOSURE_TIME_LV_MIN || EXPOSURE_TIME_LV_MAX < val ){
+		ROS_ERROR(LOG_HEADER"error:exposure time level is out of range. val=%d",val);
+		return false;
+	}
+	m_expsr_lv = val;
+	return true;
+}
+
+bool CameraReplay::get_gain_digital(int *val){
+	*val = m_gain_d;
+	return true;
+}
+
+bool CameraReplay::set_gain_digital(const int val){
+	if( val < camera::ycam3d::CAM_DIGITAL_GAIN_MIN || camera::ycam3d::CAM_DIGITAL_GAIN_MAX < val ){
+		ROS_ERROR(LOG_HEADER"error:digital gain is out of range. val=%d",val);
+		return false;
+	}
+	m_gain_d = val;
+	return true;
+}
+
+bool CameraReplay::get_gain_analog(int *val){
+	*val = m_gain_a;
+	return true;
+}
+
+bool CameraReplay::set_gain_analog(const int val){
+	if( val < camera::ycam3d::CAM_ANALOG_GAIN_MIN || camera::ycam3d::CAM_ANALOG_GAIN_MAX < val ){
+		ROS_ERROR(LOG_HEADER"error:analog gain is out of range. val=%d",val);
+		return false;
+	}
+	m_gain_a = val;
+	return true;
+}
+
+bool CameraReplay::get_projector_intensity(int *val){
+	*val = m_proj_intensity;
+	return true;
+}
+
+bool CameraReplay::set_projector_intensity(const int val){
+	if( val < camera::ycam3d::PROJ_INTENSITY_MIN || camera::ycam3d::PROJ_INTENSITY_MAX < val ){
+		ROS_ERROR(LOG_HEADER"error:projector intensity is out of range. val=%d",val);
+		return false;
+	}
+	m_proj_intensity = val;
+	return true;
+}
+
+bool CameraReplay::get_temperature(int *val){
+	//温度センサは無い
+	return false;
+}
+
+bool CameraReplay::get_capture_param(camera::ycam3d::CaptureParameter *capt_param){
+	capt_param->expsr_lv = m_expsr_lv;
+	capt_param->gain = m_gain_d;
+	capt_param->proj_intensity = m_proj_intensity;
+	return true;
+}
+
+bool CameraReplay::update_capture_param(const camera::ycam3d::CaptureParameter &capt_param){
+	//画像は保存した物なので、値を覚えるだけ
+	if( capt_param.expsr_lv >= 0 && ! set_exposure_time_level(capt_param.expsr_lv) ){
+		return false;
+	}else if( capt_param.gain >= 0 && ! set_gain_digital(capt_param.gain) ){
+		return false;
+	}else if( capt_param.proj_intensity >= 0 && ! set_projector_intensity(capt_param.proj_intensity) ){
+		return false;
+	}
+	return true;
+}
+
+void CameraReplay::set_callback_ros_error_published(camera::ycam3d::f_ros_error_published callback){
+	m_ros_err_pub = callback;
+}
+
+void CameraReplay::set_callback_auto_con_limit_exceeded(camera::ycam3d::f_auto_con_limit_exceeded callback){
+	m_callback_auto_lm_excd = callback;
+}
+
+void CameraReplay::set_callback_camera_open_finished(camera::ycam3d::f_camera_open_finished callback){
+	m_callback_cam_open_finished = callback;
+}
+
+void CameraReplay::set_callback_camera_disconnect(camera::ycam3d::f_camera_disconnect callback){
+	m_callback_cam_disconnect = callback;
+}
+
+void CameraReplay::set_callback_camera_closed(camera::ycam3d::f_camera_closed callback){
+	m_callback_cam_closed = callback;
+}
+
+void CameraReplay::set_callback_capture_img_received(camera::ycam3d::f_capture_img_received callback){
+	m_callback_capt_img_recv = callback;
+}
+
+void CameraReplay::set_callback_pattern_img_received(camera::ycam3d::f_pattern_img_received callback){
+	m_callback_trig_img_recv = callback;
+}
+
+void CameraReplay::set_callback_pattern_frame_received(camera::ycam3d::f_pattern_frame_received callback){
+	m_callback_ptn_frame_recv = callback;
+}
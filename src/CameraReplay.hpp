@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "iCameraSource.hpp"
+#include "PatternDump.hpp"
+
+/**
+ * genpcが保存したパターン画像(genpc/dump)をカメラの代わりに再生します.
+ * 実機と同じコールバックで画像を渡すので、ycam3d_node以降(genpc, remap, 点群出力)はそのまま動きます.
+ * パターン撮影は保存した撮影(HDR)を順番に繰り返し、1枚撮影は黒(0番)/白(1番)の画像を返します.
+ * 画像の間隔はcaptseq.logの撮影時刻を再現するか、interval_msで固定にできます.
+ */
+class CameraReplay : public iCameraSource {
+public:
+	/**
+	 * @param dump_dir パターン画像のダンプディレクトリ
+	 * @param interval_ms 画像1組毎の間隔[ms]. 負の時はcaptseq.logの撮影時刻の間隔
+	 */
+	CameraReplay(const std::string &dump_dir,const int interval_ms);
+	virtual ~CameraReplay();
+
+	bool init(const std::string &camera_res) override;
+
+	int width()const override;
+	int height()const override;
+
+	bool is_open()const override;
+	void open() override;
+	void close() override;
+
+	bool is_auto_connect_running() override;
+
+	bool is_busy() override;
+
+	void set_capture_timeout_period(const int timeout) override;
+
+	void set_trigger_timeout_period(const int timeout) override;
+
+	bool capture(const bool strobe) override;
+
+	bool capture_pattern(const bool multi,const bool ptnCangeWaitShort) override;
+
+	void start_auto_connect(const std::string ipaddr="") override;
+
+	bool get_exposure_time_level_default(int *val)const override;
+
+	bool get_exposure_time_level_min(int *val)const override;
+	bool get_exposure_time_level_max(int *val)const override;
+
+	bool get_exposure_time_level(int *val) override;
+	bool set_exposure_time_level(const int val) override;
+
+	bool get_gain_digital(int *val) override;
+	bool set_gain_digital(const int val) override;
+
+	bool get_gain_analog(int *val) override;
+	bool set_gain_analog(const int val) override;
+
+	bool get_projector_intensity(int *val) override;
+	bool set_projector_intensity(const int val) override;
+
+	void set_callback_ros_error_published(camera::ycam3d::f_ros_error_published callback) override;
+	void set_callback_auto_con_limit_exceeded(camera::ycam3d::f_auto_con_limit_exceeded callback) override;
+
+	bool get_temperature(int *val) override;
+
+	bool get_capture_param(camera::ycam3d::CaptureParameter *capt_param) override;
+	bool update_capture_param(const camera::ycam3d::CaptureParameter &capt_param) override;
+
+	void set_callback_camera_open_finished(camera::ycam3d::f_camera_open_finished callback) override;
+
+	void set_callback_camera_disconnect(camera::ycam3d::f_camera_disconnect callback) override;
+
+	void set_callback_camera_closed(camera::ycam3d::f_camera_closed callback) override;
+
+	void set_callback_capture_img_received(camera::ycam3d::f_capture_img_received callback) override;
+
+	void set_callback_pattern_img_received(camera::ycam3d::f_pattern_img_received callback) override;
+
+	void set_callback_pattern_frame_received(camera::ycam3d::f_pattern_frame_received callback) override;
+
+private:
+	const std::string m_dump_dir;
+	const int m_interval_ms;
+	PatternDump m_dump;
+
+	std::atomic<bool> m_open_stat;
+	std::atomic<bool> m_busy;
+	bool m_abort;
+	std::mutex m_abort_mutex; //m_abort 対象
+	std::condition_variable m_abort_cond;
+	std::mutex m_thread_mutex; //m_capture_thread 対象
+	std::thread m_capture_thread;
+	int m_next_set;
+
+	int m_expsr_lv;
+	int m_gain_d;
+	int m_gain_a;
+	int m_proj_intensity;
+
+	camera::ycam3d::f_camera_open_finished m_callback_cam_open_finished;
+	camera::ycam3d::f_camera_disconnect m_callback_cam_disconnect;
+	camera::ycam3d::f_camera_closed m_callback_cam_closed;
+	camera::ycam3d::f_capture_img_received m_callback_capt_img_recv;
+	camera::ycam3d::f_pattern_img_received m_callback_trig_img_recv;
+	camera::ycam3d::f_pattern_frame_received m_callback_ptn_frame_recv;
+	camera::ycam3d::f_auto_con_limit_exceeded m_callback_auto_lm_excd;
+	camera::ycam3d::f_ros_error_published m_ros_err_pub;
+
+	//前の撮影スレッドの終了を待ってから新しいスレッドで撮影する
+	bool start_capture_thread(std::function<void()> func);
+
+	//撮影(HDR) n の i 番目の画像を待つ時間[ms]
+	int frame_interval_ms(const int n,const int i)const;
+
+	//中断された時はfalse
+	bool wait_frame(const int interval_ms);
+
+	void to_camera_image(const cv::Mat &img,camera::ycam3d::CameraImage *cam_img)const;
+};
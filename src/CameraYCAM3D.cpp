@@ -13,6 +13,7 @@
 
 #include <ros/ros.h>
 #include "ElapsedTimer.hpp"
+#include "Trace.hpp"
 
 //#define DEBUG_DETAIL
 
@@ -92,7 +93,17 @@ void CameraYCAM3D::CameraImageReceivedCallback::operator()(int camno, int frmidx
 	}
 	
 	ElapsedTimer tmr;
+	thread_local bool trace_named=false;
+	if( ! trace_named ){
+		Trace::set_thread_name("ycam3d:recv");
+		trace_named=true;
+	}
+	TraceSpan trace_span("image_received",frmidx);
 	bool capt_wait_done=false;
+	//pattern_frameへ渡す画像. コールバックは配信に時間が掛かるので、ロック中にコピーしておきロックを外してから呼ぶ
+	//(受信スレッド毎のバッファを使い回す)
+	thread_local camera::ycam3d::CameraImage ptn_img_l, ptn_img_r;
+	bool ptn_frame_recv=false;
 	{
 		// ********** m_img_update_mutex LOCKED **********
 		std::lock_guard<std::timed_mutex> locker(m_self->m_img_update_mutex);
@@ -120,6 +131,12 @@ void CameraYCAM3D::CameraImageReceivedCallback::operator()(int camno, int frmidx
 		
 		m_self->m_img_recv_flags[frmidx]=true;
 		
+		if( m_self->m_capt_stat.load() == CaptStat_Pattern && m_self->m_callback_ptn_frame_recv ){
+			ptn_img_l = *img_buf_l;
+			ptn_img_r = *img_buf_r;
+			ptn_frame_recv=true;
+		}
+		
 #ifdef DEBUG_DETAIL
 		std::stringstream recv_flags_str;
 		for( int i = 0 ; i < m_self->m_img_recv_flags.size() ; ++i ){
@@ -138,6 +155,13 @@ void CameraYCAM3D::CameraImageReceivedCallback::operator()(int camno, int frmidx
 		// ********** m_img_update_mutex UNLOCKED **********
 	}
 	
+	if( ptn_frame_recv ){
+		m_self->m_callback_ptn_frame_recv(frmidx, captNum, ptn_img_l, ptn_img_r);
+	}
+	
+	trace_span.end();
+	tmr.record("ycam3d/image_received");
+	
 	if(capt_wait_done){
 #ifdef DEBUG_DETAIL
 		ROS_WARN(LOG_HEADER"#%d capture wait done.\n",m_self->m_camno);
@@ -261,6 +285,10 @@ void CameraYCAM3D::set_callback_pattern_img_received(camera::ycam3d::f_pattern_i
 	m_callback_trig_img_recv = callback;
 }
 
+void CameraYCAM3D::set_callback_pattern_frame_received(camera::ycam3d::f_pattern_frame_received callback){
+	m_callback_ptn_frame_recv = callback;
+}
+
 bool CameraYCAM3D::init(const std::string &camera_res){
 	if( m_arv_ptr ){
 		ROS_ERROR(LOG_HEADER"#%d error:already initialized.", m_camno);
@@ -277,12 +305,19 @@ bool CameraYCAM3D::init(const std::string &camera_res){
 	}
 	
 	m_arv_ptr.reset(new Aravis(m_ycam_res));
+	if( m_emulator ){
+		m_arv_ptr->setEmulator(m_emulator);
+	}
 	
 	m_camno = m_arv_ptr->cameraNo();
 	
 	return true;
 }
 
+void CameraYCAM3D::set_emulator(const std::shared_ptr<YCAM3DEmulator> &emulator){
+	m_emulator = emulator;
+}
+
 bool CameraYCAM3D::is_open()const{
 	return m_open_stat.load();
 }
@@ -595,6 +630,8 @@ bool CameraYCAM3D::capture_pattern(const bool pcgenModeMulti,const bool ptnCange
 	m_capture_thread = std::thread([this,capt_tmr,pcgenModeMulti,ptnCangeWaitShort](){
 		
 		ROS_INFO(LOG_HEADER"#%d pattern capture start. pcgenModeMulti=%d,timeout=%d sec", m_camno, pcgenModeMulti, m_trigger_timeout_period);
+		Trace::set_thread_name("ycam3d:capture");
+		TraceSpan trace_span("capture_pattern");
 		
 		m_capt_finish_wait_mutex.lock();
 		// ********** m_capt_finish_wait_mutex LOCKED **********
@@ -625,12 +662,16 @@ bool CameraYCAM3D::capture_pattern(const bool pcgenModeMulti,const bool ptnCange
 		ROS_INFO(LOG_HEADER"#%d cur expsr_lv=%d",m_camno,curExpsrLv);
 		
 		ROS_INFO(LOG_HEADER"#%d projector trigger start. elapsed=%d ms",m_camno,capt_tmr.elapsed_ms());
+		TraceSpan trace_trigger("projector_trigger");
 		if( ! m_arv_ptr->trigger(YCAM_PROJ_MODE_CONT) ){
 			ROS_ERROR(LOG_HEADER"#%d error:trigger call failed.", m_camno);
 		}
+		trace_trigger.end();
 		ROS_INFO(LOG_HEADER"#%d projector trigger finished. elapsed=%d ms",m_camno, capt_tmr.elapsed_ms());
 		
+		TraceSpan trace_wait("capture_wait");
 		const bool timeout_occured = ! m_capt_finish_wait_mutex.try_lock_for( std::chrono::seconds(m_trigger_timeout_period) );
+		trace_wait.end();
 		// ********** m_capt_finish_wait_mutex LOCKED ?? **********
 		ROS_INFO(LOG_HEADER"#%d pattern capture image received wait finshed. timeout=%d, elapsed=%d ms",
 			m_camno, timeout_occured, capt_tmr.elapsed_ms());
@@ -0,0 +1,193 @@
+#include "DumpWriter.hpp"
+
+#include <algorithm>
+#include <ros/ros.h>
+#include "ElapsedTimer.hpp"
+#include "Trace.hpp"
+
+DumpWriter::DumpWriter():
+	m_running(false),
+	m_stopping(false),
+	m_busy(false),
+	m_capacity(CAPACITY_DEFAULT),
+	m_policy(POLICY_BLOCK)
+{
+	m_stats.capacity = m_capacity;
+}
+
+DumpWriter::~DumpWriter(){
+	shutdown();
+}
+
+bool DumpWriter::parse_policy(const std::string &name, Policy *policy){
+	if( name == "block" ){
+		*policy = POLICY_BLOCK;
+	}else if( name == "drop_oldest" ){
+		*policy = POLICY_DROP_OLDEST;
+	}else if( name == "skip" ){
+		*policy = POLICY_SKIP;
+	}else{
+		return false;
+	}
+	return true;
+}
+
+const char *DumpWriter::policy_name(const Policy policy){
+	switch( policy ){
+	case POLICY_BLOCK:       return "block";
+	case POLICY_DROP_OLDEST: return "drop_oldest";
+	case POLICY_SKIP:        return "skip";
+	}
+	return "unknown";
+}
+
+void DumpWriter::set_capacity(const int capacity){
+	std::lock_guard<std::mutex> locker(m_mutex);
+	m_capacity = std::max(1, capacity);
+	m_stats.capacity = m_capacity;
+	//blockで待っているジョブは新しい容量で判定し直す
+	m_cond_space.notify_all();
+}
+
+void DumpWriter::set_policy(const Policy policy){
+	std::lock_guard<std::mutex> locker(m_mutex);
+	m_policy = policy;
+	m_cond_space.notify_all();
+}
+
+void DumpWriter::set_stats_callback(const StatsCallback &callback){
+	std::lock_guard<std::mutex> locker(m_mutex);
+	m_callback = callback;
+}
+
+bool DumpWriter::push(const std::string &name, const Job &job){
+	std::unique_lock<std::mutex> locker(m_mutex);
+	if( m_stopping ){
+		ROS_ERROR("DumpWriter: already shut down. job skipped. name=%s", name.c_str());
+		return false;
+	}
+	if( ! m_running ){
+		m_running = true;
+		m_thread = std::thread(&DumpWriter::run, this);
+	}
+
+	while( (int)m_queue.size() >= m_capacity ){
+		if( m_policy == POLICY_SKIP ){
+			++m_stats.skipped;
+			ROS_WARN("DumpWriter: queue full. job skipped. name=%s, queue=%d", name.c_str(), (int)m_queue.size());
+			return false;
+		}else if( m_policy == POLICY_DROP_OLDEST ){
+			++m_stats.dropped;
+			ROS_WARN("DumpWriter: queue full. oldest job dropped. name=%s, queue=%d", m_queue.front().name.c_str(), (int)m_queue.size());
+			m_queue.pop_front();
+		}else{
+			m_cond_space.wait(locker);
+			if( m_stopping ){
+				ROS_ERROR("DumpWriter: shut down while waiting. job skipped. name=%s", name.c_str());
+				return false;
+			}
+		}
+	}
+
+	Entry entry;
+	entry.name = name;
+	entry.job = job;
+	entry.queued = std::chrono::steady_clock::now();
+	m_queue.push_back(std::move(entry));
+	m_stats.queue_depth = m_queue.size();
+	m_cond_job.notify_one();
+	return true;
+}
+
+void DumpWriter::flush(){
+	std::unique_lock<std::mutex> locker(m_mutex);
+	m_cond_idle.wait(locker, [this]{ return m_queue.empty() && ! m_busy; });
+}
+
+void DumpWriter::shutdown(){
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		if( m_stopping ){
+			return;
+		}
+		m_stopping = true;
+		m_cond_job.notify_all();
+		m_cond_space.notify_all();
+	}
+	//書き出しスレッドは残りのジョブを全て実行してから終了する
+	if( m_thread.joinable() ){
+		m_thread.join();
+	}
+	//nodeletを再読み込みした時のために、次のpush()でスレッドを作り直せるようにする
+	std::lock_guard<std::mutex> locker(m_mutex);
+	m_running = false;
+	m_stopping = false;
+}
+
+DumpWriter::Stats DumpWriter::get_stats()const{
+	std::lock_guard<std::mutex> locker(m_mutex);
+	return m_stats;
+}
+
+void DumpWriter::run(){
+	Trace::set_thread_name("dump_writer");
+	while( true ){
+		Entry entry;
+		{
+			std::unique_lock<std::mutex> locker(m_mutex);
+			m_cond_job.wait(locker, [this]{ return m_stopping || ! m_queue.empty(); });
+			if( m_queue.empty() ){
+				//m_stoppingかつ全て書き終えた
+				break;
+			}
+			entry = std::move(m_queue.front());
+			m_queue.pop_front();
+			m_busy = true;
+			m_stats.queue_depth = m_queue.size();
+			m_cond_space.notify_one();
+		}
+
+		ElapsedTimer tmr;
+		TraceSpan trace_span("dump_write");
+		bool ok = false;
+		try {
+			ok = entry.job();
+		}catch( std::exception &e ){
+			ROS_ERROR("DumpWriter: job failed. name=%s, exception: %s", entry.name.c_str(), e.what());
+		}
+		trace_span.end();
+		const int write_ms = tmr.elapsed_ms();
+		const int latency_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - entry.queued).count();
+		//データを持っているジョブはここで解放する
+		entry.job = nullptr;
+
+		Stats stats;
+		StatsCallback callback;
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			if( ok ){
+				++m_stats.written;
+			}else{
+				++m_stats.failed;
+			}
+			m_stats.last_write_ms = write_ms;
+			m_stats.last_latency_ms = latency_ms;
+			m_stats.max_write_ms = std::max(m_stats.max_write_ms, write_ms);
+			m_stats.total_write_ms += write_ms;
+			m_busy = false;
+			stats = m_stats;
+			callback = m_callback;
+			if( m_queue.empty() ){
+				m_cond_idle.notify_all();
+			}
+		}
+		if( callback ){
+			callback(stats);
+		}
+	}
+
+	std::lock_guard<std::mutex> locker(m_mutex);
+	m_busy = false;
+	m_cond_idle.notify_all();
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+
+/**
+ * ダンプファイル(パターン画像/PLY/デプス画像など)の非同期書き出し.
+ * 書き出し処理(ジョブ)を有限長のキューに積み、専用スレッドが積んだ順に実行します.
+ * ジョブは書き出すデータを自分で保持すること(コピーか参照カウントで持つ).
+ */
+class DumpWriter {
+public:
+	//キューが一杯の時の扱い
+	enum Policy {
+		POLICY_BLOCK,       //空くまで待つ
+		POLICY_DROP_OLDEST, //一番古いジョブを捨てて積む
+		POLICY_SKIP         //積もうとしたジョブを捨てる
+	};
+
+	struct Stats {
+		int queue_depth = 0;
+		int capacity = 0;
+		uint64_t written = 0;
+		uint64_t failed = 0;
+		uint64_t dropped = 0;
+		uint64_t skipped = 0;
+		//直近のジョブの書き出し時間と、積んでから書き終わるまでの時間
+		int last_write_ms = 0;
+		int last_latency_ms = 0;
+		int max_write_ms = 0;
+		double total_write_ms = 0;
+	};
+
+	typedef std::function<bool()> Job;
+	typedef std::function<void(const Stats &stats)> StatsCallback;
+
+	static const int CAPACITY_DEFAULT = 32;
+
+	DumpWriter();
+	~DumpWriter();
+
+	/**
+	 * "block", "drop_oldest", "skip"からPolicyを求めます.
+	 */
+	static bool parse_policy(const std::string &name, Policy *policy);
+	static const char *policy_name(const Policy policy);
+
+	void set_capacity(const int capacity);
+	void set_policy(const Policy policy);
+
+	/**
+	 * ジョブを1つ書き出す毎に書き出しスレッドから呼ばれます.
+	 */
+	void set_stats_callback(const StatsCallback &callback);
+
+	/**
+	 * ジョブを積みます. 捨てた場合(skip, 終了処理中)はfalse.
+	 * @param name ログ用の名前
+	 */
+	bool push(const std::string &name, const Job &job);
+
+	/**
+	 * 積んであるジョブを全て書き終えるまで待ちます.
+	 */
+	void flush();
+
+	/**
+	 * 積んであるジョブを全て書き終えてから書き出しスレッドを終了します.
+	 * 終了処理中のpush()は捨てますが、終了した後のpush()はスレッドを作り直して書き出します.
+	 */
+	void shutdown();
+
+	Stats get_stats()const;
+
+private:
+	struct Entry {
+		std::string name;
+		Job job;
+		std::chrono::steady_clock::time_point queued;
+	};
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cond_job;
+	std::condition_variable m_cond_space;
+	std::condition_variable m_cond_idle;
+	std::deque<Entry> m_queue;
+	std::thread m_thread;
+	bool m_running;
+	bool m_stopping;
+	bool m_busy;
+	int m_capacity;
+	Policy m_policy;
+	Stats m_stats;
+	StatsCallback m_callback;
+
+	void run();
+};
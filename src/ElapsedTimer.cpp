@@ -1,4 +1,5 @@
 #include "ElapsedTimer.hpp"
+#include "StageMetrics.hpp"
 
 using namespace std::chrono;
 
@@ -28,7 +29,18 @@ int ElapsedTimer::elapsed_lap_ms()const{
 	return duration_cast<milliseconds>(high_resolution_clock::now() - m_lap).count();
 }
 
+void ElapsedTimer::record(const std::string &name)const{
+	StageMetrics::record(name, duration_cast<microseconds>(high_resolution_clock::now() - m_start).count() / 1000.0);
+}
+
+void ElapsedTimer::record_lap(const std::string &name)const{
+	StageMetrics::record(name, duration_cast<microseconds>(high_resolution_clock::now() - m_lap).count() / 1000.0);
+}
 
 int ElapsedTimer::duration_ms(const std::chrono::system_clock::duration &duration){
 	return (int)std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+}
+
+int64_t ElapsedTimer::duration_us(const std::chrono::system_clock::duration &duration){
+	return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
 }
\ No newline at end of file
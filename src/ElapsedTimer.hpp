@@ -1,5 +1,7 @@
 #pragma once
 #include <chrono>
+#include <cstdint>
+#include <string>
 
 class ElapsedTimer {
 	std::chrono::high_resolution_clock::time_point m_start;
@@ -13,5 +15,10 @@ public:
 	int elapsed_ms()const;
 	int elapsed_lap_ms()const;
 	
+	//経過時間をStageMetricsの段階nameに積算する
+	void record(const std::string &name)const;
+	void record_lap(const std::string &name)const;
+	
 	static int duration_ms(const std::chrono::system_clock::duration &duration);
+	static int64_t duration_us(const std::chrono::system_clock::duration &duration);
 };
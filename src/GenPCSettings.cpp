@@ -0,0 +1,93 @@
+#include "GenPCSettings.hpp"
+
+#include "ElapsedTimer.hpp"
+#include "PointQuantizer.hpp"
+
+namespace {
+	//これより有効点が少ない点群はボクセル化しない
+	const int VOXELIZE_MIN_POINTS = 10;
+}
+
+std::map<PcGenMode,std::string> PCGEN_MODE_MAP = {
+	{PCGEN_SGBM,"SGBM"},
+	{PCGEN_GRAYPS4,"Gray+4step_PS"},
+	{PCGEN_MULTI,"Multi"}
+};
+
+VoxelGrid::LeafSize VoxelLeafSize::to_voxel_grid_leaf() const{
+	VoxelGrid::LeafSize leaf;
+	leaf.x = x;
+	leaf.y = y;
+	leaf.z = z;
+	return leaf;
+}
+
+bool GenPCSettings::exec_downsampling(const sensor_msgs::PointCloud &pts,const VoxelLeafSize &vx_leaf_size,const bool quantize_count_exec,
+	rovi::Floats &ds_points,sensor_msgs::PointCloud *out_pts_vx,const YPCData *src_ypc,const VoxelPyramid *src_pyramid,
+	DownsamplingReport *report){
+	DownsamplingReport report_buf;
+	if( ! report ){
+		report = &report_buf;
+	}
+	*report = DownsamplingReport();
+
+	//以降の処理対象. ボクセル化した場合はpts_vxを指す
+	const sensor_msgs::PointCloud *pts_ds = &pts;
+	sensor_msgs::PointCloud pts_vx_buf;
+	sensor_msgs::PointCloud &pts_vx = out_pts_vx ? *out_pts_vx : pts_vx_buf;
+	//voxelization
+	if( vx_leaf_size.is_disabled() ){
+		report->voxelize = STEP_DISABLED;
+
+	}else if( pts.points.empty() ){
+		report->voxelize = STEP_SKIPPED;
+
+	}else{
+		ElapsedTimer tmr_voxel;
+		const VoxelGrid::LeafSize leaf = vx_leaf_size.to_voxel_grid_leaf();
+
+		//ピラミッドに使える階層があればセルから求め、無ければ点群から求める
+		bool voxelized = false;
+		if( src_pyramid && src_pyramid->voxelize(leaf, pts_vx, &report->pyramid_level) ){
+			voxelized = true;
+		}else if( src_ypc ){
+			voxelized = src_ypc->get_valid_index().total_valid() >= VOXELIZE_MIN_POINTS && src_ypc->voxelize(leaf, pts_vx);
+		}else{
+			voxelized = (int)pts.points.size() >= VOXELIZE_MIN_POINTS && VoxelGrid::voxelize(pts, leaf, pts_vx);
+		}
+		if( voxelized ){
+			pts_ds = &pts_vx;
+		}
+		report->voxelize = voxelized ? STEP_DONE : STEP_FAILED;
+		report->voxel_count = pts_vx.points.size();
+		report->voxelize_tm = tmr_voxel.elapsed_ms();
+	}
+
+	//Quantize points count for Numpy array
+	report->quantize_input = pts_ds->points.size();
+	if( ! quantize_count_exec ){
+		report->quantize = STEP_DISABLED;
+
+	}else if( pts_ds->points.empty() ){
+		report->quantize = STEP_SKIPPED;
+
+	}else{
+		ElapsedTimer tmr_norm_calc;
+		// 重心からの距離の近い点から残す
+		report->quantize = PointQuantizer::quantize(*pts_ds, ds_points.data) ? STEP_DONE : STEP_FAILED;
+		report->quantize_tm = tmr_norm_calc.elapsed_ms();
+	}
+
+	if( ds_points.data.empty() ){
+		const int pts_ds_count = pts_ds->points.size();
+		ds_points.data.resize(pts_ds_count * 3);
+
+		for (int i = 0,n=0 ; i < pts_ds_count ; ++i,++n) {
+			ds_points.data[  n] = pts_ds->points[i].x;
+			ds_points.data[++n] = pts_ds->points[i].y;
+			ds_points.data[++n] = pts_ds->points[i].z;
+		}
+	}
+
+	return true;
+}
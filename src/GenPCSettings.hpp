@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <sensor_msgs/PointCloud.h>
+#include "rovi/Floats.h"
+#include "iPointCloudGenerator.hpp"
+#include "YPCData.hpp"
+#include "VoxelGrid.hpp"
+#include "VoxelPyramid.hpp"
+
+/**
+ * genpc_nodeとgenpc_benchで共通の点群変換パラメータ(genpc/...)の既定値と、点群生成後のダウンサンプリング.
+ * パラメータは get_param<T>(キー,既定値) を持つ型(genpc_nodeではROSパラメータ, genpc_benchではYamlParams)から読みます.
+ */
+
+const bool DEPTH_MAP_IMG_ENABELED_DEFAULT = true;
+const std::string DEPTH_MAP_IMG_ENCODING_DEFAULT = "mono16";
+const float DEPTH_MAP_IMG_BASE_DEFAULT = 400;
+const float DEPTH_MAP_IMG_UNIT_DEFAULT = 1;
+
+const bool PC_DATA2_DENSE_DEFAULT = true;
+const bool PC_DATA2_ENABLED_DEFAULT = false;
+const std::string PC_DATA2_LAYOUT_DEFAULT = "xyzrgb32f";
+
+const bool QUANTIZE_POINTS_COUNT_ENABLED_DEFAULT = true;
+
+const float VOXEL_LEAF_MIN_SIZE     = 0.001f;
+const float VOXEL_LEAF_SIZE_DEFAULT = 1.0f;
+const float VOXEL_LEAF_SIZE_INVALID = 0.0f;
+
+/**
+ * PCGEN_SGBM = 0,  ///< SGBM
+ * PCGEN_GRAYPS4,   ///< 位相シフト: Gray + 4step PS
+ * PCGEN_MULTI,     ///< 位相シフト: マルチ
+ **/
+extern std::map<PcGenMode,std::string> PCGEN_MODE_MAP;
+
+struct VoxelLeafSize {
+	float x=VOXEL_LEAF_SIZE_INVALID;
+	float y=VOXEL_LEAF_SIZE_INVALID;
+	float z=VOXEL_LEAF_SIZE_INVALID;
+
+	bool operator == (const VoxelLeafSize &obj){
+		return this->x == obj.x && this->y == obj.y && this->z == obj.z;
+	}
+
+	bool is_disabled() const{
+		return  x == VOXEL_LEAF_SIZE_INVALID && y == VOXEL_LEAF_SIZE_INVALID && z == VOXEL_LEAF_SIZE_INVALID;
+	}
+
+	VoxelGrid::LeafSize to_voxel_grid_leaf() const;
+};
+
+class GenPCSettings {
+public:
+	/**
+	 * depthmap画像の形式(genpc/depthmap_img/...).
+	 * @param error 形式名が不明な時の理由. 形式は既定のまま
+	 */
+	template<class Params>
+	static YPCData::DepthParams get_depth_params(const Params &params,std::string *error){
+		YPCData::DepthParams depth_params;
+		const std::string encoding = params.template get_param<std::string>("genpc/depthmap_img/encoding",DEPTH_MAP_IMG_ENCODING_DEFAULT);
+		if( ! depth_params.set_encoding(encoding) ){
+			*error = "unknown depthmap image encoding. encoding=" + encoding;
+		}
+		depth_params.base = params.template get_param<float>("genpc/depthmap_img/base",DEPTH_MAP_IMG_BASE_DEFAULT);
+		depth_params.unit = params.template get_param<float>("genpc/depthmap_img/unit",DEPTH_MAP_IMG_UNIT_DEFAULT);
+		return depth_params;
+	}
+
+	/**
+	 * PointCloud2の点レイアウト(genpc/point_cloud2/layout).
+	 * @param error レイアウト名が不明な時の理由. レイアウトはPC2_XYZRGB32F
+	 */
+	template<class Params>
+	static YPCData::PC2Layout get_pc2_layout(const Params &params,std::string *error){
+		YPCData::PC2Layout layout = YPCData::PC2_XYZRGB32F;
+		const std::string name = params.template get_param<std::string>("genpc/point_cloud2/layout",PC_DATA2_LAYOUT_DEFAULT);
+		if( ! YPCData::parse_pc2_layout(name,&layout) ){
+			*error = "unknown point cloud2 layout. layout=" + name;
+		}
+		return layout;
+	}
+
+	/**
+	 * ボクセル化のリーフサイズ(genpc/voxelize/leaf_size/...). x,y,zが全て0なら無効.
+	 * 有効な時は各軸をVOXEL_LEAF_MIN_SIZE と leaf_size/v 以上にします.
+	 */
+	template<class Params>
+	static VoxelLeafSize get_voxel_leaf_size(const Params &params){
+		VoxelLeafSize leaf_size;
+		leaf_size.x = params.template get_param<float>("genpc/voxelize/leaf_size/x",VOXEL_LEAF_SIZE_DEFAULT);
+		leaf_size.y = params.template get_param<float>("genpc/voxelize/leaf_size/y",VOXEL_LEAF_SIZE_DEFAULT);
+		leaf_size.z = params.template get_param<float>("genpc/voxelize/leaf_size/z",VOXEL_LEAF_SIZE_DEFAULT);
+
+		if( leaf_size.is_disabled() ){
+			//voxelization disabled
+		}else{
+			const float vx_leaf_v = params.template get_param<float>("genpc/voxelize/leaf_size/v",0.0f);
+
+			leaf_size.x = std::max( vx_leaf_v , std::max( leaf_size.x , VOXEL_LEAF_MIN_SIZE ) );
+			leaf_size.y = std::max( vx_leaf_v , std::max( leaf_size.y , VOXEL_LEAF_MIN_SIZE ) );
+			leaf_size.z = std::max( vx_leaf_v , std::max( leaf_size.z , VOXEL_LEAF_MIN_SIZE ) );
+		}
+
+		return leaf_size;
+	}
+
+	enum StepResult {
+		STEP_DISABLED = 0,
+		STEP_SKIPPED,  //点群が空
+		STEP_FAILED,
+		STEP_DONE,
+	};
+
+	/**
+	 * exec_downsampling()の各段階の結果. ログはこれを見て呼び出し側で出します.
+	 */
+	struct DownsamplingReport {
+		StepResult voxelize = STEP_DISABLED;
+		//ボクセルピラミッドから求めた時の階層. 点群から求めた時は-1
+		int pyramid_level = -1;
+		int voxel_count = 0;
+		int voxelize_tm = 0;
+		StepResult quantize = STEP_DISABLED;
+		//点数の量子化の入力点数(ボクセル化した場合はボクセル数)
+		int quantize_input = 0;
+		int quantize_tm = 0;
+	};
+
+	/**
+	 * ダウンサンプリング. ボクセル化(有効な場合)した点群の点数を量子化し、x,y,zの並びでds_pointsに出力します.
+	 * ボクセル化は src_pyramid に使える階層があればそのセルから、無ければ src_ypc (有効点10点以上)またはptsから求めます.
+	 * 量子化しなかった場合は、ダウンサンプリング後の点をそのまま並べます.
+	 * @param out_pts_vx ボクセル化した点群の出力先(nullptrなら出力しない)
+	 */
+	static bool exec_downsampling(const sensor_msgs::PointCloud &pts,const VoxelLeafSize &vx_leaf_size,const bool quantize_count_exec,
+		rovi::Floats &ds_points,sensor_msgs::PointCloud *out_pts_vx=nullptr,const YPCData *src_ypc=nullptr,const VoxelPyramid *src_pyramid=nullptr,
+		DownsamplingReport *report=nullptr);
+};
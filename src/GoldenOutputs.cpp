@@ -0,0 +1,581 @@
+#include "GoldenOutputs.hpp"
+
+#include <stdio.h>
+#include <errno.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <unordered_map>
+#include <sys/stat.h>
+#include <yaml-cpp/yaml.h>
+#include <opencv2/core.hpp>
+#include <sensor_msgs/image_encodings.h>
+
+namespace {
+
+const char TABLE_MAGIC[4] = {'R','V','G','T'};
+const char *MANIFEST_NAME = "golden.yaml";
+const int MANIFEST_VERSION = 1;
+const char *PLY_END_HEADER = "end_header\n";
+constexpr int PLY_VERTEX_BYTES = sizeof(float) * 3 + 3;
+
+/**
+ * 比較用の表. 1行が1点(画素). color_colの列はrgbをfloatのビット列に詰めたもの.
+ */
+struct Table {
+	int cols = 0;
+	int color_col = -1;
+	std::vector<float> values;
+
+	size_t rows()const{
+		return cols > 0 ? values.size() / cols : 0;
+	}
+};
+
+bool dir_exists(const std::string &path){
+	struct stat st;
+	return stat(path.c_str(),&st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool make_dirs(const std::string &path){
+	if( path.empty() || dir_exists(path) ){
+		return true;
+	}
+	const size_t pos = path.find_last_of('/');
+	if( pos != std::string::npos && pos > 0 && ! make_dirs(path.substr(0,pos)) ){
+		return false;
+	}
+	return mkdir(path.c_str(),0755) == 0 || errno == EEXIST;
+}
+
+std::string table_path(const std::string &dir,const int camno,const std::string &name){
+	return cv::format("%s/cam%d_%s.bin",dir.c_str(),camno,name.c_str());
+}
+
+std::string ply_path(const std::string &dir,const int camno){
+	return cv::format("%s/cam%d.ply",dir.c_str(),camno);
+}
+
+bool is_computed(const GoldenOutputs::Camera &camera){
+	return ! camera.organized.points.empty();
+}
+
+Table to_table(const sensor_msgs::PointCloud &pts){
+	Table table;
+	const sensor_msgs::ChannelFloat32 *rgb = nullptr;
+	for( const auto &ch : pts.channels ){
+		if( ch.name == "rgb" && ch.values.size() == pts.points.size() ){
+			rgb = &ch;
+		}
+	}
+	table.cols = rgb ? 4 : 3;
+	table.color_col = rgb ? 3 : -1;
+	table.values.reserve(pts.points.size() * table.cols);
+	for( size_t n = 0 ; n < pts.points.size() ; n++ ){
+		table.values.push_back(pts.points[n].x);
+		table.values.push_back(pts.points[n].y);
+		table.values.push_back(pts.points[n].z);
+		if( rgb ){
+			table.values.push_back(rgb->values[n]);
+		}
+	}
+	return table;
+}
+
+Table to_table(const rovi::Floats &floats){
+	Table table;
+	table.cols = 3;
+	table.values.assign(floats.data.begin(), floats.data.begin() + floats.data.size() / 3 * 3);
+	return table;
+}
+
+Table to_table(const sensor_msgs::Image &img){
+	Table table;
+	table.cols = 1;
+	const size_t num = (size_t)img.width * img.height;
+	if( img.encoding == sensor_msgs::image_encodings::TYPE_32FC1 ){
+		table.values.resize(std::min(num, img.data.size() / sizeof(float)));
+		std::memcpy(table.values.data(), img.data.data(), table.values.size() * sizeof(float));
+	}else{
+		//mono16, 16UC1
+		std::vector<uint16_t> pixels(std::min(num, img.data.size() / sizeof(uint16_t)));
+		std::memcpy(pixels.data(), img.data.data(), pixels.size() * sizeof(uint16_t));
+		table.values.assign(pixels.begin(), pixels.end());
+	}
+	return table;
+}
+
+/**
+ * PLYのヘッダと頂点(x,y,z float + red,green,blue uchar)に分けます.
+ */
+bool parse_ply(const std::string &ply,std::string *header,Table *table){
+	const size_t pos = ply.find(PLY_END_HEADER);
+	if( pos == std::string::npos ){
+		return false;
+	}
+	*header = ply.substr(0, pos + strlen(PLY_END_HEADER));
+	const size_t vertex_num = (ply.size() - header->size()) / PLY_VERTEX_BYTES;
+	table->cols = 4;
+	table->color_col = 3;
+	table->values.resize(vertex_num * 4);
+	const char *src = ply.data() + header->size();
+	for( size_t n = 0 ; n < vertex_num ; n++, src += PLY_VERTEX_BYTES ){
+		float *dst = &table->values[n * 4];
+		std::memcpy(dst, src, sizeof(float) * 3);
+		const uint32_t rgb = ((uint32_t)(uint8_t)src[12] << 16) | ((uint32_t)(uint8_t)src[13] << 8) | (uint8_t)src[14];
+		std::memcpy(&dst[3], &rgb, sizeof(float));
+	}
+	return true;
+}
+
+bool write_file(const std::string &path,const void *data,const size_t size,std::string *error){
+	std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+	if( ! ofs.write(static_cast<const char*>(data), size) ){
+		*error = "golden file write failed. path=" + path;
+		return false;
+	}
+	return true;
+}
+
+bool read_file(const std::string &path,std::string *data){
+	std::ifstream ifs(path, std::ios::binary);
+	if( ! ifs ){
+		return false;
+	}
+	std::ostringstream oss;
+	oss << ifs.rdbuf();
+	*data = oss.str();
+	return true;
+}
+
+/**
+ * 表の書式: "RVGT", 列数(int32), 色の列(int32, 無い時は-1), 行数(int64), float値(行優先)
+ */
+bool write_table(const std::string &path,const Table &table,std::string *error){
+	std::string data(TABLE_MAGIC, sizeof(TABLE_MAGIC));
+	const int32_t cols = table.cols;
+	const int32_t color_col = table.color_col;
+	const int64_t rows = table.rows();
+	data.append(reinterpret_cast<const char*>(&cols), sizeof(cols));
+	data.append(reinterpret_cast<const char*>(&color_col), sizeof(color_col));
+	data.append(reinterpret_cast<const char*>(&rows), sizeof(rows));
+	data.append(reinterpret_cast<const char*>(table.values.data()), rows * cols * sizeof(float));
+	return write_file(path, data.data(), data.size(), error);
+}
+
+bool read_table(const std::string &path,Table *table,std::string *error){
+	std::string data;
+	if( ! read_file(path,&data) ){
+		*error = "golden file not found. path=" + path;
+		return false;
+	}
+	const size_t header_size = sizeof(TABLE_MAGIC) + sizeof(int32_t) * 2 + sizeof(int64_t);
+	if( data.size() < header_size || data.compare(0, sizeof(TABLE_MAGIC), TABLE_MAGIC, sizeof(TABLE_MAGIC)) != 0 ){
+		*error = "golden file format is wrong. path=" + path;
+		return false;
+	}
+	int32_t cols = 0, color_col = -1;
+	int64_t rows = 0;
+	const char *src = data.data() + sizeof(TABLE_MAGIC);
+	std::memcpy(&cols, src, sizeof(cols));
+	std::memcpy(&color_col, src + sizeof(cols), sizeof(color_col));
+	std::memcpy(&rows, src + sizeof(cols) + sizeof(color_col), sizeof(rows));
+	if( cols <= 0 || rows < 0 || data.size() != header_size + rows * cols * sizeof(float) ){
+		*error = "golden file size is wrong. path=" + path;
+		return false;
+	}
+	table->cols = cols;
+	table->color_col = color_col;
+	table->values.resize(rows * cols);
+	std::memcpy(table->values.data(), data.data() + header_size, table->values.size() * sizeof(float));
+	return true;
+}
+
+bool color_matches(const float golden,const float actual,const int tol){
+	uint32_t g, a;
+	std::memcpy(&g, &golden, sizeof(g));
+	std::memcpy(&a, &actual, sizeof(a));
+	for( int shift = 0 ; shift <= 16 ; shift += 8 ){
+		if( std::abs((int)((g >> shift) & 0xff) - (int)((a >> shift) & 0xff)) > tol ){
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * 行数が違う(または順番が変わった)時の点の対応の取り方.
+ *   MATCH_INDEX  : 同じ行同士(organized, depth. 画素の並びなので行数が違えば対応は取れない)
+ *   MATCH_NEAREST: 許容差内で最も近い点同士を1対1で(dense, voxelized, ply)
+ *   MATCH_SORTED : x,y,zの辞書順に並べてから先頭から順に(ps_floats. 量子化で残す点の順は重心からの距離で変わる)
+ */
+enum MatchMode {
+	MATCH_INDEX,
+	MATCH_NEAREST,
+	MATCH_SORTED
+};
+
+/**
+ * 1行を比較します. 座標は両方NaNなら一致、片方だけNaNなら不一致.
+ * @param max_diff 座標の差の最大値を更新する
+ */
+bool row_matches(const Table &golden,const float *g,const float *a,const float value_tol,const GoldenOutputs::Tolerance &tol,double *max_diff){
+	bool matched = true;
+	double row_diff = 0;
+	for( int c = 0 ; c < golden.cols ; c++ ){
+		if( c == golden.color_col ){
+			matched = matched && color_matches(g[c], a[c], tol.color);
+		}else if( std::isnan(g[c]) || std::isnan(a[c]) ){
+			matched = matched && std::isnan(g[c]) && std::isnan(a[c]);
+		}else{
+			const double diff = std::abs((double)g[c] - a[c]);
+			row_diff = std::max(row_diff, diff);
+			matched = matched && diff <= value_tol;
+		}
+	}
+	if( matched ){
+		*max_diff = std::max(*max_diff, row_diff);
+	}
+	return matched;
+}
+
+bool row_has_nan(const Table &table,const float *row){
+	for( int c = 0 ; c < table.cols ; c++ ){
+		if( c != table.color_col && std::isnan(row[c]) ){
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * 同じ行同士を比較し、一致しなかった行数を返します. 行数の差も不一致に数えます.
+ */
+size_t match_by_index(const Table &golden,const Table &actual,const float value_tol,const GoldenOutputs::Tolerance &tol,double *max_diff){
+	const size_t rows = std::min(golden.rows(), actual.rows());
+	size_t mismatched = std::max(golden.rows(), actual.rows()) - rows;
+	for( size_t n = 0 ; n < rows ; n++ ){
+		if( ! row_matches(golden, &golden.values[n * golden.cols], &actual.values[n * actual.cols], value_tol, tol, max_diff) ){
+			mismatched++;
+		}
+	}
+	return mismatched;
+}
+
+/**
+ * 基準の各点に、許容差内で最も近い実行結果の点(未使用のもの)を対応させます.
+ * 対応の取れなかった点の数(基準と実行結果の多い方)を返します. NaNを含む行は数の差だけを見ます.
+ * 近傍探索は許容差を一辺とする格子で、周囲27セルを調べます.
+ */
+size_t match_by_nearest(const Table &golden,const Table &actual,const float value_tol,const GoldenOutputs::Tolerance &tol,double *max_diff){
+	const double cell = std::max(value_tol, 1e-6f);
+	auto cell_of = [cell](const float v)->int64_t{
+		return (int64_t)std::floor(v / cell);
+	};
+	auto cell_key = [](const int64_t x,const int64_t y,const int64_t z)->uint64_t{
+		return ((uint64_t)(x & 0x1fffff) << 42) | ((uint64_t)(y & 0x1fffff) << 21) | (uint64_t)(z & 0x1fffff);
+	};
+
+	std::unordered_map<uint64_t,std::vector<uint32_t>> grid;
+	size_t actual_nan = 0;
+	for( size_t n = 0 ; n < actual.rows() ; n++ ){
+		const float *a = &actual.values[n * actual.cols];
+		if( row_has_nan(actual, a) ){
+			actual_nan++;
+			continue;
+		}
+		grid[cell_key(cell_of(a[0]), cell_of(a[1]), cell_of(a[2]))].push_back((uint32_t)n);
+	}
+
+	std::vector<char> used(actual.rows(), 0);
+	size_t golden_nan = 0;
+	size_t matched = 0;
+	for( size_t n = 0 ; n < golden.rows() ; n++ ){
+		const float *g = &golden.values[n * golden.cols];
+		if( row_has_nan(golden, g) ){
+			golden_nan++;
+			continue;
+		}
+		const int64_t cx = cell_of(g[0]), cy = cell_of(g[1]), cz = cell_of(g[2]);
+		int64_t best = -1;
+		double best_dist = 0;
+		for( int64_t dx = -1 ; dx <= 1 ; dx++ ){
+			for( int64_t dy = -1 ; dy <= 1 ; dy++ ){
+				for( int64_t dz = -1 ; dz <= 1 ; dz++ ){
+					const auto ite = grid.find(cell_key(cx + dx, cy + dy, cz + dz));
+					if( ite == grid.end() ){
+						continue;
+					}
+					for( const uint32_t m : ite->second ){
+						if( used[m] ){
+							continue;
+						}
+						const float *a = &actual.values[(size_t)m * actual.cols];
+						const double dist = std::max({std::abs((double)g[0] - a[0]), std::abs((double)g[1] - a[1]), std::abs((double)g[2] - a[2])});
+						if( dist <= value_tol && (best < 0 || dist < best_dist) && (golden.color_col < 0 || color_matches(g[golden.color_col], a[golden.color_col], tol.color)) ){
+							best = m;
+							best_dist = dist;
+						}
+					}
+				}
+			}
+		}
+		if( best >= 0 ){
+			used[best] = 1;
+			matched++;
+			*max_diff = std::max(*max_diff, best_dist);
+		}
+	}
+	const size_t nan_matched = std::min(golden_nan, actual_nan);
+	return std::max(golden.rows(), actual.rows()) - matched - nan_matched;
+}
+
+/**
+ * 行をx,y,z(NaNは後ろ)の辞書順に並べた番号.
+ */
+std::vector<size_t> sorted_rows(const Table &table){
+	std::vector<size_t> order(table.rows());
+	std::iota(order.begin(), order.end(), 0);
+	auto less = [](const float a,const float b){
+		return std::isnan(b) ? ! std::isnan(a) : a < b;
+	};
+	std::stable_sort(order.begin(), order.end(), [&](const size_t i,const size_t j){
+		const float *a = &table.values[i * table.cols];
+		const float *b = &table.values[j * table.cols];
+		for( int c = 0 ; c < table.cols ; c++ ){
+			if( less(a[c], b[c]) ){
+				return true;
+			}else if( less(b[c], a[c]) ){
+				return false;
+			}
+		}
+		return false;
+	});
+	return order;
+}
+
+/**
+ * 両方を辞書順に並べ、先頭から順に比較します. 一致しない時は辞書順で小さい方を1行進めるので、
+ * 途中の点が増減しても以降の対応はずれません. 対応の取れなかった点の数(基準と実行結果の多い方)を返します.
+ */
+size_t match_by_sorted(const Table &golden,const Table &actual,const float value_tol,const GoldenOutputs::Tolerance &tol,double *max_diff){
+	const std::vector<size_t> g_order = sorted_rows(golden);
+	const std::vector<size_t> a_order = sorted_rows(actual);
+	size_t matched = 0;
+	size_t i = 0, j = 0;
+	while( i < g_order.size() && j < a_order.size() ){
+		const float *g = &golden.values[g_order[i] * golden.cols];
+		const float *a = &actual.values[a_order[j] * actual.cols];
+		if( row_matches(golden, g, a, value_tol, tol, max_diff) ){
+			i++;
+			j++;
+			matched++;
+			continue;
+		}
+		//最初に違う列で小さい方を進める
+		bool golden_first = true;
+		for( int c = 0 ; c < golden.cols ; c++ ){
+			if( c == golden.color_col || g[c] == a[c] || (std::isnan(g[c]) && std::isnan(a[c])) ){
+				continue;
+			}
+			golden_first = std::isnan(a[c]) || ( ! std::isnan(g[c]) && g[c] < a[c] );
+			break;
+		}
+		if( golden_first ){
+			i++;
+		}else{
+			j++;
+		}
+	}
+	return std::max(g_order.size(), a_order.size()) - matched;
+}
+
+/**
+ * 行(点)毎に比較します.
+ * 行数が違う時や同じ番号の行同士が一致しない時は、modeに従って点の対応を取り直して比較します.
+ * 対応の取れなかった点は(基準/実行結果の多い方の数を)不一致に数えます.
+ */
+void compare_table(const Table &golden,const Table &actual,const float value_tol,const MatchMode mode,const GoldenOutputs::Tolerance &tol,
+	GoldenOutputs::Result *result){
+	result->elements = golden.rows();
+	const size_t allowed = (size_t)(tol.mismatch_ratio * golden.rows());
+	if( golden.cols != actual.cols || golden.color_col != actual.color_col ){
+		result->mismatched = std::max(golden.rows(), actual.rows());
+		result->detail = cv::format("columns are different. golden=%d, actual=%d",golden.cols,actual.cols);
+		return;
+	}
+
+	const char *match_name = "index";
+	double max_diff = 0;
+	size_t mismatched = match_by_index(golden, actual, value_tol, tol, &max_diff);
+	if( mismatched > 0 && mode == MATCH_NEAREST && golden.cols >= 3 ){
+		match_name = "nearest";
+		max_diff = 0;
+		mismatched = match_by_nearest(golden, actual, value_tol, tol, &max_diff);
+	}else if( mismatched > 0 && mode == MATCH_SORTED ){
+		match_name = "sorted";
+		max_diff = 0;
+		mismatched = match_by_sorted(golden, actual, value_tol, tol, &max_diff);
+	}
+	result->mismatched = mismatched;
+	result->max_diff = max_diff;
+	result->passed = result->mismatched <= allowed;
+	if( golden.rows() != actual.rows() ){
+		result->detail = cv::format("count is different. golden=%zu, actual=%zu, %zu elements are unmatched or out of tolerance (match=%s)",
+			golden.rows(),actual.rows(),result->mismatched,match_name);
+	}else if( result->mismatched > 0 ){
+		result->detail = cv::format("%zu/%zu elements are out of tolerance (match=%s)",result->mismatched,golden.rows(),match_name);
+	}
+}
+
+/**
+ * depthmap_imgの許容差. 座標の許容差[mm]をエンコーディングの単位に直します.
+ */
+float depth_tolerance(const std::string &encoding,const GoldenOutputs::Tolerance &tol){
+	if( encoding == sensor_msgs::image_encodings::TYPE_32FC1 ){
+		return tol.position / 1000.0f;
+	}else if( encoding == sensor_msgs::image_encodings::TYPE_16UC1 ){
+		return tol.position;
+	}
+	//mono16: (奥行き[mm] - base) * 256
+	return tol.position * 256.0f;
+}
+
+void add_missing(const int camno,const std::string &name,const std::string &detail,std::vector<GoldenOutputs::Result> *results){
+	GoldenOutputs::Result result;
+	result.camno = camno;
+	result.name = name;
+	result.detail = detail;
+	results->push_back(result);
+}
+
+}
+
+bool GoldenOutputs::save(const std::string &dir,const std::vector<Camera> &cameras,std::string *error){
+	if( ! make_dirs(dir) ){
+		*error = "golden directory create failed. dir=" + dir;
+		return false;
+	}
+	YAML::Emitter manifest;
+	manifest << YAML::BeginMap;
+	manifest << YAML::Key << "version" << YAML::Value << MANIFEST_VERSION;
+	manifest << YAML::Key << "cameras" << YAML::Value << YAML::BeginSeq;
+	for( size_t camno = 0 ; camno < cameras.size() ; camno++ ){
+		const Camera &camera = cameras[camno];
+		if( ! is_computed(camera) ){
+			continue;
+		}
+		if( ! write_table(table_path(dir,camno,"organized"),to_table(camera.organized),error) ||
+			! write_table(table_path(dir,camno,"dense"),to_table(camera.dense),error) ||
+			! write_table(table_path(dir,camno,"depth"),to_table(camera.depth_image),error) ||
+			! write_table(table_path(dir,camno,"ps_floats"),to_table(camera.ps_floats),error) ||
+			! write_table(table_path(dir,camno,"voxelized"),to_table(camera.voxelized),error) ||
+			! write_file(ply_path(dir,camno),camera.ply.data(),camera.ply.size(),error) ){
+			return false;
+		}
+		manifest << YAML::BeginMap;
+		manifest << YAML::Key << "camno" << YAML::Value << (int)camno;
+		manifest << YAML::Key << "points" << YAML::Value << (int)camera.dense.points.size();
+		manifest << YAML::Key << "depth_encoding" << YAML::Value << camera.depth_image.encoding;
+		manifest << YAML::Key << "depth_width" << YAML::Value << camera.depth_image.width;
+		manifest << YAML::EndMap;
+	}
+	manifest << YAML::EndSeq << YAML::EndMap;
+	const std::string text = std::string(manifest.c_str()) + "\n";
+	return write_file(dir + "/" + MANIFEST_NAME, text.data(), text.size(), error);
+}
+
+bool GoldenOutputs::compare(const std::string &dir,const std::vector<Camera> &cameras,const Tolerance &tol,
+	std::vector<Result> *results,std::string *error){
+	YAML::Node manifest;
+	try{
+		manifest = YAML::LoadFile(dir + "/" + MANIFEST_NAME);
+	}catch( YAML::Exception &e ){
+		*error = cv::format("golden manifest load failed. dir=%s, error=%s",dir.c_str(),e.what());
+		return false;
+	}
+	if( manifest["version"].as<int>(0) != MANIFEST_VERSION || ! manifest["cameras"].IsSequence() ){
+		*error = "golden manifest version is different. regenerate golden files. dir=" + dir;
+		return false;
+	}
+
+	bool passed = true;
+	std::vector<bool> golden_cameras(cameras.size(), false);
+	for( const YAML::Node &entry : manifest["cameras"] ){
+		const int camno = entry["camno"].as<int>(-1);
+		if( camno < 0 || camno >= (int)cameras.size() || ! is_computed(cameras[camno]) ){
+			add_missing(camno,"camera","camera output is missing (calc_right_camera changed?)",results);
+			passed = false;
+			continue;
+		}
+		golden_cameras[camno] = true;
+		const Camera &camera = cameras[camno];
+
+		const std::string depth_encoding = entry["depth_encoding"].as<std::string>("");
+		struct Item {
+			std::string name;
+			Table actual;
+			float value_tol;
+			MatchMode mode;
+		};
+		std::vector<Item> items = {
+			{"organized", to_table(camera.organized), tol.position, MATCH_INDEX},
+			{"dense", to_table(camera.dense), tol.position, MATCH_NEAREST},
+			{"depth", to_table(camera.depth_image), depth_tolerance(depth_encoding,tol), MATCH_INDEX},
+			{"ps_floats", to_table(camera.ps_floats), tol.position, MATCH_SORTED},
+			{"voxelized", to_table(camera.voxelized), tol.position, MATCH_NEAREST},
+		};
+		for( const Item &item : items ){
+			Result result;
+			result.camno = camno;
+			result.name = item.name;
+			Table golden;
+			std::string read_error;
+			if( ! read_table(table_path(dir,camno,item.name),&golden,&read_error) ){
+				result.detail = read_error;
+			}else if( item.name == "depth" &&
+				(depth_encoding != camera.depth_image.encoding || entry["depth_width"].as<int>(0) != (int)camera.depth_image.width) ){
+				result.detail = cv::format("depth image format is different. golden=%s (width %d), actual=%s (width %d)",
+					depth_encoding.c_str(),entry["depth_width"].as<int>(0),camera.depth_image.encoding.c_str(),(int)camera.depth_image.width);
+			}else{
+				compare_table(golden,item.actual,item.value_tol,item.mode,tol,&result);
+			}
+			passed = passed && result.passed;
+			results->push_back(result);
+		}
+
+		//PLYはヘッダが一致すること. 頂点は点群と同じ許容差
+		Result result;
+		result.camno = camno;
+		result.name = "ply";
+		std::string golden_ply, golden_header, actual_header;
+		Table golden, actual;
+		if( ! read_file(ply_path(dir,camno),&golden_ply) ){
+			result.detail = "golden file not found. path=" + ply_path(dir,camno);
+		}else if( ! parse_ply(golden_ply,&golden_header,&golden) || ! parse_ply(camera.ply,&actual_header,&actual) ){
+			result.detail = "ply header is broken";
+		}else if( golden_ply == camera.ply ){
+			result.elements = golden.rows();
+			result.passed = true;
+		}else{
+			compare_table(golden,actual,tol.position,MATCH_NEAREST,tol,&result);
+			if( golden_header != actual_header && golden.rows() == actual.rows() ){
+				result.passed = false;
+				result.detail = "ply header is different";
+			}
+		}
+		passed = passed && result.passed;
+		results->push_back(result);
+	}
+	for( size_t camno = 0 ; camno < cameras.size() ; camno++ ){
+		if( is_computed(cameras[camno]) && ! golden_cameras[camno] ){
+			add_missing(camno,"camera","golden output is missing (calc_right_camera changed?)",results);
+			passed = false;
+		}
+	}
+	return passed;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sensor_msgs/PointCloud.h>
+#include <sensor_msgs/Image.h>
+#include "rovi/Floats.h"
+
+/**
+ * 1スキャン分の点群出力(カメラ毎)を基準ファイル(golden)として保存し、後の実行結果と許容差付きで比較します.
+ * genpc_benchの--golden用. 点群生成/点群変換を最適化した時に、出力が変わっていないかを確かめます.
+ * 基準ファイルはディレクトリに cam<番号>_<出力名>.bin (cam<番号>.ply) と golden.yaml(出力の形式)で置きます.
+ */
+class GoldenOutputs {
+public:
+	//比較する出力. ycam3d/genpcが出すものと同じ
+	struct Camera {
+		sensor_msgs::PointCloud organized; //無効点(NaN)を含む全画素の点群
+		sensor_msgs::PointCloud dense;     //有効点のみの点群(ps_pc)
+		sensor_msgs::Image depth_image;    //depthmap_img. 無効の時は空
+		rovi::Floats ps_floats;            //ダウンサンプリング後の X,Y,Z, X,Y,Z ...
+		sensor_msgs::PointCloud voxelized; //ボクセル化した点群. 無効の時は空
+		std::string ply;                   //save_ply(dense)のファイルの中身
+	};
+
+	struct Tolerance {
+		float position = 0.01f;         //座標の許容差[mm]. depthmap_imgはエンコーディングの単位に直して使う
+		int color = 0;                  //rgb各チャンネルの許容差
+		double mismatch_ratio = 0.0001; //許容差を超えた点(画素)/対応の取れなかった点の、全体に対する割合の上限
+	};
+
+	struct Result {
+		int camno = 0;
+		std::string name;
+		bool passed = false;
+		size_t elements = 0;   //基準の点(画素)数
+		size_t mismatched = 0; //許容差を超えた点(画素)数. 点数が違う時は対応の取れなかった点も含む
+		double max_diff = 0;   //一致した範囲での最大の差(座標[mm], depthmap_imgはエンコーディングの単位)
+		std::string detail;
+	};
+
+	/**
+	 * 基準ファイルを書き出します. dirは無ければ作ります.
+	 * @param cameras カメラ毎の出力. 計算しなかったカメラは空のCamera
+	 */
+	static bool save(const std::string &dir,const std::vector<Camera> &cameras,std::string *error);
+
+	/**
+	 * 基準ファイルと比較します. 出力毎の結果をresultsに追加します.
+	 * @return 全て許容差内ならtrue
+	 */
+	static bool compare(const std::string &dir,const std::vector<Camera> &cameras,const Tolerance &tol,
+		std::vector<Result> *results,std::string *error);
+};
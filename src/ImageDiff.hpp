@@ -0,0 +1,28 @@
+#pragma once
+
+#include <ros/ros.h>
+#include <sensor_msgs/Image.h>
+
+/**
+ * 差分画像(dst_img - src_img, 0～255に飽和). 画像サイズが異なる時は空の画像を返します.
+ * ycam3dの/rovi/ycam/diffimg用. rovi_microbenchからも使うためノードから分けています.
+ */
+inline sensor_msgs::Image to_diff_img(const sensor_msgs::Image &src_img,const sensor_msgs::Image &dst_img){
+	sensor_msgs::Image diff_img;
+	if( src_img.data.empty() ||
+		src_img.data.size() != dst_img.data.size()
+	){
+		ROS_ERROR("to_diff_img: camera image size is different");
+	}else{
+		diff_img = src_img;
+		for ( size_t n=0; n < src_img.data.size(); n++ ) {
+			int val = dst_img.data[n] - src_img.data[n];
+			if (val < 1) { val = 0; }
+			else if (val>255) { val=255; }
+			
+			diff_img.data[n] = val;
+		}
+	}
+	
+	return diff_img;
+}
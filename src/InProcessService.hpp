@@ -0,0 +1,62 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <functional>
+#include <boost/shared_ptr.hpp>
+
+/**
+ * 同一プロセス内のサービス呼び出し.
+ * nodeletとして同じプロセスに載ったノード間では、要求をboost::shared_ptr<const>のまま提供側に渡し、シリアライズを省きます.
+ * 提供側がこのプロセスに居なければcall()はfound=falseを返すので、呼び出し側は通常のサービス呼び出しに切り替えること.
+ * サービス名はros::NodeHandle::resolveName()で解決した名前を使います.
+ */
+template<class Service>
+class InProcessService {
+public:
+	typedef typename Service::Request Request;
+	typedef typename Service::Response Response;
+	typedef boost::shared_ptr<const Request> RequestConstPtr;
+	typedef std::function<bool(const RequestConstPtr &req, Response &res)> Handler;
+
+	static void advertise(const std::string &name, const Handler &handler){
+		std::lock_guard<std::mutex> locker(get_mutex());
+		get_handlers()[name] = handler;
+	}
+
+	static void unadvertise(const std::string &name){
+		std::lock_guard<std::mutex> locker(get_mutex());
+		get_handlers().erase(name);
+	}
+
+	/**
+	 * 提供側を呼び出します. 提供側がこのプロセスに居なければ*found=falseでfalseを返します.
+	 * 提供側の処理はこの関数を呼んだスレッドで実行されます.
+	 */
+	static bool call(const std::string &name, const RequestConstPtr &req, Response &res, bool *found){
+		Handler handler;
+		{
+			std::lock_guard<std::mutex> locker(get_mutex());
+			const auto it = get_handlers().find(name);
+			if( it == get_handlers().end() ){
+				*found = false;
+				return false;
+			}
+			handler = it->second;
+		}
+		*found = true;
+		return handler(req, res);
+	}
+
+private:
+	static std::mutex &get_mutex(){
+		static std::mutex mutex;
+		return mutex;
+	}
+
+	static std::map<std::string,Handler> &get_handlers(){
+		static std::map<std::string,Handler> handlers;
+		return handlers;
+	}
+};
@@ -0,0 +1,116 @@
+#include "PatternDump.hpp"
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <opencv2/opencv.hpp>
+
+namespace {
+
+constexpr int CAMERA_NUM = 2;
+
+bool file_exists(const std::string &path){
+	struct stat st;
+	return stat(path.c_str(),&st) == 0 && S_ISREG(st.st_mode);
+}
+
+std::string pattern_image_path(const std::string &dir,const bool hdr,const int n,const int i,const int camno){
+	if( hdr ){
+		return cv::format((dir + "/hdr_%d_capt%02d_%d.pgm").c_str(), n, i, camno);
+	}
+	return cv::format((dir + "/capt%02d_%d.pgm").c_str(), i, camno);
+}
+
+/**
+ * captseq.logの1行を読みます. "(i) seq_l seq_r [stamp]" か "[n] (i) seq_l seq_r [stamp]"
+ * 時刻が無い古い形式の時はstampを0にします.
+ */
+bool parse_captseq_line(const char *line,int *n,int *i,double *stamp){
+	unsigned int seq_l = 0, seq_r = 0;
+	int matched = 0;
+	*n = 0;
+	*stamp = 0;
+	if( line[0] == '[' ){
+		matched = sscanf(line,"[%d] (%d) %u %u %lf", n, i, &seq_l, &seq_r, stamp) - 1;
+	}else{
+		matched = sscanf(line,"(%d) %u %u %lf", i, &seq_l, &seq_r, stamp);
+	}
+	return matched >= 3;
+}
+
+}
+
+bool PatternDump::has_stamps()const{
+	if( stamps.size() != sets.size() ){
+		return false;
+	}
+	for( const std::vector<double> &set_stamps : stamps ){
+		for( const double stamp : set_stamps ){
+			if( stamp <= 0 ){
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool PatternDump::load(const std::string &dir, std::string *error){
+	const bool hdr = file_exists(pattern_image_path(dir,true,0,0,0));
+	for( int n = 0 ; hdr || n == 0 ; n++ ){
+		if( ! file_exists(pattern_image_path(dir,hdr,n,0,0)) ){
+			break;
+		}
+		std::vector<cv::Mat> imgs;
+		for( int i = 0 ; file_exists(pattern_image_path(dir,hdr,n,i,0)) ; i++ ){
+			for( int camno = 0 ; camno < CAMERA_NUM ; camno++ ){
+				const std::string path = pattern_image_path(dir,hdr,n,i,camno);
+				cv::Mat img = cv::imread(path, cv::IMREAD_GRAYSCALE);
+				if( img.empty() ){
+					*error = "pattern image load failed. path=" + path;
+					return false;
+				}else if( width == 0 ){
+					width = img.cols;
+					height = img.rows;
+				}else if( img.cols != width || img.rows != height ){
+					*error = cv::format("pattern image size is different. path=%s, size=%dx%d, expected=%dx%d",
+						path.c_str(),img.cols,img.rows,width,height);
+					return false;
+				}
+				//点群生成器やカメラ画像へは先頭アドレスで渡すので行詰めにしておく
+				if( ! img.isContinuous() ){
+					img = img.clone();
+				}
+				imgs.push_back(img);
+			}
+		}
+		if( ! sets.empty() && imgs.size() != sets[0].size() ){
+			*error = cv::format("pattern image count is different. capt=%d, count=%d, expected=%d",
+				n,(int)imgs.size()/2,frames_per_set());
+			return false;
+		}
+		sets.push_back(imgs);
+	}
+	if( sets.empty() ){
+		*error = "pattern image not found. dir=" + dir;
+		return false;
+	}
+
+	stamps.assign(sets.size(), std::vector<double>(frames_per_set(), 0));
+	FILE *f_captseq = fopen((dir + "/captseq.log").c_str(), "r");
+	if( f_captseq ){
+		captseq_lines = 0;
+		char line[256];
+		while( fgets(line,sizeof(line),f_captseq) ){
+			++captseq_lines;
+			int n = 0, i = 0;
+			double stamp = 0;
+			if( ! parse_captseq_line(line,&n,&i,&stamp) ){
+				continue;
+			}else if( n < 0 || n >= (int)stamps.size() || i < 0 || i >= frames_per_set() ){
+				continue;
+			}
+			stamps[n][i] = stamp;
+		}
+		fclose(f_captseq);
+	}
+	return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+/**
+ * genpcのdump_pattern_images()/dump_captseq()が書き出したパターン画像のダンプ.
+ * 撮影(HDR)毎に左0, 右0, 左1, 右1, ... の順に画像を持ちます.
+ */
+struct PatternDump {
+	int width = 0;
+	int height = 0;
+	std::vector<std::vector<cv::Mat>> sets;
+	//captseq.logの行数. ファイルが無い時は-1
+	int captseq_lines = -1;
+	//captseq.logに記録された撮影時刻[s]. 撮影毎, 画像毎. 時刻が無い行は0
+	std::vector<std::vector<double>> stamps;
+
+	int frames_per_set()const{
+		return sets.empty() ? 0 : sets[0].size() / 2;
+	}
+
+	/**
+	 * 全ての画像の撮影時刻が記録されているか.
+	 */
+	bool has_stamps()const;
+
+	/**
+	 * ダンプディレクトリから読み込みます.
+	 * capt%02d_0/1.pgm(1回撮影)と hdr_%d_capt%02d_0/1.pgm(複数回撮影)に対応.
+	 * 画像は行詰め(isContinuous)にしてあります.
+	 * @param error 失敗した時の理由
+	 */
+	bool load(const std::string &dir, std::string *error);
+};
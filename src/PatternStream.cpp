@@ -0,0 +1,166 @@
+#include "PatternStream.hpp"
+
+#include <chrono>
+#include <ros/ros.h>
+
+PatternStream::PatternStream():
+	m_state(STATE_IDLE),
+	m_scan_id(0),
+	m_taken_id(0),
+	m_cur_set(0)
+{
+}
+
+void PatternStream::set_handlers(const Handlers &handlers){
+	std::lock_guard<std::mutex> locker(m_mutex);
+	m_handlers = handlers;
+}
+
+void PatternStream::push(const Frame &frame){
+	std::unique_lock<std::mutex> locker(m_mutex);
+
+	//ハンドラはロックを外して呼び、戻ってきた時にまだこのスキャンを受信中か確かめる(take()のタイムアウトで引き取られることがある)
+	auto call_handler = [&](const std::function<bool()> &handler)->bool{
+		locker.unlock();
+		const bool ok = handler();
+		locker.lock();
+		if( m_state != STATE_RECEIVING || m_scan_id != frame.scan_id ){
+			return false;
+		}
+		if( ! ok ){
+			finish(STATE_FAILED);
+			return false;
+		}
+		return true;
+	};
+
+	if( frame.scan_id == 0 || frame.scan_id == m_taken_id ){
+		return;
+	}else if( frame.capt_num < 1 || frame.frame_num < 1 ||
+		frame.capt_no < 0 || frame.capt_num <= frame.capt_no ||
+		frame.index < 0 || frame.frame_num <= frame.index ){
+		ROS_ERROR("PatternStream: frame is out of range. scan_id=%u, capt_no=%d/%d, index=%d/%d",
+			frame.scan_id, frame.capt_no, frame.capt_num, frame.index, frame.frame_num);
+		return;
+	}
+
+	if( m_state == STATE_IDLE || m_scan_id != frame.scan_id ){
+		if( m_state == STATE_RECEIVING ){
+			ROS_WARN("PatternStream: scan abandoned. scan_id=%u", m_scan_id);
+		}
+		begin(frame);
+		const Handlers handlers = m_handlers;
+		if( handlers.begin && ! call_handler([&]{ return handlers.begin(frame); }) ){
+			return;
+		}
+	}
+
+	if( m_state != STATE_RECEIVING ){
+		//失敗したスキャンの残りの画像
+		return;
+	}else if( frame.capt_num != (int)m_frames.size() || frame.frame_num != (int)m_frames[0].size() ){
+		ROS_ERROR("PatternStream: frame count mismatch. scan_id=%u, capt_num=%d (%d), frame_num=%d (%d)",
+			frame.scan_id, frame.capt_num, (int)m_frames.size(), frame.frame_num, (int)m_frames[0].size());
+		finish(STATE_FAILED);
+		return;
+	}else if( m_received[frame.capt_no][frame.index] ){
+		ROS_WARN("PatternStream: duplicate frame ignored. scan_id=%u, capt_no=%d, index=%d",
+			frame.scan_id, frame.capt_no, frame.index);
+		return;
+	}
+
+	m_frames[frame.capt_no][frame.index] = frame;
+	m_received[frame.capt_no][frame.index] = 1;
+	++m_received_count[frame.capt_no];
+
+	if( frame.capt_no == m_cur_set ){
+		const Handlers handlers = m_handlers;
+		if( handlers.frame && ! call_handler([&]{ return handlers.frame(frame); }) ){
+			return;
+		}
+	}
+
+	//揃ったセットを順に確定し、保留していた次のセットの画像を渡す
+	while( m_cur_set < (int)m_frames.size() && m_received_count[m_cur_set] == (int)m_frames[m_cur_set].size() ){
+		const Handlers handlers = m_handlers;
+		const int capt_no = m_cur_set;
+		if( handlers.set_complete && ! call_handler([&]{ return handlers.set_complete(capt_no); }) ){
+			return;
+		}
+		++m_cur_set;
+
+		if( m_cur_set == (int)m_frames.size() ){
+			if( handlers.complete && ! call_handler([&]{ return handlers.complete(); }) ){
+				return;
+			}
+			finish(STATE_COMPLETE);
+			return;
+		}
+
+		for( int i = 0 ; i < (int)m_frames[m_cur_set].size() ; ++i ){
+			if( ! m_received[m_cur_set][i] ){
+				continue;
+			}
+			const Frame pending = m_frames[m_cur_set][i];
+			if( handlers.frame && ! call_handler([&]{ return handlers.frame(pending); }) ){
+				return;
+			}
+		}
+	}
+}
+
+bool PatternStream::take(const uint32_t scan_id, const int timeout_ms, Frames *frames){
+	std::unique_lock<std::mutex> locker(m_mutex);
+	const bool done = m_cond.wait_for(locker, std::chrono::milliseconds(timeout_ms), [&]{
+		return m_scan_id == scan_id && ( m_state == STATE_COMPLETE || m_state == STATE_FAILED );
+	});
+
+	bool ret = false;
+	if( ! done ){
+		int received = 0;
+		if( m_scan_id == scan_id ){
+			for( const int count : m_received_count ){
+				received += count;
+			}
+		}
+		ROS_ERROR("PatternStream: scan wait timeout. scan_id=%u, received=%d, timeout=%d ms", scan_id, received, timeout_ms);
+	}else if( m_state == STATE_FAILED ){
+		ROS_ERROR("PatternStream: scan failed. scan_id=%u", scan_id);
+	}else{
+		frames->swap(m_frames);
+		ret = true;
+	}
+
+	m_taken_id = scan_id;
+	if( m_scan_id == scan_id ){
+		m_state = STATE_IDLE;
+		m_frames.clear();
+		m_received.clear();
+		m_received_count.clear();
+	}
+	return ret;
+}
+
+uint32_t PatternStream::abort(){
+	std::lock_guard<std::mutex> locker(m_mutex);
+	if( m_state != STATE_RECEIVING ){
+		return 0;
+	}
+	ROS_WARN("PatternStream: scan aborted. scan_id=%u", m_scan_id);
+	finish(STATE_FAILED);
+	return m_scan_id;
+}
+
+void PatternStream::begin(const Frame &frame){
+	m_state = STATE_RECEIVING;
+	m_scan_id = frame.scan_id;
+	m_cur_set = 0;
+	m_frames.assign(frame.capt_num, std::vector<Frame>(frame.frame_num));
+	m_received.assign(frame.capt_num, std::vector<char>(frame.frame_num, 0));
+	m_received_count.assign(frame.capt_num, 0);
+}
+
+void PatternStream::finish(const State state){
+	m_state = state;
+	m_cond.notify_all();
+}
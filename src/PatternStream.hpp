@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+#include <boost/shared_ptr.hpp>
+#include <opencv2/opencv.hpp>
+
+/**
+ * パターン画像の逐次受信.
+ * ycam3dがパターン撮影中に1組(左右)ずつ配信する画像を受け取り、揃うのを待たずに点群生成器へ渡していきます.
+ * 画像はスキャンID(scan_id)とHDRの撮影番号(capt_no)、パターン番号(index)で識別します.
+ * 撮影番号の順にセットを処理し、先のセットの画像が早く届いた場合は前のセットが揃うまで保留します.
+ * push()は1つのスレッド(受信スレッド)から呼ぶこと. ハンドラもそのスレッドで呼ばれます.
+ */
+class PatternStream {
+public:
+	//左右1組のパターン画像
+	struct Frame {
+		uint32_t scan_id = 0;
+		int capt_no = 0;
+		int capt_num = 1;
+		int index = 0;
+		int frame_num = 0;
+		//0: 左, 1: 右
+		cv::Mat imgs[2];
+		uint32_t seqs[2] = {0, 0};
+		//左画像の撮影時刻[s]
+		double stamp = 0;
+		//imgsが参照しているバッファ(受信したメッセージ)
+		boost::shared_ptr<const void> holder;
+	};
+
+	//撮影番号毎・パターン番号順の画像
+	typedef std::vector<std::vector<Frame>> Frames;
+
+	struct Handlers {
+		//スキャンの最初の画像を受け取った時(点群生成器の準備)
+		std::function<bool(const Frame &frame)> begin;
+		//処理中のセットの画像を受け取った時
+		std::function<bool(const Frame &frame)> frame;
+		//1セット揃った時
+		std::function<bool(const int capt_no)> set_complete;
+		//全てのセットが揃った時
+		std::function<bool()> complete;
+	};
+
+	PatternStream();
+
+	void set_handlers(const Handlers &handlers);
+
+	/**
+	 * 受信した画像を1組渡します.
+	 */
+	void push(const Frame &frame);
+
+	/**
+	 * scan_idのスキャンが揃う(または失敗する)まで待ち、画像を引き取ります.
+	 * 引き取ったスキャン(失敗/タイムアウトも含む)の画像が後から届いても無視します.
+	 * @return 全てのハンドラが成功して揃った場合はtrue
+	 */
+	bool take(const uint32_t scan_id, const int timeout_ms, Frames *frames);
+
+	/**
+	 * 受信中のスキャンを打ち切ります. 待っているtake()は失敗し、残りの画像は無視します.
+	 * 点群生成器を別の要求で使う前に呼ぶこと.
+	 * @return 打ち切ったスキャンのscan_id. 受信中でなければ0
+	 */
+	uint32_t abort();
+
+private:
+	enum State {
+		STATE_IDLE,
+		STATE_RECEIVING,
+		STATE_COMPLETE,
+		STATE_FAILED
+	};
+
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	Handlers m_handlers;
+
+	State m_state;
+	uint32_t m_scan_id;
+	uint32_t m_taken_id;
+	Frames m_frames;
+	std::vector<std::vector<char>> m_received;
+	std::vector<int> m_received_count;
+	//処理中のセット(撮影番号)
+	int m_cur_set;
+
+	void begin(const Frame &frame);
+	void finish(const State state);
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/**
+ * 点群生成器のinit()に渡す位相シフトパラメータ.
+ * パラメータは "pshift_genpc/calc/<key>" から読み、値が無い時はdefault_valueを使います.
+ * genpc_nodeとgenpc_benchで同じ表を使うこと.
+ */
+struct PhaseShiftParam {
+	const char *key;
+	double default_value;
+};
+
+inline const std::vector<PhaseShiftParam> &phase_shift_params(){
+	static const std::vector<PhaseShiftParam> params = {
+		{"method3d", 0},
+		{"camera_type", 2},
+		{"bw_diff", 16},
+		{"brightness", 256},
+		{"darkness", 16},
+		{"phase_wd_min", 8},
+		{"phase_wd_thr", 3},
+		{"gcode_variation", 2},
+		{"max_ph_diff", 1.0},
+		{"max_parallax", 300},
+		{"min_parallax", -200},
+		{"ls_points", 3},
+		{"n_phaseshift", 4},
+		{"n_periods", 3},
+		{"period0", 9},
+		{"period1", 10},
+		{"period2", 11},
+		{"interpolation", 0},
+	};
+	return params;
+}
+
+inline std::string phase_shift_param_key(const PhaseShiftParam &param){
+	return std::string("pshift_genpc/calc/") + param.key;
+}
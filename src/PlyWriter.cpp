@@ -0,0 +1,191 @@
+#include "PlyWriter.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ros/ros.h>
+
+namespace {
+	//1バンドあたりの行数
+	const int BAND_ROWS = 32;
+	//非構造化点群の1バンドあたりの点数
+	const int BAND_POINTS = 65536;
+
+	inline char *put_vertex(char *dst, const float x, const float y, const float z,
+		const unsigned char r, const unsigned char g, const unsigned char b){
+		const float pos[3] = {x, y, z};
+		std::memcpy(dst, pos, sizeof(pos));
+		dst[12] = r;
+		dst[13] = g;
+		dst[14] = b;
+		return dst + PlyWriter::VERTEX_BYTES;
+	}
+
+	bool pwrite_all(const int fd, const char *buf, size_t len, off_t offset){
+		while( len > 0 ){
+			const ssize_t ret = ::pwrite(fd, buf, len, offset);
+			if( ret < 0 ){
+				if( errno == EINTR ){
+					continue;
+				}
+				return false;
+			}
+			buf += ret;
+			len -= ret;
+			offset += ret;
+		}
+		return true;
+	}
+}
+
+std::string PlyWriter::make_header(const int width, const int height, const int vertex_num){
+	std::ostringstream oss;
+	oss << "ply\n";
+	oss << "format binary_little_endian 1.0\n";
+	oss << "obj_info num_cols " << width << std::endl;
+	oss << "obj_info num_rows " << height << std::endl;
+	oss << "element vertex " << vertex_num << std::endl;
+	oss << "property float x\n";
+	oss << "property float y\n";
+	oss << "property float z\n";
+	oss << "property uchar red\n";
+	oss << "property uchar green\n";
+	oss << "property uchar blue\n";
+	oss << "element face 0\n";
+	oss << "end_header\n";
+	return oss.str();
+}
+
+bool PlyWriter::write_bands(const std::string &file_path, const std::string &header,
+	const std::vector<size_t> &band_offsets, const std::function<void(const int band, char *dst)> &format){
+
+	const int fd = ::open(file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if( fd < 0 ){
+		ROS_ERROR("PlyWriter: file open failed. path=%s, errno=%d", file_path.c_str(), errno);
+		return false;
+	}
+
+	const int band_num = band_offsets.size() - 1;
+	const size_t data_bytes = band_num > 0 ? band_offsets[band_num] * VERTEX_BYTES : 0;
+	std::atomic<bool> ok(pwrite_all(fd, header.data(), header.size(), 0));
+	//全体サイズを先に確保しておく
+	if( ok && ::ftruncate(fd, header.size() + data_bytes) != 0 ){
+		ok = false;
+	}
+
+	if( ok ){
+		#pragma omp parallel
+		{
+			std::vector<char> buf;
+			#pragma omp for schedule(dynamic)
+			for( int b = 0 ; b < band_num ; ++b ){
+				const size_t num = band_offsets[b + 1] - band_offsets[b];
+				if( num == 0 || ! ok ){
+					continue;
+				}
+				buf.resize(num * VERTEX_BYTES);
+				format(b, buf.data());
+				if( ! pwrite_all(fd, buf.data(), buf.size(), header.size() + band_offsets[b] * VERTEX_BYTES) ){
+					ok = false;
+				}
+			}
+		}
+	}
+
+	if( ::close(fd) != 0 ){
+		ok = false;
+	}
+	if( ! ok ){
+		ROS_ERROR("PlyWriter: file write failed. path=%s, errno=%d", file_path.c_str(), errno);
+	}
+	return ok;
+}
+
+bool PlyWriter::write(const std::string &file_path,
+	const Point3d *points, const unsigned char *image, const size_t step,
+	const int width, const int height, const int vertex_num, const bool dense, int *written,
+	const int *row_valid){
+
+	const int rows = std::max(0, height);
+	const int cols = std::max(0, width);
+	const int band_num = (rows + BAND_ROWS - 1) / BAND_ROWS;
+
+	//バンド毎の頂点数から書き込み位置を求める
+	std::vector<size_t> band_offsets(band_num + 1, 0);
+	#pragma omp parallel for schedule(static)
+	for( int b = 0 ; b < band_num ; ++b ){
+		const int j_end = std::min(rows, (b + 1) * BAND_ROWS);
+		size_t count = 0;
+		if( ! dense ){
+			count = (size_t)(j_end - b * BAND_ROWS) * cols;
+		}else if( row_valid ){
+			for( int j = b * BAND_ROWS ; j < j_end ; ++j ){
+				count += row_valid[j];
+			}
+		}else{
+			for( int n = b * BAND_ROWS * cols ; n < j_end * cols ; ++n ){
+				if( ! std::isnan(points[n].x) ){
+					++count;
+				}
+			}
+		}
+		band_offsets[b + 1] = count;
+	}
+	for( int b = 0 ; b < band_num ; ++b ){
+		band_offsets[b + 1] += band_offsets[b];
+	}
+	if( written ){
+		*written = band_offsets[band_num];
+	}
+
+	return write_bands(file_path, make_header(width, height, vertex_num), band_offsets,
+		[&](const int b, char *dst){
+			const int j_end = std::min(rows, (b + 1) * BAND_ROWS);
+			for( int j = b * BAND_ROWS ; j < j_end ; ++j ){
+				if( dense && row_valid && row_valid[j] <= 0 ){
+					continue;
+				}
+				const unsigned char *iP = image + j * step;
+				const Point3d *pP = points + j * cols;
+				for( int i = 0 ; i < cols ; ++i ){
+					if( dense && std::isnan(pP[i].x) ){
+						continue;
+					}
+					dst = put_vertex(dst, pP[i].x, pP[i].y, pP[i].z, iP[i], iP[i], iP[i]);
+				}
+			}
+		});
+}
+
+bool PlyWriter::write(const std::string &file_path, const sensor_msgs::PointCloud &pts){
+	const int num = pts.points.size();
+	const float *rgbs = nullptr;
+	for( const auto &ch : pts.channels ){
+		if( ch.name == "rgb" && ch.values.size() == pts.points.size() ){
+			rgbs = ch.values.data();
+			break;
+		}
+	}
+
+	const int band_num = (num + BAND_POINTS - 1) / BAND_POINTS;
+	std::vector<size_t> band_offsets(band_num + 1, 0);
+	for( int b = 0 ; b < band_num ; ++b ){
+		band_offsets[b + 1] = std::min(num, (b + 1) * BAND_POINTS);
+	}
+
+	return write_bands(file_path, make_header(num, 1, num), band_offsets,
+		[&](const int b, char *dst){
+			for( size_t n = band_offsets[b] ; n < band_offsets[b + 1] ; ++n ){
+				const geometry_msgs::Point32 &p = pts.points[n];
+				uint32_t rgb = 0;
+				if( rgbs ){
+					std::memcpy(&rgb, rgbs + n, sizeof(rgb));
+				}
+				dst = put_vertex(dst, p.x, p.y, p.z, (rgb >> 16) & 0xff, (rgb >> 8) & 0xff, rgb & 0xff);
+			}
+		});
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <sensor_msgs/PointCloud.h>
+#include "iPointCloudGenerator.hpp"
+
+/**
+ * バイナリPLY(x,y,z float + red,green,blue uchar = 15byte/点)の書き出し.
+ * 頂点データを行の帯(バンド)毎に並列で大きなバッファへ整形し、
+ * 事前に求めたファイル内オフセットへpwriteで書き込みます.
+ */
+class PlyWriter {
+public:
+	typedef PointCloudCallback::Point3d Point3d;
+
+	static const int VERTEX_BYTES = sizeof(float) * 3 + 3;
+
+	/**
+	 * 構造化点群(YPCDataの点群/テクスチャ)を書き出します.
+	 * @param vertex_num ヘッダに書く頂点数(dense時はn_valid)
+	 * @param dense      trueなら有効点のみ、falseなら全点を書き出す
+	 * @param written    実際に書き出した頂点数
+	 * @param row_valid  行毎の有効点数(省略時は点群を走査して数える). dense時は有効点の無い行を読み飛ばす
+	 */
+	static bool write(const std::string &file_path,
+		const Point3d *points, const unsigned char *image, const size_t step,
+		const int width, const int height, const int vertex_num, const bool dense, int *written=nullptr,
+		const int *row_valid=nullptr);
+
+	/**
+	 * rgbチャンネル付きのsensor_msgs::PointCloudを書き出します(num_cols=点数, num_rows=1).
+	 */
+	static bool write(const std::string &file_path, const sensor_msgs::PointCloud &pts);
+
+	static std::string make_header(const int width, const int height, const int vertex_num);
+
+private:
+	/**
+	 * band_offsets[b]からband_offsets[b+1]までの頂点をformat(b,dst)で整形して書き込みます.
+	 */
+	static bool write_bands(const std::string &file_path, const std::string &header,
+		const std::vector<size_t> &band_offsets, const std::function<void(const int band, char *dst)> &format);
+};
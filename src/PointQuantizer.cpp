@@ -0,0 +1,175 @@
+#include "PointQuantizer.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+	//基数ソートの1パスあたりのビット数(11+11+10bit=3パス)
+	const int RADIX_BITS = 11;
+	const int RADIX_SIZE = 1 << RADIX_BITS;
+	const int RADIX_PASSES = ( 32 + RADIX_BITS - 1 ) / RADIX_BITS;
+	//これより少ない点数は1スレッドで処理する
+	const int PARALLEL_MIN_POINTS = 65536;
+
+	inline uint32_t digit_of(const uint64_t item, const int pass){
+		return (uint32_t)( item >> ( 32 + pass * RADIX_BITS ) ) & ( RADIX_SIZE - 1 );
+	}
+
+	/**
+	 * 上位32bitをキー、下位32bitを点番号とした要素を、キーで安定にソートします.
+	 * 各スレッドは連続した区間を担当し、バケット毎の書き出し位置を(バケット,スレッド)順に割り当てることで安定性を保ちます.
+	 * 最後のパスは書き出し位置がcount未満の要素だけを書き出し、結果はitemsの先頭count個に入ります.
+	 */
+	void radix_sort_prefix(std::vector<uint64_t> &items, const int count){
+		const int N = items.size();
+		std::vector<uint64_t> work(N);
+
+#ifdef _OPENMP
+		const int thread_num = N < PARALLEL_MIN_POINTS ? 1 : omp_get_max_threads();
+#else
+		const int thread_num = 1;
+#endif
+		std::vector<int> hists((size_t)thread_num * RADIX_SIZE);
+
+		uint64_t *src = items.data();
+		uint64_t *dst = work.data();
+		for( int pass = 0 ; pass < RADIX_PASSES ; ++pass ){
+			std::fill(hists.begin(), hists.end(), 0);
+
+			#pragma omp parallel num_threads(thread_num)
+			{
+#ifdef _OPENMP
+				const int t = omp_get_thread_num();
+#else
+				const int t = 0;
+#endif
+				const int begin = (int)( (int64_t)N * t / thread_num );
+				const int end = (int)( (int64_t)N * ( t + 1 ) / thread_num );
+				int *hist = hists.data() + (size_t)t * RADIX_SIZE;
+				for( int n = begin ; n < end ; ++n ){
+					++hist[digit_of(src[n], pass)];
+				}
+			}
+
+			//全要素が同じバケットならこのパスは並びが変わらない
+			bool single_bucket = false;
+			for( int d = 0 ; d < RADIX_SIZE ; ++d ){
+				int total = 0;
+				for( int t = 0 ; t < thread_num ; ++t ){
+					total += hists[(size_t)t * RADIX_SIZE + d];
+				}
+				if( total ){
+					single_bucket = total == N;
+					break;
+				}
+			}
+			if( single_bucket ){
+				continue;
+			}
+
+			//(バケット,スレッド)順の書き出し開始位置
+			int offset = 0;
+			for( int d = 0 ; d < RADIX_SIZE ; ++d ){
+				for( int t = 0 ; t < thread_num ; ++t ){
+					int &h = hists[(size_t)t * RADIX_SIZE + d];
+					const int c = h;
+					h = offset;
+					offset += c;
+				}
+			}
+
+			const int limit = pass == RADIX_PASSES - 1 ? count : N;
+			#pragma omp parallel num_threads(thread_num)
+			{
+#ifdef _OPENMP
+				const int t = omp_get_thread_num();
+#else
+				const int t = 0;
+#endif
+				const int begin = (int)( (int64_t)N * t / thread_num );
+				const int end = (int)( (int64_t)N * ( t + 1 ) / thread_num );
+				int *pos = hists.data() + (size_t)t * RADIX_SIZE;
+				for( int n = begin ; n < end ; ++n ){
+					const int p = pos[digit_of(src[n], pass)]++;
+					if( p < limit ){
+						dst[p] = src[n];
+					}
+				}
+			}
+			std::swap(src, dst);
+		}
+
+		if( src != items.data() ){
+			std::memcpy(items.data(), src, sizeof(uint64_t) * count);
+		}
+	}
+}
+
+const double PointQuantizer::GAMMA = 1.1;
+
+int PointQuantizer::quantized_count(const int N){
+	const double kn = floor((log10(N)-1)/log10(GAMMA));
+	return N < 10 ? N : floor(10*pow(GAMMA,kn));
+}
+
+void PointQuantizer::select_nearest(const sensor_msgs::PointCloud &pts, const int count, std::vector<uint32_t> &indices){
+	const int N = pts.points.size();
+	indices.clear();
+	if( N <= 0 || count <= 0 ){
+		return;
+	}
+
+	//重心は従来どおり点の順に倍精度で足し込む(並列の部分和にすると丸めが変わり、同距離付近の並びが変わるため)
+	double X0=0,Y0=0;
+	for( int n = 0 ; n < N ; n++ ){
+		X0 += pts.points[n].x;
+		Y0 += pts.points[n].y;
+	}
+	X0/=N;
+	Y0/=N;
+
+	//距離は非負なので、floatのビット列をそのまま符号無し整数として比べれば大小関係が保たれる
+	std::vector<uint64_t> items(N);
+	#pragma omp parallel for schedule(static) if( N >= PARALLEL_MIN_POINTS )
+	for( int n = 0 ; n < N ; n++ ){
+		const float dx = pts.points[n].x - X0;
+		const float dy = pts.points[n].y - Y0;
+		const float w = std::sqrt(dx*dx + dy*dy);
+		uint32_t key;
+		std::memcpy(&key, &w, sizeof(key));
+		items[n] = (uint64_t)key << 32 | (uint32_t)n;
+	}
+
+	const int K = std::min(count, N);
+	radix_sort_prefix(items, K);
+
+	indices.resize(K);
+	for( int n = 0 ; n < K ; n++ ){
+		indices[n] = (uint32_t)items[n];
+	}
+}
+
+bool PointQuantizer::quantize(const sensor_msgs::PointCloud &pts, std::vector<float> &xyz){
+	const int N = pts.points.size();
+	if( N <= 0 ){
+		return false;
+	}
+
+	std::vector<uint32_t> indices;
+	select_nearest(pts, quantized_count(N), indices);
+
+	const int Qn = indices.size();
+	xyz.resize(3*Qn);
+	#pragma omp parallel for schedule(static) if( Qn >= PARALLEL_MIN_POINTS )
+	for( int n = 0 ; n < Qn ; n++ ){
+		const geometry_msgs::Point32 &p = pts.points[indices[n]];
+		xyz[3*n  ] = p.x;
+		xyz[3*n+1] = p.y;
+		xyz[3*n+2] = p.z;
+	}
+	return true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <sensor_msgs/PointCloud.h>
+
+/**
+ * ps_floats用の点数の量子化.
+ * Numpy配列の形状が毎回変わらないよう、点数を10*1.1^k個に切り詰めます.
+ * 残す点は、重心からのxy平面上の距離が近い順です(同距離は元の点の順).
+ */
+class PointQuantizer {
+public:
+	static const double GAMMA;
+
+	/**
+	 * N点に対する量子化後の点数を返します(N<10ならN).
+	 */
+	static int quantized_count(const int N);
+
+	/**
+	 * 重心からのxy距離の昇順に並べた先頭count点の番号を求めます.
+	 * 距離のfloatのビット列をキーとした並列・安定なLSD基数ソートで、最後のパスは先頭count点分だけ書き出します.
+	 */
+	static void select_nearest(const sensor_msgs::PointCloud &pts, const int count, std::vector<uint32_t> &indices);
+
+	/**
+	 * 量子化した点群をx,y,zの並びで出力します.
+	 */
+	static bool quantize(const sensor_msgs::PointCloud &pts, std::vector<float> &xyz);
+};
@@ -0,0 +1,1022 @@
+#include "SceneRenderer.hpp"
+
+#include <stdio.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <yaml-cpp/yaml.h>
+#include "PhaseShiftParams.hpp"
+
+namespace {
+
+constexpr int CAMERA_NUM = 2;
+constexpr int GRAY_CODE_BITS = 7;
+//GRAYPS4の位相シフトの枚数. YCAM3DのPHSFTパターン(13枚)とlibyds3dのGray+4step_PSで固定なので、n_phaseshiftは使わない
+constexpr int GRAYPS4_PHASE_SHIFT = 4;
+const int PROJECTOR_WIDTH_DEFAULT = 1280;
+const double ALBEDO_DEFAULT = 0.8;
+//交点から出す光線(影, 右カメラからの見え)の始点のずらし量[mm]
+const double RAY_OFFSET = 1e-3;
+const int UNDISTORT_ITERATIONS = 20;
+const int BVH_LEAF_SIZE = 4;
+
+struct Vec3 {
+	double x, y, z;
+
+	Vec3():x(0),y(0),z(0){}
+	Vec3(const double x,const double y,const double z):x(x),y(y),z(z){}
+
+	Vec3 operator+(const Vec3 &v)const{ return Vec3(x + v.x, y + v.y, z + v.z); }
+	Vec3 operator-(const Vec3 &v)const{ return Vec3(x - v.x, y - v.y, z - v.z); }
+	Vec3 operator*(const double s)const{ return Vec3(x * s, y * s, z * s); }
+	double operator[](const int i)const{ return i == 0 ? x : (i == 1 ? y : z); }
+
+	double dot(const Vec3 &v)const{ return x * v.x + y * v.y + z * v.z; }
+	Vec3 cross(const Vec3 &v)const{ return Vec3(y * v.z - z * v.y, z * v.x - x * v.z, x * v.y - y * v.x); }
+	double norm()const{ return std::sqrt(dot(*this)); }
+	Vec3 normalized()const{
+		const double n = norm();
+		return n > 0 ? *this * (1.0 / n) : *this;
+	}
+};
+
+//行優先の3x3行列との積
+Vec3 mul(const double *M,const Vec3 &v){
+	return Vec3(M[0] * v.x + M[1] * v.y + M[2] * v.z,
+		M[3] * v.x + M[4] * v.y + M[5] * v.z,
+		M[6] * v.x + M[7] * v.y + M[8] * v.z);
+}
+
+//転置した行列との積
+Vec3 mul_t(const double *M,const Vec3 &v){
+	return Vec3(M[0] * v.x + M[3] * v.y + M[6] * v.z,
+		M[1] * v.x + M[4] * v.y + M[7] * v.z,
+		M[2] * v.x + M[5] * v.y + M[8] * v.z);
+}
+
+struct Ray {
+	Vec3 origin;
+	Vec3 dir; //長さ1
+};
+
+struct Hit {
+	double t = 0;
+	Vec3 normal; //光線の側を向いた法線
+	double albedo = 0;
+};
+
+Vec3 facing(const Vec3 &normal,const Ray &ray){
+	return normal.dot(ray.dir) > 0 ? normal * -1.0 : normal;
+}
+
+/**
+ * 光線と軸平行な箱の交差(スラブ法). 光線の始点が箱の中の時は出口を返します.
+ * @param axis 交わった面の軸
+ */
+bool intersect_box(const Vec3 &lo,const Vec3 &hi,const Ray &ray,const double tmax,double *t,int *axis){
+	double tnear = -std::numeric_limits<double>::infinity();
+	double tfar = std::numeric_limits<double>::infinity();
+	int axis_near = 0, axis_far = 0;
+	for( int i = 0 ; i < 3 ; i++ ){
+		const double o = ray.origin[i], d = ray.dir[i];
+		if( std::abs(d) < 1e-12 ){
+			if( o < lo[i] || o > hi[i] ){
+				return false;
+			}
+			continue;
+		}
+		double t0 = (lo[i] - o) / d, t1 = (hi[i] - o) / d;
+		if( t0 > t1 ){
+			std::swap(t0,t1);
+		}
+		if( t0 > tnear ){
+			tnear = t0;
+			axis_near = i;
+		}
+		if( t1 < tfar ){
+			tfar = t1;
+			axis_far = i;
+		}
+	}
+	if( tnear > tfar ){
+		return false;
+	}else if( tnear > 0 && tnear < tmax ){
+		*t = tnear;
+		*axis = axis_near;
+		return true;
+	}else if( tnear <= 0 && tfar > 0 && tfar < tmax ){
+		*t = tfar;
+		*axis = axis_far;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * レンズ歪み(k1,k2,p1,p2[,k3[,k4,k5,k6]]).
+ */
+void distort(const std::vector<double> &D,const double x,const double y,double *xd,double *yd){
+	const double k1 = D.size() > 0 ? D[0] : 0, k2 = D.size() > 1 ? D[1] : 0;
+	const double p1 = D.size() > 2 ? D[2] : 0, p2 = D.size() > 3 ? D[3] : 0;
+	const double k3 = D.size() > 4 ? D[4] : 0;
+	const double k4 = D.size() > 7 ? D[5] : 0, k5 = D.size() > 7 ? D[6] : 0, k6 = D.size() > 7 ? D[7] : 0;
+	const double r2 = x * x + y * y, r4 = r2 * r2, r6 = r4 * r2;
+	const double radial = (1 + k1 * r2 + k2 * r4 + k3 * r6) / (1 + k4 * r2 + k5 * r4 + k6 * r6);
+	*xd = x * radial + 2 * p1 * x * y + p2 * (r2 + 2 * x * x);
+	*yd = y * radial + p1 * (r2 + 2 * y * y) + 2 * p2 * x * y;
+}
+
+/**
+ * 画素から正規化座標へ(cv::undistortPointsと同じ反復).
+ */
+void undistort(const double *K,const std::vector<double> &D,const double u,const double v,double *x,double *y){
+	const double x0 = (u - K[2]) / K[0];
+	const double y0 = (v - K[5]) / K[4];
+	*x = x0;
+	*y = y0;
+	for( int i = 0 ; i < UNDISTORT_ITERATIONS ; i++ ){
+		double xd, yd;
+		distort(D,*x,*y,&xd,&yd);
+		*x += x0 - xd;
+		*y += y0 - yd;
+	}
+}
+
+Vec3 read_vec3(const YAML::Node &node,const Vec3 &default_value){
+	if( ! node ){
+		return default_value;
+	}
+	const std::vector<double> v = node.as<std::vector<double>>();
+	if( v.size() != 3 ){
+		throw YAML::Exception(node.Mark(),"3 values are required");
+	}
+	return Vec3(v[0],v[1],v[2]);
+}
+
+struct PlyProperty {
+	std::string name;
+	std::string type;
+	bool is_list = false;
+	std::string count_type;
+};
+
+struct PlyElement {
+	std::string name;
+	size_t count = 0;
+	std::vector<PlyProperty> properties;
+};
+
+int ply_type_size(const std::string &type){
+	if( type == "char" || type == "uchar" || type == "int8" || type == "uint8" ){
+		return 1;
+	}else if( type == "short" || type == "ushort" || type == "int16" || type == "uint16" ){
+		return 2;
+	}else if( type == "int" || type == "uint" || type == "int32" || type == "uint32" || type == "float" || type == "float32" ){
+		return 4;
+	}else if( type == "double" || type == "float64" ){
+		return 8;
+	}
+	return 0;
+}
+
+bool read_ply_binary(std::istream &is,const std::string &type,double *value){
+	char buf[8];
+	const int size = ply_type_size(type);
+	if( size == 0 || ! is.read(buf,size) ){
+		return false;
+	}
+	if( type == "char" || type == "int8" ){ int8_t v; std::memcpy(&v,buf,1); *value = v; }
+	else if( type == "uchar" || type == "uint8" ){ uint8_t v; std::memcpy(&v,buf,1); *value = v; }
+	else if( type == "short" || type == "int16" ){ int16_t v; std::memcpy(&v,buf,2); *value = v; }
+	else if( type == "ushort" || type == "uint16" ){ uint16_t v; std::memcpy(&v,buf,2); *value = v; }
+	else if( type == "int" || type == "int32" ){ int32_t v; std::memcpy(&v,buf,4); *value = v; }
+	else if( type == "uint" || type == "uint32" ){ uint32_t v; std::memcpy(&v,buf,4); *value = v; }
+	else if( type == "float" || type == "float32" ){ float v; std::memcpy(&v,buf,4); *value = v; }
+	else{ double v; std::memcpy(&v,buf,8); *value = v; }
+	return true;
+}
+
+/**
+ * PLY(ascii, binary_little_endian)の頂点(x,y,z)と面(多角形は扇形に三角形へ分割)を読みます.
+ */
+bool load_ply_mesh(const std::string &path,std::vector<Vec3> *vertices,std::vector<std::array<int,3>> *triangles,std::string *error){
+	std::ifstream is(path, std::ios::binary);
+	if( ! is ){
+		*error = "ply open failed. path=" + path;
+		return false;
+	}
+	std::string line, format;
+	std::vector<PlyElement> elements;
+	if( ! std::getline(is,line) || line.compare(0,3,"ply") != 0 ){
+		*error = "not a ply file. path=" + path;
+		return false;
+	}
+	while( std::getline(is,line) ){
+		if( ! line.empty() && line.back() == '\r' ){
+			line.pop_back();
+		}
+		std::istringstream ls(line);
+		std::string word;
+		ls >> word;
+		if( word == "format" ){
+			ls >> format;
+		}else if( word == "element" ){
+			PlyElement element;
+			ls >> element.name >> element.count;
+			elements.push_back(element);
+		}else if( word == "property" && ! elements.empty() ){
+			PlyProperty prop;
+			ls >> prop.type;
+			if( prop.type == "list" ){
+				prop.is_list = true;
+				ls >> prop.count_type >> prop.type;
+			}
+			ls >> prop.name;
+			elements.back().properties.push_back(prop);
+		}else if( word == "end_header" ){
+			break;
+		}
+	}
+	const bool ascii = format == "ascii";
+	if( ! ascii && format != "binary_little_endian" ){
+		*error = "ply format is not supported. format=" + format;
+		return false;
+	}
+
+	//ascii/binaryのどちらでも1値ずつ読む
+	auto read_value = [&](const std::string &type,double *value){
+		if( ascii ){
+			return (bool)(is >> *value);
+		}
+		return read_ply_binary(is,type,value);
+	};
+	for( const PlyElement &element : elements ){
+		for( size_t n = 0 ; n < element.count ; n++ ){
+			Vec3 vertex;
+			std::vector<int> face;
+			for( const PlyProperty &prop : element.properties ){
+				double value = 0;
+				if( prop.is_list ){
+					double count = 0;
+					if( ! read_value(prop.count_type,&count) ){
+						*error = "ply data is broken. path=" + path;
+						return false;
+					}
+					for( int i = 0 ; i < (int)count ; i++ ){
+						if( ! read_value(prop.type,&value) ){
+							*error = "ply data is broken. path=" + path;
+							return false;
+						}
+						if( element.name == "face" && (prop.name == "vertex_indices" || prop.name == "vertex_index") ){
+							face.push_back((int)value);
+						}
+					}
+					continue;
+				}
+				if( ! read_value(prop.type,&value) ){
+					*error = "ply data is broken. path=" + path;
+					return false;
+				}
+				if( prop.name == "x" ){
+					vertex.x = value;
+				}else if( prop.name == "y" ){
+					vertex.y = value;
+				}else if( prop.name == "z" ){
+					vertex.z = value;
+				}
+			}
+			if( element.name == "vertex" ){
+				vertices->push_back(vertex);
+			}else if( element.name == "face" ){
+				for( size_t i = 2 ; i < face.size() ; i++ ){
+					triangles->push_back({face[0], face[i - 1], face[i]});
+				}
+			}
+		}
+	}
+	for( const std::array<int,3> &tri : *triangles ){
+		for( const int index : tri ){
+			if( index < 0 || index >= (int)vertices->size() ){
+				*error = "ply face index is out of range. path=" + path;
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+}
+
+struct SceneRenderer::Shape {
+	double albedo = ALBEDO_DEFAULT;
+
+	virtual ~Shape(){}
+
+	//0 < t < tmaxで最も近い交点
+	virtual bool intersect(const Ray &ray,const double tmax,Hit *hit)const = 0;
+};
+
+namespace {
+
+/**
+ * 平面. sizeを指定した時はpointを中心とする長方形.
+ */
+struct PlaneShape : public SceneRenderer::Shape {
+	Vec3 point;
+	Vec3 normal;
+	Vec3 axis_u;
+	Vec3 axis_v;
+	double half_u = std::numeric_limits<double>::infinity();
+	double half_v = std::numeric_limits<double>::infinity();
+
+	bool intersect(const Ray &ray,const double tmax,Hit *hit)const override{
+		const double denom = normal.dot(ray.dir);
+		if( std::abs(denom) < 1e-12 ){
+			return false;
+		}
+		const double t = normal.dot(point - ray.origin) / denom;
+		if( t <= 0 || t >= tmax ){
+			return false;
+		}
+		const Vec3 d = ray.origin + ray.dir * t - point;
+		if( std::abs(d.dot(axis_u)) > half_u || std::abs(d.dot(axis_v)) > half_v ){
+			return false;
+		}
+		hit->t = t;
+		hit->normal = facing(normal,ray);
+		hit->albedo = albedo;
+		return true;
+	}
+};
+
+struct BoxShape : public SceneRenderer::Shape {
+	Vec3 lo;
+	Vec3 hi;
+
+	bool intersect(const Ray &ray,const double tmax,Hit *hit)const override{
+		double t = 0;
+		int axis = 0;
+		if( ! intersect_box(lo,hi,ray,tmax,&t,&axis) ){
+			return false;
+		}
+		hit->t = t;
+		hit->normal = facing(Vec3(axis == 0, axis == 1, axis == 2),ray);
+		hit->albedo = albedo;
+		return true;
+	}
+};
+
+struct SphereShape : public SceneRenderer::Shape {
+	Vec3 center;
+	double radius = 0;
+
+	bool intersect(const Ray &ray,const double tmax,Hit *hit)const override{
+		const Vec3 oc = ray.origin - center;
+		const double b = oc.dot(ray.dir);
+		const double c = oc.dot(oc) - radius * radius;
+		const double disc = b * b - c;
+		if( disc < 0 ){
+			return false;
+		}
+		const double sq = std::sqrt(disc);
+		double t = -b - sq;
+		if( t <= 0 ){
+			t = -b + sq;
+		}
+		if( t <= 0 || t >= tmax ){
+			return false;
+		}
+		hit->t = t;
+		hit->normal = facing((ray.origin + ray.dir * t - center).normalized(),ray);
+		hit->albedo = albedo;
+		return true;
+	}
+};
+
+/**
+ * 三角形メッシュ. 重心の中央値で分けたBVHで交差判定を絞ります.
+ */
+struct MeshShape : public SceneRenderer::Shape {
+	struct Node {
+		Vec3 lo;
+		Vec3 hi;
+		int left = -1;
+		int right = -1;
+		int begin = 0;
+		int end = 0;
+	};
+
+	std::vector<Vec3> vertices;
+	std::vector<std::array<int,3>> triangles;
+	std::vector<Node> nodes;
+
+	Vec3 centroid(const std::array<int,3> &tri)const{
+		return (vertices[tri[0]] + vertices[tri[1]] + vertices[tri[2]]) * (1.0 / 3);
+	}
+
+	int build(const int begin,const int end){
+		Node node;
+		node.begin = begin;
+		node.end = end;
+		const double inf = std::numeric_limits<double>::infinity();
+		node.lo = Vec3(inf,inf,inf);
+		node.hi = Vec3(-inf,-inf,-inf);
+		Vec3 clo = node.lo, chi = node.hi;
+		for( int i = begin ; i < end ; i++ ){
+			for( const int index : triangles[i] ){
+				const Vec3 &v = vertices[index];
+				node.lo = Vec3(std::min(node.lo.x,v.x),std::min(node.lo.y,v.y),std::min(node.lo.z,v.z));
+				node.hi = Vec3(std::max(node.hi.x,v.x),std::max(node.hi.y,v.y),std::max(node.hi.z,v.z));
+			}
+			const Vec3 c = centroid(triangles[i]);
+			clo = Vec3(std::min(clo.x,c.x),std::min(clo.y,c.y),std::min(clo.z,c.z));
+			chi = Vec3(std::max(chi.x,c.x),std::max(chi.y,c.y),std::max(chi.z,c.z));
+		}
+		const int index = nodes.size();
+		nodes.push_back(node);
+		if( end - begin <= BVH_LEAF_SIZE ){
+			return index;
+		}
+		const Vec3 extent = chi - clo;
+		const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+		const int mid = (begin + end) / 2;
+		std::nth_element(triangles.begin() + begin, triangles.begin() + mid, triangles.begin() + end,
+			[&](const std::array<int,3> &a,const std::array<int,3> &b){ return centroid(a)[axis] < centroid(b)[axis]; });
+		const int left = build(begin,mid);
+		const int right = build(mid,end);
+		nodes[index].left = left;
+		nodes[index].right = right;
+		return index;
+	}
+
+	//Moller-Trumbore
+	bool intersect_triangle(const std::array<int,3> &tri,const Ray &ray,const double tmax,double *t,Vec3 *normal)const{
+		const Vec3 &v0 = vertices[tri[0]];
+		const Vec3 e1 = vertices[tri[1]] - v0;
+		const Vec3 e2 = vertices[tri[2]] - v0;
+		const Vec3 p = ray.dir.cross(e2);
+		const double det = e1.dot(p);
+		if( std::abs(det) < 1e-12 ){
+			return false;
+		}
+		const double inv = 1.0 / det;
+		const Vec3 s = ray.origin - v0;
+		const double u = s.dot(p) * inv;
+		if( u < 0 || u > 1 ){
+			return false;
+		}
+		const Vec3 q = s.cross(e1);
+		const double v = ray.dir.dot(q) * inv;
+		if( v < 0 || u + v > 1 ){
+			return false;
+		}
+		const double tt = e2.dot(q) * inv;
+		if( tt <= 0 || tt >= tmax ){
+			return false;
+		}
+		*t = tt;
+		*normal = e1.cross(e2).normalized();
+		return true;
+	}
+
+	bool intersect(const Ray &ray,const double tmax,Hit *hit)const override{
+		if( nodes.empty() ){
+			return false;
+		}
+		double nearest = tmax;
+		Vec3 normal;
+		//中央値で分けるので深さは三角形数のlog2程度
+		int stack[64];
+		int top = 0;
+		stack[top++] = 0;
+		while( top > 0 ){
+			const Node &node = nodes[stack[--top]];
+			double t = 0;
+			int axis = 0;
+			const bool inside = ray.origin.x >= node.lo.x && ray.origin.x <= node.hi.x &&
+				ray.origin.y >= node.lo.y && ray.origin.y <= node.hi.y &&
+				ray.origin.z >= node.lo.z && ray.origin.z <= node.hi.z;
+			if( ! inside && ! intersect_box(node.lo,node.hi,ray,nearest,&t,&axis) ){
+				continue;
+			}
+			if( node.left >= 0 ){
+				stack[top++] = node.left;
+				stack[top++] = node.right;
+				continue;
+			}
+			for( int i = node.begin ; i < node.end ; i++ ){
+				Vec3 n;
+				if( intersect_triangle(triangles[i],ray,nearest,&t,&n) ){
+					nearest = t;
+					normal = n;
+				}
+			}
+		}
+		if( nearest >= tmax ){
+			return false;
+		}
+		hit->t = nearest;
+		hit->normal = facing(normal,ray);
+		hit->albedo = albedo;
+		return true;
+	}
+};
+
+/**
+ * 平面の中の直交する2軸.
+ */
+void plane_axes(const Vec3 &normal,Vec3 *axis_u,Vec3 *axis_v){
+	const Vec3 up = std::abs(normal.y) < 0.9 ? Vec3(0,1,0) : Vec3(1,0,0);
+	*axis_u = up.cross(normal).normalized();
+	*axis_v = normal.cross(*axis_u);
+}
+
+std::shared_ptr<BoxShape> make_box(const Vec3 &a,const Vec3 &b,const double albedo){
+	std::shared_ptr<BoxShape> box = std::make_shared<BoxShape>();
+	box->lo = Vec3(std::min(a.x,b.x),std::min(a.y,b.y),std::min(a.z,b.z));
+	box->hi = Vec3(std::max(a.x,b.x),std::max(a.y,b.y),std::max(a.z,b.z));
+	box->albedo = albedo;
+	return box;
+}
+
+/**
+ * シーンファイルの物体1つ. 階段は箱の並びにします.
+ */
+bool load_object(const YAML::Node &node,const std::string &scene_dir,std::vector<std::shared_ptr<const SceneRenderer::Shape>> *shapes,std::string *error){
+	const std::string type = node["type"].as<std::string>("");
+	const double albedo = node["albedo"].as<double>(ALBEDO_DEFAULT);
+	if( type == "plane" ){
+		std::shared_ptr<PlaneShape> plane = std::make_shared<PlaneShape>();
+		plane->point = read_vec3(node["point"],Vec3());
+		plane->normal = read_vec3(node["normal"],Vec3(0,0,-1)).normalized();
+		plane_axes(plane->normal,&plane->axis_u,&plane->axis_v);
+		if( node["size"] ){
+			const std::vector<double> size = node["size"].as<std::vector<double>>();
+			if( size.size() != 2 ){
+				*error = "plane size must be [width, height]";
+				return false;
+			}
+			plane->half_u = size[0] / 2;
+			plane->half_v = size[1] / 2;
+		}
+		plane->albedo = albedo;
+		shapes->push_back(plane);
+	}else if( type == "box" ){
+		shapes->push_back(make_box(read_vec3(node["min"],Vec3()),read_vec3(node["max"],Vec3()),albedo));
+	}else if( type == "sphere" ){
+		std::shared_ptr<SphereShape> sphere = std::make_shared<SphereShape>();
+		sphere->center = read_vec3(node["center"],Vec3());
+		sphere->radius = node["radius"].as<double>(0);
+		sphere->albedo = albedo;
+		if( sphere->radius <= 0 ){
+			*error = "sphere radius must be positive";
+			return false;
+		}
+		shapes->push_back(sphere);
+	}else if( type == "steps" ){
+		//originは一番奥の段の左上. 段はx方向に並び、1段毎にheightだけカメラへ近づく
+		const Vec3 origin = read_vec3(node["origin"],Vec3());
+		const int count = node["count"].as<int>(0);
+		const double step_width = node["width"].as<double>(0);
+		const double step_height = node["height"].as<double>(0);
+		const double depth = node["depth"].as<double>(0);
+		if( count <= 0 || step_width <= 0 || depth <= 0 ){
+			*error = "steps count, width and depth must be positive";
+			return false;
+		}
+		for( int k = 0 ; k < count ; k++ ){
+			const Vec3 a(origin.x + step_width * k, origin.y, origin.z);
+			const Vec3 b(origin.x + step_width * (k + 1), origin.y + depth, origin.z - step_height * (k + 1));
+			shapes->push_back(make_box(a,b,albedo));
+		}
+	}else if( type == "mesh" ){
+		std::string path = node["path"].as<std::string>("");
+		if( ! path.empty() && path[0] != '/' ){
+			path = scene_dir + "/" + path;
+		}
+		std::shared_ptr<MeshShape> mesh = std::make_shared<MeshShape>();
+		if( ! load_ply_mesh(path,&mesh->vertices,&mesh->triangles,error) ){
+			return false;
+		}
+		const double scale = node["scale"].as<double>(1);
+		const Vec3 translation = read_vec3(node["translation"],Vec3());
+		for( Vec3 &v : mesh->vertices ){
+			v = v * scale + translation;
+		}
+		if( ! mesh->triangles.empty() ){
+			mesh->build(0,mesh->triangles.size());
+		}
+		mesh->albedo = albedo;
+		shapes->push_back(mesh);
+	}else{
+		*error = "unknown object type. type=" + type;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * 位相シフトのパラメータ. 値が無い時はphase_shift_params()の既定値.
+ */
+double phase_shift_value(const SceneRenderer::ParamSource &params,const std::string &key,const double default_value){
+	double value = default_value;
+	for( const PhaseShiftParam &param : phase_shift_params() ){
+		if( key == param.key ){
+			value = param.default_value;
+		}
+	}
+	if( params.get_value ){
+		params.get_value("pshift_genpc/calc/" + key,&value);
+	}
+	return value;
+}
+
+}
+
+SceneRenderer::SceneRenderer():
+	m_calib_width(0),
+	m_calib_height(0),
+	m_rectify(false),
+	m_gcode_variation(2),
+	m_n_phaseshift(4),
+	m_periods({9,10,11}),
+	m_proj_position_set(false),
+	m_proj_width(PROJECTOR_WIDTH_DEFAULT),
+	m_width(0),
+	m_height(0),
+	m_proj_fx(0),
+	m_proj_cx(0)
+{
+	for( CameraModel &camera : m_cameras ){
+		std::fill(camera.K, camera.K + 9, 0);
+		std::fill(camera.R, camera.R + 9, 0);
+		camera.R[0] = camera.R[4] = camera.R[8] = 1;
+		std::fill(camera.T, camera.T + 3, 0);
+	}
+	std::fill(m_rect_R, m_rect_R + 9, 0);
+	std::fill(m_proj_position, m_proj_position + 3, 0);
+	std::fill(m_proj_center, m_proj_center + 3, 0);
+}
+
+bool SceneRenderer::load_calibration(const ParamSource &params,std::string *error){
+	auto get = [&](const std::string &key,const size_t size,std::vector<double> *values){
+		return params.get_list && params.get_list(key,values) && (size == 0 || values->size() == size);
+	};
+	std::vector<double> Kl, Dl, Kr, Dr, R, T, R1, R2, P2, Q;
+	const bool has_rect = get("left/remap/R",9,&R1);
+	if( get("left/genpc/K",9,&Kl) && get("left/genpc/D",0,&Dl) &&
+		get("right/genpc/K",9,&Kr) && get("right/genpc/D",0,&Dr) &&
+		get("right/genpc/R",9,&R) && get("right/genpc/T",3,&T) ){
+		//カメラから読んだ平行化前のキャリブレーション
+	}else if( has_rect && get("left/remap/K",9,&Kl) && get("left/remap/D",0,&Dl) &&
+		get("right/remap/K",9,&Kr) && get("right/remap/D",0,&Dr) && get("right/remap/R",9,&R2) ){
+		//平行化後の右カメラは左カメラからx方向にtxずれている. X_r = R2^T * (R1 * X_l + (tx,0,0))
+		double tx = 0;
+		if( get("right/remap/P",12,&P2) && P2[0] != 0 ){
+			tx = P2[3] / P2[0];
+		}else if( get("genpc/Q",16,&Q) && Q[14] != 0 ){
+			tx = -1.0 / Q[14];
+		}else{
+			*error = "stereo baseline not found. right/remap/P or genpc/Q is required.";
+			return false;
+		}
+		R.assign(9,0);
+		for( int i = 0 ; i < 3 ; i++ ){
+			for( int j = 0 ; j < 3 ; j++ ){
+				for( int k = 0 ; k < 3 ; k++ ){
+					R[i * 3 + j] += R2[k * 3 + i] * R1[k * 3 + j];
+				}
+			}
+		}
+		const Vec3 t = mul_t(R2.data(),Vec3(tx,0,0));
+		T = {t.x, t.y, t.z};
+	}else{
+		*error = "camera calibration not found. (left|right)/genpc/K,D,R,T or (left|right)/remap/K,D,R,P is required.";
+		return false;
+	}
+	std::copy(Kl.begin(), Kl.end(), m_cameras[0].K);
+	m_cameras[0].D = Dl;
+	std::copy(Kr.begin(), Kr.end(), m_cameras[1].K);
+	m_cameras[1].D = Dr;
+	std::copy(R.begin(), R.end(), m_cameras[1].R);
+	std::copy(T.begin(), T.end(), m_cameras[1].T);
+	m_rectify = has_rect;
+	if( has_rect ){
+		std::copy(R1.begin(), R1.end(), m_rect_R);
+	}
+
+	//キャリブレーションの画像サイズ. 無い時はprepare()の画像サイズ
+	double width = 0, height = 0;
+	if( params.get_value ){
+		if( ! params.get_value("left/remap/width",&width) ){
+			params.get_value("pshift_genpc/calc/image_width",&width);
+		}
+		if( ! params.get_value("left/remap/height",&height) ){
+			params.get_value("pshift_genpc/calc/image_height",&height);
+		}
+	}
+	m_calib_width = (int)width;
+	m_calib_height = (int)height;
+
+	m_gcode_variation = (int)phase_shift_value(params,"gcode_variation",2);
+	m_n_phaseshift = (int)phase_shift_value(params,"n_phaseshift",4);
+	const int n_periods = (int)phase_shift_value(params,"n_periods",3);
+	m_periods.clear();
+	for( int i = 0 ; i < n_periods ; i++ ){
+		m_periods.push_back(phase_shift_value(params,"period" + std::to_string(i),0));
+	}
+	if( m_gcode_variation <= 0 || m_n_phaseshift <= 0 || n_periods <= 0 ||
+		std::any_of(m_periods.begin(), m_periods.end(), [](const double period){ return period <= 0; }) ){
+		*error = "phase shift parameter is wrong. gcode_variation, n_phaseshift, n_periods and period0.. must be positive.";
+		return false;
+	}
+	return true;
+}
+
+bool SceneRenderer::load_scene(const std::string &path,std::string *error){
+	const size_t pos = path.find_last_of('/');
+	const std::string scene_dir = pos == std::string::npos ? "." : path.substr(0,pos);
+	std::vector<std::shared_ptr<const Shape>> shapes;
+	try{
+		const YAML::Node root = YAML::LoadFile(path);
+		const YAML::Node projector = root["projector"];
+		m_proj_position_set = projector && projector["position"];
+		if( m_proj_position_set ){
+			const Vec3 position = read_vec3(projector["position"],Vec3());
+			m_proj_position[0] = position.x;
+			m_proj_position[1] = position.y;
+			m_proj_position[2] = position.z;
+		}
+		m_proj_width = projector ? projector["width"].as<int>(PROJECTOR_WIDTH_DEFAULT) : PROJECTOR_WIDTH_DEFAULT;
+		if( m_proj_width <= 0 ){
+			*error = "projector width must be positive";
+			return false;
+		}
+		if( ! root["objects"] || ! root["objects"].IsSequence() ){
+			*error = "scene has no objects. path=" + path;
+			return false;
+		}
+		for( const YAML::Node &node : root["objects"] ){
+			if( ! load_object(node,scene_dir,&shapes,error) ){
+				return false;
+			}
+		}
+	}catch( YAML::Exception &e ){
+		*error = "scene load failed. path=" + path + ", error=" + e.what();
+		return false;
+	}
+	m_shapes = shapes;
+	return true;
+}
+
+void SceneRenderer::set_settings(const Settings &settings){
+	m_settings = settings;
+}
+
+const SceneRenderer::Settings &SceneRenderer::get_settings()const{
+	return m_settings;
+}
+
+namespace {
+
+//最も近い交点
+bool trace(const std::vector<std::shared_ptr<const SceneRenderer::Shape>> &shapes,const Ray &ray,const double tmax,Hit *hit){
+	bool found = false;
+	double nearest = tmax;
+	for( const auto &shape : shapes ){
+		Hit h;
+		if( shape->intersect(ray,nearest,&h) ){
+			nearest = h.t;
+			*hit = h;
+			found = true;
+		}
+	}
+	return found;
+}
+
+}
+
+bool SceneRenderer::prepare(const int width,const int height,std::string *error){
+	if( width <= 0 || height <= 0 ){
+		*error = "image size must be positive";
+		return false;
+	}else if( m_cameras[0].K[0] == 0 || m_cameras[1].K[0] == 0 ){
+		*error = "camera calibration is not loaded";
+		return false;
+	}
+	m_width = width;
+	m_height = height;
+	const double sx = m_calib_width > 0 ? width / (double)m_calib_width : 1.0;
+	const double sy = m_calib_height > 0 ? height / (double)m_calib_height : 1.0;
+	double K[CAMERA_NUM][9];
+	Vec3 centers[CAMERA_NUM];
+	for( int c = 0 ; c < CAMERA_NUM ; c++ ){
+		std::copy(m_cameras[c].K, m_cameras[c].K + 9, K[c]);
+		K[c][0] *= sx;
+		K[c][1] *= sx;
+		K[c][2] *= sx;
+		K[c][4] *= sy;
+		K[c][5] *= sy;
+		//カメラの中心 = -R^T * T
+		centers[c] = mul_t(m_cameras[c].R,Vec3(m_cameras[c].T[0],m_cameras[c].T[1],m_cameras[c].T[2])) * -1.0;
+	}
+
+	//プロジェクタは左カメラと同じ向きで、横の画角も左カメラと同じにする
+	const Vec3 proj_center = m_proj_position_set ? Vec3(m_proj_position[0],m_proj_position[1],m_proj_position[2]) : centers[1] * 0.5;
+	m_proj_center[0] = proj_center.x;
+	m_proj_center[1] = proj_center.y;
+	m_proj_center[2] = proj_center.z;
+	m_proj_fx = K[0][0] * m_proj_width / width;
+	m_proj_cx = m_proj_width / 2.0;
+
+	const size_t pixels = (size_t)width * height;
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+	for( int c = 0 ; c < CAMERA_NUM ; c++ ){
+		PixelMap &map = m_pixels[c];
+		map.proj_u.assign(pixels, nan);
+		map.shade.assign(pixels, 0);
+		map.albedo.assign(pixels, 0);
+		map.shadow.assign(pixels, 0);
+	}
+	m_gt_points.assign(pixels * 3, nan);
+	m_gt_albedo.assign(pixels, 0);
+	m_gt_shadow.assign(pixels, 0);
+
+	for( int c = 0 ; c < CAMERA_NUM ; c++ ){
+		const CameraModel &camera = m_cameras[c];
+		PixelMap &map = m_pixels[c];
+		#pragma omp parallel for schedule(dynamic,8)
+		for( int y = 0 ; y < height ; y++ ){
+			for( int x = 0 ; x < width ; x++ ){
+				const size_t idx = (size_t)y * width + x;
+				double nx, ny;
+				undistort(K[c],camera.D,x,y,&nx,&ny);
+				const Ray ray = {centers[c], mul_t(camera.R,Vec3(nx,ny,1)).normalized()};
+				Hit hit;
+				if( ! trace(m_shapes,ray,std::numeric_limits<double>::infinity(),&hit) ){
+					continue;
+				}
+				const Vec3 point = ray.origin + ray.dir * hit.t;
+				map.albedo[idx] = hit.albedo;
+
+				//プロジェクタの光. 左カメラと同じ向きなので、プロジェクタ座標はずらすだけ
+				const Vec3 to_proj = proj_center - point;
+				const double dist = to_proj.norm();
+				const Vec3 light = to_proj * (1.0 / dist);
+				const double cos_light = hit.normal.dot(light);
+				const Vec3 p = point - proj_center;
+				if( cos_light <= 0 || p.z <= 0 ){
+					continue;
+				}
+				const double proj_u = m_proj_fx * p.x / p.z + m_proj_cx;
+				if( proj_u < 0 || proj_u >= m_proj_width ){
+					continue;
+				}
+				map.proj_u[idx] = proj_u;
+				map.shade[idx] = hit.albedo * cos_light;
+				Hit blocker;
+				const Ray shadow_ray = {point + hit.normal * RAY_OFFSET, light};
+				map.shadow[idx] = trace(m_shapes,shadow_ray,dist - RAY_OFFSET,&blocker) ? 1 : 0;
+
+				//真値は左カメラの点のうち、右カメラの画像内で遮られずに見えるもの
+				if( c != 0 ){
+					continue;
+				}
+				const Vec3 to_right = centers[1] - point;
+				const double dist_right = to_right.norm();
+				if( hit.normal.dot(to_right) <= 0 ){
+					continue;
+				}
+				const Ray right_ray = {point + hit.normal * RAY_OFFSET, to_right * (1.0 / dist_right)};
+				if( trace(m_shapes,right_ray,dist_right - RAY_OFFSET,&blocker) ){
+					continue;
+				}
+				const Vec3 pr = mul(m_cameras[1].R,point) + Vec3(m_cameras[1].T[0],m_cameras[1].T[1],m_cameras[1].T[2]);
+				double xd, yd;
+				distort(m_cameras[1].D,pr.x / pr.z,pr.y / pr.z,&xd,&yd);
+				const double ur = K[1][0] * xd + K[1][1] * yd + K[1][2];
+				const double vr = K[1][4] * yd + K[1][5];
+				if( pr.z <= 0 || ur < 0 || ur > width - 1 || vr < 0 || vr > height - 1 ){
+					continue;
+				}
+				const Vec3 gt = m_rectify ? mul(m_rect_R,point) : point;
+				m_gt_points[idx * 3] = gt.x;
+				m_gt_points[idx * 3 + 1] = gt.y;
+				m_gt_points[idx * 3 + 2] = gt.z;
+				m_gt_albedo[idx] = hit.albedo;
+				m_gt_shadow[idx] = map.shadow[idx];
+			}
+		}
+	}
+	return true;
+}
+
+int SceneRenderer::width()const{
+	return m_width;
+}
+
+int SceneRenderer::height()const{
+	return m_height;
+}
+
+int SceneRenderer::frame_num(const Sequence seq)const{
+	if( seq == SEQ_GRAYPS4 ){
+		return 2 + GRAY_CODE_BITS + GRAYPS4_PHASE_SHIFT;
+	}
+	return 2 + m_periods.size() * m_n_phaseshift;
+}
+
+float SceneRenderer::pattern(const Sequence seq,const int frame,const float proj_u)const{
+	if( frame == 1 ){
+		return 1;
+	}else if( frame <= 0 || frame >= frame_num(seq) ){
+		return 0;
+	}
+	double period = 0;
+	int shift = 0;
+	int n_phaseshift = m_n_phaseshift;
+	if( seq == SEQ_GRAYPS4 ){
+		//グレイコードは上位ビットから. 位相シフトの1周期はグレイコードgcode_variation本分
+		const double stripe = m_proj_width / (double)(1 << GRAY_CODE_BITS);
+		if( frame < 2 + GRAY_CODE_BITS ){
+			const int code = std::min(std::max((int)(proj_u / stripe),0),(1 << GRAY_CODE_BITS) - 1);
+			const int gray = code ^ (code >> 1);
+			return (gray >> (GRAY_CODE_BITS - 1 - (frame - 2))) & 1;
+		}
+		period = stripe * m_gcode_variation;
+		shift = frame - 2 - GRAY_CODE_BITS;
+		n_phaseshift = GRAYPS4_PHASE_SHIFT;
+	}else{
+		//周期毎にn_phaseshift枚. 周期はプロジェクタの画素数
+		period = m_periods[(frame - 2) / m_n_phaseshift];
+		shift = (frame - 2) % m_n_phaseshift;
+	}
+	const double phase = 2 * M_PI * (proj_u / period - shift / (double)n_phaseshift);
+	return 0.5f + 0.5f * (float)std::cos(phase);
+}
+
+void SceneRenderer::render(const Sequence seq,const int frame,const double exposure,const uint64_t shot,cv::Mat *left,cv::Mat *right)const{
+	cv::Mat *imgs[CAMERA_NUM] = {left, right};
+	for( int c = 0 ; c < CAMERA_NUM ; c++ ){
+		cv::Mat &img = *imgs[c];
+		img.create(m_height, m_width, CV_8UC1);
+		const PixelMap &map = m_pixels[c];
+		#pragma omp parallel for
+		for( int y = 0 ; y < m_height ; y++ ){
+			//行毎に乱数の系列を分けて、並列でも同じ画像にする
+			std::seed_seq seq_seed = {m_settings.seed, (unsigned int)(shot & 0xffffffff), (unsigned int)(shot >> 32), (unsigned int)c, (unsigned int)y};
+			std::mt19937 random(seq_seed);
+			std::normal_distribution<float> noise(0, m_settings.noise > 0 ? m_settings.noise : 1);
+			unsigned char *dst = img.ptr<unsigned char>(y);
+			for( int x = 0 ; x < m_width ; x++ ){
+				const size_t idx = (size_t)y * m_width + x;
+				float value = map.albedo[idx] * m_settings.ambient;
+				if( ! std::isnan(map.proj_u[idx]) && ! (m_settings.shadow && map.shadow[idx]) ){
+					value += map.shade[idx] * m_settings.projector_level * pattern(seq,frame,map.proj_u[idx]);
+				}
+				value *= exposure;
+				if( m_settings.noise > 0 ){
+					value += noise(random);
+				}
+				if( value >= m_settings.saturation ){
+					dst[x] = 255;
+				}else{
+					dst[x] = (unsigned char)std::min(std::max(std::round(value),0.0f),255.0f);
+				}
+			}
+		}
+	}
+}
+
+void SceneRenderer::ground_truth(sensor_msgs::PointCloud *pts)const{
+	pts->points.clear();
+	pts->channels.resize(1);
+	pts->channels[0].name = "rgb";
+	pts->channels[0].values.clear();
+	for( size_t idx = 0 ; idx < m_gt_albedo.size() ; idx++ ){
+		if( std::isnan(m_gt_points[idx * 3]) || std::isnan(m_pixels[0].proj_u[idx]) || (m_settings.shadow && m_gt_shadow[idx]) ){
+			continue;
+		}
+		geometry_msgs::Point32 p;
+		p.x = m_gt_points[idx * 3];
+		p.y = m_gt_points[idx * 3 + 1];
+		p.z = m_gt_points[idx * 3 + 2];
+		pts->points.push_back(p);
+		const uint32_t gray = (uint32_t)std::min(std::max(m_gt_albedo[idx] * 255.0f,0.0f),255.0f);
+		const uint32_t rgb = (gray << 16) | (gray << 8) | gray;
+		float packed;
+		std::memcpy(&packed, &rgb, sizeof(float));
+		pts->channels[0].values.push_back(packed);
+	}
+}
+
+double SceneRenderer::fill_ratio()const{
+	sensor_msgs::PointCloud pts;
+	ground_truth(&pts);
+	return m_gt_albedo.empty() ? 0 : pts.points.size() / (double)m_gt_albedo.size();
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <sensor_msgs/PointCloud.h>
+
+/**
+ * 構造化光(位相シフト)のパターン画像の合成.
+ * ステレオカメラのキャリブレーションとシーン(平面, 箱, 球, 階段, PLYメッシュ)から、
+ * プロジェクタが投影したGRAYPS4(13枚)/MULTI(14枚)のパターンを左右のカメラで撮影した画像をCPUで作ります.
+ * 形状が既知なので点群生成の精度の確認に使え、任意の解像度/有効点の割合/HDR/飽和の入力を作れます.
+ *
+ * 座標は左カメラ(平行化前)の座標系で、単位はキャリブレーションの基線長と同じ. x右, y下, z奥.
+ * プロジェクタは左カメラと同じ向きで左右カメラの中点に置き(シーンファイルで変更可)、縦縞を投影します.
+ * 視線とシーンの交点は画像サイズを決めた時(prepare)に求めておき、1枚毎の合成はパターンの参照とノイズだけです.
+ */
+class SceneRenderer {
+public:
+	enum Sequence {
+		SEQ_GRAYPS4 = 0, //黒, 白, グレイコード7枚, 位相シフト4枚
+		SEQ_MULTI        //黒, 白, 3周期 x 位相シフト4枚
+	};
+
+	/**
+	 * パラメータの読み出し. rosparam dumpしたyamlとノードのパラメータの両方から使います.
+	 */
+	struct ParamSource {
+		std::function<bool(const std::string &key,std::vector<double> *values)> get_list;
+		std::function<bool(const std::string &key,double *value)> get_value;
+	};
+
+	struct Settings {
+		double projector_level = 200; //albedo 1の面に正面から投影した白の明るさ[階調]
+		double ambient = 10;          //albedo 1の面の環境光の明るさ[階調]
+		double noise = 1.0;           //ノイズの標準偏差[階調]
+		double saturation = 255;      //この階調以上は飽和して255になる
+		bool shadow = true;           //プロジェクタの光が遮られた所を影にする
+		unsigned int seed = 0;
+	};
+
+	SceneRenderer();
+
+	/**
+	 * キャリブレーションを読みます.
+	 * left/genpc/K,D と right/genpc/K,D,R,T (カメラから読んだ値)があればそれを使い、
+	 * 無ければ left/remap/K,D,R,P と right/remap/K,D,R,P (Pが無い時は genpc/Q の基線長)から左右の位置関係を求めます.
+	 * 位相シフトのパラメータ(pshift_genpc/calc/gcode_variation, n_phaseshift, n_periods, period0～)もここで読みます.
+	 * n_phaseshift, n_periods, period0～はMULTIだけに使います. GRAYPS4は実機/libyds3dと同じく常に4枚(計13枚)です.
+	 */
+	bool load_calibration(const ParamSource &params,std::string *error);
+
+	/**
+	 * シーンファイル(yaml)を読みます. 書式はREADMEを参照.
+	 */
+	bool load_scene(const std::string &path,std::string *error);
+
+	void set_settings(const Settings &settings);
+	const Settings &get_settings()const;
+
+	/**
+	 * 1台分の画像サイズを決めて、画素毎の視線とシーンの交点/プロジェクタの座標を求めます.
+	 * キャリブレーションの画像サイズと違う時は内部パラメータを拡大縮小します.
+	 * load_calibration()/load_scene()の後に呼んでください. Settingsは後から変えてもかまいません.
+	 */
+	bool prepare(const int width,const int height,std::string *error);
+
+	int width()const;
+	int height()const;
+
+	int frame_num(const Sequence seq)const;
+
+	/**
+	 * パターンのframe番目を撮影した左右の画像(CV_8UC1)を作ります.
+	 * @param exposure 露光の倍率(HDR撮影用)
+	 * @param shot ノイズの系列番号. 同じ値なら同じ画像
+	 */
+	void render(const Sequence seq,const int frame,const double exposure,const uint64_t shot,cv::Mat *left,cv::Mat *right)const;
+
+	/**
+	 * 左右のカメラから見えてプロジェクタの光が当たる点(点群生成で復元できる点)の真値. rgbチャンネルはalbedo.
+	 * left/remap/Rがある時は平行化した左カメラの座標系(genpcの点群と同じ)に直します.
+	 */
+	void ground_truth(sensor_msgs::PointCloud *pts)const;
+
+	//ground_truth()の点数/画素数
+	double fill_ratio()const;
+
+	struct Shape; //シーンの物体. 交差判定はcppで定義
+
+private:
+	//X_cam = R * X + T (Xは左カメラの座標系)
+	struct CameraModel {
+		double K[9];
+		std::vector<double> D;
+		double R[9];
+		double T[3];
+	};
+
+	//画素毎の合成用データ. 明るさの設定(Settings)はrender()の時に掛ける
+	struct PixelMap {
+		std::vector<float> proj_u;         //プロジェクタの列[px]. 投影範囲外/裏面の時はNaN
+		std::vector<float> shade;          //albedo * 投影方向との余弦
+		std::vector<float> albedo;         //物体が無い時は0
+		std::vector<unsigned char> shadow; //プロジェクタとの間に物体がある
+	};
+
+	Settings m_settings;
+
+	CameraModel m_cameras[2];
+	int m_calib_width;
+	int m_calib_height;
+	bool m_rectify;
+	double m_rect_R[9]; //left/remap/R
+
+	//位相シフトのパターン
+	int m_gcode_variation;
+	int m_n_phaseshift; //MULTIの1周期の枚数
+	std::vector<double> m_periods;
+
+	std::vector<std::shared_ptr<const Shape>> m_shapes;
+	bool m_proj_position_set;
+	double m_proj_position[3];
+	int m_proj_width;
+
+	int m_width;
+	int m_height;
+	double m_proj_center[3];
+	double m_proj_fx;
+	double m_proj_cx;
+	PixelMap m_pixels[2];
+	//左画素毎の真値の候補(左右から見える点). x,y,z ...
+	std::vector<float> m_gt_points;
+	std::vector<float> m_gt_albedo;
+	std::vector<unsigned char> m_gt_shadow;
+
+	//投影パターンの明るさ(0～1)
+	float pattern(const Sequence seq,const int frame,const float proj_u)const;
+};
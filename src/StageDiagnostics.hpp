@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <diagnostic_msgs/DiagnosticArray.h>
+#include "StageMetrics.hpp"
+
+/**
+ * StageMetricsの直近の分布をdiagnostic_msgs/DiagnosticStatusにします.
+ * 段階毎に "<段階>[単位].p50" "～.p95" "～.p99" "～.max" "～.count"(直近の値の数) "～.total"(起動からの値の数) を値に持ちます.
+ * @param prefix 対象の段階名の先頭(キーからは取り除く)
+ */
+inline diagnostic_msgs::DiagnosticStatus make_stage_diagnostic(const std::string &name, const std::string &hardware_id, const std::string &prefix){
+	diagnostic_msgs::DiagnosticStatus status;
+	status.name = name;
+	status.hardware_id = hardware_id;
+	status.level = diagnostic_msgs::DiagnosticStatus::OK;
+	status.message = "stage metrics";
+
+	auto add_value = [&status](const std::string &key, const double value){
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%g", value);
+		diagnostic_msgs::KeyValue kv;
+		kv.key = key;
+		kv.value = buf;
+		status.values.push_back(kv);
+	};
+	for( const StageMetrics::Summary &summary : StageMetrics::summaries(prefix, true) ){
+		const std::string stage = summary.name.substr(prefix.size()) + "[" + StageMetrics::unit_name(summary.unit) + "]";
+		add_value(stage + ".p50", summary.p50);
+		add_value(stage + ".p95", summary.p95);
+		add_value(stage + ".p99", summary.p99);
+		add_value(stage + ".max", summary.max);
+		add_value(stage + ".count", summary.recent_count);
+		add_value(stage + ".total", summary.count);
+	}
+	return status;
+}
@@ -0,0 +1,223 @@
+#include "StageMetrics.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <mutex>
+
+namespace {
+
+//バケットの細かさ. 2のべき乗毎に16分割する
+constexpr int SUB_BUCKET_BITS = 4;
+constexpr int SUB_BUCKET_NUM = 1 << SUB_BUCKET_BITS;
+constexpr int BUCKET_NUM = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_NUM;
+
+//整数のバケットに積む時の倍率. ms→us, 割合→0.01%
+double unit_scale(const StageMetrics::Unit unit){
+	switch( unit ){
+	case StageMetrics::UNIT_MS:    return 1000;
+	case StageMetrics::UNIT_COUNT: return 1;
+	case StageMetrics::UNIT_RATIO: return 10000;
+	}
+	return 1;
+}
+
+int bucket_index(const uint64_t v){
+	if( v < SUB_BUCKET_NUM ){
+		return (int)v;
+	}
+	const int msb = 63 - __builtin_clzll(v);
+	const int sub = (int)((v >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKET_NUM - 1));
+	return (msb - SUB_BUCKET_BITS + 1) * SUB_BUCKET_NUM + sub;
+}
+
+//バケットの代表値(範囲の中央)
+double bucket_value(const int idx){
+	if( idx < SUB_BUCKET_NUM ){
+		return idx;
+	}
+	const int msb = idx / SUB_BUCKET_NUM + SUB_BUCKET_BITS - 1;
+	const int sub = idx % SUB_BUCKET_NUM;
+	const double width = (double)(1ULL << (msb - SUB_BUCKET_BITS));
+	return (SUB_BUCKET_NUM + sub) * width + (width - 1) / 2;
+}
+
+//1つの区間の分布
+struct Window {
+	std::vector<uint64_t> buckets = std::vector<uint64_t>(BUCKET_NUM, 0);
+	uint64_t count = 0;
+	double sum = 0;
+	double min = 0;
+	double max = 0;
+
+	void add(const double v, const uint64_t scaled){
+		++buckets[bucket_index(scaled)];
+		min = count == 0 ? v : std::min(min, v);
+		++count;
+		sum += v;
+		max = std::max(max, v);
+	}
+
+	void merge(const Window &other){
+		if( other.count == 0 ){
+			return;
+		}
+		for( int i = 0 ; i < BUCKET_NUM ; ++i ){
+			buckets[i] += other.buckets[i];
+		}
+		min = count == 0 ? other.min : std::min(min, other.min);
+		count += other.count;
+		sum += other.sum;
+		max = std::max(max, other.max);
+	}
+
+	void reset(){
+		std::fill(buckets.begin(), buckets.end(), 0);
+		count = 0;
+		sum = 0;
+		min = 0;
+		max = 0;
+	}
+
+	double percentile(const double p, const StageMetrics::Unit unit)const{
+		if( count == 0 ){
+			return 0;
+		}
+		const uint64_t target = std::max<uint64_t>(1, (uint64_t)(count * p + 0.5));
+		uint64_t acc = 0;
+		for( int i = 0 ; i < BUCKET_NUM ; ++i ){
+			acc += buckets[i];
+			if( acc >= target ){
+				//代表値が実際の最小値～最大値を外れないようにする
+				return std::max(std::min(bucket_value(i) / unit_scale(unit), max), min);
+			}
+		}
+		return max;
+	}
+};
+
+/**
+ * 起動からの累積と、直近の分布(現在と1つ前の区間. rotate()で入れ替える).
+ */
+struct Histogram {
+	StageMetrics::Unit unit = StageMetrics::UNIT_MS;
+	Window total;
+	Window current;
+	Window previous;
+};
+
+std::mutex g_mutex; //g_histograms 対象
+std::map<std::string,Histogram> g_histograms;
+
+std::string prometheus_metric(const StageMetrics::Unit unit){
+	switch( unit ){
+	case StageMetrics::UNIT_MS:    return "rovi_stage_latency_ms";
+	case StageMetrics::UNIT_COUNT: return "rovi_stage_count";
+	case StageMetrics::UNIT_RATIO: return "rovi_stage_ratio";
+	}
+	return "rovi_stage";
+}
+
+}
+
+void StageMetrics::record(const std::string &name, const double value, const Unit unit){
+	const double v = std::max(value, 0.0);
+	const uint64_t scaled = (uint64_t)(v * unit_scale(unit) + 0.5);
+	std::lock_guard<std::mutex> locker(g_mutex);
+	Histogram &hist = g_histograms[name];
+	hist.unit = unit;
+	hist.total.add(v, scaled);
+	hist.current.add(v, scaled);
+}
+
+void StageMetrics::rotate(const std::string &prefix){
+	std::lock_guard<std::mutex> locker(g_mutex);
+	for( auto &entry : g_histograms ){
+		if( entry.first.compare(0, prefix.size(), prefix) != 0 ){
+			continue;
+		}
+		Histogram &hist = entry.second;
+		std::swap(hist.previous, hist.current);
+		hist.current.reset();
+	}
+}
+
+std::vector<StageMetrics::Summary> StageMetrics::summaries(const std::string &prefix, const bool recent){
+	std::vector<Summary> summaries;
+	std::lock_guard<std::mutex> locker(g_mutex);
+	Window window;
+	for( const auto &entry : g_histograms ){
+		if( entry.first.compare(0, prefix.size(), prefix) != 0 ){
+			continue;
+		}
+		const Histogram &hist = entry.second;
+		const Window *dist = &hist.total;
+		if( recent ){
+			window.reset();
+			window.merge(hist.previous);
+			window.merge(hist.current);
+			dist = &window;
+		}
+		Summary summary;
+		summary.name = entry.first;
+		summary.unit = hist.unit;
+		summary.count = hist.total.count;
+		summary.sum = hist.total.sum;
+		summary.recent_count = dist->count;
+		summary.p50 = dist->percentile(0.50, hist.unit);
+		summary.p95 = dist->percentile(0.95, hist.unit);
+		summary.p99 = dist->percentile(0.99, hist.unit);
+		summary.max = dist->max;
+		summaries.push_back(summary);
+	}
+	return summaries;
+}
+
+bool StageMetrics::write_prometheus(const std::string &path, const std::string &prefix){
+	//分位点は直近の分布、_sum/_countは起動からの累積
+	const std::vector<Summary> stats = summaries(prefix, true);
+	//単位毎にまとめて1つのsummaryメトリクスにする
+	std::map<std::string,std::vector<const Summary*>> metrics;
+	for( const Summary &summary : stats ){
+		metrics[prometheus_metric(summary.unit)].push_back(&summary);
+	}
+
+	const std::string tmp_path = path + ".tmp";
+	FILE *fp = fopen(tmp_path.c_str(), "w");
+	if( ! fp ){
+		return false;
+	}
+	for( const auto &metric : metrics ){
+		const char *name = metric.first.c_str();
+		fprintf(fp, "# TYPE %s summary\n", name);
+		for( const Summary *summary : metric.second ){
+			const char *stage = summary->name.c_str();
+			fprintf(fp, "%s{stage=\"%s\",quantile=\"0.5\"} %g\n", name, stage, summary->p50);
+			fprintf(fp, "%s{stage=\"%s\",quantile=\"0.95\"} %g\n", name, stage, summary->p95);
+			fprintf(fp, "%s{stage=\"%s\",quantile=\"0.99\"} %g\n", name, stage, summary->p99);
+			fprintf(fp, "%s{stage=\"%s\",quantile=\"1\"} %g\n", name, stage, summary->max);
+			fprintf(fp, "%s_sum{stage=\"%s\"} %g\n", name, stage, summary->sum);
+			fprintf(fp, "%s_count{stage=\"%s\"} %llu\n", name, stage, (unsigned long long)summary->count);
+		}
+	}
+	const bool written = ! ferror(fp);
+	if( fclose(fp) != 0 || ! written ){
+		remove(tmp_path.c_str());
+		return false;
+	}
+	return rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+void StageMetrics::clear(){
+	std::lock_guard<std::mutex> locker(g_mutex);
+	g_histograms.clear();
+}
+
+const char *StageMetrics::unit_name(const Unit unit){
+	switch( unit ){
+	case UNIT_MS:    return "ms";
+	case UNIT_COUNT: return "count";
+	case UNIT_RATIO: return "ratio";
+	}
+	return "unknown";
+}
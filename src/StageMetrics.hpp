@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * 処理段階毎の値の分布(処理時間、点数など).
+ * 各段階の値をHDR Histogram風の対数バケット(相対誤差 約6%)に積算し、p50/p95/p99/maxを求めます.
+ * ElapsedTimer::record()からも積算され、プロセス内で1つの登録簿を共有します.
+ * 段階名は "ycam3d/pattern_capture" のようにノード名を前に付け、summaries()/write_prometheus()で絞り込みます.
+ * 起動からの累積とは別に、現在と1つ前の区間の分布を持ちます. rotate()で区間を入れ替えると、
+ * 直近の分布(summaries(prefix,true))は入れ替え周期の1～2倍の期間の値になります.
+ */
+class StageMetrics {
+public:
+	enum Unit {
+		UNIT_MS,    //処理時間(ms)
+		UNIT_COUNT, //個数
+		UNIT_RATIO  //割合(0～1)
+	};
+
+	struct Summary {
+		std::string name;
+		Unit unit = UNIT_MS;
+		uint64_t count = 0;        //起動からの累積
+		double sum = 0;            //起動からの累積
+		uint64_t recent_count = 0; //p50～maxの元になった値の数
+		double p50 = 0;
+		double p95 = 0;
+		double p99 = 0;
+		double max = 0;
+	};
+
+	/**
+	 * 値を1つ積算します. 負値は0として扱います.
+	 */
+	static void record(const std::string &name, const double value, const Unit unit=UNIT_MS);
+
+	/**
+	 * 名前がprefixで始まる段階の現在の区間を1つ前の区間にし、新しい区間を始めます.
+	 */
+	static void rotate(const std::string &prefix=std::string());
+
+	/**
+	 * 名前がprefixで始まる段階の集計. 名前順.
+	 * @param recent trueならp50～maxを直近の分布(現在と1つ前の区間)から、falseなら起動からの累積から求める
+	 */
+	static std::vector<Summary> summaries(const std::string &prefix=std::string(), const bool recent=false);
+
+	/**
+	 * 名前がprefixで始まる段階をPrometheusのテキスト形式(node_exporterのtextfile collector用)で書き出します.
+	 * 分位点は直近の分布、_sum/_countは起動からの累積です.
+	 * 読み込み途中のファイルを見せないよう、一時ファイルに書いてから置き換えます.
+	 */
+	static bool write_prometheus(const std::string &path, const std::string &prefix=std::string());
+
+	static void clear();
+
+	static const char *unit_name(const Unit unit);
+};
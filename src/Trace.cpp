@@ -0,0 +1,219 @@
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace {
+
+struct Event {
+	const char *name;
+	int64_t begin_ns;
+	int64_t end_ns;
+	int64_t arg;
+	int tid;
+};
+
+//スレッド毎のリングバッファ. スレッドが終わっても記録は残し、後から作られたスレッドが使い回す
+struct Ring {
+	std::mutex mutex;
+	std::vector<Event> events;
+	size_t next = 0;
+	bool wrapped = false;
+	std::atomic<bool> in_use{false};
+};
+
+std::atomic<bool> g_enabled(true);
+std::atomic<size_t> g_capacity(Trace::RING_CAPACITY_DEFAULT);
+
+std::mutex g_rings_mutex; //g_rings, g_thread_names 対象
+std::vector<std::shared_ptr<Ring>> g_rings;
+std::map<int,std::string> g_thread_names;
+
+std::shared_ptr<Ring> acquire_ring(){
+	std::lock_guard<std::mutex> locker(g_rings_mutex);
+	for( const std::shared_ptr<Ring> &ring : g_rings ){
+		bool expected = false;
+		if( ring->in_use.compare_exchange_strong(expected, true) ){
+			return ring;
+		}
+	}
+	std::shared_ptr<Ring> ring = std::make_shared<Ring>();
+	ring->events.resize(std::max<size_t>(g_capacity.load(), 1));
+	ring->in_use.store(true);
+	g_rings.push_back(ring);
+	return ring;
+}
+
+struct RingHolder {
+	std::shared_ptr<Ring> ring;
+	~RingHolder(){
+		if( ring ){
+			ring->in_use.store(false);
+		}
+	}
+};
+
+Ring *local_ring(){
+	thread_local RingHolder holder;
+	if( ! holder.ring ){
+		holder.ring = acquire_ring();
+	}
+	return holder.ring.get();
+}
+
+int current_tid(){
+	thread_local const int tid = (int)syscall(SYS_gettid);
+	return tid;
+}
+
+int64_t to_ns(const Trace::Clock::time_point &tp){
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+}
+
+std::string json_escape(const std::string &src){
+	std::string dst;
+	for( const char c : src ){
+		if( c == '"' || c == '\\' ){
+			dst += '\\';
+			dst += c;
+		}else if( (unsigned char)c < 0x20 ){
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			dst += buf;
+		}else{
+			dst += c;
+		}
+	}
+	return dst;
+}
+
+}
+
+void Trace::set_enabled(const bool enabled){
+	g_enabled.store(enabled);
+}
+
+bool Trace::enabled(){
+	return g_enabled.load(std::memory_order_relaxed);
+}
+
+void Trace::set_capacity(const size_t capacity){
+	g_capacity.store(capacity);
+}
+
+void Trace::set_thread_name(const std::string &name){
+	std::lock_guard<std::mutex> locker(g_rings_mutex);
+	g_thread_names[current_tid()] = name;
+}
+
+void Trace::record(const char *name, const Clock::time_point &begin, const Clock::time_point &end, const int64_t arg){
+	if( ! enabled() ){
+		return;
+	}
+	Ring *ring = local_ring();
+	//他のスレッドと取り合うのはdump()の時だけ
+	std::lock_guard<std::mutex> locker(ring->mutex);
+	Event &ev = ring->events[ring->next];
+	ev.name = name;
+	ev.begin_ns = to_ns(begin);
+	ev.end_ns = to_ns(end);
+	ev.arg = arg;
+	ev.tid = current_tid();
+	if( ++ring->next == ring->events.size() ){
+		ring->next = 0;
+		ring->wrapped = true;
+	}
+}
+
+bool Trace::dump(const std::string &path, const std::string &process_name, int *event_num){
+	std::vector<std::shared_ptr<Ring>> rings;
+	std::map<int,std::string> thread_names;
+	{
+		std::lock_guard<std::mutex> locker(g_rings_mutex);
+		rings = g_rings;
+		thread_names = g_thread_names;
+	}
+
+	FILE *fp = fopen(path.c_str(), "w");
+	if( ! fp ){
+		return false;
+	}
+	const int pid = (int)getpid();
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"%s\"}}",
+		pid, json_escape(process_name).c_str());
+	for( const auto &thread_name : thread_names ){
+		fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			pid, thread_name.first, json_escape(thread_name.second).c_str());
+	}
+
+	int count = 0;
+	for( const std::shared_ptr<Ring> &ring : rings ){
+		std::vector<Event> events;
+		{
+			//書き出しの間は記録を止めないよう、コピーしてから出力する
+			std::lock_guard<std::mutex> locker(ring->mutex);
+			if( ring->wrapped ){
+				events.assign(ring->events.begin() + ring->next, ring->events.end());
+			}
+			events.insert(events.end(), ring->events.begin(), ring->events.begin() + ring->next);
+		}
+		for( const Event &ev : events ){
+			fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"rovi\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+				json_escape(ev.name).c_str(), pid, ev.tid, ev.begin_ns / 1000.0, (ev.end_ns - ev.begin_ns) / 1000.0);
+			if( ev.arg >= 0 ){
+				fprintf(fp, ",\"args\":{\"arg\":%lld}", (long long)ev.arg);
+			}
+			fprintf(fp, "}");
+			++count;
+		}
+	}
+	fprintf(fp, "\n]}\n");
+
+	const bool written = ! ferror(fp);
+	if( fclose(fp) != 0 || ! written ){
+		return false;
+	}
+	if( event_num ){
+		*event_num = count;
+	}
+	return true;
+}
+
+void Trace::clear(){
+	std::lock_guard<std::mutex> locker(g_rings_mutex);
+	for( const std::shared_ptr<Ring> &ring : g_rings ){
+		std::lock_guard<std::mutex> ring_locker(ring->mutex);
+		ring->next = 0;
+		ring->wrapped = false;
+	}
+}
+
+TraceSpan::TraceSpan(const char *name, const int64_t arg):
+	m_name(name),
+	m_arg(arg),
+	m_active(Trace::enabled())
+{
+	if( m_active ){
+		m_begin = Trace::Clock::now();
+	}
+}
+
+TraceSpan::~TraceSpan(){
+	end();
+}
+
+void TraceSpan::end(){
+	if( ! m_active ){
+		return;
+	}
+	m_active = false;
+	Trace::record(m_name, m_begin, Trace::Clock::now(), m_arg);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/**
+ * 処理区間の記録. Chrome trace形式(JSON)で書き出し、chrome://tracing や Perfetto(ui.perfetto.dev)で時間軸として見られます.
+ * 区間はスレッド毎のリングバッファに溜め(古いものから上書き)、記録時にスレッド間の待ちは発生しません.
+ * 時刻はsteady_clock(CLOCK_MONOTONIC)なので、同じマシンで動くycam3dとgenpcの出力を並べて読み込めばプロセスをまたいで比較できます.
+ */
+class Trace {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	//スレッド毎に保持する区間の数
+	static constexpr size_t RING_CAPACITY_DEFAULT = 4096;
+
+	static void set_enabled(const bool enabled);
+	static bool enabled();
+
+	/**
+	 * 以降に作るリングバッファの容量.
+	 */
+	static void set_capacity(const size_t capacity);
+
+	/**
+	 * 呼び出したスレッドの表示名を設定します.
+	 */
+	static void set_thread_name(const std::string &name);
+
+	/**
+	 * 区間を1つ記録します. nameは文字列リテラルなど、dump()まで無くならないものを渡すこと.
+	 * @param arg 区間の補足(撮影番号、カメラ番号など). 負値は出力しない
+	 */
+	static void record(const char *name, const Clock::time_point &begin, const Clock::time_point &end, const int64_t arg=-1);
+
+	/**
+	 * 全スレッドの区間をChrome trace形式で書き出します. バッファはクリアしません.
+	 * @param [in] process_name 表示するプロセス名
+	 * @param [out] event_num 書き出した区間の数
+	 */
+	static bool dump(const std::string &path, const std::string &process_name, int *event_num=nullptr);
+
+	static void clear();
+};
+
+/**
+ * スコープの処理区間を記録します.
+ */
+class TraceSpan {
+	const char *m_name;
+	int64_t m_arg;
+	Trace::Clock::time_point m_begin;
+	bool m_active;
+public:
+	explicit TraceSpan(const char *name, const int64_t arg=-1);
+	~TraceSpan();
+
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan &operator=(const TraceSpan&) = delete;
+
+	/**
+	 * スコープを抜ける前に区間を閉じます.
+	 */
+	void end();
+};
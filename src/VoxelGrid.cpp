@@ -0,0 +1,303 @@
+#include "VoxelGrid.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <ros/ros.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+	/**
+	 * オープンアドレス法(線形探索)のボクセルハッシュ. count==0のセルを空きとする.
+	 */
+	class VoxelMap {
+	public:
+		VoxelMap():m_mask(0),m_size(0){}
+
+		VoxelGrid::Accum &operator[](const VoxelGrid::Key &key){
+			if( ( m_size + 1 ) * 2 > m_cells.size() ){
+				grow();
+			}
+			size_t idx = VoxelGrid::KeyHash()(key) & m_mask;
+			while( m_cells[idx].accum.count ){
+				if( m_cells[idx].key == key ){
+					return m_cells[idx].accum;
+				}
+				idx = ( idx + 1 ) & m_mask;
+			}
+			m_cells[idx].key = key;
+			++m_size;
+			return m_cells[idx].accum;
+		}
+
+		size_t size()const{
+			return m_size;
+		}
+
+		template<typename F>
+		void for_each(F f)const{
+			for( const VoxelGrid::Cell &cell : m_cells ){
+				if( cell.accum.count ){
+					f(cell);
+				}
+			}
+		}
+
+	private:
+		std::vector<VoxelGrid::Cell> m_cells;
+		size_t m_mask;
+		size_t m_size;
+
+		void grow(){
+			std::vector<VoxelGrid::Cell> old;
+			old.swap(m_cells);
+			m_cells.resize(std::max<size_t>(4096, old.size() * 2));
+			m_mask = m_cells.size() - 1;
+			m_size = 0;
+			for( const VoxelGrid::Cell &cell : old ){
+				if( cell.accum.count ){
+					(*this)[cell.key] = cell.accum;
+				}
+			}
+		}
+	};
+
+	//非構造化点群/セル列の1チャンクあたりの要素数
+	const int CHUNK_POINTS = 16384;
+
+	struct InverseLeaf {
+		double x;
+		double y;
+		double z;
+
+		explicit InverseLeaf(const VoxelGrid::LeafSize &leaf):
+			x(1.0 / leaf.x), y(1.0 / leaf.y), z(1.0 / leaf.z){}
+	};
+
+	//座標からボクセル座標を求めます. NaN/Infや、int64に収まらない座標はfalse
+	inline bool to_key(const InverseLeaf &inv, const double x, const double y, const double z, VoxelGrid::Key &key){
+		const double kx = std::floor(x * inv.x);
+		const double ky = std::floor(y * inv.y);
+		const double kz = std::floor(z * inv.z);
+		const double limit = 9.2e18;
+		if( ! ( std::fabs(kx) < limit && std::fabs(ky) < limit && std::fabs(kz) < limit ) ){
+			return false;
+		}
+		key.x = (int64_t)kx;
+		key.y = (int64_t)ky;
+		key.z = (int64_t)kz;
+		return true;
+	}
+
+	inline void merge(VoxelGrid::Accum &dst, const VoxelGrid::Accum &src){
+		dst.x += src.x;
+		dst.y += src.y;
+		dst.z += src.z;
+		dst.intensity += src.intensity;
+		dst.count += src.count;
+	}
+
+	inline VoxelGrid::Accum point_accum(const float x, const float y, const float z, const unsigned char intensity){
+		VoxelGrid::Accum accum;
+		accum.x = x;
+		accum.y = y;
+		accum.z = z;
+		accum.intensity = intensity;
+		accum.count = 1;
+		return accum;
+	}
+
+	/**
+	 * for_each_chunk(chunk, add)で各チャンクの要素をadd(key, accum)に渡してもらい、
+	 * スレッド毎の部分ハッシュに集計してから統合し、ボクセル座標順に並べます.
+	 */
+	template<typename F>
+	void accumulate_chunks(const int chunk_num, F for_each_chunk, std::vector<VoxelGrid::Cell> &cells){
+
+#ifdef _OPENMP
+		const int thread_num = std::max(1, std::min(omp_get_max_threads(), chunk_num));
+#else
+		const int thread_num = 1;
+#endif
+		std::vector<VoxelMap> partials(thread_num);
+
+		#pragma omp parallel num_threads(thread_num)
+		{
+#ifdef _OPENMP
+			VoxelMap &voxels = partials[omp_get_thread_num()];
+#else
+			VoxelMap &voxels = partials[0];
+#endif
+			#pragma omp for schedule(dynamic)
+			for( int c = 0 ; c < chunk_num ; ++c ){
+				for_each_chunk(c, [&](const VoxelGrid::Key &key, const VoxelGrid::Accum &accum){
+					merge(voxels[key], accum);
+				});
+			}
+		}
+
+		//部分ハッシュの統合
+		VoxelMap &voxels = partials[0];
+		for( int t = 1 ; t < thread_num ; ++t ){
+			partials[t].for_each([&](const VoxelGrid::Cell &cell){
+				merge(voxels[cell.key], cell.accum);
+			});
+			partials[t] = VoxelMap();
+		}
+
+		cells.clear();
+		cells.reserve(voxels.size());
+		voxels.for_each([&](const VoxelGrid::Cell &cell){
+			cells.push_back(cell);
+		});
+		std::sort(cells.begin(), cells.end(),
+			[](const VoxelGrid::Cell &a, const VoxelGrid::Cell &b){ return a.key < b.key; });
+	}
+
+	void cells_to_point_cloud(const std::vector<VoxelGrid::Cell> &cells, sensor_msgs::PointCloud &output){
+		const int num = cells.size();
+		output.header.stamp     = ros::Time::now();
+		output.header.frame_id  = "camera";
+		output.points.resize(num);
+		output.channels.resize(1);
+		output.channels[0].name = "rgb";
+		output.channels[0].values.resize(num);
+
+		#pragma omp parallel for schedule(static)
+		for( int n = 0 ; n < num ; ++n ){
+			const VoxelGrid::Accum &accum = cells[n].accum;
+			output.points[n].x = accum.x / accum.count;
+			output.points[n].y = accum.y / accum.count;
+			output.points[n].z = accum.z / accum.count;
+
+			const uint32_t pixel = (uint32_t)( accum.intensity / accum.count );
+			const uint32_t rgb = ( pixel << 16 | pixel << 8 | pixel);
+			std::memcpy(&output.channels[0].values[n], &rgb, sizeof(float));
+		}
+	}
+
+	bool check_leaf(const VoxelGrid::LeafSize &leaf){
+		if( ! VoxelGrid::is_valid_leaf(leaf) ){
+			ROS_ERROR("VoxelGrid: invalid leaf size. leaf_size=(%g, %g, %g)", leaf.x, leaf.y, leaf.z);
+			return false;
+		}
+		return true;
+	}
+}
+
+bool VoxelGrid::is_valid_leaf(const LeafSize &leaf){
+	return leaf.x > 0 && leaf.y > 0 && leaf.z > 0;
+}
+
+bool VoxelGrid::accumulate(const YPCValidIndex &index, const unsigned char *gray, const LeafSize &leaf,
+	std::vector<Cell> &cells){
+
+	if( ! check_leaf(leaf) ){
+		return false;
+	}
+
+	const InverseLeaf inv(leaf);
+	//1行を1チャンクとし、有効点のビットだけを辿る
+	accumulate_chunks(index.height,
+		[&](const int j, const auto &add){
+			const YPCValidIndex::Point3d *row = index.row(j);
+			const unsigned char *gP = gray + (size_t)j * index.width;
+			Key key;
+			index.for_each_valid(j, [&](const int i){
+				const YPCValidIndex::Point3d &pt = row[i];
+				if( to_key(inv, pt.x, pt.y, pt.z, key) ){
+					add(key, point_accum(pt.x, pt.y, pt.z, gP[i]));
+				}
+			});
+		}, cells);
+	return true;
+}
+
+bool VoxelGrid::voxelize(const YPCValidIndex &index, const unsigned char *gray, const LeafSize &leaf,
+	sensor_msgs::PointCloud &output){
+
+	std::vector<Cell> cells;
+	if( ! accumulate(index, gray, leaf, cells) ){
+		return false;
+	}
+	cells_to_point_cloud(cells, output);
+	return true;
+}
+
+bool VoxelGrid::voxelize(const sensor_msgs::PointCloud &pts, const LeafSize &leaf,
+	sensor_msgs::PointCloud &output){
+
+	if( ! check_leaf(leaf) ){
+		return false;
+	}
+
+	const int num = pts.points.size();
+	const float *rgbs = nullptr;
+	for( const auto &ch : pts.channels ){
+		if( ch.name == "rgb" && ch.values.size() == pts.points.size() ){
+			rgbs = ch.values.data();
+			break;
+		}
+	}
+
+	const InverseLeaf inv(leaf);
+	std::vector<Cell> cells;
+	accumulate_chunks((num + CHUNK_POINTS - 1) / CHUNK_POINTS,
+		[&](const int c, const auto &add){
+			const int end = std::min(num, (c + 1) * CHUNK_POINTS);
+			Key key;
+			for( int n = c * CHUNK_POINTS ; n < end ; ++n ){
+				const geometry_msgs::Point32 &p = pts.points[n];
+				uint32_t rgb = 0;
+				if( rgbs ){
+					std::memcpy(&rgb, rgbs + n, sizeof(rgb));
+				}
+				if( to_key(inv, p.x, p.y, p.z, key) ){
+					add(key, point_accum(p.x, p.y, p.z, (unsigned char)(rgb & 0xff)));
+				}
+			}
+		}, cells);
+	cells_to_point_cloud(cells, output);
+	return true;
+}
+
+bool VoxelGrid::voxelize(const std::vector<Cell> &src, const LeafSize &leaf,
+	sensor_msgs::PointCloud &output){
+
+	if( ! check_leaf(leaf) ){
+		return false;
+	}
+
+	//セルは重心の位置で振り分け、累積値をそのまま足し込む
+	const int num = src.size();
+	const InverseLeaf inv(leaf);
+	std::vector<Cell> cells;
+	accumulate_chunks((num + CHUNK_POINTS - 1) / CHUNK_POINTS,
+		[&](const int c, const auto &add){
+			const int end = std::min(num, (c + 1) * CHUNK_POINTS);
+			Key key;
+			for( int n = c * CHUNK_POINTS ; n < end ; ++n ){
+				const Accum &accum = src[n].accum;
+				if( to_key(inv, accum.x / accum.count, accum.y / accum.count, accum.z / accum.count, key) ){
+					add(key, accum);
+				}
+			}
+		}, cells);
+	cells_to_point_cloud(cells, output);
+	return true;
+}
+
+void VoxelGrid::coarsen(const std::vector<Cell> &src, std::vector<Cell> &dst){
+	const int num = src.size();
+	accumulate_chunks((num + CHUNK_POINTS - 1) / CHUNK_POINTS,
+		[&](const int c, const auto &add){
+			const int end = std::min(num, (c + 1) * CHUNK_POINTS);
+			for( int n = c * CHUNK_POINTS ; n < end ; ++n ){
+				//算術シフトなので負の座標も切り捨てになる
+				const Key key = { src[n].key.x >> 1, src[n].key.y >> 1, src[n].key.z >> 1 };
+				add(key, src[n].accum);
+			}
+		}, dst);
+}
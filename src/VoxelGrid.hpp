@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <sensor_msgs/PointCloud.h>
+#include "YPCValidIndex.hpp"
+
+/**
+ * ハッシュによる疎なボクセルグリッドでのダウンサンプリング.
+ * スレッド毎に部分ハッシュを作ってから統合するので、点群の範囲/リーフサイズによる上限はありません.
+ * ボクセル内の点の位置と濃淡値を平均し、rgbチャンネル付きのsensor_msgs::PointCloudとして出力します.
+ * 出力順はボクセル座標の(z,y,x)順です.
+ */
+class VoxelGrid {
+public:
+	struct LeafSize {
+		float x;
+		float y;
+		float z;
+	};
+
+	//ボクセル座標
+	struct Key {
+		int64_t x;
+		int64_t y;
+		int64_t z;
+
+		bool operator==(const Key &obj)const{
+			return x == obj.x && y == obj.y && z == obj.z;
+		}
+		bool operator<(const Key &obj)const{
+			if( z != obj.z ) return z < obj.z;
+			if( y != obj.y ) return y < obj.y;
+			return x < obj.x;
+		}
+	};
+
+	struct KeyHash {
+		size_t operator()(const Key &key)const{
+			uint64_t h = (uint64_t)key.x * 0x9E3779B97F4A7C15ULL;
+			h ^= (uint64_t)key.y * 0xC2B2AE3D27D4EB4FULL + (h << 6) + (h >> 2);
+			h ^= (uint64_t)key.z * 0x165667B19E3779F9ULL + (h << 6) + (h >> 2);
+			h ^= h >> 33;
+			h *= 0xFF51AFD7ED558CCDULL;
+			h ^= h >> 33;
+			return h;
+		}
+	};
+
+	//ボクセル内の点の累積
+	struct Accum {
+		double x = 0;
+		double y = 0;
+		double z = 0;
+		uint64_t intensity = 0;
+		uint32_t count = 0;
+	};
+
+	struct Cell {
+		Key key;
+		Accum accum;
+	};
+
+	/**
+	 * 有効点インデックス(構造化点群)と濃淡画像からボクセル毎の累積値を求めます(ボクセル座標順).
+	 */
+	static bool accumulate(const YPCValidIndex &index, const unsigned char *gray, const LeafSize &leaf,
+		std::vector<Cell> &cells);
+
+	/**
+	 * 有効点インデックス(構造化点群)と濃淡画像からボクセル化します.
+	 */
+	static bool voxelize(const YPCValidIndex &index, const unsigned char *gray, const LeafSize &leaf,
+		sensor_msgs::PointCloud &output);
+
+	/**
+	 * rgbチャンネル付きの点群からボクセル化します(濃淡値はrgbの下位8bitを使う).
+	 */
+	static bool voxelize(const sensor_msgs::PointCloud &pts, const LeafSize &leaf,
+		sensor_msgs::PointCloud &output);
+
+	/**
+	 * 別のリーフサイズで集計済みのセルを、重心の位置で振り分けてボクセル化します.
+	 * 処理時間は点数ではなくセル数に比例します.
+	 */
+	static bool voxelize(const std::vector<Cell> &cells, const LeafSize &leaf,
+		sensor_msgs::PointCloud &output);
+
+	/**
+	 * 各軸2倍のリーフサイズのセルへまとめます.
+	 */
+	static void coarsen(const std::vector<Cell> &src, std::vector<Cell> &dst);
+
+	static bool is_valid_leaf(const LeafSize &leaf);
+};
@@ -0,0 +1,71 @@
+#include "VoxelPyramid.hpp"
+
+#include <algorithm>
+
+bool VoxelPyramid::build(const YPCValidIndex &index, const unsigned char *gray, const float base_leaf){
+	clear();
+
+	VoxelGrid::LeafSize leaf;
+	leaf.x = leaf.y = leaf.z = base_leaf;
+
+	m_levels.emplace_back();
+	if( ! VoxelGrid::accumulate(index, gray, leaf, m_levels.back()) ){
+		clear();
+		return false;
+	}
+	m_leafs.push_back(base_leaf);
+
+	while( (int)m_levels.size() < MAX_LEVELS && (int)m_levels.back().size() >= MIN_LEVEL_CELLS ){
+		std::vector<VoxelGrid::Cell> coarse;
+		VoxelGrid::coarsen(m_levels.back(), coarse);
+		if( coarse.size() == m_levels.back().size() ){
+			break;
+		}
+		m_levels.push_back(std::move(coarse));
+		m_leafs.push_back(m_leafs.back() * 2);
+	}
+	return true;
+}
+
+void VoxelPyramid::clear(){
+	m_leafs.clear();
+	m_levels.clear();
+}
+
+bool VoxelPyramid::empty()const{
+	return m_levels.empty();
+}
+
+int VoxelPyramid::select_level(const VoxelGrid::LeafSize &leaf)const{
+	const float min_leaf = std::min(leaf.x, std::min(leaf.y, leaf.z));
+	//条件を満たす一番粗い階層
+	for( int level = m_leafs.size() - 1 ; level >= 0 ; --level ){
+		if( m_leafs[level] * LEVEL_RATIO <= min_leaf ){
+			return level;
+		}
+	}
+	return -1;
+}
+
+bool VoxelPyramid::voxelize(const VoxelGrid::LeafSize &leaf, sensor_msgs::PointCloud &output, int *used_level)const{
+	const int level = select_level(leaf);
+	if( used_level ){
+		*used_level = level;
+	}
+	if( level < 0 ){
+		return false;
+	}
+	return VoxelGrid::voxelize(m_levels[level], leaf, output);
+}
+
+int VoxelPyramid::level_count()const{
+	return m_levels.size();
+}
+
+float VoxelPyramid::level_leaf(const int level)const{
+	return m_leafs[level];
+}
+
+int VoxelPyramid::level_cells(const int level)const{
+	return m_levels[level].size();
+}
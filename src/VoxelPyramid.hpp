@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+#include <sensor_msgs/PointCloud.h>
+#include "VoxelGrid.hpp"
+
+/**
+ * 再ボクセル化用のボクセルピラミッド.
+ * スキャン毎に、最小リーフサイズ(base_leaf)のセルと、各軸2倍ずつ粗くしたセルの階層を作っておき、
+ * 任意のリーフサイズのボクセル化を、点群ではなくいずれかの階層のセルから求めます.
+ * セルは重心の位置で振り分けるので、使う階層のリーフサイズは要求リーフサイズの1/LEVEL_RATIO以下に限ります.
+ */
+class VoxelPyramid {
+public:
+	//使う階層のリーフサイズに対する、要求リーフサイズの最小倍率
+	static const int LEVEL_RATIO = 4;
+	//これよりセル数が少なくなったら階層を作るのをやめる
+	static const int MIN_LEVEL_CELLS = 256;
+	static const int MAX_LEVELS = 16;
+
+	/**
+	 * 有効点インデックス(構造化点群)と濃淡画像から作成します.
+	 */
+	bool build(const YPCValidIndex &index, const unsigned char *gray, const float base_leaf);
+
+	void clear();
+
+	bool empty()const;
+
+	/**
+	 * 要求リーフサイズに使える階層(無ければ-1)を返します.
+	 */
+	int select_level(const VoxelGrid::LeafSize &leaf)const;
+
+	/**
+	 * 階層のセルからボクセル化します. 使える階層が無い場合はfalse.
+	 * @param used_level 使用した階層
+	 */
+	bool voxelize(const VoxelGrid::LeafSize &leaf, sensor_msgs::PointCloud &output, int *used_level=nullptr)const;
+
+	int level_count()const;
+	float level_leaf(const int level)const;
+	int level_cells(const int level)const;
+
+private:
+	std::vector<float> m_leafs;
+	std::vector<std::vector<VoxelGrid::Cell>> m_levels;
+};
@@ -0,0 +1,462 @@
+#include "YCAM3DEmulator.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+namespace {
+	//既定のレジスタ値. version(REG_FW_VERSIONの下位2byte)は非同期撮影(VER_ACAP)以降にする
+	const uint32_t EMU_YCAM_VERSION   = 0x00000001;
+	const uint32_t EMU_IP_ADDRESS     = 0x7F000001; //127.0.0.1
+	const uint32_t EMU_FW_VERSION     = 0x01000200; //MicroBlaze[1.0] FPGA[2.0]
+	const uint32_t EMU_EXPOSURE_TIME  = 8300;
+	const uint32_t EMU_HEART_BEAT_TIMEOUT = 3000;
+	const int EMU_FRAME_RATE_DEFAULT  = 60;
+	const std::string EMU_SERIAL_NO   = "EMULATOR";
+
+	//撮影画像の右カメラのずれ(px)
+	const int EMU_DISPARITY = 32;
+
+	/**
+	 * 既定の撮影画像. 黒(0枚目), 白(1枚目), 以降は枚数毎に周期が半分になる縞模様.
+	 */
+	void default_frame(const int width,const int height,const YCAM_PROJ_PTN ptn,const int frmidx,const int intensity,std::vector<uint8_t> *img){
+		const int half = width / 2;
+		const uint8_t level = (uint8_t)std::min(std::max(intensity,0),255);
+		if( ptn != YCAM_PROJ_PTN_PHSFT && ptn != YCAM_PROJ_PTN_PHSFT_3 ){
+			std::fill(img->begin(), img->end(), level);
+			return;
+		}else if( frmidx == 0 ){
+			std::fill(img->begin(), img->end(), 0);
+			return;
+		}else if( frmidx == 1 ){
+			std::fill(img->begin(), img->end(), level);
+			return;
+		}
+		const int period = std::max(2, half >> std::min(frmidx - 1, 30));
+		std::vector<uint8_t> row(width);
+		for( int x = 0 ; x < half ; ++x ){
+			row[x] = ((x / period) & 1) ? level : 0;
+			row[half + x] = (((x + EMU_DISPARITY) / period) & 1) ? level : 0;
+		}
+		for( int y = 0 ; y < height ; ++y ){
+			std::copy(row.begin(), row.end(), img->begin() + (size_t)y * width);
+		}
+	}
+}
+
+YCAM3DEmulator::YCAM3DEmulator(const YCAM_RES res):
+	YCAM3DEmulator(res,Settings())
+{
+}
+
+YCAM3DEmulator::YCAM3DEmulator(const YCAM_RES res,const Settings &settings):
+	m_width(res == YCAM_RES_VGA ? 1280 : 2560),
+	m_height(res == YCAM_RES_VGA ? 480 : 1024),
+	m_settings(settings),
+	m_random(settings.seed),
+	m_connected(false),
+	m_connect_failures_left(0),
+	m_proj_ptn(YCAM_PROJ_PTN_PHSFT),
+	m_proj_intensity(0),
+	m_proj_exposure_time(0),
+	m_proj_flash_interval(0),
+	m_proj_running(true),
+	m_proj_invalid(0),
+	m_streaming(false),
+	m_stream_stop(false),
+	m_pending_frames(0),
+	m_total_frames(0)
+{
+	m_registers[REG_YCAM_VERSION] = EMU_YCAM_VERSION;
+	m_registers[REG_IP_ADDRESS] = EMU_IP_ADDRESS;
+	m_registers[REG_PWM_FRAME_RATE] = EMU_FRAME_RATE_DEFAULT;
+	m_registers[REG_EXPOSURE_TIME] = EMU_EXPOSURE_TIME;
+	m_registers[REG_ANALOG_GAIN] = 0;
+	m_registers[REG_DIGITAL_GAIN] = 0;
+	m_registers[REG_EXTERNAL_TRIGGER] = 0;
+	m_registers[REG_STREAM_NUM] = 0;
+	m_registers[REG_TRANSFER_MODE] = 0;
+	m_registers[REG_CLOCK_DELAY] = 0;
+	m_registers[REG_FW_VERSION] = EMU_FW_VERSION;
+	m_registers[REG_HEAT_BEAT_TIMEOUT] = EMU_HEART_BEAT_TIMEOUT;
+
+	m_nodes["Width"] = m_width;
+	m_nodes["Height"] = m_height;
+	m_nodes["AcquisitionFrameRate"] = EMU_FRAME_RATE_DEFAULT;
+
+	m_frame_source = [this](const YCAM_PROJ_PTN ptn,const int frmidx,const int frame_num,const int intensity,std::vector<uint8_t> *img){
+		default_frame(m_width,m_height,ptn,frmidx,intensity,img);
+	};
+}
+
+YCAM3DEmulator::~YCAM3DEmulator(){
+	stop_stream();
+}
+
+void YCAM3DEmulator::set_settings(const Settings &settings){
+	std::lock_guard<std::mutex> locker(m_mutex);
+	m_settings = settings;
+	m_random.seed(settings.seed);
+}
+
+YCAM3DEmulator::Settings YCAM3DEmulator::get_settings()const{
+	std::lock_guard<std::mutex> locker(m_mutex);
+	return m_settings;
+}
+
+void YCAM3DEmulator::set_frame_source(const FrameSource &source){
+	std::lock_guard<std::mutex> locker(m_mutex);
+	m_frame_source = source;
+}
+
+YCAM3DEmulator::Stats YCAM3DEmulator::get_stats()const{
+	std::lock_guard<std::mutex> locker(m_mutex);
+	return m_stats;
+}
+
+bool YCAM3DEmulator::connect(){
+	std::lock_guard<std::mutex> locker(m_mutex);
+	if( m_connect_failures_left > 0 ){
+		--m_connect_failures_left;
+		++m_stats.connect_failures;
+		return false;
+	}
+	m_connected = true;
+	m_total_frames = 0;
+	m_uart_line.clear();
+	m_uart_reply.clear();
+	++m_stats.connects;
+	return true;
+}
+
+void YCAM3DEmulator::disconnect(){
+	stop_stream();
+	std::lock_guard<std::mutex> locker(m_mutex);
+	m_connected = false;
+}
+
+bool YCAM3DEmulator::is_connected()const{
+	std::lock_guard<std::mutex> locker(m_mutex);
+	return m_connected;
+}
+
+void YCAM3DEmulator::lose_control(){
+	LostCallback on_lost;
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		if( ! m_connected ){
+			return;
+		}
+		m_connected = false;
+		m_connect_failures_left = m_settings.connect_failures;
+		++m_stats.disconnects;
+		if( m_streaming ){
+			on_lost = m_on_lost;
+		}
+		m_stream_stop = true;
+	}
+	m_cond.notify_all();
+	if( on_lost ){
+		on_lost();
+	}
+}
+
+bool YCAM3DEmulator::random_hit(const double rate){
+	if( rate <= 0 ){
+		return false;
+	}
+	return std::uniform_real_distribution<double>(0,1)(m_random) < rate;
+}
+
+void YCAM3DEmulator::wait_register_access(){
+	int latency_us = 0;
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		latency_us = m_settings.reg_latency_us;
+	}
+	if( latency_us > 0 ){
+		std::this_thread::sleep_for(std::chrono::microseconds(latency_us));
+	}
+}
+
+bool YCAM3DEmulator::read_register(const uint64_t reg,uint32_t *value){
+	wait_register_access();
+	std::lock_guard<std::mutex> locker(m_mutex);
+	++m_stats.reg_reads;
+	if( ! m_connected || random_hit(m_settings.reg_failure_rate) ){
+		++m_stats.reg_failures;
+		return false;
+	}
+
+	if( reg == REG_UART ){
+		UART_DATA_FIELD u;
+		if( ! m_uart_reply.empty() && m_uart_reply.front().first <= std::chrono::steady_clock::now() ){
+			u.b.data = m_uart_reply.front().second;
+			u.b.data_lrc = ~u.b.data;
+			m_uart_reply.pop_front();
+		}
+		*value = u.dwData;
+		return true;
+	}
+	std::map<uint64_t,uint32_t>::const_iterator ite = m_registers.find(reg);
+	if( ite == m_registers.end() ){
+		++m_stats.reg_failures;
+		return false;
+	}
+	*value = ite->second;
+	return true;
+}
+
+bool YCAM3DEmulator::write_register(const uint64_t reg,const uint32_t value){
+	wait_register_access();
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		++m_stats.reg_writes;
+		if( ! m_connected || random_hit(m_settings.reg_failure_rate) ){
+			++m_stats.reg_failures;
+			return false;
+		}
+
+		if( reg == REG_UART ){
+			uart_receive(value);
+			return true;
+		}else if( m_registers.find(reg) == m_registers.end() ){
+			++m_stats.reg_failures;
+			return false;
+		}
+		m_registers[reg] = value;
+		if( reg != REG_STREAM_NUM || value == 0 ){
+			return true;
+		}
+		//撮影枚数を書くと撮影が始まる
+		++m_stats.triggers;
+		m_pending_frames = value;
+	}
+	m_cond.notify_all();
+	return true;
+}
+
+bool YCAM3DEmulator::get_node_int(const std::string &feature,int64_t *value)const{
+	std::lock_guard<std::mutex> locker(m_mutex);
+	std::map<std::string,int64_t>::const_iterator ite = m_nodes.find(feature);
+	if( ! m_connected || ite == m_nodes.end() ){
+		return false;
+	}
+	*value = ite->second;
+	return true;
+}
+
+bool YCAM3DEmulator::set_node_int(const std::string &feature,const int64_t value){
+	std::lock_guard<std::mutex> locker(m_mutex);
+	std::map<std::string,int64_t>::iterator ite = m_nodes.find(feature);
+	if( ! m_connected || ite == m_nodes.end() ){
+		return false;
+	}else if( (feature == "Width" && value != m_width) || (feature == "Height" && value != m_height) ){
+		return false;
+	}else if( feature == "AcquisitionFrameRate" && value <= 0 ){
+		return false;
+	}
+	ite->second = value;
+	return true;
+}
+
+bool YCAM3DEmulator::get_description(const std::string &feature,std::string *description)const{
+	std::lock_guard<std::mutex> locker(m_mutex);
+	if( ! m_connected || feature != "YCam_Serial_No" ){
+		return false;
+	}
+	*description = EMU_SERIAL_NO;
+	return true;
+}
+
+YCAM_PROJ_PTN YCAM3DEmulator::projector_pattern()const{
+	std::lock_guard<std::mutex> locker(m_mutex);
+	return m_proj_ptn;
+}
+
+int YCAM3DEmulator::projector_intensity()const{
+	std::lock_guard<std::mutex> locker(m_mutex);
+	return m_proj_intensity;
+}
+
+void YCAM3DEmulator::uart_receive(const uint32_t data){
+	UART_DATA_FIELD u;
+	u.dwData = data;
+	//Aravis::uart_write()と同じく、下位16bitの反転が付いていること
+	if( u.b.data_lrc != (uint8_t)~u.b.data ){
+		++m_stats.uart_lrc_errors;
+		return;
+	}
+	const char c = (char)u.b.data;
+	if( c != '\r' && c != '\n' ){
+		m_uart_line.push_back(c);
+		return;
+	}
+	if( ! m_uart_line.empty() ){
+		uart_command(m_uart_line);
+		m_uart_line.clear();
+	}
+}
+
+void YCAM3DEmulator::uart_reply(const std::string &reply){
+	const std::chrono::steady_clock::time_point ready = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_settings.uart_reply_latency_ms);
+	for( const char c : reply + "\r\n" ){
+		m_uart_reply.push_back(std::make_pair(ready, c));
+	}
+}
+
+/**
+ * プロジェクタのコマンド. 1文字目がコマンド、残りが値.
+ *   a<n> 点灯(1)/消灯(0), i<RRGGBB> 明るさ, x<n> 露光時間, p<n> 発光間隔, z<n> パターン,
+ *   q<n> 停止(0)/開始(2), v 設定の検証(0:OK), g 温度, d 診断メッセージ
+ */
+void YCAM3DEmulator::uart_command(const std::string &line){
+	++m_stats.uart_commands;
+	const char cmd = line[0];
+	const std::string arg = line.substr(1);
+	char buf[256];
+	switch( cmd ){
+	case 'a':
+	case 'x':
+	case 'p':
+	case 'i':
+		if( cmd == 'x' ){
+			m_proj_exposure_time = atoi(arg.c_str());
+		}else if( cmd == 'p' ){
+			m_proj_flash_interval = atoi(arg.c_str());
+		}else if( cmd == 'i' ){
+			m_proj_intensity = (int)strtol(arg.substr(0,2).c_str(), nullptr, 16);
+		}
+		uart_reply(std::string(1,cmd) + ":OK");
+		break;
+	case 'z':{
+		const int ptn = atoi(arg.c_str());
+		if( ptn < 0 || nYCAM_PROJ_PTN <= ptn ){
+			m_proj_invalid |= 0x02;
+		}else if( m_proj_running ){
+			//パターンは停止中にしか変えられない
+			m_proj_invalid |= 0x01;
+		}else{
+			m_proj_ptn = (YCAM_PROJ_PTN)ptn;
+		}
+		uart_reply("z:OK");
+		break;
+	}
+	case 'q':
+		m_proj_running = atoi(arg.c_str()) != 0;
+		break;
+	case 'v':
+		uart_reply(std::to_string(m_proj_invalid));
+		m_proj_invalid = 0;
+		break;
+	case 'g':
+		uart_reply(std::to_string(m_settings.temperature));
+		break;
+	case 'd':
+		snprintf(buf, sizeof(buf), "//cmd:diag\r\ndiag.exposure time:%d\r\nCycle:%d\r\ncmd:d=1:OK\r\nDlp.X>",
+			m_proj_exposure_time, m_proj_flash_interval);
+		uart_reply(buf);
+		break;
+	default:
+		uart_reply("?");
+		break;
+	}
+}
+
+bool YCAM3DEmulator::start_stream(const FrameCallback &on_frame,const LostCallback &on_lost){
+	stop_stream();
+	std::lock_guard<std::mutex> locker(m_mutex);
+	if( ! m_connected ){
+		return false;
+	}
+	m_on_frame = on_frame;
+	m_on_lost = on_lost;
+	m_stream_stop = false;
+	m_pending_frames = 0;
+	m_streaming = true;
+	m_stream_thread = std::thread(&YCAM3DEmulator::stream_loop, this);
+	return true;
+}
+
+void YCAM3DEmulator::stop_stream(){
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		m_stream_stop = true;
+	}
+	m_cond.notify_all();
+	if( ! m_stream_thread.joinable() ){
+		return;
+	}else if( m_stream_thread.get_id() == std::this_thread::get_id() ){
+		//切断の通知から呼ばれた時
+		m_stream_thread.detach();
+	}else{
+		m_stream_thread.join();
+	}
+}
+
+void YCAM3DEmulator::stream_loop(){
+	std::vector<uint8_t> img((size_t)m_width * m_height, 0);
+	std::unique_lock<std::mutex> locker(m_mutex);
+	while( ! m_stream_stop ){
+		m_cond.wait(locker, [this](){ return m_stream_stop || m_pending_frames > 0; });
+		if( m_stream_stop ){
+			break;
+		}
+		const int frame_num = m_pending_frames;
+		m_pending_frames = 0;
+		const int frame_rate = (int)std::max<int64_t>(m_nodes["AcquisitionFrameRate"], 1);
+		const std::chrono::microseconds interval(1000000 / frame_rate);
+		std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_settings.trigger_latency_ms);
+
+		bool lost = false;
+		for( int frmidx = 0 ; frmidx < frame_num ; ++frmidx ){
+			if( m_cond.wait_until(locker, next, [this](){ return m_stream_stop; }) ){
+				break;
+			}
+			next += interval;
+			if( m_pending_frames > 0 ){
+				//撮影中に次の撮影が始まった
+				break;
+			}else if( random_hit(m_settings.frame_loss_rate) ){
+				++m_stats.frames_lost;
+				continue;
+			}
+			const bool complete = ! random_hit(m_settings.frame_error_rate);
+			if( ! complete ){
+				++m_stats.frames_error;
+			}
+			++m_stats.frames_sent;
+			++m_total_frames;
+			const FrameSource frame_source = m_frame_source;
+			const FrameCallback on_frame = m_on_frame;
+			const YCAM_PROJ_PTN ptn = m_proj_ptn;
+			const int intensity = m_proj_running ? m_proj_intensity : 0;
+			locker.unlock();
+			//画像を作る間もレジスタにはアクセスできるようにする
+			frame_source(ptn, frmidx, frame_num, intensity, &img);
+			if( on_frame ){
+				on_frame(complete, img.data(), img.size());
+			}
+			locker.lock();
+
+			if( m_settings.disconnect_after_frames >= 0 && (int64_t)m_total_frames >= m_settings.disconnect_after_frames ){
+				m_connected = false;
+				m_connect_failures_left = m_settings.connect_failures;
+				++m_stats.disconnects;
+				lost = true;
+				break;
+			}
+		}
+		if( lost ){
+			const LostCallback on_lost = m_on_lost;
+			m_streaming = false;
+			locker.unlock();
+			if( on_lost ){
+				on_lost();
+			}
+			return;
+		}
+	}
+	m_streaming = false;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "YCAM3D.h"
+
+/**
+ * YCAM3D(GigE)の疑似デバイス. Aravisに設定すると、カメラの代わりにレジスタ/UART/画像ストリームに応答します.
+ * レジスタマップ(YCAM3D.h), プロジェクタのUARTコマンド(1byte毎にREG_UARTへ書く), 温度取得,
+ * REG_STREAM_NUMへの書き込みで始まる複数枚の撮影を模擬します.
+ * 遅延, 画像の欠落, レジスタアクセスの失敗, 切断/再接続の失敗をSettingsで指定できます.
+ */
+class YCAM3DEmulator {
+public:
+	struct Settings {
+		int reg_latency_us = 0;          //レジスタ読み書き1回の時間
+		int uart_reply_latency_ms = 0;   //UARTコマンドを受けてから応答が読めるまでの時間
+		int trigger_latency_ms = 0;      //撮影開始から1枚目の画像までの時間(以降はフレームレートの間隔)
+		double frame_loss_rate = 0;      //画像が届かない割合
+		double frame_error_rate = 0;     //パケットが欠けた画像(バッファエラー)になる割合
+		double reg_failure_rate = 0;     //レジスタアクセスがタイムアウトする割合
+		int disconnect_after_frames = -1; //接続毎にこの枚数を送ったら切断する. 負の時は切断しない
+		int connect_failures = 0;        //切断後、接続に失敗する回数
+		int temperature = 40;            //温度取得(UART "g")の応答
+		unsigned int seed = 0;
+	};
+
+	struct Stats {
+		uint64_t reg_reads = 0;
+		uint64_t reg_writes = 0;
+		uint64_t reg_failures = 0;
+		uint64_t uart_commands = 0;
+		uint64_t uart_lrc_errors = 0;
+		uint64_t triggers = 0;
+		uint64_t frames_sent = 0;
+		uint64_t frames_lost = 0;
+		uint64_t frames_error = 0;
+		uint64_t connects = 0;
+		uint64_t connect_failures = 0;
+		uint64_t disconnects = 0;
+	};
+
+	/**
+	 * 画像1枚を受け取ります(ストリームのスレッド).
+	 * @param complete falseの時はパケットが欠けた画像
+	 * @param data 左右を連結した画像
+	 */
+	typedef std::function<void(const bool complete,const uint8_t *data,const size_t size)> FrameCallback;
+	typedef std::function<void(void)> LostCallback;
+
+	/**
+	 * 撮影画像を作ります. 既定は投影パターン毎に濃度を変えた縞模様.
+	 * @param ptn 投影パターン
+	 * @param frmidx 撮影中の何枚目か
+	 * @param frame_num 撮影枚数
+	 * @param intensity プロジェクタの明るさ. 消灯中は0
+	 * @param img 左右を連結した画像(width x height, mono8)
+	 */
+	typedef std::function<void(const YCAM_PROJ_PTN ptn,const int frmidx,const int frame_num,const int intensity,std::vector<uint8_t> *img)> FrameSource;
+
+	explicit YCAM3DEmulator(const YCAM_RES res);
+	YCAM3DEmulator(const YCAM_RES res,const Settings &settings);
+	~YCAM3DEmulator();
+
+	void set_settings(const Settings &settings);
+	Settings get_settings()const;
+
+	void set_frame_source(const FrameSource &source);
+
+	Stats get_stats()const;
+
+	//左右を連結した画像の幅と高さ
+	int width()const { return m_width; }
+	int height()const { return m_height; }
+
+	bool connect();
+	void disconnect();
+	bool is_connected()const;
+
+	/**
+	 * 切断を起こします. 画像ストリームが動いていれば、LostCallbackを呼びます.
+	 */
+	void lose_control();
+
+	bool read_register(const uint64_t reg,uint32_t *value);
+	bool write_register(const uint64_t reg,const uint32_t value);
+
+	//GenICamのノード
+	bool get_node_int(const std::string &feature,int64_t *value)const;
+	bool set_node_int(const std::string &feature,const int64_t value);
+	bool get_description(const std::string &feature,std::string *description)const;
+
+	/**
+	 * 画像ストリームを始めます. 撮影(REG_STREAM_NUM)毎に画像をon_frameで渡します.
+	 */
+	bool start_stream(const FrameCallback &on_frame,const LostCallback &on_lost);
+	void stop_stream();
+
+	//UARTで受けた最後の設定
+	YCAM_PROJ_PTN projector_pattern()const;
+	int projector_intensity()const;
+
+private:
+	const int m_width;
+	const int m_height;
+
+	mutable std::mutex m_mutex; //以下全て 対象
+	std::condition_variable m_cond;
+	Settings m_settings;
+	Stats m_stats;
+	std::mt19937 m_random;
+	FrameSource m_frame_source;
+
+	bool m_connected;
+	int m_connect_failures_left;
+	std::map<uint64_t,uint32_t> m_registers;
+	std::map<std::string,int64_t> m_nodes;
+
+	//プロジェクタ
+	std::string m_uart_line;
+	std::deque<std::pair<std::chrono::steady_clock::time_point,char>> m_uart_reply;
+	YCAM_PROJ_PTN m_proj_ptn;
+	int m_proj_intensity;
+	int m_proj_exposure_time;
+	int m_proj_flash_interval;
+	bool m_proj_running;
+	int m_proj_invalid;
+
+	//画像ストリーム
+	std::thread m_stream_thread;
+	bool m_streaming;
+	bool m_stream_stop;
+	int m_pending_frames;
+	uint64_t m_total_frames;
+	FrameCallback m_on_frame;
+	LostCallback m_on_lost;
+
+	bool random_hit(const double rate);
+	void wait_register_access();
+	void uart_receive(const uint32_t data);
+	void uart_command(const std::string &line);
+	void uart_reply(const std::string &reply);
+	void stream_loop();
+};
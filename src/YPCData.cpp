@@ -1,20 +1,185 @@
 #include "YPCData.hpp"
 
 #include <numeric>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
 #include <ros/types.h>
 #include <ros/ros.h>
 #include <sensor_msgs/point_cloud_conversion.h>
 #include <sensor_msgs/image_encodings.h>
 
 #include "YPCGenerator.hpp"
+#include "YPCKernels.hpp"
+#include "PlyWriter.hpp"
 
 namespace {
-	const int DEPTH_BASE=400;
-	const int DEPTH_UNIT=1;
+	static_assert(sizeof(geometry_msgs::Point32) == sizeof(float) * 3, "geometry_msgs::Point32 must be packed x,y,z floats.");
+	
 	int isLittleEndian(void){
 	    unsigned i = 1;
 	    return *((char *)&i);
 	}
+	void add_point_field(sensor_msgs::PointCloud2 &pts,const std::string &name,const int offset,const int datatype){
+		sensor_msgs::PointField field;
+		field.name = name;
+		field.offset = offset;
+		field.datatype = datatype;
+		field.count = 1;
+		pts.fields.push_back(field);
+	}
+	
+	//レイアウトに従ってPointCloud2ヘッダ/フィールドを設定し、データ領域を確保します
+	bool init_point_cloud2(sensor_msgs::PointCloud2 &pts,const int width,const int height,const int n_valid,const bool dense,
+		const YPCData::PC2Layout layout){
+		pts = sensor_msgs::PointCloud2();
+		pts.header.stamp = ros::Time::now();
+		pts.header.frame_id = "camera";
+		
+		const float field_data_size= 4;
+		
+		if( sizeof(float) != field_data_size ){
+			ROS_ERROR("sensor_msgs::PointCloud2 point field data size is different.");
+			return false;
+		}
+		
+		if( layout == YPCData::PC2_XYZ32F_I8 ){
+			add_point_field(pts, "x", 0, sensor_msgs::PointField::FLOAT32);
+			add_point_field(pts, "y", 4, sensor_msgs::PointField::FLOAT32);
+			add_point_field(pts, "z", 8, sensor_msgs::PointField::FLOAT32);
+			add_point_field(pts, "intensity", 12, sensor_msgs::PointField::UINT8);
+			pts.point_step = 13;
+		}else if( layout == YPCData::PC2_XYZ16_I8 ){
+			add_point_field(pts, "x", 0, sensor_msgs::PointField::INT16);
+			add_point_field(pts, "y", 2, sensor_msgs::PointField::INT16);
+			add_point_field(pts, "z", 4, sensor_msgs::PointField::INT16);
+			add_point_field(pts, "intensity", 6, sensor_msgs::PointField::UINT8);
+			pts.point_step = 7;
+		}else{
+			add_point_field(pts, "x", 0, sensor_msgs::PointField::FLOAT32);
+			add_point_field(pts, "y", field_data_size, sensor_msgs::PointField::FLOAT32);
+			add_point_field(pts, "z", field_data_size * 2, sensor_msgs::PointField::FLOAT32);
+			add_point_field(pts, "rgb", field_data_size * 3, sensor_msgs::PointField::FLOAT32);
+			pts.point_step = field_data_size * pts.fields.size();
+		}
+		
+		int point_count = 0;
+		if( ! dense ){
+			point_count = std::max(0, width * height);
+			pts.width = width;
+			pts.height = height;
+			pts.row_step = width * pts.point_step;
+		}else{
+			point_count = n_valid;
+			pts.width = point_count;
+			pts.height = 1;
+			pts.row_step = point_count * pts.point_step;
+		}
+		
+		pts.is_dense = dense;
+		pts.is_bigendian = isLittleEndian()?false:true;
+		
+		pts.data.assign( point_count * pts.point_step,{});
+		
+		return true;
+	}
+	
+	//PC2_XYZ32F_I8の1点
+	struct PC2WriterXYZ32F_I8 {
+		static const int STEP = 13;
+		
+		static void put(unsigned char *dst,const float x,const float y,const float z,const unsigned char intensity,
+			const YPCData::PC2Quantization &){
+			const float pos[3] = {x, y, z};
+			std::memcpy(dst, pos, sizeof(pos));
+			dst[12] = intensity;
+		}
+	};
+	
+	//PC2_XYZ16_I8の1点
+	struct PC2WriterXYZ16_I8 {
+		static const int STEP = 7;
+		
+		static int16_t quantize(const float v,const float origin,const float scale){
+			float q = (v - origin) / scale;
+			q = q < -32767.0f ? -32767.0f : ( q > 32767.0f ? 32767.0f : q );
+			return (int16_t)std::lrint(q);
+		}
+		
+		static void put(unsigned char *dst,const float x,const float y,const float z,const unsigned char intensity,
+			const YPCData::PC2Quantization &quant){
+			int16_t pos[3] = {INT16_MIN, INT16_MIN, INT16_MIN};
+			if( ! std::isnan(x) ){
+				pos[0] = quantize(x, quant.origin[0], quant.scale);
+				pos[1] = quantize(y, quant.origin[1], quant.scale);
+				pos[2] = quantize(z, quant.origin[2], quant.scale);
+			}
+			std::memcpy(dst, pos, sizeof(pos));
+			dst[6] = intensity;
+		}
+	};
+	
+	//j行目をレイアウトWで書き込みます. denseの場合はdstが行の書き込み開始位置で、max_out点まで書く
+	template<typename W>
+	void write_pc2_row(const YPCValidIndex &index,const unsigned char *irow,const int j,const bool dense,
+		unsigned char *dst,const int max_out,const YPCData::PC2Quantization &quant){
+		const PointCloudCallback::Point3d *row = index.row(j);
+		
+		if( ! dense ){
+			for( int i = 0 ; i < index.width ; ++i ){
+				W::put(dst + i * W::STEP, row[i].x, row[i].y, row[i].z, irow[i], quant);
+			}
+		}else{
+			int n = 0;
+			index.for_each_valid(j, [&](const int i){
+				if( n < max_out ){
+					W::put(dst + n * W::STEP, row[i].x, row[i].y, row[i].z, irow[i], quant);
+					++n;
+				}
+			});
+		}
+	}
+	
+	//有効点の範囲の中心を原点とし、範囲がint16に収まるスケールを求めます
+	YPCData::PC2Quantization make_pc2_quantization(const YPCValidIndex &index){
+		YPCData::PC2Quantization quant;
+		if( index.total_valid() <= 0 ){
+			return quant;
+		}
+		
+		std::vector<float> row_min(index.height * 3, std::numeric_limits<float>::max());
+		std::vector<float> row_max(index.height * 3, std::numeric_limits<float>::lowest());
+		#pragma omp parallel for schedule(static)
+		for( int j = 0 ; j < index.height ; ++j ){
+			const PointCloudCallback::Point3d *row = index.row(j);
+			float *mn = row_min.data() + j * 3;
+			float *mx = row_max.data() + j * 3;
+			index.for_each_valid(j, [&](const int i){
+				const float xyz[3] = { row[i].x, row[i].y, row[i].z };
+				for( int k = 0 ; k < 3 ; ++k ){
+					mn[k] = std::min(mn[k], xyz[k]);
+					mx[k] = std::max(mx[k], xyz[k]);
+				}
+			});
+		}
+		
+		float mn[3] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+		float mx[3] = { std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
+		for( int j = 0 ; j < index.height ; ++j ){
+			for( int k = 0 ; k < 3 ; ++k ){
+				mn[k] = std::min(mn[k], row_min[j * 3 + k]);
+				mx[k] = std::max(mx[k], row_max[j * 3 + k]);
+			}
+		}
+		
+		float half_range = 0;
+		for( int k = 0 ; k < 3 ; ++k ){
+			quant.origin[k] = ( mn[k] + mx[k] ) * 0.5f;
+			half_range = std::max(half_range, ( mx[k] - mn[k] ) * 0.5f);
+		}
+		quant.scale = half_range > 0 ? half_range / 32767.0f : 1.0f;
+		return quant;
+	}
 	/*
 #pragma pack(1)
 	struct VertexXYZRGB{
@@ -29,18 +194,142 @@ namespace {
 	} __attribute__((__packed__)) __attribute__((aligned(1)));
 #pragma pack()
 	*/
+	
+	/**
+	 * 1行分のdepthmapを書き込みます. 分岐の無いループにしてベクトル化させる.
+	 * valid=falseの行は全て無効値で埋める.
+	 */
+	void make_depth_row(const YPCData::DepthParams &params, const PointCloudCallback::Point3d *row, const int width,
+		const bool valid, unsigned char *dst){
+		
+		const float unit = params.unit;
+		const float base = params.base;
+		if( params.encoding == YPCData::DepthParams::METER32 ){
+			float *dP = reinterpret_cast<float*>(dst);
+			if( ! valid ){
+				std::fill(dP, dP + width, std::numeric_limits<float>::quiet_NaN());
+				return;
+			}
+			const float scale = unit * 0.001f;
+			#pragma omp simd
+			for( int i = 0 ; i < width ; ++i ){
+				dP[i] = row[i].x != row[i].x ? std::numeric_limits<float>::quiet_NaN() : row[i].z * scale;
+			}
+		}else if( params.encoding == YPCData::DepthParams::MM16 ){
+			unsigned short *dP = reinterpret_cast<unsigned short*>(dst);
+			if( ! valid ){
+				std::fill(dP, dP + width, 0);
+				return;
+			}
+			#pragma omp simd
+			for( int i = 0 ; i < width ; ++i ){
+				const float v = unit * row[i].z + 0.5f;
+				const bool ok = row[i].x == row[i].x && v >= 1.0f && v < 65536.0f;
+				dP[i] = ok ? (unsigned short)v : 0;
+			}
+		}else{
+			unsigned short *dP = reinterpret_cast<unsigned short*>(dst);
+			if( ! valid ){
+				std::fill(dP, dP + width, std::numeric_limits<unsigned short>::max());
+				return;
+			}
+			#pragma omp simd
+			for( int i = 0 ; i < width ; ++i ){
+				const float v = (unit * row[i].z - base) * 256 + 0.5f;
+				const unsigned short d = v < 1.0f ? 0 : (v < 65536.0f ? (unsigned short)v : std::numeric_limits<unsigned short>::max());
+				dP[i] = row[i].x != row[i].x ? std::numeric_limits<unsigned short>::max() : d;
+			}
+		}
+	}
 }
 
-YPCData::YPCData():
-	image(nullptr),
+std::vector<PointCloudCallback::Point3d> YPCDataPool::acquire_points(const size_t size){
+	std::vector<PointCloudCallback::Point3d> buf;
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		if( ! m_points_bufs.empty() ){
+			buf.swap(m_points_bufs.back());
+			m_points_bufs.pop_back();
+		}
+	}
+	
+	if( buf.size() != size ){
+		buf.assign(size,PointCloudCallback::Point3d());
+	}
+	return buf;
+}
+
+void YPCDataPool::release_points(std::vector<PointCloudCallback::Point3d> &&buf){
+	if( buf.empty() ){
+		return;
+	}
+	
+	//再利用時に点群生成器が無効点を書き込まない可能性があるため、返却時(スキャン処理後)に無効点で埋めておく
+	std::fill(buf.begin(),buf.end(),PointCloudCallback::Point3d());
+	
+	std::lock_guard<std::mutex> locker(m_mutex);
+	m_points_bufs.push_back(std::move(buf));
+}
+
+std::vector<unsigned char> YPCDataPool::acquire_image(const size_t size){
+	std::vector<unsigned char> buf;
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		if( ! m_image_bufs.empty() ){
+			buf.swap(m_image_bufs.back());
+			m_image_bufs.pop_back();
+		}
+	}
+	buf.resize(size);
+	return buf;
+}
+
+void YPCDataPool::release_image(std::vector<unsigned char> &&buf){
+	if( buf.empty() ){
+		return;
+	}
+	
+	std::lock_guard<std::mutex> locker(m_mutex);
+	m_image_bufs.push_back(std::move(buf));
+}
+
+YPCData::YPCData(YPCDataPool *pool):
+	pool(pool),
+	step(0),
 	width(0),
 	height(0),
 	n_valid(0)
 {
 }
 
+YPCData::YPCData(YPCData &&obj):
+	pool(obj.pool),
+	image(std::move(obj.image)),
+	step(obj.step),
+	width(obj.width),
+	height(obj.height),
+	points(std::move(obj.points)),
+	n_valid(obj.n_valid),
+	valid_index(std::move(obj.valid_index))
+{
+	obj.step = 0;
+	obj.width = 0;
+	obj.height = 0;
+	obj.n_valid = 0;
+}
+
 YPCData::~YPCData(){
-	
+	release();
+}
+
+void YPCData::release(){
+	if( pool ){
+		pool->release_points(std::move(this->points));
+		pool->release_image(std::move(this->image));
+	}
+	this->points.clear();
+	this->image.clear();
+	this->valid_index.clear();
 }
 
 bool YPCData::is_empty()const{
@@ -51,6 +340,25 @@ int YPCData::count()const{
 	return n_valid;
 }
 
+const YPCValidIndex &YPCData::get_valid_index()const{
+	return valid_index;
+}
+
+bool YPCData::voxelize(const VoxelGrid::LeafSize &leaf,sensor_msgs::PointCloud &output)const{
+	if( this->valid_index.empty() || this->image.size() < this->valid_index.size() ){
+		return false;
+	}
+	return VoxelGrid::voxelize(this->valid_index,this->image.data(),leaf,output);
+}
+
+bool YPCData::build_voxel_pyramid(const float base_leaf,VoxelPyramid &pyramid)const{
+	if( this->valid_index.empty() || this->image.size() < this->valid_index.size() ){
+		pyramid.clear();
+		return false;
+	}
+	return pyramid.build(this->valid_index,this->image.data(),base_leaf);
+}
+
 void YPCData::operator()(
 	unsigned char *image, const size_t step,
 	const int width, const int height, 
@@ -59,12 +367,49 @@ void YPCData::operator()(
 	//ROS_WARN("pcgen callback. step=%d, width=%d, height=%d, points_size=%d, n_valid=%d",
 	//	(int)step,width,height,(int)points.size(),n_valid);
 		
-	this->image=image;
-	this->step=step;
+	//点群生成器の出力バッファはswapで受け取り、同じサイズのプール済みバッファを生成器側へ返す
+	std::vector<Point3d> recycled;
+	if( pool ){
+		recycled = pool->acquire_points(points.size());
+	}else{
+		recycled.assign(points.size(),Point3d());
+	}
+	recycled.swap(points);
+	
+	if( pool ){
+		pool->release_points(std::move(this->points));
+	}
+	this->points.swap(recycled);
+	
+	//テクスチャは生成器の内部バッファなので、自前のバッファへ詰めてコピーする
+	const size_t len = std::max(0, width) * (size_t)std::max(0, height);
+	if( pool ){
+		if( this->image.size() != len ){
+			pool->release_image(std::move(this->image));
+			this->image = pool->acquire_image(len);
+		}
+	}else{
+		this->image.resize(len);
+	}
+	if( step == (size_t)width ){
+		std::memcpy(this->image.data(),image,len);
+	}else{
+		for( int j = 0 ; j < height ; ++j ){
+			std::memcpy(this->image.data() + j * width, image + j * step, width);
+		}
+	}
+	
+	this->step=width;
 	this->width=width;
 	this->height=height;
-	this->points=points;
 	this->n_valid=n_valid;
+	
+	//有効点ビットマップを作成しておき、以降の変換は有効点のある行/語だけを見る(座標はpointsを参照)
+	if( this->points.size() >= len ){
+		this->valid_index.build(this->points.data(),width,height);
+	}else{
+		this->valid_index.clear();
+	}
 }
 
 
@@ -79,180 +424,72 @@ sensor_msgs::Image YPCData::texture_image()const{
 	img.step             = width;
 	const int len=width*height;
 	img.data.assign(len,0);
-	std::memcpy(img.data.data(),image,len);
+	std::memcpy(img.data.data(),image.data(),len);
 	return img;
 }
 	
-bool YPCData::make_point_cloud(sensor_msgs::PointCloud &pts,const bool dense){
-	
-	int point_count = this->n_valid;
-	if( ! dense ){
-		point_count = std::max(0, width * height);
-	}
-	
-	pts.header.stamp     = ros::Time::now();
-	pts.header.frame_id  = "camera";
-	pts.points.resize(point_count);
-
-	pts.channels.resize(1);
-	pts.channels[0].name = "rgb";
-	pts.channels[0].values.resize(point_count);
-	
-	if( point_count <= 0 ){
-		return true;
-	}
-	
-	float *pChRGB=pts.channels[0].values.data();
-	uint32_t rgb=0;
-	
-	const Point3d *org_points = this->points.data();
-	if( dense ){
-		for (int i = 0,n = 0 ; i < this->points.size(); i++) {
-			const Point3d * org_point = org_points + i;
-			const unsigned char * pixel = this->image + i ;
-			
-			if( n  < point_count  && ! std::isnan(org_point->x) ){
-				pts.points[n].x = org_point->x;
-				pts.points[n].y = org_point->y;
-				pts.points[n].z = org_point->z;
+bool YPCData::make_point_cloud(sensor_msgs::PointCloud &pts,const bool dense)const{
+	Outputs outputs;
+	outputs.point_cloud = &pts;
+	outputs.point_cloud_dense = dense;
+	return make_outputs(outputs);
+}
 
-				rgb = ( *pixel << 16 | *pixel << 8 | *pixel);
-				//pts.channels[0].values[n] =*reinterpret_cast<float*>(&rgb);
-				*(pChRGB + n) = *reinterpret_cast<float*>(&rgb);
-				n++;
-			}
-		}
+bool YPCData::parse_pc2_layout(const std::string &name,PC2Layout *layout){
+	if( name == "xyzrgb32f" ){
+		*layout = PC2_XYZRGB32F;
+	}else if( name == "xyz32f_i8" ){
+		*layout = PC2_XYZ32F_I8;
+	}else if( name == "xyz16_i8" ){
+		*layout = PC2_XYZ16_I8;
 	}else{
-		for (int i = 0; i < this->points.size(); i++) {
-			const Point3d * org_point = org_points + i;
-			const unsigned char * pixel = this->image + i ;
-			
-			pts.points[i].x = org_point->x;
-			pts.points[i].y = org_point->y;
-			pts.points[i].z = org_point->z;
-
-			rgb = ( *pixel << 16 | *pixel << 8 | *pixel);
-			//pts.channels[0].values[n] =*reinterpret_cast<float*>(&rgb);
-			*(pChRGB + i) = *reinterpret_cast<float*>(&rgb);
-		}
+		return false;
 	}
-	
 	return true;
 }
 
-bool YPCData::make_point_cloud2(sensor_msgs::PointCloud2 &pts,const bool dense){
+bool YPCData::make_point_cloud2(sensor_msgs::PointCloud2 &pts,const bool dense,
+	const PC2Layout layout,PC2Quantization *quant)const{
+	Outputs outputs;
+	outputs.point_cloud2 = &pts;
+	outputs.point_cloud2_dense = dense;
+	outputs.point_cloud2_layout = layout;
+	outputs.point_cloud2_quant = quant;
+	return make_outputs(outputs);
+}
 
-	
-	pts = sensor_msgs::PointCloud2();
-	pts.header.stamp = ros::Time::now();
-	pts.header.frame_id = "camera";
-	
-	const float field_data_size= 4;
-	const int field_num= 4;
-	
-	if( sizeof(float) != field_data_size ){
-		ROS_ERROR("sensor_msgs::PointCloud2 point field data size is different.");
-		return false;
-	}
-	
-	
-	pts.fields.resize(field_num);
-	pts.fields[0].name = "x";
-	pts.fields[0].offset = 0;
-	pts.fields[0].datatype = sensor_msgs::PointField::FLOAT32;
-	pts.fields[0].count = 1;
-	pts.fields[1].name = "y";
-	pts.fields[1].offset = field_data_size;
-	pts.fields[1].datatype =  sensor_msgs::PointField::FLOAT32;
-	pts.fields[1].count = 1;
-	pts.fields[2].name = "z";
-	pts.fields[2].offset = field_data_size * 2;
-	pts.fields[2].datatype =  sensor_msgs::PointField::FLOAT32;
-	pts.fields[2].count = 1;
-	pts.fields[3].name = "rgb";
-	pts.fields[3].offset = field_data_size * 3;
-	pts.fields[3].datatype =  sensor_msgs::PointField::FLOAT32;
-	pts.fields[3].count = 1;
-	
-	pts.point_step = field_data_size * field_num ;
-		
-	int point_count = 0;
-	if( ! dense ){
-		point_count = std::max(0, width * height);
-		pts.width = width;
-		pts.height = height;
-		pts.row_step = width * pts.point_step;
+bool YPCData::DepthParams::set_encoding(const std::string &name){
+	if( name == "mono16" ){
+		encoding = MONO16_OFFSET;
+	}else if( name == sensor_msgs::image_encodings::TYPE_16UC1 ){
+		encoding = MM16;
+	}else if( name == sensor_msgs::image_encodings::TYPE_32FC1 ){
+		encoding = METER32;
 	}else{
-		point_count = this->n_valid;
-		pts.width = point_count;
-		pts.height = 1;
-		pts.row_step = point_count * pts.point_step;
-	}
-	
-	pts.is_dense = dense;
-	pts.is_bigendian = isLittleEndian()?false:true;
-	
-	pts.data.assign( point_count * pts.point_step,{});
-		
-	const Point3d * pPoints = this->points.data();
-	const Point3d * pPoint = nullptr;
-	unsigned char pixel = 0;
-	float *vertices=(float*)pts.data.data();
-	int32_t rgb=0;
-	if( dense ){
-		for ( int i = 0,n = 0 ; i < this->points.size(); i++ ) {
-			pPoint = pPoints + i;
-			pixel = *(this->image + i);
-			
-			if( n  < point_count  && ! std::isnan(pPoint->x) ){
-				float * vtx = vertices + n * field_num;
-				*(vtx) = pPoint->x;
-				*(vtx+1) = pPoint->y;
-				*(vtx+2) = pPoint->z;
-				
-				rgb = (pixel << 16) | (pixel << 8) | pixel; 
-				*(vtx+3) = *reinterpret_cast<float*>(&rgb);
-				n++;
-			}
-		}
-	}else{
-		for ( int i = 0 ; i < this->points.size(); i++ ) {
-			pPoint = pPoints + i;
-			pixel = *(this->image + i);
-			
-			float * vtx = vertices + i * field_num;
-			*(vtx) = pPoint->x;
-			*(vtx+1) = pPoint->y;
-			*(vtx+2) = pPoint->z;
-			
-			rgb = (pixel << 16) | (pixel << 8) | pixel; 
-			*(vtx+3) = *reinterpret_cast<float*>(&rgb);
-		}
+		return false;
 	}
-	
-	//std::cerr << "fileds=" <<  p2.fields.size() << std::endl;
 	return true;
 }
 
-bool YPCData::make_depth_image(cv::Mat &img){
-	//fprintf(stderr,"width=%d height=%d\n",this->height,this->width);
-
-	const long base=DEPTH_BASE*256;
-	img=cv::Mat(this->height,this->width,CV_16UC1,cv::Scalar(std::numeric_limits<unsigned short>::max()));
-	
-	if(this->n_valid <= 0 ){
-		return true;
+std::string YPCData::DepthParams::encoding_name()const{
+	switch( encoding ){
+	case MM16:
+		return sensor_msgs::image_encodings::TYPE_16UC1;
+	case METER32:
+		return sensor_msgs::image_encodings::TYPE_32FC1;
+	default:
+		return sensor_msgs::image_encodings::MONO16;
 	}
+}
+
+bool YPCData::make_depth_image(sensor_msgs::Image &img,const DepthParams &params)const{
+	//fprintf(stderr,"width=%d height=%d\n",this->height,this->width);
 	
-	int n = 0;
-	for (int j = 0; j < this->height; j++) {
-		unsigned short *dP = img.ptr<unsigned short>(j);
-		for (int i = 0; i < this->width; i++, n++) {
-			if (std::isnan(this->points[n].x)) continue;
-			long d = std::round((DEPTH_UNIT * this->points[n].z - DEPTH_BASE)*256);
-			if(d<0) dP[i] = 0;
-			else if(d<65536L) dP[i]=d;
-		}
+	Outputs outputs;
+	outputs.depth_image = &img;
+	outputs.depth_params = params;
+	if( ! make_outputs(outputs) ){
+		return false;
 	}
 #if 0
 
@@ -290,69 +527,17 @@ bool YPCData::save_ply(const std::string &file_path,const bool dense)const{
 	//saver(this->image, this->step, this->width, this->height, this->points, this->n_valid);
 	//return saver.is_ok();
 	
-	std::ofstream ofs(file_path, std::ios::binary);
-	if ( ! ofs.is_open() ) {
+	if( this->points.size() < (size_t)std::max(0, width) * std::max(0, height) ){
 		return false;
 	}
 	
-	ofs << "ply\n";
-	ofs << "format binary_little_endian 1.0\n";
-	//ofs << "comment VCGLIB generated\n";
-	ofs << "obj_info num_cols " << width << std::endl;
-	ofs << "obj_info num_rows " << height << std::endl;
-	ofs << "element vertex " << ( dense ? n_valid : points.size()) << std::endl;
-	ofs << "property float x\n";
-	ofs << "property float y\n";
-	ofs << "property float z\n";
-	ofs << "property uchar red\n";
-	ofs << "property uchar green\n";
-	ofs << "property uchar blue\n";
-	ofs << "element face 0\n";
-	ofs << "end_header\n";
-
-	unsigned char *pimage=image;
-	
 	int count=0;
-	if(dense){
-		for (int j = 0, n = 0; j < height; j++) {
-			unsigned char *iP = pimage;
-			for (int i = 0; i < width; i++, n++) {
-				float pos[3] = {0, 0, 0};
-				unsigned char col[3] = {iP[i], iP[i], iP[i]};
-					
-				if ( ! std::isnan(points[n].x) ) {
-					pos[0] = points[n].x;
-					pos[1] = points[n].y;
-					pos[2] = points[n].z;
-					
-					ofs.write((char *)pos, sizeof(float) * 3);
-					ofs.write((char *)col, 3);
-					count++;
-				}
-			}
-			pimage += step;
-		}
-	}else{
-		for (int j = 0, n = 0; j < height; j++) {
-			unsigned char *iP = pimage;
-			for (int i = 0; i < width; i++, n++) {
-				float pos[3] = {0, 0, 0};
-				unsigned char col[3] = {iP[i], iP[i], iP[i]};
-					
-				pos[0] = points[n].x;
-				pos[1] = points[n].y;
-				pos[2] = points[n].z;
-				
-				ofs.write((char *)pos, sizeof(float) * 3);
-				ofs.write((char *)col, 3);
-				count++;
-			}
-			pimage += step;
-		}
+	const int *row_valid = this->valid_index.empty() ? nullptr : this->valid_index.row_valid.data();
+	if( ! PlyWriter::write(file_path, this->points.data(), this->image.data(), this->step,
+			this->width, this->height, ( dense ? n_valid : points.size()), dense, &count, row_valid) ){
+		return false;
 	}
 	
-
-	ofs.close();
 	bool ret=false;
 	if(dense){
 		ret = count == n_valid;
@@ -366,21 +551,172 @@ rovi::Floats YPCData::to_rg_floats()const{
 	rovi::Floats pt_floats;
 	
 	if( ! this->points.empty() ){
-		const int num = this->points.size();
-		pt_floats.data.assign( num * 3 , 0);
-		const Point3d *pts = this->points.data();
-		for( int i = 0,n = 0 ; i < num ; ++i){
-			const Point3d *pt = pts + i;
-			if( std::isnan(pt->x) ){
-				n+=3;
+		Outputs outputs;
+		outputs.rg_floats = &pt_floats;
+		make_outputs(outputs);
+	}
+	
+	return pt_floats;
+}
+
+bool YPCData::make_outputs(const Outputs &outputs)const{
+	const int total = std::max(0, width) * std::max(0, height);
+	if( this->points.size() < (size_t)total || this->image.size() < (size_t)total
+		|| ( total > 0 && ( this->valid_index.width != width || this->valid_index.height != height ) ) ){
+		ROS_ERROR("YPCData::make_outputs point data size is different. points=%d image=%d total=%d",
+			(int)this->points.size(),(int)this->image.size(),total);
+		return false;
+	}
+	
+	const bool pc_dense = outputs.point_cloud && outputs.point_cloud_dense;
+	const bool pc2_dense = outputs.point_cloud2 && outputs.point_cloud2_dense;
+	const Point3d *pPoints = this->points.data();
+	const unsigned char *pImage = this->image.data();
+	const YPCValidIndex &index = this->valid_index;
+	const int dense_count = std::max(0, this->n_valid);
+	
+	geometry_msgs::Point32 *pc_points = nullptr;
+	float *pc_rgb = nullptr;
+	if( outputs.point_cloud ){
+		sensor_msgs::PointCloud &pts = *outputs.point_cloud;
+		const int point_count = pc_dense ? dense_count : total;
+		pts.header.stamp     = ros::Time::now();
+		pts.header.frame_id  = "camera";
+		pts.points.resize(point_count);
+		pts.channels.resize(1);
+		pts.channels[0].name = "rgb";
+		pts.channels[0].values.resize(point_count);
+		if( point_count > 0 ){
+			pc_points = pts.points.data();
+			pc_rgb = pts.channels[0].values.data();
+		}
+	}
+	
+	//PC2_XYZRGB32Fはpc2_vertices、それ以外のレイアウトはpc2_dataへ書き込む
+	float *pc2_vertices = nullptr;
+	int pc2_field_num = 0;
+	unsigned char *pc2_data = nullptr;
+	const PC2Layout pc2_layout = outputs.point_cloud2_layout;
+	PC2Quantization pc2_quant;
+	if( outputs.point_cloud2 ){
+		if( ! init_point_cloud2(*outputs.point_cloud2,width,height,dense_count,pc2_dense,pc2_layout) ){
+			return false;
+		}
+		if( outputs.point_cloud2->data.empty() ){
+			//no points
+		}else if( pc2_layout == PC2_XYZRGB32F ){
+			pc2_vertices = (float*)outputs.point_cloud2->data.data();
+			pc2_field_num = outputs.point_cloud2->fields.size();
+		}else{
+			pc2_data = outputs.point_cloud2->data.data();
+		}
+		if( pc2_layout == PC2_XYZ16_I8 ){
+			pc2_quant = make_pc2_quantization(index);
+		}
+		if( outputs.point_cloud2_quant ){
+			*outputs.point_cloud2_quant = pc2_quant;
+		}
+	}
+	
+	if( outputs.depth_image ){
+		sensor_msgs::Image &img = *outputs.depth_image;
+		const int pixel_size = outputs.depth_params.encoding == DepthParams::METER32 ? sizeof(float) : sizeof(unsigned short);
+		img.header.stamp     = ros::Time::now();
+		img.header.frame_id  = "camera";
+		img.height           = height;
+		img.width            = width;
+		img.encoding         = outputs.depth_params.encoding_name();
+		img.is_bigendian     = isLittleEndian()?false:true;
+		img.step             = width * pixel_size;
+		img.data.resize(img.step * height);
+	}
+	
+	float *rg = nullptr;
+	if( outputs.rg_floats ){
+		outputs.rg_floats->data.assign( this->points.empty() ? 0 : total * 3 , 0);
+		if( total > 0 && ! this->points.empty() ){
+			rg = outputs.rg_floats->data.data();
+		}
+	}
+	
+	sensor_msgs::Image *depth = outputs.depth_image;
+	const bool organized = ( pc_points && ! pc_dense ) || ( pc2_vertices && ! pc2_dense );
+	
+	#pragma omp parallel for schedule(static)
+	for( int j = 0 ; j < height ; ++j ){
+		const Point3d *row = pPoints + j * width;
+		const unsigned char *irow = pImage + j * width;
+		
+		//非dense出力は無効点も含めて全点を書く
+		if( organized ){
+			for( int i = 0 ; i < width ; ++i ){
+				const Point3d &pt = row[i];
+				const int idx = j * width + i;
+				const unsigned char pixel = irow[i];
+				const uint32_t rgb_u = ( pixel << 16 | pixel << 8 | pixel);
+				float rgb;
+				std::memcpy(&rgb,&rgb_u,sizeof(rgb));
+				
+				if( pc_points && ! pc_dense ){
+					pc_points[idx].x = pt.x;
+					pc_points[idx].y = pt.y;
+					pc_points[idx].z = pt.z;
+					pc_rgb[idx] = rgb;
+				}
+				if( pc2_vertices && ! pc2_dense ){
+					float *vtx = pc2_vertices + idx * pc2_field_num;
+					vtx[0] = pt.x;
+					vtx[1] = pt.y;
+					vtx[2] = pt.z;
+					vtx[3] = rgb;
+				}
+			}
+		}
+		
+		//depthmapは無効点も含めて行全体を書く
+		if( depth ){
+			make_depth_row(outputs.depth_params, row, width,
+				this->n_valid > 0 && index.row_valid[j] > 0, depth->data.data() + j * depth->step);
+		}
+		
+		if( pc2_data && ( ! pc2_dense || index.row_offsets[j] < dense_count ) ){
+			const int row_start = pc2_dense ? index.row_offsets[j] : j * width;
+			const int max_out = dense_count - index.row_offsets[j];
+			if( pc2_layout == PC2_XYZ16_I8 ){
+				write_pc2_row<PC2WriterXYZ16_I8>(index, irow, j, pc2_dense,
+					pc2_data + (size_t)row_start * PC2WriterXYZ16_I8::STEP, max_out, pc2_quant);
 			}else{
-				pt_floats.data[  n] = pt->x;
-				pt_floats.data[++n] = pt->y;
-				pt_floats.data[++n] = pt->z;
-				++n;
+				write_pc2_row<PC2WriterXYZ32F_I8>(index, irow, j, pc2_dense,
+					pc2_data + (size_t)row_start * PC2WriterXYZ32F_I8::STEP, max_out, pc2_quant);
 			}
 		}
+		
+		//以降は有効点だけが対象なので、有効点の無い行には触れない
+		if( index.row_valid[j] <= 0 ){
+			continue;
+		}
+		
+		//dense出力は行単位でベクトル化した前詰めカーネルに任せる
+		const int n = index.row_offsets[j];
+		if( pc_points && pc_dense && n < dense_count ){
+			YPCKernels::compact_points(row, irow, width,
+				&pc_points[n].x, 3, pc_rgb + n, 1, dense_count - n);
+		}
+		if( pc2_vertices && pc2_dense && n < dense_count ){
+			float *vtx = pc2_vertices + n * pc2_field_num;
+			YPCKernels::compact_points(row, irow, width,
+				vtx, pc2_field_num, vtx + 3, pc2_field_num, dense_count - n);
+		}
+		
+		if( rg ){
+			float *rgP = rg + j * width * 3;
+			index.for_each_valid(j, [&](const int i){
+				rgP[i * 3] = row[i].x;
+				rgP[i * 3 + 1] = row[i].y;
+				rgP[i * 3 + 2] = row[i].z;
+			});
+		}
 	}
 	
-	return pt_floats;
+	return true;
 }
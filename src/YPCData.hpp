@@ -1,25 +1,56 @@
 #pragma once
 
 #include <vector>
+#include <mutex>
 #include <sensor_msgs/PointCloud.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <sensor_msgs/Image.h>
 #include <opencv2/opencv.hpp>
 #include "rovi/Floats.h"
 #include "iPointCloudGenerator.hpp"
+#include "YPCValidIndex.hpp"
+#include "VoxelGrid.hpp"
+#include "VoxelPyramid.hpp"
+
+/**
+ * YPCDataの点群/テクスチャバッファを使い回すためのプール.
+ * 点群バッファは点群生成器の出力バッファとswapで受け渡すため、スキャン毎のコピーが発生しない.
+ */
+class YPCDataPool {
+private:
+	std::mutex m_mutex;
+	std::vector<std::vector<PointCloudCallback::Point3d>> m_points_bufs;
+	std::vector<std::vector<unsigned char>> m_image_bufs;
+
+public:
+	//点群生成器に返すバッファなので、無効点(NaN)で埋めた状態で渡す
+	std::vector<PointCloudCallback::Point3d> acquire_points(const size_t size);
+	void release_points(std::vector<PointCloudCallback::Point3d> &&buf);
+	
+	std::vector<unsigned char> acquire_image(const size_t size);
+	void release_image(std::vector<unsigned char> &&buf);
+};
 
 class YPCData : public PointCloudCallback{
 private:
-	unsigned char *image;
+	YPCDataPool *pool;
+	std::vector<unsigned char> image;
 	size_t step;
 	int width;
 	int height; 
 	std::vector<Point3d> points;
 	int n_valid;
+	//pointsの有効点ビットマップと行毎の有効点数. 各変換の有効点判定/行スキップに使う
+	YPCValidIndex valid_index;
+	
+	void release();
 
 public:
 	
-	YPCData();
+	explicit YPCData(YPCDataPool *pool=nullptr);
+	YPCData(YPCData &&obj);
+	YPCData(const YPCData &)=delete;
+	YPCData &operator=(const YPCData &)=delete;
 	virtual ~YPCData();
 	
 	bool is_empty()const;
@@ -30,14 +61,95 @@ public:
 	
 	void operator()(unsigned char *image, const size_t step,const int width, const int height,std::vector<Point3d> &points, const int n_valid);
 	
-	bool make_point_cloud(sensor_msgs::PointCloud &pts,const bool dense=true);
+	bool make_point_cloud(sensor_msgs::PointCloud &pts,const bool dense=true)const;
+	
+	/**
+	 * PointCloud2の点レイアウト.
+	 *   PC2_XYZRGB32F: x,y,z,rgb float32 (16byte/点, 従来形式)
+	 *   PC2_XYZ32F_I8: x,y,z float32 + intensity uint8 (13byte/点)
+	 *   PC2_XYZ16_I8 : x,y,z int16固定小数点 + intensity uint8 (7byte/点)
+	 *                  座標 = origin + 値 * scale. 無効点は全軸INT16_MIN
+	 */
+	enum PC2Layout {
+		PC2_XYZRGB32F = 0,
+		PC2_XYZ32F_I8,
+		PC2_XYZ16_I8,
+	};
 	
-	bool make_point_cloud2(sensor_msgs::PointCloud2 &pts,const bool dense=true);
+	//"xyzrgb32f", "xyz32f_i8", "xyz16_i8"からレイアウトを求めます
+	static bool parse_pc2_layout(const std::string &name,PC2Layout *layout);
 	
-	bool make_depth_image(cv::Mat &img);
+	//PC2_XYZ16_I8の固定小数点の原点とスケール(スキャン毎に有効点の範囲から決める)
+	struct PC2Quantization {
+		float origin[3];
+		float scale;
+		
+		PC2Quantization():origin{0,0,0},scale(1){}
+	};
+	
+	bool make_point_cloud2(sensor_msgs::PointCloud2 &pts,const bool dense=true,
+		const PC2Layout layout=PC2_XYZRGB32F,PC2Quantization *quant=nullptr)const;
+	
+	/**
+	 * depthmap画像の形式.
+	 * 奥行き[mm] = unit * z として、
+	 *   MONO16_OFFSET: (奥行き[mm] - base) * 256 を16bitで格納(従来形式). 無効点は65535
+	 *   MM16         : 奥行き[mm]を16UC1で格納. 無効点/範囲外は0
+	 *   METER32      : 奥行き[m]を32FC1で格納(depth_image_proc互換). 無効点はNaN
+	 */
+	struct DepthParams {
+		enum Encoding {
+			MONO16_OFFSET = 0,
+			MM16,
+			METER32,
+		};
+		Encoding encoding;
+		float base;
+		float unit;
+		
+		DepthParams():encoding(MONO16_OFFSET),base(400),unit(1){}
+		
+		//"mono16", "16UC1", "32FC1"から形式を設定します
+		bool set_encoding(const std::string &name);
+		std::string encoding_name()const;
+	};
+	
+	//imgのデータ領域へ直接書き込みます
+	bool make_depth_image(sensor_msgs::Image &img,const DepthParams &params=DepthParams())const;
 		
 	bool save_ply(const std::string &file_path,const bool dense=true)const;
 	
 	//range grid. X,Y,Z, X,Y,Z ...
 	rovi::Floats to_rg_floats()const;
+	
+	const YPCValidIndex &get_valid_index()const;
+	
+	//有効点をボクセル化した点群(rgbチャンネル付き)を作成します
+	bool voxelize(const VoxelGrid::LeafSize &leaf,sensor_msgs::PointCloud &output)const;
+	
+	//再ボクセル化用のボクセルピラミッドを作成します
+	bool build_voxel_pyramid(const float base_leaf,VoxelPyramid &pyramid)const;
+	
+	/**
+	 * make_point_cloud, make_point_cloud2, make_depth_image, to_rg_floatsの出力先.
+	 * nullptrの出力は作成しません.
+	 */
+	struct Outputs {
+		sensor_msgs::PointCloud *point_cloud = nullptr;
+		bool point_cloud_dense = true;
+		sensor_msgs::PointCloud2 *point_cloud2 = nullptr;
+		bool point_cloud2_dense = true;
+		PC2Layout point_cloud2_layout = PC2_XYZRGB32F;
+		//PC2_XYZ16_I8の原点/スケールの出力先
+		PC2Quantization *point_cloud2_quant = nullptr;
+		sensor_msgs::Image *depth_image = nullptr;
+		DepthParams depth_params;
+		rovi::Floats *rg_floats = nullptr;
+	};
+	
+	/**
+	 * 指定された出力を、点群を1回だけ行単位(並列)で走査してまとめて作成します.
+	 * dense出力の書き込み位置は、行毎の有効点数の累積和から求めます.
+	 */
+	bool make_outputs(const Outputs &outputs)const;
 };
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "YPCGeneratorUnix.hpp"
+
+/**
+ * パターン画像を1枚ずつ受け取れる点群生成器.
+ * set_images()は1セット分の画像が揃ってからまとめて渡しますが、こちらは受信した画像から順にsetpictし、
+ * 1セット揃った所でflush_images()(flushImageBuffer)を呼びます.
+ */
+class YPCGeneratorStream : public YPCGeneratorUnix {
+public:
+	/**
+	 * 1セットの画像枚数(1カメラ分)
+	 */
+	size_t required_frames()const{
+		return pcgen ? pcgen->requiredframes() : 0;
+	}
+
+	/**
+	 * 画像を1枚渡します. 画像はflush_images()とpreprocess()が終わるまで保持しておくこと.
+	 * @param [in] cam カメラ番号(0: 左, 1: 右)
+	 * @param [in] idx 画像番号
+	 */
+	bool set_image(unsigned char *img, const size_t step, const int cam, const int idx){
+		if( ! pcgen ){
+			return false;
+		}
+		return pcgen->setpict(img, step, cam, idx);
+	}
+
+	/**
+	 * 1セット分の画像をset_image()した後に呼び出します.
+	 */
+	bool flush_images(){
+		if( ! pcgen ){
+			return false;
+		}
+		return pcgen->flushImageBuffer();
+	}
+};
@@ -0,0 +1,197 @@
+#include "YPCKernels.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define YPC_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+namespace YPCKernels {
+
+namespace {
+	static_assert(sizeof(Point3d) == sizeof(float) * 3, "Point3d must be packed x,y,z floats.");
+
+	inline uint32_t gray_to_rgb(const unsigned char pixel){
+		return ( pixel << 16 | pixel << 8 | pixel);
+	}
+
+	inline void store_point(const Point3d &pt, const uint32_t rgb_u, float *xyz, float *rgb){
+		xyz[0] = pt.x;
+		xyz[1] = pt.y;
+		xyz[2] = pt.z;
+		std::memcpy(rgb, &rgb_u, sizeof(float));
+	}
+
+	//maskの立っている点だけを前詰めで書き込みます
+	inline int store_masked(const Point3d *points, const uint32_t *rgbs, unsigned int mask,
+		float *xyz, const int xyz_step, float *rgb, const int rgb_step, int n, const int max_out){
+
+		while( mask && n < max_out ){
+			const int b = __builtin_ctz(mask);
+			store_point(points[b], rgbs[b], xyz + n * xyz_step, rgb + n * rgb_step);
+			mask &= mask - 1;
+			++n;
+		}
+		return n;
+	}
+
+	//全点有効なブロックの書き込み
+	inline int store_all(const Point3d *points, const uint32_t *rgbs, const int num,
+		float *xyz, const int xyz_step, float *rgb, const int rgb_step, int n){
+
+		if( xyz_step == 3 ){
+			std::memcpy(xyz + n * 3, points, sizeof(Point3d) * num);
+		}else{
+			for( int k = 0 ; k < num ; ++k ){
+				float *p = xyz + (n + k) * xyz_step;
+				p[0] = points[k].x;
+				p[1] = points[k].y;
+				p[2] = points[k].z;
+			}
+		}
+		if( rgb_step == 1 ){
+			std::memcpy(rgb + n, rgbs, sizeof(uint32_t) * num);
+		}else{
+			for( int k = 0 ; k < num ; ++k ){
+				std::memcpy(rgb + (n + k) * rgb_step, rgbs + k, sizeof(float));
+			}
+		}
+		return n + num;
+	}
+
+	int compact_scalar(const Point3d *points, const unsigned char *gray, const int begin, const int count,
+		float *xyz, const int xyz_step, float *rgb, const int rgb_step, int n, const int max_out){
+
+		for( int i = begin ; i < count && n < max_out ; ++i ){
+			if( ! std::isnan(points[i].x) ){
+				store_point(points[i], gray_to_rgb(gray[i]), xyz + n * xyz_step, rgb + n * rgb_step);
+				++n;
+			}
+		}
+		return n;
+	}
+
+#ifdef YPC_KERNELS_X86
+	__attribute__((target("sse4.1")))
+	int compact_sse41(const Point3d *points, const unsigned char *gray, const int count,
+		float *xyz, const int xyz_step, float *rgb, const int rgb_step, const int max_out){
+
+		const __m128i gray_mul = _mm_set1_epi32(0x010101);
+		alignas(16) uint32_t rgbs[4];
+		int n = 0;
+		int i = 0;
+		for( ; i + 4 <= count && n < max_out ; i += 4 ){
+			//4点=12floatを3回のロードで読み、xだけを取り出す
+			const float *src = &points[i].x;
+			const __m128 a = _mm_loadu_ps(src);
+			const __m128 b = _mm_loadu_ps(src + 4);
+			const __m128 c = _mm_loadu_ps(src + 8);
+			const __m128 x01_2 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,2,3,0));
+			const __m128 x = _mm_blend_ps(x01_2, _mm_shuffle_ps(c, c, _MM_SHUFFLE(1,1,1,1)), 0x8);
+			const unsigned int mask = _mm_movemask_ps(_mm_cmpord_ps(x, x));
+			if( mask == 0 ){
+				continue;
+			}
+
+			int32_t g4;
+			std::memcpy(&g4, gray + i, sizeof(g4));
+			const __m128i g = _mm_mullo_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(g4)), gray_mul);
+			_mm_store_si128((__m128i*)rgbs, g);
+
+			if( mask == 0xF && n + 4 <= max_out ){
+				n = store_all(points + i, rgbs, 4, xyz, xyz_step, rgb, rgb_step, n);
+			}else{
+				n = store_masked(points + i, rgbs, mask, xyz, xyz_step, rgb, rgb_step, n, max_out);
+			}
+		}
+		return compact_scalar(points, gray, i, count, xyz, xyz_step, rgb, rgb_step, n, max_out);
+	}
+
+	__attribute__((target("avx2")))
+	int compact_avx2(const Point3d *points, const unsigned char *gray, const int count,
+		float *xyz, const int xyz_step, float *rgb, const int rgb_step, const int max_out){
+
+		const __m256i x_index = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+		const __m256i gray_mul = _mm256_set1_epi32(0x010101);
+		alignas(32) uint32_t rgbs[8];
+		int n = 0;
+		int i = 0;
+		for( ; i + 8 <= count && n < max_out ; i += 8 ){
+			const __m256 x = _mm256_i32gather_ps(&points[i].x, x_index, sizeof(float));
+			const unsigned int mask = _mm256_movemask_ps(_mm256_cmp_ps(x, x, _CMP_ORD_Q));
+			if( mask == 0 ){
+				continue;
+			}
+
+			const __m256i g = _mm256_mullo_epi32(
+				_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(gray + i))), gray_mul);
+			_mm256_store_si256((__m256i*)rgbs, g);
+
+			if( mask == 0xFF && n + 8 <= max_out ){
+				n = store_all(points + i, rgbs, 8, xyz, xyz_step, rgb, rgb_step, n);
+			}else{
+				n = store_masked(points + i, rgbs, mask, xyz, xyz_step, rgb, rgb_step, n, max_out);
+			}
+		}
+		return compact_scalar(points, gray, i, count, xyz, xyz_step, rgb, rgb_step, n, max_out);
+	}
+#endif
+
+	Isa detect_isa(){
+#ifdef YPC_KERNELS_X86
+		__builtin_cpu_init();
+		if( __builtin_cpu_supports("avx2") ){
+			return ISA_AVX2;
+		}else if( __builtin_cpu_supports("sse4.1") ){
+			return ISA_SSE41;
+		}
+#endif
+		return ISA_SCALAR;
+	}
+}
+
+Isa selected_isa(){
+	static const Isa isa = detect_isa();
+	return isa;
+}
+
+const char *isa_name(const Isa isa){
+	switch( isa ){
+	case ISA_AVX2:
+		return "avx2";
+	case ISA_SSE41:
+		return "sse4.1";
+	default:
+		return "scalar";
+	}
+}
+
+int compact_points(const Point3d *points, const unsigned char *gray, const int count,
+	float *xyz, const int xyz_step, float *rgb, const int rgb_step, const int max_out){
+	return compact_points(selected_isa(), points, gray, count, xyz, xyz_step, rgb, rgb_step, max_out);
+}
+
+int compact_points(const Isa isa, const Point3d *points, const unsigned char *gray, const int count,
+	float *xyz, const int xyz_step, float *rgb, const int rgb_step, const int max_out){
+
+	if( count <= 0 || max_out <= 0 ){
+		return 0;
+	}
+
+#ifdef YPC_KERNELS_X86
+	const Isa use = isa < selected_isa() ? isa : selected_isa();
+	if( use == ISA_AVX2 ){
+		return compact_avx2(points, gray, count, xyz, xyz_step, rgb, rgb_step, max_out);
+	}else if( use == ISA_SSE41 ){
+		return compact_sse41(points, gray, count, xyz, xyz_step, rgb, rgb_step, max_out);
+	}
+#else
+	(void)isa;
+#endif
+	return compact_scalar(points, gray, 0, count, xyz, xyz_step, rgb, rgb_step, 0, max_out);
+}
+
+}
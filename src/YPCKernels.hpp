@@ -0,0 +1,42 @@
+#pragma once
+
+#include "iPointCloudGenerator.hpp"
+
+/**
+ * YPCDataの点群変換用カーネル.
+ * 実行時にCPUを判定し、AVX2 / SSE4.1 / スカラー実装を切り替えます(x86以外は常にスカラー).
+ */
+namespace YPCKernels {
+
+	typedef PointCloudCallback::Point3d Point3d;
+
+	enum Isa {
+		ISA_SCALAR = 0,
+		ISA_SSE41,
+		ISA_AVX2,
+	};
+
+	//実行時に選択されている実装
+	Isa selected_isa();
+	const char *isa_name(const Isa isa);
+
+	/**
+	 * 有効点(xがNaNでない点)だけを前詰めで出力します.
+	 * rgbはテクスチャの濃淡値を(p<<16|p<<8|p)にしてfloatとしてビット列のまま格納します.
+	 * @param points   入力点群
+	 * @param gray     入力テクスチャ(pointsと同じ並び)
+	 * @param count    入力点数
+	 * @param xyz      x,y,zの出力先
+	 * @param xyz_step xyzの出力点間隔(float数)
+	 * @param rgb      rgbの出力先
+	 * @param rgb_step rgbの出力点間隔(float数)
+	 * @param max_out  出力する最大点数
+	 * @return 出力した点数
+	 */
+	int compact_points(const Point3d *points, const unsigned char *gray, const int count,
+		float *xyz, const int xyz_step, float *rgb, const int rgb_step, const int max_out);
+
+	//実装を指定して実行します(selected_isa()以下の実装のみ指定可能)
+	int compact_points(const Isa isa, const Point3d *points, const unsigned char *gray, const int count,
+		float *xyz, const int xyz_step, float *rgb, const int rgb_step, const int max_out);
+}
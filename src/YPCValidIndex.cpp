@@ -0,0 +1,44 @@
+#include "YPCValidIndex.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+void YPCValidIndex::build(const Point3d *points, const int width, const int height){
+	this->width = std::max(0, width);
+	this->height = std::max(0, height);
+	this->words_per_row = (this->width + WORD_BITS - 1) / WORD_BITS;
+
+	this->points = points;
+	valid.assign((size_t)this->words_per_row * this->height, 0);
+	row_valid.assign(this->height, 0);
+	row_offsets.assign(this->height + 1, 0);
+
+	#pragma omp parallel for schedule(static)
+	for( int j = 0 ; j < this->height ; ++j ){
+		const Point3d *row = points + (size_t)j * this->width;
+		uint64_t *words = valid.data() + (size_t)j * this->words_per_row;
+		int count = 0;
+
+		for( int i = 0 ; i < this->width ; ++i ){
+			if( ! std::isnan(row[i].x) ){
+				words[i / WORD_BITS] |= (uint64_t)1 << (i % WORD_BITS);
+				++count;
+			}
+		}
+		row_valid[j] = count;
+	}
+
+	for( int j = 0 ; j < this->height ; ++j ){
+		row_offsets[j + 1] = row_offsets[j] + row_valid[j];
+	}
+}
+
+void YPCValidIndex::clear(){
+	width = 0;
+	height = 0;
+	words_per_row = 0;
+	points = nullptr;
+	valid.clear();
+	row_valid.clear();
+	row_offsets.clear();
+}
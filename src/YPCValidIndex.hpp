@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "iPointCloudGenerator.hpp"
+
+/**
+ * 構造化点群の有効点インデックス.
+ * 有効点(NaNでない点)を行毎のビットマップと行毎の有効点数で保持し、点の座標は元のAoS点群を参照します.
+ * 有効点の無い行はビットマップを見るだけで飛ばせるので、無効領域の点データには触れずに済みます.
+ * 座標はコピーしないので、参照している点群を解放/入れ替えた時はclear()かbuild()し直すこと.
+ */
+class YPCValidIndex {
+public:
+	typedef PointCloudCallback::Point3d Point3d;
+
+	static const int WORD_BITS = 64;
+
+	int width = 0;
+	int height = 0;
+	//1行あたりのビットマップ語数
+	int words_per_row = 0;
+
+	//元のAoS点群(所有しない). width*height点
+	const Point3d *points = nullptr;
+	//有効点ビットマップ. 行毎にwords_per_row語(LSBが行内の若い番号)
+	std::vector<uint64_t> valid;
+	//行毎の有効点数
+	std::vector<int> row_valid;
+	//行毎の有効点数の累積和(height+1). dense出力の書き込み開始位置
+	std::vector<int> row_offsets;
+
+	/**
+	 * AoSの点群から作成します(行単位で並列). pointsはclear()まで参照し続けます.
+	 */
+	void build(const Point3d *points, const int width, const int height);
+
+	void clear();
+
+	bool empty()const{
+		return row_offsets.empty();
+	}
+
+	int total_valid()const{
+		return row_offsets.empty() ? 0 : row_offsets.back();
+	}
+
+	size_t size()const{
+		return (size_t)width * height;
+	}
+
+	//j行目の先頭の点
+	const Point3d *row(const int j)const{
+		return points + (size_t)j * width;
+	}
+
+	const uint64_t *valid_row(const int j)const{
+		return valid.data() + (size_t)j * words_per_row;
+	}
+
+	bool is_valid(const int j, const int i)const{
+		return ( valid_row(j)[i / WORD_BITS] >> (i % WORD_BITS) ) & 1;
+	}
+
+	/**
+	 * j行目の有効点の行内番号iについてf(i)を呼びます.
+	 */
+	template<typename F>
+	void for_each_valid(const int j, F f)const{
+		if( row_valid[j] <= 0 ){
+			return;
+		}
+		const uint64_t *words = valid_row(j);
+		for( int w = 0 ; w < words_per_row ; ++w ){
+			uint64_t bits = words[w];
+			while( bits ){
+				f( w * WORD_BITS + __builtin_ctzll(bits) );
+				bits &= bits - 1;
+			}
+		}
+	}
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <yaml-cpp/yaml.h>
+
+/**
+ * rosparam dumpしたパラメータyaml. ノードのget_paramと同じキー("pshift_genpc/calc/..." "left/genpc/K" など)で引けるようにします.
+ * ROSマスター無しで動くツール(genpc_bench, rovi_scene_render)から使います.
+ */
+class YamlParams {
+	std::vector<YAML::Node> m_roots;
+
+	static bool find_node(const YAML::Node &node,const std::vector<std::string> &keys,const size_t i,YAML::Node *out){
+		if( i == keys.size() ){
+			*out = node;
+			return true;
+		}
+		if( ! node.IsMap() ){
+			return false;
+		}
+		const YAML::Node child = node[keys[i]];
+		if( ! child ){
+			return false;
+		}
+		return find_node(child,keys,i+1,out);
+	}
+
+public:
+	/**
+	 * 複数読み込んだ場合は後のファイルの値が優先されます.
+	 * @param error 失敗した時の理由
+	 */
+	bool load(const std::string &path,std::string *error){
+		try{
+			YAML::Node root = YAML::LoadFile(path);
+			//rosparam dump <file> / の場合は/rovi以下を使う
+			if( root.IsMap() && root["rovi"] && root["rovi"].IsMap() ){
+				root = root["rovi"];
+			}
+			m_roots.push_back(root);
+		}catch( YAML::Exception &e ){
+			*error = "param file load failed. path=" + path + ", error=" + e.what();
+			return false;
+		}
+		return true;
+	}
+
+	bool find(const std::string &key,YAML::Node *out)const{
+		std::vector<std::string> keys;
+		size_t pos = 0;
+		while( pos <= key.size() ){
+			const size_t next = std::min(key.find('/',pos),key.size());
+			keys.push_back(key.substr(pos,next-pos));
+			pos = next + 1;
+		}
+		//後から読み込んだファイルを優先する
+		for( auto it = m_roots.rbegin() ; it != m_roots.rend() ; ++it ){
+			if( find_node(*it,keys,0,out) ){
+				return true;
+			}
+		}
+		return false;
+	}
+
+	template<typename T>
+	bool get(const std::string &key,T *val)const{
+		YAML::Node node;
+		if( ! find(key,&node) ){
+			return false;
+		}
+		try{
+			*val = node.as<T>();
+		}catch( YAML::Exception &e ){
+			fprintf(stderr, "param type mismatch. key=%s, error=%s\n", key.c_str(), e.what());
+			return false;
+		}
+		return true;
+	}
+
+	template<typename T>
+	T get_param(const std::string &key,const T defaultVal)const{
+		T val=defaultVal;
+		get(key,&val);
+		return val;
+	}
+};
@@ -0,0 +1,658 @@
+/**
+ * genpc_bench: 保存済みのパターン画像(genpc/dump)から点群生成を繰り返し、段階毎の処理時間をJSONで出力します.
+ * ROSマスター無しで動き、genpc_nodeと同じ点群生成器/点群変換(YPCData)を同じ順で呼び出します.
+ *
+ * 使い方: genpc_bench [オプション] <ダンプディレクトリ> <パラメータyaml> [<パラメータyaml> ...]
+ *   パラメータyamlは rosparam dump <file> /rovi の形式(キーは "pshift_genpc/calc/..." "left/genpc/K" など).
+ *   複数指定した場合は後のファイルの値が優先されます.
+ *
+ * --golden <dir> を指定すると、最初のスキャンの出力を基準ファイルと許容差付きで比較し、
+ * 処理時間を<dir>/baseline.json(または--baseline)と比べます(--no-baselineの時は比べません). 不一致/性能劣化の時は終了コード3.
+ * --update-golden で基準ファイルとbaseline.jsonを作り直します.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <getopt.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <ros/time.h>
+#include <yaml-cpp/yaml.h>
+#include <opencv2/opencv.hpp>
+#include <sensor_msgs/PointCloud.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/Image.h>
+#include "rovi/Floats.h"
+
+#include "iPointCloudGenerator.hpp"
+#include "YPCGeneratorStream.hpp"
+#include "YPCData.hpp"
+#include "PhaseShiftParams.hpp"
+#include "PatternDump.hpp"
+#include "GenPCSettings.hpp"
+#include "ElapsedTimer.hpp"
+#include "Trace.hpp"
+#include "StageMetrics.hpp"
+#include "YamlParams.hpp"
+#include "GoldenOutputs.hpp"
+
+#define LOG_HEADER "(genpc_bench) "
+#define LOG_INFO(...) fprintf(stderr, LOG_HEADER __VA_ARGS__), fputc('\n', stderr)
+
+namespace {
+//============================================= 無名名前空間 start =============================================
+
+constexpr int CAMERA_NUM = 2;
+
+const int ITERATIONS_DEFAULT = 10;
+const int WARMUP_DEFAULT = 1;
+const double MAX_REGRESSION_DEFAULT = 10;
+const char *BASELINE_NAME = "baseline.json";
+//性能劣化の判定に使う段階. p50/p95は対数バケット(相対誤差 約6%)なので平均で比べる
+const char *REGRESSION_STAGE = "total";
+
+struct BenchOptions {
+	int iterations = ITERATIONS_DEFAULT;
+	int warmup = WARMUP_DEFAULT;
+	std::string dump_dir;
+	std::vector<std::string> param_files;
+	std::string output_path;
+	std::string trace_path;
+	std::string golden_dir;
+	bool update_golden = false;
+	std::string baseline_path;
+	bool no_baseline = false;
+	double max_regression = MAX_REGRESSION_DEFAULT;
+	GoldenOutputs::Tolerance tolerance;
+};
+
+/**
+ * 基準ファイルとの比較結果.
+ */
+struct GoldenReport {
+	bool enabled = false;
+	bool updated = false;
+	bool passed = true;
+	std::vector<GoldenOutputs::Result> results;
+};
+
+/**
+ * baselineのレポートとの処理時間(平均)の差.
+ */
+struct StageDelta {
+	std::string name;
+	double baseline_mean = 0;
+	double mean = 0;
+	double delta_pct = 0;
+};
+
+struct BaselineReport {
+	bool enabled = false;
+	std::string path;
+	std::vector<StageDelta> deltas;
+	bool regressed = false;
+};
+
+/**
+ * genpcのdump_pattern_images()が書き出した画像を読み込みます.
+ */
+bool load_pattern_dump(const std::string &dir,PatternDump *dump){
+	ElapsedTimer tmr;
+	std::string error;
+	if( ! dump->load(dir,&error) ){
+		LOG_INFO("%s",error.c_str());
+		return false;
+	}
+	//captseq.logは撮影枚数の確認にだけ使う
+	const int frame_num = dump->sets.size() * dump->frames_per_set();
+	if( dump->captseq_lines >= 0 && dump->captseq_lines != frame_num ){
+		LOG_INFO("captseq.log line count is different from pattern images. lines=%d, images=%d",dump->captseq_lines,frame_num);
+	}
+	LOG_INFO("pattern images loaded. dir=%s, capt_num=%d, frames=%d, size=%dx%d, proc_tm=%d ms",
+		dir.c_str(),(int)dump->sets.size(),dump->frames_per_set(),dump->width,dump->height,tmr.elapsed_ms());
+	return true;
+}
+
+bool read_calib(const YamlParams &params,const std::string &key,const size_t size,std::vector<double> *values){
+	if( ! params.get(key,values) ){
+		LOG_INFO("param read failed. key=%s",key.c_str());
+		return false;
+	}else if( size > 0 && values->size() != size ){
+		LOG_INFO("param size is wrong. key=%s, size=%d, expected=%d",key.c_str(),(int)values->size(),(int)size);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * genpc_nodeのcreate_pcgen/load_phase_shift_params/load_camera_calib_dataと同じ手順で点群生成器を準備します.
+ */
+bool setup_pcgen(const YamlParams &params,const PatternDump &dump,YPCGeneratorStream &pcgen,PcGenMode *mode){
+	*mode = (PcGenMode)params.get_param<int>("pshift_genpc/calc/pcgen_mode",(int)PCGEN_GRAYPS4);
+	if( ! pcgen.create_pcgen(*mode) ){
+		LOG_INFO("point cloud generator create failed. mode=%d",*mode);
+		return false;
+	}
+
+	std::map<std::string,double> ps_params;
+	for( const PhaseShiftParam &param : phase_shift_params() ){
+		ps_params[param.key] = params.get_param<double>(phase_shift_param_key(param),param.default_value);
+	}
+	ps_params["image_width"] = dump.width;
+	ps_params["image_height"] = dump.height;
+	if( ! pcgen.init(ps_params) ){
+		LOG_INFO("phase shift parameter init failed.");
+		return false;
+	}
+
+	std::vector<double> Kl, Kr, Dl, Dr, R, T;
+	if( ! read_calib(params,"left/genpc/K",9,&Kl) ||
+		! read_calib(params,"left/genpc/D",0,&Dl) ||
+		! read_calib(params,"right/genpc/K",9,&Kr) ||
+		! read_calib(params,"right/genpc/D",0,&Dr) ||
+		! read_calib(params,"right/genpc/R",9,&R) ||
+		! read_calib(params,"right/genpc/T",3,&T) ){
+		LOG_INFO("camera calibration data load failed. dump /rovi params of a running ycam3d (rosparam dump) and pass the file.");
+		return false;
+	}
+	if( ! pcgen.create_camera_raw(Kl,Kr,Dl,Dr,R,T) ){
+		LOG_INFO("stereo camera create failed.");
+		return false;
+	}
+
+	if( pcgen.required_frames() > 0 && (size_t)dump.frames_per_set() < pcgen.required_frames() ){
+		LOG_INFO("pattern images are too few. frames=%d, required=%d",dump.frames_per_set(),(int)pcgen.required_frames());
+		return false;
+	}
+	LOG_INFO("point cloud generator created. mode=%d (%s), required_frames=%d",
+		*mode,PCGEN_MODE_MAP[*mode].c_str(),(int)pcgen.required_frames());
+	return true;
+}
+
+/**
+ * genpc_nodeのexec_genpc()での点群変換の設定.
+ */
+struct OutputSettings {
+	bool depthmap_enabled = DEPTH_MAP_IMG_ENABELED_DEFAULT;
+	YPCData::DepthParams depth_params;
+	bool pcdata2_enabled = PC_DATA2_ENABLED_DEFAULT;
+	bool pcdata2_dense = PC_DATA2_DENSE_DEFAULT;
+	YPCData::PC2Layout pcdata2_layout = YPCData::PC2_XYZRGB32F;
+	bool quantize_count_enabled = QUANTIZE_POINTS_COUNT_ENABLED_DEFAULT;
+	VoxelLeafSize leaf_size;
+	bool calc_right_camera = false;
+};
+
+OutputSettings load_output_settings(const YamlParams &params){
+	OutputSettings settings;
+	std::string error;
+	settings.depthmap_enabled = params.get_param<bool>("genpc/depthmap_img/enabled",DEPTH_MAP_IMG_ENABELED_DEFAULT);
+	settings.depth_params = GenPCSettings::get_depth_params(params,&error);
+	if( ! error.empty() ){
+		LOG_INFO("%s",error.c_str());
+		error.clear();
+	}
+
+	settings.pcdata2_enabled = params.get_param<bool>("genpc/point_cloud2/enabled",PC_DATA2_ENABLED_DEFAULT);
+	settings.pcdata2_dense = params.get_param<bool>("genpc/point_cloud2/dense",PC_DATA2_DENSE_DEFAULT);
+	settings.pcdata2_layout = GenPCSettings::get_pc2_layout(params,&error);
+	if( ! error.empty() ){
+		LOG_INFO("%s",error.c_str());
+	}
+	settings.quantize_count_enabled = params.get_param<bool>("genpc/quantize_points_count/enabled",QUANTIZE_POINTS_COUNT_ENABLED_DEFAULT);
+	settings.leaf_size = GenPCSettings::get_voxel_leaf_size(params);
+	settings.calc_right_camera = params.get_param<bool>("pshift_genpc/calc/calc_right_camera",false);
+	return settings;
+}
+
+/**
+ * save_ply()の出力(dense)を一時ファイル経由で読み込みます.
+ */
+bool read_ply_bytes(const YPCData &ypcData,std::string *ply){
+	char path[] = "/tmp/genpc_bench_XXXXXX";
+	const int fd = mkstemp(path);
+	if( fd < 0 ){
+		return false;
+	}
+	close(fd);
+	bool ret = false;
+	if( ypcData.save_ply(path,true) ){
+		std::ifstream ifs(path, std::ios::binary);
+		std::ostringstream oss;
+		oss << ifs.rdbuf();
+		*ply = oss.str();
+		ret = ! ifs.bad();
+	}
+	unlink(path);
+	return ret;
+}
+
+/**
+ * 1スキャン分の点群生成～点群変換～ダウンサンプリング. 段階毎の時間はgenpc_nodeと同じ名前でStageMetricsに積算します.
+ * @param [out] points カメラ毎の点数
+ * @param [out] golden 指定した時はカメラ毎の出力(基準ファイルとの比較用)を返す
+ */
+bool run_scan(YPCGeneratorStream &pcgen,YPCDataPool &pool,const PatternDump &dump,const OutputSettings &settings,const int scan,std::vector<int> *points,
+	std::vector<GoldenOutputs::Camera> *golden=nullptr){
+	ElapsedTimer tmr_proc;
+	TraceSpan trace_span("genpc",scan);
+
+	ElapsedTimer tmr;
+	pcgen.reset();
+	for( size_t n = 0 ; n < dump.sets.size() ; n++ ){
+		tmr.start_lap();
+		TraceSpan trace_set_images("set_images",n);
+		std::vector<unsigned char*> ptn_img_pointers;
+		for( const cv::Mat &img : dump.sets[n] ){
+			ptn_img_pointers.push_back(img.data);
+		}
+		if( ! pcgen.set_images(ptn_img_pointers) ){
+			LOG_INFO("<%d> point cloud generator pattern image load failed.",(int)n);
+			return false;
+		}
+		tmr.record_lap("genpc/set_images");
+	}
+
+	{
+		TraceSpan trace_preprocess("preprocess",0);
+		ElapsedTimer tmr_preprocess;
+		if( ! pcgen.preprocess() ){
+			LOG_INFO("point cloud data generator preprocess failed.");
+			return false;
+		}
+		tmr_preprocess.record("genpc/preprocess");
+	}
+
+	points->assign(CAMERA_NUM,-1);
+	if( golden ){
+		golden->assign(CAMERA_NUM,GoldenOutputs::Camera());
+	}
+	for( int camno = 0 ; camno < CAMERA_NUM ; ++camno ){
+		if( camno == 1 && ! settings.calc_right_camera ){
+			continue;
+		}
+		ElapsedTimer tmr_genpc;
+		TraceSpan trace_execute("execute",camno);
+		YPCData ypcData(&pool);
+		if( ! pcgen.execute(camno) ){
+			LOG_INFO("[%d] point cloud generate failed.",camno);
+			return false;
+		}
+		const int N = pcgen.save_pointcloud(&ypcData);
+		trace_execute.end();
+		tmr_genpc.record("genpc/execute");
+		StageMetrics::record("genpc/disparity",ElapsedTimer::duration_us(pcgen.get_elapsed_disparity()) / 1000.0);
+		StageMetrics::record("genpc/genpcloud",ElapsedTimer::duration_us(pcgen.get_elapsed_genpcloud()) / 1000.0);
+		StageMetrics::record("genpc/points",N,StageMetrics::UNIT_COUNT);
+		StageMetrics::record("genpc/valid_pixel_ratio",N / (double)(dump.width * dump.height),StageMetrics::UNIT_RATIO);
+		(*points)[camno] = N;
+
+		ElapsedTimer tmr_pcgen_conv;
+		TraceSpan trace_convert("make_outputs",camno);
+		sensor_msgs::PointCloud pts;
+		sensor_msgs::PointCloud2 pcdata2;
+		YPCData::PC2Quantization pcdata2_quant;
+		sensor_msgs::Image depth_img;
+		rovi::Floats pc_points;
+		YPCData::Outputs outputs;
+		outputs.point_cloud = &pts;
+		outputs.point_cloud_dense = true;
+		outputs.point_cloud2 = settings.pcdata2_enabled ? &pcdata2 : nullptr;
+		outputs.point_cloud2_dense = settings.pcdata2_dense;
+		outputs.point_cloud2_layout = settings.pcdata2_layout;
+		outputs.point_cloud2_quant = &pcdata2_quant;
+		outputs.depth_image = settings.depthmap_enabled ? &depth_img : nullptr;
+		outputs.depth_params = settings.depth_params;
+		outputs.rg_floats = &pc_points;
+		if( ! ypcData.make_outputs(outputs) ){
+			LOG_INFO("[%d] point cloud data convert failed.",camno);
+			return false;
+		}
+		trace_convert.end();
+		tmr_pcgen_conv.record("genpc/make_outputs");
+
+		ElapsedTimer tmr_downsampling;
+		TraceSpan trace_downsampling("downsampling",camno);
+		sensor_msgs::PointCloud pts_vx;
+		rovi::Floats ds_points;
+		GenPCSettings::exec_downsampling(pts,settings.leaf_size,settings.quantize_count_enabled,ds_points,&pts_vx,&ypcData);
+		tmr_downsampling.record("genpc/downsampling");
+		
+		if( golden ){
+			GoldenOutputs::Camera &outs = (*golden)[camno];
+			if( ! ypcData.make_point_cloud(outs.organized,false) || ! read_ply_bytes(ypcData,&outs.ply) ){
+				LOG_INFO("[%d] golden outputs create failed.",camno);
+				return false;
+			}
+			outs.ps_floats = std::move(ds_points);
+			outs.dense = std::move(pts);
+			outs.depth_image = std::move(depth_img);
+			outs.voxelized = std::move(pts_vx);
+		}
+	}
+	tmr_proc.record("genpc/total");
+	return true;
+}
+
+std::string json_escape(const std::string &src){
+	std::string dst;
+	for( const char c : src ){
+		if( c == '"' || c == '\\' ){
+			dst += '\\';
+		}
+		dst += c;
+	}
+	return dst;
+}
+
+/**
+ * baselineのレポート(genpc_benchのJSON)と段階毎の処理時間の平均を比べます.
+ * REGRESSION_STAGEがmax_regression[%]より遅くなっていたらregressed.
+ */
+bool compare_baseline(const std::string &path,const double max_regression,BaselineReport *report){
+	report->enabled = true;
+	report->path = path;
+	YAML::Node baseline;
+	try{
+		//JSONはYAMLとして読める
+		baseline = YAML::LoadFile(path);
+	}catch( YAML::Exception &e ){
+		LOG_INFO("baseline load failed. path=%s, error=%s",path.c_str(),e.what());
+		return false;
+	}
+	const YAML::Node stages = baseline["stages"];
+	if( ! stages || ! stages.IsMap() ){
+		LOG_INFO("baseline has no stages. path=%s",path.c_str());
+		return false;
+	}
+	for( const StageMetrics::Summary &summary : StageMetrics::summaries("genpc/") ){
+		const std::string name = summary.name.substr(6);
+		const YAML::Node stage = stages[name];
+		if( summary.unit != StageMetrics::UNIT_MS || summary.count == 0 || ! stage || stage["unit"].as<std::string>("") != "ms" ){
+			continue;
+		}
+		StageDelta delta;
+		delta.name = name;
+		delta.baseline_mean = stage["mean"].as<double>(0);
+		delta.mean = summary.sum / summary.count;
+		if( delta.baseline_mean <= 0 ){
+			continue;
+		}
+		delta.delta_pct = (delta.mean - delta.baseline_mean) / delta.baseline_mean * 100;
+		if( name == REGRESSION_STAGE && delta.delta_pct > max_regression ){
+			report->regressed = true;
+		}
+		LOG_INFO("stage %s: baseline=%.3f ms, current=%.3f ms (%+.1f%%)",name.c_str(),delta.baseline_mean,delta.mean,delta.delta_pct);
+		report->deltas.push_back(delta);
+	}
+	return true;
+}
+
+void write_golden_report(FILE *fp,const BenchOptions &opts,const GoldenReport &golden){
+	fprintf(fp, "  \"golden\": {\"dir\": \"%s\", \"updated\": %s, \"passed\": %s, ",
+		json_escape(opts.golden_dir).c_str(), golden.updated ? "true" : "false", golden.passed ? "true" : "false");
+	fprintf(fp, "\"tolerance\": {\"position_mm\": %g, \"color\": %d, \"mismatch_ratio\": %g}, \"outputs\": [",
+		opts.tolerance.position, opts.tolerance.color, opts.tolerance.mismatch_ratio);
+	bool first = true;
+	for( const GoldenOutputs::Result &result : golden.results ){
+		fprintf(fp, "%s\n    {\"camno\": %d, \"name\": \"%s\", \"passed\": %s, \"elements\": %zu, \"mismatched\": %zu, \"max_diff\": %g, \"detail\": \"%s\"}",
+			first ? "" : ",", result.camno, json_escape(result.name).c_str(), result.passed ? "true" : "false",
+			result.elements, result.mismatched, result.max_diff, json_escape(result.detail).c_str());
+		first = false;
+	}
+	fprintf(fp, "%s]},\n", first ? "" : "\n  ");
+}
+
+void write_baseline_report(FILE *fp,const BenchOptions &opts,const BaselineReport &baseline){
+	fprintf(fp, "  \"baseline\": {\"path\": \"%s\", \"stage\": \"%s\", \"max_regression_pct\": %g, \"regressed\": %s, \"stages\": {",
+		json_escape(baseline.path).c_str(), REGRESSION_STAGE, opts.max_regression, baseline.regressed ? "true" : "false");
+	bool first = true;
+	for( const StageDelta &delta : baseline.deltas ){
+		fprintf(fp, "%s\n    \"%s\": {\"baseline_mean\": %g, \"mean\": %g, \"delta_pct\": %.2f}",
+			first ? "" : ",", json_escape(delta.name).c_str(), delta.baseline_mean, delta.mean, delta.delta_pct);
+		first = false;
+	}
+	fprintf(fp, "%s}},\n", first ? "" : "\n  ");
+}
+
+bool write_report(const std::string &path,const BenchOptions &opts,const PatternDump &dump,const PcGenMode mode,const OutputSettings &settings,
+	const double elapsed_s,const std::vector<int> &points,const GoldenReport &golden,const BaselineReport &baseline){
+	FILE *fp = path.empty() ? stdout : fopen(path.c_str(), "w");
+	if( ! fp ){
+		LOG_INFO("report open failed. path=%s",path.c_str());
+		return false;
+	}
+	const int cameras = settings.calc_right_camera ? 2 : 1;
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"dump_dir\": \"%s\",\n", json_escape(opts.dump_dir).c_str());
+	fprintf(fp, "  \"pcgen_mode\": \"%s\",\n", json_escape(PCGEN_MODE_MAP[mode]).c_str());
+	fprintf(fp, "  \"width\": %d,\n  \"height\": %d,\n", dump.width, dump.height);
+	fprintf(fp, "  \"capt_num\": %d,\n  \"frames\": %d,\n  \"cameras\": %d,\n", (int)dump.sets.size(), dump.frames_per_set(), cameras);
+	fprintf(fp, "  \"iterations\": %d,\n  \"warmup\": %d,\n", opts.iterations, opts.warmup);
+	fprintf(fp, "  \"points\": [%d, %d],\n", points.size() > 0 ? points[0] : -1, points.size() > 1 ? points[1] : -1);
+	fprintf(fp, "  \"elapsed_s\": %.6f,\n", elapsed_s);
+	fprintf(fp, "  \"scans_per_s\": %.3f,\n", elapsed_s > 0 ? opts.iterations / elapsed_s : 0.0);
+	if( golden.enabled ){
+		write_golden_report(fp,opts,golden);
+	}
+	if( baseline.enabled ){
+		write_baseline_report(fp,opts,baseline);
+	}
+	fprintf(fp, "  \"stages\": {");
+	bool first = true;
+	for( const StageMetrics::Summary &summary : StageMetrics::summaries("genpc/") ){
+		fprintf(fp, "%s\n    \"%s\": {\"unit\": \"%s\", \"count\": %llu, \"mean\": %g, \"p50\": %g, \"p95\": %g, \"p99\": %g, \"max\": %g}",
+			first ? "" : ",", json_escape(summary.name.substr(6)).c_str(), StageMetrics::unit_name(summary.unit),
+			(unsigned long long)summary.count, summary.count == 0 ? 0.0 : summary.sum / summary.count,
+			summary.p50, summary.p95, summary.p99, summary.max);
+		first = false;
+	}
+	fprintf(fp, "\n  }\n}\n");
+
+	const bool written = ! ferror(fp);
+	if( fp != stdout ){
+		return fclose(fp) == 0 && written;
+	}
+	fflush(fp);
+	return written;
+}
+
+void usage(const char *prog){
+	fprintf(stderr,
+		"usage: %s [options] <dump_dir> <param.yaml> [<param.yaml> ...]\n"
+		"  -n, --iterations N  measured scans (default %d)\n"
+		"  -w, --warmup N      scans run before measuring (default %d)\n"
+		"  -o, --output PATH   JSON report path (default stdout)\n"
+		"  -t, --trace PATH    write stage spans as Chrome trace JSON\n"
+		"  -g, --golden DIR    compare outputs of the first scan with golden files in DIR\n"
+		"  -u, --update-golden regenerate golden files and DIR/%s instead of comparing\n"
+		"  -b, --baseline PATH baseline report to compare stage times with (default DIR/%s)\n"
+		"  --no-baseline       compare outputs only, not stage times\n"
+		"  --max-regression PCT  fail when the %s stage is slower than baseline by PCT%% (default %g)\n"
+		"  --tol-position MM   coordinate tolerance (default %g)\n"
+		"  --tol-color N       rgb channel tolerance (default %d)\n"
+		"  --tol-ratio R       allowed ratio of out-of-tolerance points (default %g)\n"
+		"exit status is 3 when outputs differ from golden files or the stage time regressed.\n",
+		prog, ITERATIONS_DEFAULT, WARMUP_DEFAULT, BASELINE_NAME, BASELINE_NAME, REGRESSION_STAGE, MAX_REGRESSION_DEFAULT,
+		GoldenOutputs::Tolerance().position, GoldenOutputs::Tolerance().color, GoldenOutputs::Tolerance().mismatch_ratio);
+}
+
+bool parse_options(int argc,char **argv,BenchOptions *opts){
+	static const struct option long_options[] = {
+		{"iterations", required_argument, nullptr, 'n'},
+		{"warmup",     required_argument, nullptr, 'w'},
+		{"output",     required_argument, nullptr, 'o'},
+		{"trace",      required_argument, nullptr, 't'},
+		{"golden",         required_argument, nullptr, 'g'},
+		{"update-golden",  no_argument,       nullptr, 'u'},
+		{"baseline",       required_argument, nullptr, 'b'},
+		{"no-baseline",    no_argument,       nullptr, 'B'},
+		{"max-regression", required_argument, nullptr, 'R'},
+		{"tol-position",   required_argument, nullptr, 'P'},
+		{"tol-color",      required_argument, nullptr, 'C'},
+		{"tol-ratio",      required_argument, nullptr, 'X'},
+		{"help",       no_argument,       nullptr, 'h'},
+		{nullptr, 0, nullptr, 0}
+	};
+	int c;
+	while( (c = getopt_long(argc, argv, "n:w:o:t:g:ub:h", long_options, nullptr)) != -1 ){
+		switch( c ){
+		case 'n': opts->iterations = atoi(optarg); break;
+		case 'w': opts->warmup = atoi(optarg); break;
+		case 'o': opts->output_path = optarg; break;
+		case 't': opts->trace_path = optarg; break;
+		case 'g': opts->golden_dir = optarg; break;
+		case 'u': opts->update_golden = true; break;
+		case 'b': opts->baseline_path = optarg; break;
+		case 'B': opts->no_baseline = true; break;
+		case 'R': opts->max_regression = atof(optarg); break;
+		case 'P': opts->tolerance.position = atof(optarg); break;
+		case 'C': opts->tolerance.color = atoi(optarg); break;
+		case 'X': opts->tolerance.mismatch_ratio = atof(optarg); break;
+		default:  return false;
+		}
+	}
+	if( argc - optind < 2 || opts->iterations < 1 || opts->warmup < 0 ||
+		(opts->update_golden && opts->golden_dir.empty()) || opts->tolerance.position < 0 || opts->tolerance.mismatch_ratio < 0 ){
+		return false;
+	}
+	opts->dump_dir = argv[optind++];
+	while( optind < argc ){
+		opts->param_files.push_back(argv[optind++]);
+	}
+	return true;
+}
+
+//============================================= 無名名前空間  end  =============================================
+}
+
+int main(int argc, char **argv)
+{
+	BenchOptions opts;
+	if( ! parse_options(argc,argv,&opts) ){
+		usage(argv[0]);
+		return 2;
+	}
+	//YPCDataのメッセージのstamp用. マスターには繋がない
+	ros::Time::init();
+	Trace::set_enabled( ! opts.trace_path.empty() );
+	Trace::set_thread_name("genpc_bench");
+
+	YamlParams params;
+	for( const std::string &path : opts.param_files ){
+		std::string error;
+		if( ! params.load(path,&error) ){
+			LOG_INFO("%s",error.c_str());
+			return 1;
+		}
+	}
+
+	PatternDump dump;
+	if( ! load_pattern_dump(opts.dump_dir,&dump) ){
+		return 1;
+	}
+
+	YPCGeneratorStream pcgen;
+	PcGenMode mode = PCGEN_GRAYPS4;
+	if( ! setup_pcgen(params,dump,pcgen,&mode) ){
+		return 1;
+	}
+	const OutputSettings settings = load_output_settings(params);
+
+	YPCDataPool pool;
+	std::vector<int> points;
+	GoldenReport golden;
+	if( ! opts.golden_dir.empty() ){
+		//比較するのは計測前の最初のスキャン. 比較用の出力の作成は計測に含めない
+		std::vector<GoldenOutputs::Camera> outputs;
+		if( ! run_scan(pcgen,pool,dump,settings,-1,&points,&outputs) ){
+			return 1;
+		}
+		std::string error;
+		golden.enabled = true;
+		if( opts.update_golden ){
+			if( ! GoldenOutputs::save(opts.golden_dir,outputs,&error) ){
+				LOG_INFO("%s",error.c_str());
+				return 1;
+			}
+			golden.updated = true;
+			LOG_INFO("golden files updated. dir=%s",opts.golden_dir.c_str());
+		}else{
+			if( ! GoldenOutputs::compare(opts.golden_dir,outputs,opts.tolerance,&golden.results,&error) && ! error.empty() ){
+				LOG_INFO("%s",error.c_str());
+				return 1;
+			}
+			for( const GoldenOutputs::Result &result : golden.results ){
+				golden.passed = golden.passed && result.passed;
+				LOG_INFO("[%d] golden %s: %s, elements=%zu, mismatched=%zu, max_diff=%g %s",result.camno,result.name.c_str(),
+					result.passed ? "ok" : "NG",result.elements,result.mismatched,result.max_diff,result.detail.c_str());
+			}
+		}
+	}
+	for( int i = 0 ; i < opts.warmup ; i++ ){
+		if( ! run_scan(pcgen,pool,dump,settings,-1,&points) ){
+			return 1;
+		}
+	}
+	//ウォームアップ(バッファ確保、キャッシュ)分は集計に含めない
+	StageMetrics::clear();
+	Trace::clear();
+
+	ElapsedTimer tmr;
+	const auto bench_begin = std::chrono::steady_clock::now();
+	for( int i = 0 ; i < opts.iterations ; i++ ){
+		if( ! run_scan(pcgen,pool,dump,settings,i,&points) ){
+			return 1;
+		}
+	}
+	const double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - bench_begin).count();
+	LOG_INFO("benchmark finished. iterations=%d, points=%d, proc_tm=%d ms",opts.iterations,points[0],tmr.elapsed_ms());
+
+	if( ! opts.trace_path.empty() ){
+		int event_num = 0;
+		if( ! Trace::dump(opts.trace_path,"genpc_bench",&event_num) ){
+			LOG_INFO("trace dump failed. path=%s",opts.trace_path.c_str());
+		}else{
+			LOG_INFO("trace dumped. path=%s, events=%d",opts.trace_path.c_str(),event_num);
+		}
+	}
+	
+	BaselineReport baseline;
+	//--no-baselineの時は処理時間を比べない
+	std::string baseline_path = opts.no_baseline ? "" : opts.baseline_path;
+	if( baseline_path.empty() && ! opts.no_baseline && ! opts.golden_dir.empty() && ! opts.update_golden ){
+		struct stat st;
+		const std::string path = opts.golden_dir + "/" + BASELINE_NAME;
+		if( stat(path.c_str(),&st) == 0 ){
+			baseline_path = path;
+		}
+	}
+	if( ! baseline_path.empty() && ! compare_baseline(baseline_path,opts.max_regression,&baseline) ){
+		return 1;
+	}
+	
+	if( ! write_report(opts.output_path,opts,dump,mode,settings,elapsed_s,points,golden,baseline) ){
+		return 1;
+	}
+	if( opts.update_golden ){
+		const std::string path = opts.golden_dir + "/" + BASELINE_NAME;
+		if( ! write_report(path,opts,dump,mode,settings,elapsed_s,points,golden,BaselineReport()) ){
+			return 1;
+		}
+		LOG_INFO("baseline updated. path=%s",path.c_str());
+	}
+	if( ! golden.passed ){
+		LOG_INFO("outputs differ from golden files. dir=%s",opts.golden_dir.c_str());
+		return 3;
+	}else if( baseline.regressed ){
+		LOG_INFO("%s stage regressed more than %g%%. baseline=%s",REGRESSION_STAGE,opts.max_regression,baseline.path.c_str());
+		return 3;
+	}
+	return 0;
+}
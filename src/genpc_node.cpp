@@ -1,6 +1,10 @@
 #include <stdio.h>
 #include <map>
+#include <mutex>
+#include <thread>
+#include <boost/make_shared.hpp>
 #include <ros/ros.h>
+#include <ros/callback_queue.h>
 #include <std_srvs/Trigger.h>
 #include <std_msgs/String.h>
 #include <std_msgs/Int32.h>
@@ -11,17 +15,27 @@
 #include <opencv2/opencv.hpp>
 #include <cv_bridge/cv_bridge.h>
 #include <sensor_msgs/Image.h>
-#include <pcl/point_cloud.h>
-#include <pcl/io/ply_io.h>
-#include <pcl_ros/filters/voxel_grid.h>
-#include <pcl_conversions/pcl_conversions.h>
 #include "rovi/Floats.h"
 #include "rovi/GenPC.h"
+#include "rovi/PatternFrame.h"
+#include "rovi/PC2Quantization.h"
 
 #include "iPointCloudGenerator.hpp"
 #include "YPCGeneratorUnix.hpp"
+#include "YPCGeneratorStream.hpp"
 #include "YPCData.hpp"
+#include "PlyWriter.hpp"
+#include "VoxelGrid.hpp"
+#include "VoxelPyramid.hpp"
+#include "GenPCSettings.hpp"
+#include "DumpWriter.hpp"
+#include "PatternStream.hpp"
+#include "PhaseShiftParams.hpp"
 #include "ElapsedTimer.hpp"
+#include "Trace.hpp"
+#include "StageMetrics.hpp"
+#include "StageDiagnostics.hpp"
+#include "InProcessService.hpp"
 
 #define LOG_HEADER "(genpc) "
 
@@ -32,29 +46,67 @@ namespace {
 #define GET_CAMERA_LABEL(camno) (camno==0?'L':(camno==1?'R':'?'))
 constexpr int CAMERA_NUM = 2;
 
-std::unique_ptr<YPCGeneratorUnix> pcgen_ptr;
+std::unique_ptr<YPCGeneratorStream> pcgen_ptr;
+//左右並列生成時の右カメラ用点群生成器
+std::unique_ptr<YPCGeneratorStream> pcgen_r_ptr;
 	
-YPCData pcdata;
+YPCDataPool pcdata_pool;
 std::vector<sensor_msgs::PointCloud> pre_ptss(CAMERA_NUM);
+//再ボクセル化用. 前回スキャンのボクセルピラミッド
+std::vector<VoxelPyramid> pre_vx_pyramids(CAMERA_NUM);
+
+//file_dumpへの書き出し
+DumpWriter dump_writer;
+
+//nodeletで同じプロセスに載った場合、ycam3dからの直接呼び出しはycam3d側のスレッドで実行されるので、
+//サービス/タイマーのコールバックとはこれで排他する
+std::mutex genpc_mutex;
+//同一プロセス内呼び出し用に登録したサービス名(解決済み)
+std::string genpc_service_name;
 
 int cur_cam_width = -1;
 int cur_cam_height = -1;
 	
-/** 
- * PCGEN_SGBM = 0,  ///< SGBM
- * PCGEN_GRAYPS4,   ///< 位相シフト: Gray + 4step PS
- * PCGEN_MULTI,     ///< 位相シフト: マルチ
- **/
 //PcGenMode cur_pc_gen_mode = PCGEN_GRAYPS4;
-std::map<PcGenMode,std::string> PCGEN_MODE_MAP = {
-	{PCGEN_SGBM,"SGBM"},
-	{PCGEN_GRAYPS4,"Gray+4step_PS"},
-	{PCGEN_MULTI,"Multi"} 
-};
 
 std::string file_dump("/tmp/");
 bool isready = false;
 
+/**
+ * 点群生成器に最後に適用したパラメータ/キャリブレーションデータ.
+ * パラメータはgetParamCached(マスターの更新通知付きキャッシュ)で取得し、値が変わった時だけinit/create_camera_rawを呼ぶ.
+ */
+struct PcGenApplied {
+	bool params_valid = false;
+	std::map<std::string,double> params;
+	bool calib_valid = false;
+	std::vector<std::vector<double>> calib;
+};
+std::map<const YPCGeneratorUnix*,PcGenApplied> pcgen_applied;
+
+/**
+ * 1スキャン分の点群生成器の準備結果.
+ */
+struct ScanSetup {
+	bool calc_right_camera = false;
+	//右カメラを専用の点群生成器(pcgen_r_ptr)で並列に計算する
+	bool run_parallel = false;
+	int width = 0;
+	int height = 0;
+	std::vector<YPCGeneratorStream*> pcgens;
+};
+
+//パターン画像の逐次受信(pattern_frame). 受信は専用のキューとスレッドで行う
+PatternStream pattern_stream;
+ros::CallbackQueue stream_queue;
+std::unique_ptr<ros::AsyncSpinner> stream_spinner;
+ros::Subscriber sub_ptn_frame;
+//受信中のスキャンの準備結果と前処理の結果. pattern_stream.take()で引き取った後に参照する
+//いずれもgenpc_mutexで保護する. stream_scan_idは点群生成器がそのスキャンの画像を持っている間だけ0以外
+ScanSetup stream_setup;
+bool stream_preprocessed[CAMERA_NUM] = {false,false};
+uint32_t stream_scan_id = 0;
+
 ros::NodeHandle *nh = nullptr;
 //[0]左カメラ用、[1]右カメラ用
 ros::Publisher pub_ps_pointclouds[2];
@@ -63,46 +115,41 @@ ros::Publisher pub_depth_imgs[2];
 ros::Publisher pub_ps_alls[2];
 ros::Publisher pub_pcounts[2];
 ros::Publisher pub_ps_pointclouds2[2];
+ros::Publisher pub_ps_pc2_quants[2];
 	
 ros::Publisher pub_rep;
+ros::Publisher pub_dump_stat;
+ros::ServiceServer svs_dump_trace;
+ros::Publisher pub_diagnostics;
+ros::Timer metrics_timer;
+int metrics_publish_num = 0; //直近の分布の区間を入れ替えてからの出力回数
 	
 const bool STEREO_CAM_IMG_SAVE_DEFAULT = true;
+const int DUMP_QUEUE_SIZE_DEFAULT = DumpWriter::CAPACITY_DEFAULT;
+const std::string DUMP_QUEUE_POLICY_DEFAULT = "block";
+const bool CAMERA_PARALLEL_DEFAULT = false;
+const int PATTERN_STREAM_TIMEOUT_DEFAULT = 3000; //ms
+const int PATTERN_STREAM_QUEUE_SIZE = 64;
+const bool TRACE_ENABLED_DEFAULT = true;
+const std::string TRACE_DIR_DEFAULT = "/tmp";
+const float METRICS_INTERVAL_DEFAULT = 10; //sec
+const int METRICS_WINDOW_DEFAULT = 30; //出力周期の回数. /diagnosticsの分布はこの1～2倍の期間の値
 const bool PC_DATA_SAVE_DEFAULT = true;
 const bool PC_DATA2_SAVE_DEFAULT = false;
-const bool QUANTIZE_POINTS_COUNT_ENABLED_DEFAULT = true;
-const bool DEPTH_MAP_IMG_ENABELED_DEFAULT = true;
-
-const bool PC_DATA2_DENSE_DEFAULT = true;
-const bool PC_DATA2_ENABLED_DEFAULT = false;
+//点群変換/ボクセル化の既定値はgenpc_benchと共通(GenPCSettings.hpp)
 
 const bool VOXELIZED_PC_DATA_SAVE_ENABELED_DEFAULT = false;
-const float VOXEL_LEAF_MIN_SIZE     = 0.001f;
-const float VOXEL_LEAF_SIZE_DEFAULT = 1.0f;
-const float VOXEL_LEAF_SIZE_INVALID = 0.0f;
 
 const float RE_VOXEL_INTERVAL_DEFAULT = 0.1;
 const float RE_VOXEL_MIN_INTERVAL     = 0.0001;
 const bool  RE_VOXEL_ENABLED_DEFAULT  = false;
+const float RE_VOXEL_BASE_LEAF_DEFAULT = 0.25;
 	
 std::vector<double> vecQ;
 std::vector<double> cam_K;
 bool pre_quantize_points_count_enabled=false;
 
 
-struct VoxelLeafSize {
-	float x=VOXEL_LEAF_SIZE_INVALID;
-	float y=VOXEL_LEAF_SIZE_INVALID;
-	float z=VOXEL_LEAF_SIZE_INVALID;
-	
-	bool operator == (const VoxelLeafSize &obj){
-		return this->x == obj.x && this->y == obj.y && this->z == obj.z;
-	}
-	
-	bool is_disabled() const{
-		return  x == VOXEL_LEAF_SIZE_INVALID && y == VOXEL_LEAF_SIZE_INVALID && z == VOXEL_LEAF_SIZE_INVALID; 
-	}
-};
-
 VoxelLeafSize pre_vx_leaf_size;
 
 
@@ -136,22 +183,74 @@ struct CamCalibMat {
 
 void set_ps_params(std::map<std::string,double> &params,const std::string &src_key,const std::string &dst_key,const double defaultVal){
 	double val=defaultVal;
-	nh->getParam(src_key,val);
+	nh->getParamCached(src_key,val);
 	params[dst_key]=val;
 }
 
 template<typename T>
 T get_param(const std::string &key,const T defaultVal){
 	T val=defaultVal;
-	if( ! nh->getParam(key,val) ){
+	if( ! nh->getParamCached(key,val) ){
 		ROS_ERROR(LOG_HEADER"ros param get failed. key=%s",key.c_str());
 	}
 	return val;
 }
 
-struct XYZW{ float x,y,z,w;};
+//作成済みの点群生成器
+std::vector<YPCGeneratorUnix*> get_pcgens(){
+	std::vector<YPCGeneratorUnix*> pcgens;
+	if( pcgen_ptr ){
+		pcgens.push_back(pcgen_ptr.get());
+	}
+	if( pcgen_r_ptr ){
+		pcgens.push_back(pcgen_r_ptr.get());
+	}
+	return pcgens;
+}
+
+bool create_pcgen(std::unique_ptr<YPCGeneratorStream> &pcgen,const char *label){
+	pcgen_applied.erase(pcgen.get());
+	pcgen.reset(new YPCGeneratorStream());
+	pcgen_applied.erase(pcgen.get());
+	//途中で変えないこと
+	const PcGenMode pc_gen_mode = (PcGenMode)get_param<int>("pshift_genpc/calc/pcgen_mode",(int)PCGEN_GRAYPS4);
+	
+	if( ! pcgen->create_pcgen(pc_gen_mode) ){
+		ROS_ERROR(LOG_HEADER"point cloud generator create failed. %s",label);
+		pcgen.reset();
+		return false;
+	}
+	ROS_INFO(LOG_HEADER"Point Cloud Generator Created. %s mode=%d (%s)",label,pc_gen_mode,PCGEN_MODE_MAP[pc_gen_mode].c_str());
+	return true;
+}
+
+void configure_dump_writer(){
+	dump_writer.set_capacity(get_param<int>("genpc/dump_queue/size",DUMP_QUEUE_SIZE_DEFAULT));
+	
+	const std::string policy_name = get_param<std::string>("genpc/dump_queue/policy",DUMP_QUEUE_POLICY_DEFAULT);
+	DumpWriter::Policy policy = DumpWriter::POLICY_BLOCK;
+	if( ! DumpWriter::parse_policy(policy_name,&policy) ){
+		ROS_ERROR(LOG_HEADER"unknown dump queue policy. policy=%s",policy_name.c_str());
+	}
+	dump_writer.set_policy(policy);
+}
 
-bool operator<(const XYZW& left, const XYZW& right){ return left.w < right.w;}
+//書き出しキューの状態をpub_repと同じ辞書形式の文字列で出力します
+void publish_dump_stats(const DumpWriter::Stats &stats){
+	const uint64_t done = stats.written + stats.failed;
+	char s[256];
+	snprintf(s,sizeof(s),"{'queue':%d, 'capacity':%d, 'written':%llu, 'failed':%llu, 'dropped':%llu, 'skipped':%llu, 'write_ms':%d, 'latency_ms':%d, 'max_write_ms':%d, 'avg_write_ms':%.1f}",
+		stats.queue_depth, stats.capacity,
+		(unsigned long long)stats.written, (unsigned long long)stats.failed,
+		(unsigned long long)stats.dropped, (unsigned long long)stats.skipped,
+		stats.last_write_ms, stats.last_latency_ms, stats.max_write_ms,
+		done == 0 ? 0.0 : stats.total_write_ms / done);
+	std_msgs::String msg;
+	msg.data=s;
+	pub_dump_stat.publish(msg);
+	
+	StageMetrics::record("genpc/save",stats.last_write_ms);
+}
 
 bool load_phase_shift_params()
 {
@@ -160,85 +259,90 @@ bool load_phase_shift_params()
 	std::map<std::string,double> params;
 	{
 		int prm_width=0;
-		if(nh->getParam("pshift_genpc/calc/image_width",prm_width) && prm_width != cur_cam_width){
+		if(nh->getParamCached("pshift_genpc/calc/image_width",prm_width) && prm_width != cur_cam_width){
 			ROS_ERROR(LOG_HEADER"param image width different. cur_cam_width=%d param_width=%d",cur_cam_width,prm_width);
 			return false;
 		}
 		
 		int prm_height=0;
-		if(nh->getParam("pshift_genpc/calc/image_height",prm_height) && prm_height != cur_cam_height){
+		if(nh->getParamCached("pshift_genpc/calc/image_height",prm_height) && prm_height != cur_cam_height){
 			ROS_ERROR(LOG_HEADER"param image height different. cur_cam_height=%d param_height=%d",cur_cam_height,prm_height);
 			return false;
 		}
 	}
 	
-	set_ps_params(params,"pshift_genpc/calc/method3d", "method3d", 0);
-	set_ps_params(params,"pshift_genpc/calc/camera_type", "camera_type", 2);
-	set_ps_params(params,"pshift_genpc/calc/bw_diff", "bw_diff", 16);
-	set_ps_params(params,"pshift_genpc/calc/brightness", "brightness", 256);
-	set_ps_params(params,"pshift_genpc/calc/darkness", "darkness", 16);
-	set_ps_params(params,"pshift_genpc/calc/phase_wd_min", "phase_wd_min", 8);
-	set_ps_params(params,"pshift_genpc/calc/phase_wd_thr", "phase_wd_thr", 3);
-	set_ps_params(params,"pshift_genpc/calc/gcode_variation", "gcode_variation", 2);
-	set_ps_params(params,"pshift_genpc/calc/max_ph_diff", "max_ph_diff", 1.0);
-	set_ps_params(params,"pshift_genpc/calc/max_parallax", "max_parallax", 300);
-	set_ps_params(params,"pshift_genpc/calc/min_parallax", "min_parallax", -200);
-	set_ps_params(params,"pshift_genpc/calc/ls_points", "ls_points", 3);
-	set_ps_params(params,"pshift_genpc/calc/n_phaseshift", "n_phaseshift", 4);
-	set_ps_params(params,"pshift_genpc/calc/n_periods", "n_periods", 3);
-	set_ps_params(params,"pshift_genpc/calc/period0", "period0", 9);
-	set_ps_params(params,"pshift_genpc/calc/period1", "period1", 10);
-	set_ps_params(params,"pshift_genpc/calc/period2", "period2", 11);
-	set_ps_params(params,"pshift_genpc/calc/interpolation", "interpolation", 0);
+	for( const PhaseShiftParam &param : phase_shift_params() ){
+		set_ps_params(params,phase_shift_param_key(param),param.key,param.default_value);
+	}
 	
 	params["image_width"]=cur_cam_width;
 	params["image_height"]=cur_cam_height;
+	const int fetch_tm = tmr.elapsed_ms();
+	
+	//前回initした値と同じ点群生成器はinitを省く
+	std::vector<YPCGeneratorUnix*> init_pcgens;
+	for( YPCGeneratorUnix *pcgen : get_pcgens() ){
+		const PcGenApplied &applied = pcgen_applied[pcgen];
+		if( ! applied.params_valid || applied.params != params ){
+			init_pcgens.push_back(pcgen);
+		}
+	}
 	
-	for(std::map<std::string,double>::iterator it=params.begin();it!=params.end();++it){
-		ROS_INFO(LOG_HEADER"<phsft> %s=%g",it->first.c_str(),it->second);
+	if( ! init_pcgens.empty() ){
+		for(std::map<std::string,double>::iterator it=params.begin();it!=params.end();++it){
+			ROS_INFO(LOG_HEADER"<phsft> %s=%g",it->first.c_str(),it->second);
+		}
 	}
 	
-	if ( ! pcgen_ptr->init(params) ) {
-		ROS_ERROR(LOG_HEADER"phase shift parameter reload failed.");
-		return false;
+	ElapsedTimer tmr_init;
+	for( YPCGeneratorUnix *pcgen : init_pcgens ){
+		PcGenApplied &applied = pcgen_applied[pcgen];
+		applied.params_valid = false;
+		if ( ! pcgen->init(params) ) {
+			ROS_ERROR(LOG_HEADER"phase shift parameter reload failed.");
+			return false;
+		}
+		applied.params = params;
+		applied.params_valid = true;
 	}
+	const int init_tm = tmr_init.elapsed_ms();
 	
-	nh->getParam("genpc/Q", vecQ); 
+	nh->getParamCached("genpc/Q", vecQ); 
 	if (vecQ.size() != 16){
 		ROS_ERROR(LOG_HEADER"Param Q NG");
 		return false;
 	}
-	nh->getParam("left/remap/K", cam_K);
+	nh->getParamCached("left/remap/K", cam_K);
 	if (cam_K.size() != 9){
 		ROS_ERROR(LOG_HEADER"Param K NG");
 		return false;
 	}
 	{
 		int remap_width=0;
-		if(nh->getParam("left/remap/width", remap_width) && remap_width != cur_cam_width){
+		if(nh->getParamCached("left/remap/width", remap_width) && remap_width != cur_cam_width){
 			ROS_ERROR(LOG_HEADER"remap image width different. cur_cam_width=%d remap_width=%d",cur_cam_width,remap_width);
 			return false;
 		}
 		
 		int remap_height=0;
-		if(nh->getParam("left/remap/height", remap_height) && remap_height != cur_cam_height){
+		if(nh->getParamCached("left/remap/height", remap_height) && remap_height != cur_cam_height){
 			ROS_ERROR(LOG_HEADER"remap image height different. cur_cam_width=%d remap_height=%d",cur_cam_height,remap_height);
 			return false;
 		}
 	}
 	
-	if(nh->hasParam("genpc/dump")) nh->getParam("genpc/dump",file_dump);
-	else file_dump="";
+	if( ! nh->getParamCached("genpc/dump",file_dump) ) file_dump="";
 	
 	if (vecQ.size() != 16){
 		ROS_ERROR(LOG_HEADER"Param Q NG");
 		return false;
 	}
-	ROS_INFO(LOG_HEADER"phase shift parameter load finished. proc_tm=%d ms",tmr.elapsed_ms());
+	ROS_INFO(LOG_HEADER"phase shift parameter load finished. fetch_tm=%d ms, init=%d (skipped=%d), init_tm=%d ms, proc_tm=%d ms",
+		fetch_tm,(int)init_pcgens.size(),(int)(get_pcgens().size()-init_pcgens.size()),init_tm,tmr.elapsed_ms());
 	return true;
 }
 
-bool load_camera_calib_data(){
+bool load_camera_calib_data(const std::vector<YPCGeneratorUnix*> &pcgens){
 	ROS_INFO(LOG_HEADER"camera calibration data load start.");
 	ElapsedTimer tmr;
 	
@@ -250,73 +354,73 @@ bool load_camera_calib_data(){
 	CamCalibMat Dr;
 	CamCalibMat R;
 	CamCalibMat T;
-	if( ! nh->getParam("left/genpc/K_Cols",Kl.cols) ){
+	if( ! nh->getParamCached("left/genpc/K_Cols",Kl.cols) ){
 		ROS_ERROR(LOG_HEADER"param read failed. cam=left, key=K_Cols");
 		
-	}else if( ! nh->getParam("left/genpc/K_Rows",Kl.rows) ){
+	}else if( ! nh->getParamCached("left/genpc/K_Rows",Kl.rows) ){
 		ROS_ERROR(LOG_HEADER"param read failed. cam=left, key=K_Rows");
 		
-	}else if( ! nh->getParam("left/genpc/K",Kl.values) ){
+	}else if( ! nh->getParamCached("left/genpc/K",Kl.values) ){
 		ROS_ERROR(LOG_HEADER"param read failed. cam=left, key=K");
 		
 	}else if( ! Kl.validate() ){
 		ROS_ERROR(LOG_HEADER"K matrix is wrong. cam=left %s", Kl.to_string().c_str());
 		
-	}else if( ! nh->getParam("left/genpc/D_Cols",Dl.cols) ){
+	}else if( ! nh->getParamCached("left/genpc/D_Cols",Dl.cols) ){
 		ROS_ERROR(LOG_HEADER"param read failed. cam=left, key=D_Cols");
 		
-	}else if( ! nh->getParam("left/genpc/D_Rows",Dl.rows) ){
+	}else if( ! nh->getParamCached("left/genpc/D_Rows",Dl.rows) ){
 		ROS_ERROR(LOG_HEADER"param read failed. cam=left, key=D_Rows");
 		
-	}else if( ! nh->getParam("left/genpc/D",Dl.values) ){
+	}else if( ! nh->getParamCached("left/genpc/D",Dl.values) ){
 		ROS_ERROR(LOG_HEADER"param read failed. cam=left, key=D");
 		
 	}else if( ! Kl.validate() ){
 		ROS_ERROR(LOG_HEADER"D matix is wrong. cam=left %s", Dl.to_string().c_str());
 		
-	}else if( ! nh->getParam("right/genpc/K_Cols",Kr.cols) ){
+	}else if( ! nh->getParamCached("right/genpc/K_Cols",Kr.cols) ){
 		ROS_ERROR(LOG_HEADER"param read failed. cam=right, key=K_Cols");
 		
-	}else if( ! nh->getParam("right/genpc/K_Rows",Kr.rows) ){
+	}else if( ! nh->getParamCached("right/genpc/K_Rows",Kr.rows) ){
 		ROS_ERROR(LOG_HEADER"param read failed. cam=right, key=K_Rows");
 		
-	}else if( ! nh->getParam("right/genpc/K",Kr.values) ){
+	}else if( ! nh->getParamCached("right/genpc/K",Kr.values) ){
 		ROS_ERROR(LOG_HEADER"param read failed. cam=right, key=K");
 		
 	}else if( ! Kr.validate() ){
 		ROS_ERROR(LOG_HEADER"K matrix is wrong. cam=right %s", Kr.to_string().c_str());
 		
-	}else if( ! nh->getParam("right/genpc/D_Cols",Dr.cols) ){
+	}else if( ! nh->getParamCached("right/genpc/D_Cols",Dr.cols) ){
 		ROS_ERROR(LOG_HEADER"param read failed. cam=right, key=D_Cols");
 		
-	}else if( ! nh->getParam("right/genpc/D_Rows",Dr.rows) ){
+	}else if( ! nh->getParamCached("right/genpc/D_Rows",Dr.rows) ){
 		ROS_ERROR(LOG_HEADER"param read failed. cam=right, key=D_Rows");
 		
-	}else if( ! nh->getParam("right/genpc/D",Dr.values) ){
+	}else if( ! nh->getParamCached("right/genpc/D",Dr.values) ){
 		ROS_ERROR(LOG_HEADER"param read failed. cam=right, key=D");
 		
 	}else if( ! Dr.validate() ){
 		ROS_ERROR(LOG_HEADER"D matix is wrong. cam=right %s", Dr.to_string().c_str());
 		
-	}else if( ! nh->getParam("right/genpc/R_Cols",R.cols) ){
+	}else if( ! nh->getParamCached("right/genpc/R_Cols",R.cols) ){
 		ROS_ERROR(LOG_HEADER"param read failed. cam=right, key=R_Cols");
 		
-	}else if( ! nh->getParam("right/genpc/R_Rows",R.rows) ){
+	}else if( ! nh->getParamCached("right/genpc/R_Rows",R.rows) ){
 		ROS_ERROR(LOG_HEADER"param read failed. cam=right, key=R_Rows");
 		
-	}else if( ! nh->getParam("right/genpc/R",R.values) ){
+	}else if( ! nh->getParamCached("right/genpc/R",R.values) ){
 		ROS_ERROR(LOG_HEADER"param read failed. cam=right, key=R");
 		
 	}else if( ! R.validate() ){
 		ROS_ERROR(LOG_HEADER"R matrix is wrong. cam=right %s", R.to_string().c_str());
 		
-	}else if( ! nh->getParam("right/genpc/T_Cols",T.cols) ){
+	}else if( ! nh->getParamCached("right/genpc/T_Cols",T.cols) ){
 		ROS_ERROR(LOG_HEADER"param read failed. cam=right, key=T_Cols");
 		
-	}else if( ! nh->getParam("right/genpc/T_Rows",T.rows) ){
+	}else if( ! nh->getParamCached("right/genpc/T_Rows",T.rows) ){
 		ROS_ERROR(LOG_HEADER"param read failed. cam=right, key=T_Rows");
 		
-	}else if( ! nh->getParam("right/genpc/T",T.values) ){
+	}else if( ! nh->getParamCached("right/genpc/T",T.values) ){
 		ROS_ERROR(LOG_HEADER"param read failed. cam=right, key=T");
 		
 	}else if( ! T.validate() ){
@@ -324,25 +428,124 @@ bool load_camera_calib_data(){
 		
 	}
 	
-	ROS_INFO(LOG_HEADER"(calib) <left>  K %s",Kl.to_string().c_str());
-	ROS_INFO(LOG_HEADER"(calib) <left>  D %s",Dl.to_string().c_str());
-	ROS_INFO(LOG_HEADER"(calib) <right> K %s",Kr.to_string().c_str());
-	ROS_INFO(LOG_HEADER"(calib) <right> D %s",Dr.to_string().c_str());
+	const int fetch_tm = tmr.elapsed_ms();
 	
-	ROS_INFO(LOG_HEADER"(calib)         R %s",R.to_string().c_str());
-	ROS_INFO(LOG_HEADER"(calib)         T %s",T.to_string().c_str());
+	//前回と同じキャリブレーションデータでステレオカメラを作成済みの点群生成器は作成を省く
+	const std::vector<std::vector<double>> calib = { Kl.values, Kr.values, Dl.values, Dr.values, R.values, T.values };
+	std::vector<YPCGeneratorUnix*> create_pcgens;
+	for( YPCGeneratorUnix *pcgen : pcgens ){
+		const PcGenApplied &applied = pcgen_applied[pcgen];
+		if( ! applied.calib_valid || applied.calib != calib ){
+			create_pcgens.push_back(pcgen);
+		}
+	}
 	
-	if( ! pcgen_ptr->create_camera_raw(Kl.values,Kr.values,Dl.values,Dr.values,R.values,T.values) ){
-		ROS_ERROR(LOG_HEADER"stereo camera create failed.");
-	}else{
-		ret=true;
+	if( ! create_pcgens.empty() ){
+		ROS_INFO(LOG_HEADER"(calib) <left>  K %s",Kl.to_string().c_str());
+		ROS_INFO(LOG_HEADER"(calib) <left>  D %s",Dl.to_string().c_str());
+		ROS_INFO(LOG_HEADER"(calib) <right> K %s",Kr.to_string().c_str());
+		ROS_INFO(LOG_HEADER"(calib) <right> D %s",Dr.to_string().c_str());
+		
+		ROS_INFO(LOG_HEADER"(calib)         R %s",R.to_string().c_str());
+		ROS_INFO(LOG_HEADER"(calib)         T %s",T.to_string().c_str());
+	}
+	
+	ElapsedTimer tmr_create;
+	ret = true;
+	for( YPCGeneratorUnix *pcgen : create_pcgens ){
+		PcGenApplied &applied = pcgen_applied[pcgen];
+		applied.calib_valid = false;
+		if( ! pcgen->create_camera_raw(Kl.values,Kr.values,Dl.values,Dr.values,R.values,T.values) ){
+			ROS_ERROR(LOG_HEADER"stereo camera create failed.");
+			ret=false;
+			break;
+		}
+		applied.calib = calib;
+		applied.calib_valid = true;
 	}
-	ROS_INFO(LOG_HEADER"camera calibration data load finished. proc_tm=%d ms",tmr.elapsed_ms() );
+	ROS_INFO(LOG_HEADER"camera calibration data load finished. fetch_tm=%d ms, create=%d (skipped=%d), create_tm=%d ms, proc_tm=%d ms",
+		fetch_tm,(int)create_pcgens.size(),(int)(pcgens.size()-create_pcgens.size()),tmr_create.elapsed_ms(),tmr.elapsed_ms() );
 	
 	return ret;
 }
 
-bool load_pattern_images(const rovi::GenPC::Request &req){
+/**
+ * 行詰め(step==width)のMONO8画像を、メッセージのバッファを参照するcv::Matにします.
+ * 点群生成器には画像の先頭アドレスしか渡せないので、行に詰め物のある画像は対象外.
+ */
+bool wrap_mono8_image(const sensor_msgs::Image &msg,cv::Mat &img){
+	if( msg.encoding != sensor_msgs::image_encodings::MONO8 && msg.encoding != sensor_msgs::image_encodings::TYPE_8UC1 ){
+		return false;
+	}else if( msg.step != msg.width || msg.data.size() < (size_t)msg.step * msg.height ){
+		return false;
+	}
+	img = cv::Mat(msg.height, msg.width, CV_8UC1, const_cast<unsigned char*>(msg.data.data()), msg.step);
+	return true;
+}
+
+/**
+ * 1セット分のパターン画像(左0, 右0, 左1, 右1, ... の順)を書き出しスレッドへ渡します.
+ * @param holder save_imgsが参照しているバッファの持ち主. 書き終わるまで保持する(複製済みならnullptr)
+ */
+void dump_pattern_images(const int n,const int ptnCaptNum,const std::vector<cv::Mat> &save_imgs,const boost::shared_ptr<const void> &holder){
+	const std::string dump_dir = file_dump;
+	const int ptnImageNum = save_imgs.size() / 2;
+	dump_writer.push("<" + std::to_string(n) + "> pattern images", [n,ptnCaptNum,ptnImageNum,save_imgs,holder,dump_dir](){
+		ElapsedTimer tmr_save;
+		ROS_INFO(LOG_HEADER"<%d> pattern images save start. save_path=%s",n,dump_dir.c_str());
+		bool saved=true;
+		int img_idx=0;
+		
+		for (int i = 0 ; i < ptnImageNum ; i++) {
+			if( ptnCaptNum < 2 ){
+				saved &= cv::imwrite(cv::format((dump_dir + "/capt%02d_0.pgm").c_str(), i), save_imgs.at(img_idx) );
+			}else{
+				saved &= cv::imwrite(cv::format((dump_dir + "/hdr_%d_capt%02d_0.pgm").c_str(),n, i), save_imgs.at(img_idx) );
+			}
+			img_idx++;
+			
+			if( ptnCaptNum < 2 ){
+				saved &= cv::imwrite(cv::format((dump_dir + "/capt%02d_1.pgm").c_str(), i), save_imgs.at(img_idx) );
+			}else{
+				saved &= cv::imwrite(cv::format((dump_dir + "/hdr_%d_capt%02d_1.pgm").c_str(),n,i), save_imgs.at(img_idx) );
+			}
+			img_idx++;
+		}
+		
+		ROS_INFO(LOG_HEADER"<%d> pattern images save finished. proc_tm=%d ms",n,tmr_save.elapsed_ms());
+		return saved;
+	});
+}
+
+//captseq.logの1行. 末尾は左画像の撮影時刻[s](ycam3dのリプレイで撮影間隔の再現に使う)
+std::string captseq_line(const int n,const int ptnCaptNum,const int i,const uint32_t seq_l,const uint32_t seq_r,const double stamp){
+	char line[96];
+	if( ptnCaptNum < 2 ){
+		snprintf(line,sizeof(line),"(%d) %d %d %.6f\n", i, seq_l, seq_r, stamp);
+	}else{
+		snprintf(line,sizeof(line),"[%d] (%d) %d %d %.6f\n", n, i, seq_l, seq_r, stamp);
+	}
+	return line;
+}
+
+void dump_captseq(const std::string &captseq){
+	const std::string captseq_path = file_dump + "/captseq.log";
+	dump_writer.push("captseq.log", [captseq_path,captseq](){
+		FILE *f_captseq = fopen(captseq_path.c_str(), "w");
+		if( ! f_captseq ){
+			ROS_ERROR(LOG_HEADER"captseq.log open failed. path=%s",captseq_path.c_str());
+			return false;
+		}
+		const bool written = fwrite(captseq.data(), 1, captseq.size(), f_captseq) == captseq.size();
+		return fclose(f_captseq) == 0 && written;
+	});
+}
+
+/**
+ * パターン画像の変換/保存は1回だけ行い、同じ画像を各点群生成器へ渡します.
+ */
+bool load_pattern_images(const rovi::GenPC::Request &req,const std::vector<YPCGeneratorStream*> &pcgens){
+	TraceSpan trace_span("load_pattern_images");
 	
 	const int ptnCaptNum=req.ptn_capt_num < 1 ? 1 : req.ptn_capt_num;
 	const int ptnImageNum = req.imgL.size()/ptnCaptNum;
@@ -353,102 +556,107 @@ bool load_pattern_images(const rovi::GenPC::Request &req){
 	bool ret=true;
 	const bool ptn_image_save_flg = get_param<bool>("genpc/point_cloud/img_save",STEREO_CAM_IMG_SAVE_DEFAULT);
 	
-	FILE *f_captseq =nullptr;
+	//captseq.logの内容. 最後にまとめて書き出しスレッドへ渡す
+	std::string captseq;
+	bool captseq_enabled=false;
 	
 	for( int n = 0 ; n < ptnCaptNum ; n++ ){
-		std::vector<cv::Mat> ptn_imgs;
-		std::vector<unsigned char*> ptn_img_pointers;
+		//左0, 右0, 左1, 右1, ... の順
+		const int ptn_img_count = ptnImageNum * 2;
+		std::vector<cv::Mat> ptn_imgs(ptn_img_count);
+		std::vector<unsigned char*> ptn_img_pointers(ptn_img_count);
+		//メッセージのバッファを参照している画像
+		std::vector<char> ptn_img_wrapped(ptn_img_count,0);
+		std::vector<std::string> ptn_img_errors(ptn_img_count);
 		
 		tmr.start_lap();
 		ROS_INFO(LOG_HEADER"<%d> pattern image convert start.",n);
+		TraceSpan trace_convert("pattern_image_convert",n);
 		
-		bool all_img_cnv_flg=true;
-		for (int i = 0; i < ptnImageNum ; i++ ){
-			const int idx = n * ptnImageNum + i;
-			//ROS_WARN(LOG_HEADER"n=%d i=%d idx=%d", n, i, idx);
+		//MONO8の画像はリクエストのバッファをそのまま使い、それ以外だけ並列に変換する
+		int wrapped_count=0;
+		#pragma omp parallel for schedule(dynamic) reduction(+:wrapped_count)
+		for (int k = 0; k < ptn_img_count ; k++ ){
+			const int idx = n * ptnImageNum + k / 2;
+			const sensor_msgs::Image &msg = ( k % 2 == 0 ) ? req.imgL[idx] : req.imgR[idx];
 			
-			try {
-				cv::Mat img = cv_bridge::toCvCopy(req.imgL[idx], sensor_msgs::image_encodings::MONO8)->image;
-				//ROS_INFO(LOG_HEADER"[%d] #%2d left  size=%dx%d",n,i,img.cols,img.rows);
-				ptn_imgs.push_back(img);
-				ptn_img_pointers.push_back(ptn_imgs.back().data);
-				
-				img = cv_bridge::toCvCopy(req.imgR[idx], sensor_msgs::image_encodings::MONO8)->image;
-				//ROS_INFO(LOG_HEADER"[%d] #%2d right size=%dx%d",n,i,img.cols,img.rows);
-
-				ptn_imgs.push_back(img);
-				ptn_img_pointers.push_back(ptn_imgs.back().data);
-			}catch( cv_bridge::Exception& e ){
+			if( wrap_mono8_image(msg,ptn_imgs[k]) ){
+				ptn_img_wrapped[k] = 1;
+				++wrapped_count;
+			}else{
+				try {
+					ptn_imgs[k] = cv_bridge::toCvCopy(msg, sensor_msgs::image_encodings::MONO8)->image;
+				}catch( cv_bridge::Exception& e ){
+					ptn_img_errors[k] = e.what();
+				}
+			}
+			ptn_img_pointers[k] = ptn_imgs[k].data;
+		}
+		
+		bool all_img_cnv_flg=true;
+		for (int k = 0; k < ptn_img_count ; k++ ){
+			if( ! ptn_img_errors[k].empty() ){
 				ROS_ERROR(LOG_HEADER"<%d> error:pattern image convert failed. ptn_img_idx=%d, cv_bridge:exception: %s",
-					n,i, e.what());
+					n,k / 2, ptn_img_errors[k].c_str());
 				all_img_cnv_flg=false;
 				break;
 			}
 		}
 		
+		trace_convert.end();
+		
 		if( ! all_img_cnv_flg ){
 			break;
 		}else{
-			ROS_INFO(LOG_HEADER"<%d> pattern image convert finished. proc_tm=%d ms",n,tmr.elapsed_lap_ms());
+			tmr.record_lap("genpc/image_convert");
+			ROS_INFO(LOG_HEADER"<%d> pattern image convert finished. wrapped=%d, converted=%d, proc_tm=%d ms",
+				n,wrapped_count,ptn_img_count-wrapped_count,tmr.elapsed_lap_ms());
 		}
 		
-		//撮影画像保存
+		//撮影画像保存. 画像はcv::Matの参照カウントで書き出しスレッドへ渡す
+		//リクエストのバッファを参照している画像は応答後に無くなるので、保存する時だけ複製する
 		if( ! file_dump.empty() ) {
 			if( ptn_image_save_flg ){
-				tmr.start_lap();
-				ROS_INFO(LOG_HEADER"<%d> pattern images save start. save_path=%s",n,file_dump.c_str());
-				int img_idx=0;
-			
-				for (int i = 0 ; i < ptnImageNum ; i++) {
-					const int idx = i * 2;
-					//ROS_WARN(LOG_HEADER"n=%d i=%d idx=%d", n, i, idx);
-					if( ptnCaptNum < 2 ){
-						cv::imwrite(cv::format((file_dump + "/capt%02d_0.pgm").c_str(), i), ptn_imgs.at(img_idx) );
-					}else{
-						cv::imwrite(cv::format((file_dump + "/hdr_%d_capt%02d_0.pgm").c_str(),n, i), ptn_imgs.at(img_idx) );
-					}
-					img_idx++;
-					
-					if( ptnCaptNum < 2 ){
-						cv::imwrite(cv::format((file_dump + "/capt%02d_1.pgm").c_str(), i), ptn_imgs.at(img_idx) );
-					}else{
-						cv::imwrite(cv::format((file_dump + "/hdr_%d_capt%02d_1.pgm").c_str(),n,i), ptn_imgs.at(img_idx) );
+				std::vector<cv::Mat> save_imgs(ptn_imgs);
+				#pragma omp parallel for schedule(dynamic)
+				for (int k = 0; k < ptn_img_count ; k++ ){
+					if( ptn_img_wrapped[k] ){
+						save_imgs[k] = ptn_imgs[k].clone();
 					}
-					img_idx++;
 				}
-				
-				ROS_INFO(LOG_HEADER"<%d> pattern images save finished. proc_tm=%d ms",n,tmr.elapsed_lap_ms());
+				dump_pattern_images(n,ptnCaptNum,save_imgs,nullptr);
 			}
 			
-			if( ! f_captseq ){
-				f_captseq = fopen((file_dump+"/captseq.log").c_str(), "w");
-			}
+			captseq_enabled=true;
 			//for(int j=0; j < ptnImageNum ; j++) {
 			//	fprintf(f,"(%d) %d %d\n", j, req.imgL[j].header.seq, req.imgR[j].header.seq);
 			//}
 			for (int i = 0; i < ptnImageNum ; i++ ){
 				const int idx = n * ptnImageNum + i;
-				if( ptnCaptNum < 2 ){
-					fprintf(f_captseq,"(%d) %d %d\n", i, req.imgL[idx].header.seq, req.imgR[idx].header.seq);
-				}else{
-					fprintf(f_captseq,"[%d] (%d) %d %d\n", n, i, req.imgL[idx].header.seq, req.imgR[idx].header.seq);
-				}
+				captseq += captseq_line(n,ptnCaptNum,i,req.imgL[idx].header.seq,req.imgR[idx].header.seq,req.imgL[idx].header.stamp.toSec());
 			}
 		}
 		
 		
 		tmr.start_lap();
 		ROS_INFO(LOG_HEADER"<%d> point cloud generator pattern image load start.",n);
-		if( ! pcgen_ptr->set_images(ptn_img_pointers) ){
-			ROS_ERROR(LOG_HEADER"<%d> error: point cloud generator pattern image load failed.",n);
-			ret=false;
+		TraceSpan trace_set_images("set_images",n);
+		for( YPCGeneratorStream *pcgen : pcgens ){
+			if( ! pcgen->set_images(ptn_img_pointers) ){
+				ROS_ERROR(LOG_HEADER"<%d> error: point cloud generator pattern image load failed.",n);
+				ret=false;
+				break;
+			}
+		}
+		if( ! ret ){
 			break;
 		}else{
+			tmr.record_lap("genpc/set_images");
 			ROS_INFO(LOG_HEADER"<%d> point cloud generator pattern image load finished. proc_tm=%d ms",n,tmr.elapsed_lap_ms());
 		}
 	}
-	if( f_captseq ){
-		fclose(f_captseq);
+	if( captseq_enabled ){
+		dump_captseq(captseq);
 	}
 	
 	if( ! ret ){
@@ -460,185 +668,88 @@ bool load_pattern_images(const rovi::GenPC::Request &req){
 	return ret;
 }
 
-VoxelLeafSize get_voxel_leaf_size(){
-	VoxelLeafSize leaf_size;
-	leaf_size.x = get_param<float>("genpc/voxelize/leaf_size/x",VOXEL_LEAF_SIZE_DEFAULT);
-	leaf_size.y = get_param<float>("genpc/voxelize/leaf_size/y",VOXEL_LEAF_SIZE_DEFAULT);
-	leaf_size.z = get_param<float>("genpc/voxelize/leaf_size/z",VOXEL_LEAF_SIZE_DEFAULT);
-	
-	if( leaf_size.is_disabled() ){
-		//voxelization disabled
-	}else{
-		const float vx_leaf_v = get_param<float>("genpc/voxelize/leaf_size/v",0);
-		
-		leaf_size.x = std::max( vx_leaf_v , std::max( leaf_size.x , VOXEL_LEAF_MIN_SIZE ) );
-		leaf_size.y = std::max( vx_leaf_v , std::max( leaf_size.y , VOXEL_LEAF_MIN_SIZE ) );
-		leaf_size.z = std::max( vx_leaf_v , std::max( leaf_size.z , VOXEL_LEAF_MIN_SIZE ) );
+//GenPCSettingsにROSパラメータを渡す
+struct NodeParams {
+	template<typename T>
+	T get_param(const std::string &key,const T defaultVal)const{
+		return ::get_param<T>(key,defaultVal);
 	}
-	
-	return leaf_size;
-}
+};
 
-bool count_quantize_points(const sensor_msgs::PointCloud &pts,rovi::Floats &output){
-	const int N = pts.points.size();
-	if( N <= 0 ){
-		return false;
+YPCData::DepthParams get_depth_params(){
+	std::string error;
+	const YPCData::DepthParams params = GenPCSettings::get_depth_params(NodeParams(),&error);
+	if( ! error.empty() ){
+		ROS_ERROR(LOG_HEADER"%s",error.c_str());
 	}
-	
-	double X0=0,Y0=0,Z0=0;
-	
-	for (int n = 0 ; n < N ; n++ ) {
-		X0 += pts.points[n].x;
-		Y0 += pts.points[n].y;
-		Z0 += pts.points[n].z;
-	}
-	X0/=N;
-	Y0/=N;
-	Z0/=N;
-	
-	// getting norm from the center and sort by it
-	std::vector<XYZW> norm;
-	norm.resize(N);
-	for (int n = 0; n < N; n++) {
-		float dx = (norm[n].x = pts.points[n].x) - X0;
-		float dy = (norm[n].y = pts.points[n].y) - Y0;
-		float dz = (norm[n].z = pts.points[n].z) - Z0;
-		//  norm[n].w=sqrt(dx*dx+dy*dy+dz*dz);
-		norm[n].w = sqrt(dx*dx + dy*dy);
-	}
-	std::sort(norm.begin(), norm.end());
-	
-	// Quantize points count for Numpy array
-	const double gamma=1.1;
-	const double kn=floor((log10(N)-1)/log10(gamma));
-	const int Qn=N<10? N:floor(10*pow(gamma,kn));
-	output.data.resize(3*Qn);
-	for (int n = 0; n < Qn; n++) {
-		int n3=3*n;
-		output.data[n3++] = norm[n].x;
-		output.data[n3++] = norm[n].y;
-		output.data[n3  ] = norm[n].z;
-	}
-	
-	return true;
+	return params;
 }
 
-bool voxelizing_pcdata (const sensor_msgs::PointCloud &src_pcdata,const VoxelLeafSize &vxLeafSize, sensor_msgs::PointCloud &dst_pcdata){
-	if( src_pcdata.points.size() < 10 ){
-		ROS_ERROR("voxelization failure. too few points.");
-		return false;
+YPCData::PC2Layout get_pc2_layout(){
+	std::string error;
+	const YPCData::PC2Layout layout = GenPCSettings::get_pc2_layout(NodeParams(),&error);
+	if( ! error.empty() ){
+		ROS_ERROR(LOG_HEADER"%s",error.c_str());
 	}
-	
-	pcl::PointCloud<pcl::PointXYZRGB>::Ptr pcdata_pcl(new pcl::PointCloud<pcl::PointXYZRGB>());
-	pcdata_pcl->width = src_pcdata.points.size();
-	pcdata_pcl->height = 1;
-	pcdata_pcl->points.resize(src_pcdata.points.size());
-	
-	uint32_t rgb=0;
-	const float *pChRGB=src_pcdata.channels[0].values.data();
-	for (int i = 0 ; i < src_pcdata.points.size(); i++) {
-		pcl::PointXYZRGB * pos = pcdata_pcl->points.data() + i;
-		pos->x = src_pcdata.points[i].x;
-		pos->y = src_pcdata.points[i].y;
-		pos->z = src_pcdata.points[i].z;
-		//pos->r = pos->g = pos->b =  src_pcdata.channels[0].values[i] * 255.0;
-		rgb = *reinterpret_cast<const uint32_t*>((pChRGB+i));
-		pos->r = 0xFF & (rgb >> 16);
-		pos->g = 0xFF & (rgb >> 8);
-		pos->b = 0xFF &  rgb;
-	}
-
-	pcl::PointCloud<pcl::PointXYZRGB> vx_points;
-	pcl::VoxelGrid<pcl::PointXYZRGB> sor;
-	sor.setInputCloud (pcdata_pcl);
-	sor.setLeafSize (vxLeafSize.x, vxLeafSize.y, vxLeafSize.z);
-	sor.filter (vx_points);
-	
-	const Eigen::Vector3i minBoxCoord= sor.getMinBoxCoordinates();
-	const Eigen::Vector3i maxBoxCoord= sor.getMaxBoxCoordinates();
-
-	bool ret = false;
-	if( minBoxCoord[0] == 0 && minBoxCoord[1] == 0 && minBoxCoord[2] == 0 &&
-		maxBoxCoord[0] == 0 && maxBoxCoord[1] == 0 && maxBoxCoord[2] == 0){
-		ROS_ERROR("voxelization failure. out of memory? leaf_size=(%g, %g, %g)",vxLeafSize.x,vxLeafSize.y,vxLeafSize.z);
-		
-	}else{
-		ret = true;
-		sensor_msgs::PointCloud2 pts2_vx;
-		pcl::toROSMsg(vx_points, pts2_vx);
-		sensor_msgs::convertPointCloud2ToPointCloud(pts2_vx,dst_pcdata);
-	}
-	return ret;
+	return layout;
 }
-	
-bool exec_downsampling (const sensor_msgs::PointCloud &pts,const VoxelLeafSize &vx_leaf_size,const bool quantize_count_exec,rovi::Floats &ds_points,sensor_msgs::PointCloud *out_pts_vx=nullptr){
-	
+
+VoxelLeafSize get_voxel_leaf_size(){
+	return GenPCSettings::get_voxel_leaf_size(NodeParams());
+}
+
+bool exec_downsampling (const sensor_msgs::PointCloud &pts,const VoxelLeafSize &vx_leaf_size,const bool quantize_count_exec,rovi::Floats &ds_points,sensor_msgs::PointCloud *out_pts_vx=nullptr,const YPCData *src_ypc=nullptr,const VoxelPyramid *src_pyramid=nullptr){
 	const int N = pts.points.size();
+	GenPCSettings::DownsamplingReport report;
+	const bool ret = GenPCSettings::exec_downsampling(pts,vx_leaf_size,quantize_count_exec,ds_points,out_pts_vx,src_ypc,src_pyramid,&report);
 	
-	sensor_msgs::PointCloud pts_ds = pts;
 	//voxelization
-	if( vx_leaf_size.is_disabled() ){
+	switch( report.voxelize ){
+	case GenPCSettings::STEP_DISABLED:
 		ROS_INFO(LOG_HEADER"voxelization disabled.");
-		
-	}else if(pts_ds.points.empty()){
+		break;
+	case GenPCSettings::STEP_SKIPPED:
 		ROS_INFO(LOG_HEADER"voxelization skipped. data is empty.");
-		
-	}else{
-		ElapsedTimer tmr_voxel;
-		
-		ROS_INFO(LOG_HEADER"voxelization start.");
-		
-		sensor_msgs::PointCloud pts_vx;
-		if( ! voxelizing_pcdata( pts_ds, vx_leaf_size, pts_vx) ){
-			ROS_ERROR(LOG_HEADER"voxelization failed.");
-		}else{
-			pts_ds = pts_vx;
-			if(out_pts_vx){
-				*out_pts_vx=pts_vx;
-			}
+		break;
+	default:
+		if( report.voxelize == GenPCSettings::STEP_FAILED ){
+			ROS_ERROR(LOG_HEADER"voxelization failed. leaf_size=(%g, %g, %g)",vx_leaf_size.x,vx_leaf_size.y,vx_leaf_size.z);
+		}else if( report.pyramid_level >= 0 ){
+			ROS_INFO(LOG_HEADER"voxelization from pyramid. level=%d, level_leaf=%g, cells=%d",
+				report.pyramid_level, src_pyramid->level_leaf(report.pyramid_level), src_pyramid->level_cells(report.pyramid_level));
 		}
-		
 		ROS_INFO(LOG_HEADER"voxelization finished. leaf_size=(%g, %g, %g) count=%d / %d (%.2f%%), proc_tm=%d ms",
 			vx_leaf_size.x, vx_leaf_size.y, vx_leaf_size.z,
-			(int)pts_vx.points.size(), N, N==0?0:pts_vx.points.size()/(float)N *100,
-			tmr_voxel.elapsed_ms());
+			report.voxel_count, N, N==0?0:report.voxel_count/(float)N *100,
+			report.voxelize_tm);
+		break;
 	}
-
+	
 	//Quantize points count for Numpy array
-	if( ! quantize_count_exec ){
+	switch( report.quantize ){
+	case GenPCSettings::STEP_DISABLED:
 		ROS_INFO(LOG_HEADER"quantize points count disabled.");
-		
-	}else if(pts_ds.points.empty()){
+		break;
+	case GenPCSettings::STEP_SKIPPED:
 		ROS_INFO(LOG_HEADER"quantize points count skipped. data is empty.");
-		
-	}else{
-		
-		ROS_INFO(LOG_HEADER"quantize points count start.");
-		ElapsedTimer tmr_norm_calc;
-		if( ! count_quantize_points( pts_ds, ds_points ) ){
+		break;
+	default:
+		if( report.quantize == GenPCSettings::STEP_FAILED ){
 			ROS_ERROR(LOG_HEADER"quantize points count failed.");
 		}
 		const int ds_point_count = ds_points.data.size()/3;
 		ROS_INFO(LOG_HEADER"quantize points count finished. count=%d / %d (%.2f%%), proc_tm=%d ms",
-			ds_point_count, (int)pts_ds.points.size(),ds_point_count /(float)pts_ds.points.size() *100,tmr_norm_calc.elapsed_ms());
+			ds_point_count, report.quantize_input, ds_point_count /(float)report.quantize_input *100, report.quantize_tm);
+		break;
 	}
 	
-	if( ds_points.data.empty() ){
-		const int pts_ds_count = pts_ds.points.size();
-		ds_points.data.resize(pts_ds_count * 3);
-		
-		for (int i = 0,n=0 ; i < pts_ds_count ; ++i,++n) {
-			ds_points.data[  n] = pts_ds.points[i].x;
-			ds_points.data[++n] = pts_ds.points[i].y;
-			ds_points.data[++n] = pts_ds.points[i].z;
-		}
-	}
-	
-	return true;
+	return ret;
 }
 
 void re_voxelization_monitor(const ros::TimerEvent& e)
 {
+	std::lock_guard<std::mutex> locker(genpc_mutex);
+	
 	//leaf_sizeを個別に変えるとそのたびにpublishされるので一気に指定する方法
 	//$rosparam set genpc/voxelize/leaf_size '{"x":3,"y":3,"z":3}'
 	
@@ -668,7 +779,8 @@ void re_voxelization_monitor(const ros::TimerEvent& e)
 				
 				sensor_msgs::PointCloud pts_vx;
 				rovi::Floats pc_points;
-				if( ! exec_downsampling( *pre_pc, vx_leaf_size, pre_quantize_points_count_enabled, pc_points ) ){
+				const VoxelPyramid *pyramid = pre_vx_pyramids[camno].empty() ? nullptr : &pre_vx_pyramids[camno];
+				if( ! exec_downsampling( *pre_pc, vx_leaf_size, pre_quantize_points_count_enabled, pc_points, nullptr, nullptr, pyramid ) ){
 					ROS_ERROR(LOG_HEADER"[%c] downsampling failed.",GET_CAMERA_LABEL(camno));
 					continue;
 				}
@@ -695,46 +807,31 @@ void re_voxelization_monitor(const ros::TimerEvent& e)
 	}
 }
 
-bool genpc(rovi::GenPC::Request &req, rovi::GenPC::Response &res)
+/**
+ * 点群生成器の準備. パラメータ/キャリブレーションデータを適用し、パターン画像を受け取れる状態(reset済み)にします.
+ * 点群生成器が作れない時と画像サイズが変わった時はfalse. キャリブレーションデータが無い時はisready=falseのままtrueを返す.
+ */
+bool prepare_pcgens(const int width,const int height,ScanSetup *setup)
 {
-    double t02 = ros::Time::now().toSec();
-	
-	ElapsedTimer tmr_proc;
-	ROS_INFO(LOG_HEADER"start: ptn_capt_num=%d, ptn capt left image num=%d, ptncapt left image num=%d",req.ptn_capt_num, (int)req.imgL.size(), (int)req.imgR.size());
-	
-	re_vx_monitor_timer.stop();
+	TraceSpan trace_span("prepare_pcgens");
 	
-	bool result=false;
-	res.pc_cnt = 0;
-	res.pc_cnt_r = -1;
-	
-	const bool calc_right_camera_flg =  get_param<bool>("pshift_genpc/calc/calc_right_camera",false);
-	if( calc_right_camera_flg ){
+	setup->calc_right_camera = get_param<bool>("pshift_genpc/calc/calc_right_camera",false);
+	if( setup->calc_right_camera ){
 		ROS_INFO(LOG_HEADER"calculate right camera");
 	}
 	
-	if( ! pcgen_ptr ){
-		pcgen_ptr.reset(new YPCGeneratorUnix());
-		//途中で変えないこと
-		const PcGenMode pc_gen_mode = (PcGenMode)get_param<int>("pshift_genpc/calc/pcgen_mode",(int)PCGEN_GRAYPS4);
-		
-		if( ! pcgen_ptr->create_pcgen(pc_gen_mode) ){
-			ROS_ERROR(LOG_HEADER"point cloud generator create failed.");
-			return false;
-		}else{
-			ROS_INFO(LOG_HEADER"Point Cloud Generator Created. mode=%d (%s)",pc_gen_mode,PCGEN_MODE_MAP[pc_gen_mode].c_str());
-		}
-	}
+	//左右並列生成. 右カメラは専用の点群生成器で前処理から並行して行う
+	const bool camera_parallel = setup->calc_right_camera && get_param<bool>("pshift_genpc/calc/camera_parallel",CAMERA_PARALLEL_DEFAULT);
 	
-	std::vector<YPCData> yds_pcs(CAMERA_NUM);
-	pre_ptss.assign(CAMERA_NUM,{});
-	std::vector<sensor_msgs::PointCloud> cur_pts(CAMERA_NUM);
-
-	
-	pre_vx_leaf_size = VoxelLeafSize();
+	if( ! pcgen_ptr && ! create_pcgen(pcgen_ptr,"[L]") ){
+		return false;
+	}
+	if( camera_parallel && ! pcgen_r_ptr && ! create_pcgen(pcgen_r_ptr,"[R]") ){
+		return false;
+	}
 	
-	const int width  = req.imgL[0].width;
-	const int height = req.imgL[0].height;
+	setup->width = width;
+	setup->height = height;
 	
 	if( cur_cam_width < 0 || cur_cam_height < 0 ){
 		cur_cam_width = width;
@@ -752,68 +849,172 @@ bool genpc(rovi::GenPC::Request &req, rovi::GenPC::Response &res)
 	if( ! load_phase_shift_params() ){
 		ROS_ERROR(LOG_HEADER"phase shift parameter load failed.");
 		
-	}else if ( ! isready ) {
-		ROS_INFO(LOG_HEADER"current camera resolution. w=%d h=%d", cur_cam_width, cur_cam_height);
-		if( ! load_camera_calib_data() ){
+	}else{
+		if( ! isready ){
+			ROS_INFO(LOG_HEADER"current camera resolution. w=%d h=%d", cur_cam_width, cur_cam_height);
+		}
+		//キャリブレーションデータが変わった時と、点群生成器を新しく作った時だけステレオカメラを作成し直す
+		if( ! load_camera_calib_data(get_pcgens()) ){
 			ROS_ERROR(LOG_HEADER"camera calibration data load failed.");
 			
-		}else{
+		}else if( ! isready ){
 			ROS_INFO(LOG_HEADER"camera calibration data loaded.");
 			isready=true;
-			
 		}
 	}
+	setup->run_parallel = camera_parallel && pcgen_applied[pcgen_r_ptr.get()].calib_valid;
+	if( camera_parallel && ! setup->run_parallel ){
+		ROS_WARN(LOG_HEADER"right camera generator is not ready. left and right cameras are calculated sequentially.");
+	}
+	setup->pcgens = { pcgen_ptr.get() };
+	if( setup->run_parallel ){
+		setup->pcgens.push_back(pcgen_r_ptr.get());
+	}
+	
+	for( YPCGeneratorStream *pcgen : setup->pcgens ){
+		pcgen->reset();
+	}
+	return true;
+}
+
+/**
+ * pattern_frameで受け取ったパターン画像の保存. 点群生成器へは受信時に渡し済み.
+ * 画像は受信したメッセージのバッファを参照しているので、メッセージごと書き出しスレッドへ渡す.
+ */
+void dump_streamed_pattern_images(const PatternStream::Frames &frames)
+{
+	if( file_dump.empty() ){
+		return;
+	}
+	const bool ptn_image_save_flg = get_param<bool>("genpc/point_cloud/img_save",STEREO_CAM_IMG_SAVE_DEFAULT);
+	const int ptnCaptNum = frames.size();
+	std::string captseq;
+	
+	for( int n = 0 ; n < ptnCaptNum ; n++ ){
+		const std::vector<PatternStream::Frame> &ptn_frames = frames[n];
+		if( ptn_image_save_flg ){
+			std::vector<cv::Mat> save_imgs;
+			for( const PatternStream::Frame &frame : ptn_frames ){
+				save_imgs.push_back(frame.imgs[0]);
+				save_imgs.push_back(frame.imgs[1]);
+			}
+			dump_pattern_images(n,ptnCaptNum,save_imgs,boost::make_shared<std::vector<PatternStream::Frame>>(ptn_frames));
+		}
+		for( int i = 0 ; i < (int)ptn_frames.size() ; i++ ){
+			captseq += captseq_line(n,ptnCaptNum,i,ptn_frames[i].seqs[0],ptn_frames[i].seqs[1],ptn_frames[i].stamp);
+		}
+	}
+	dump_captseq(captseq);
+}
+
+/**
+ * @param streamed pattern_frameで受け取ったスキャンの画像. この場合、点群生成器の準備(stream_setup)と前処理は受信スレッドで済んでいる
+ */
+bool exec_genpc(const rovi::GenPC::Request &req, rovi::GenPC::Response &res, const PatternStream::Frames *streamed)
+{
+    double t02 = ros::Time::now().toSec();
+	
+	ElapsedTimer tmr_proc;
+	TraceSpan trace_span("genpc",req.scan_id);
+	ROS_INFO(LOG_HEADER"start: ptn_capt_num=%d, ptn capt left image num=%d, ptncapt left image num=%d, scan_id=%u",req.ptn_capt_num, (int)req.imgL.size(), (int)req.imgR.size(), req.scan_id);
+	
+	re_vx_monitor_timer.stop();
+	
+	bool result=false;
+	res.pc_cnt = 0;
+	res.pc_cnt_r = -1;
+	
+	ScanSetup setup;
+	if( streamed ){
+		setup = stream_setup;
+		
+	}else if( req.imgL.empty() ){
+		ROS_ERROR(LOG_HEADER"pattern image is empty.");
+		return false;
+		
+	}else if( ! prepare_pcgens(req.imgL[0].width,req.imgL[0].height,&setup) ){
+		return false;
+	}
+	const bool calc_right_camera_flg = setup.calc_right_camera;
+	const bool run_parallel = setup.run_parallel;
+	
+	//点群は保存が終わるまで書き出しスレッドからも参照される
+	std::vector<std::shared_ptr<YPCData>> yds_pcs;
+	yds_pcs.reserve(CAMERA_NUM);
+	for( int camno=0; camno < CAMERA_NUM; ++camno ){
+		yds_pcs.push_back(std::make_shared<YPCData>(&pcdata_pool));
+	}
+	pre_ptss.assign(CAMERA_NUM,{});
+	for( VoxelPyramid &pyramid : pre_vx_pyramids ){
+		pyramid.clear();
+	}
+	const bool re_voxel_enabled = get_param<bool>("genpc/voxelize/recalc/enabled",RE_VOXEL_ENABLED_DEFAULT);
+	std::vector<sensor_msgs::PointCloud> cur_pts(CAMERA_NUM);
+
+	
+	pre_vx_leaf_size = VoxelLeafSize();
+	
+	configure_dump_writer();
+	
 	//std::vector<cv::Mat> stereo_imgs;
 	//std::vector<unsigned char*> stereo_img_pointers;
-	std::vector<sensor_msgs::ImagePtr> depth_imgs;
-	depth_imgs.assign(CAMERA_NUM,sensor_msgs::ImagePtr(new sensor_msgs::Image));
+	//depthmapは点群変換時にpublishするメッセージのバッファへ直接書き込む
+	std::vector<sensor_msgs::ImagePtr> depth_imgs(CAMERA_NUM);
+	for( int camno = 0 ; camno < CAMERA_NUM ; ++camno ){
+		depth_imgs[camno].reset(new sensor_msgs::Image);
+	}
 	std::vector<sensor_msgs::PointCloud> pts_vxs(CAMERA_NUM);
-	std::vector<cv::Mat> depthimg_mats(CAMERA_NUM);
-	
-	pcgen_ptr->reset();
 	
 	const bool pcdata2_dense = get_param<bool>("genpc/point_cloud2/dense",PC_DATA2_DENSE_DEFAULT);
+	const YPCData::PC2Layout pcdata2_layout = get_pc2_layout();
 	
 	if( ! isready ){
 		ROS_ERROR(LOG_HEADER"camera calibration data load failed. elapsed=%d ms", tmr_proc.elapsed_ms());
 	
-	}else if( ! load_pattern_images(req) ){
+	}else if( ! streamed && ! load_pattern_images(req,setup.pcgens) ){
 		ROS_ERROR(LOG_HEADER"point cloud generator pattern image load failed.");
 		
-	}else if ( ! pcgen_ptr->preprocess() ) {
-		ROS_ERROR(LOG_HEADER"point cloud data generator preprocess failed.");
-		
 	}else{
-		ROS_INFO(LOG_HEADER"point cloud generation start.");
-		
+		if( streamed ){
+			dump_streamed_pattern_images(*streamed);
+		}
 		const bool depthmap_enabled = get_param<bool>("genpc/depthmap_img/enabled",DEPTH_MAP_IMG_ENABELED_DEFAULT);
+		const YPCData::DepthParams depth_params = get_depth_params();
 		const bool quantize_count_enabled = get_param<bool>("genpc/quantize_points_count/enabled",QUANTIZE_POINTS_COUNT_ENABLED_DEFAULT);
 		const bool pcdata2_enabled = get_param<bool>("genpc/point_cloud2/enabled",PC_DATA2_ENABLED_DEFAULT);
+		const VoxelLeafSize vx_leaf_size = get_voxel_leaf_size();
 		
-		result=true;
+		pre_quantize_points_count_enabled = quantize_count_enabled;
+		pre_vx_leaf_size = vx_leaf_size;
 		
-		for( int camno=0; camno < CAMERA_NUM; ++camno ){
-			if( camno == 1 && ! calc_right_camera_flg ){
-				continue;
-			}
-			
+		//1カメラ分の点群生成～publish. 左右並列時は別スレッドから呼ばれるので、カメラ毎の領域(camno)以外は書き換えないこと
+		auto generate_camera = [&](YPCGeneratorUnix &pcgen,const int camno)->bool{
 			ElapsedTimer tmr_genpc;
+			TraceSpan trace_execute("execute",camno);
 			sensor_msgs::PointCloud pts;
 			rovi::Floats ds_points;
 			rovi::Floats pc_points;
 			
-			YPCData *ypcData=yds_pcs.data()+camno;
+			YPCData *ypcData=yds_pcs[camno].get();
 			
-			if(! pcgen_ptr->execute(camno) ){
+			if(! pcgen.execute(camno) ){
 				ROS_ERROR(LOG_HEADER"[%c] point cloud generate failed.",GET_CAMERA_LABEL(camno));
-				result=false;
+				return false;
 				
 			}else{
 				
-				const int N = pcgen_ptr->save_pointcloud(ypcData);
+				const int N = pcgen.save_pointcloud(ypcData);
+				trace_execute.end();
+				tmr_genpc.record("genpc/execute");
+				StageMetrics::record("genpc/disparity",ElapsedTimer::duration_us(pcgen.get_elapsed_disparity()) / 1000.0);
+				StageMetrics::record("genpc/genpcloud",ElapsedTimer::duration_us(pcgen.get_elapsed_genpcloud()) / 1000.0);
+				StageMetrics::record("genpc/points",N,StageMetrics::UNIT_COUNT);
+				if( setup.width > 0 && setup.height > 0 ){
+					StageMetrics::record("genpc/valid_pixel_ratio",N / (double)(setup.width * setup.height),StageMetrics::UNIT_RATIO);
+				}
 				
 				ROS_INFO(LOG_HEADER"[%c] point cloud generation finished. point_num=%d, diparity_tm=%d ms, genpc_tm=%d ms, total_tm=%d ms, elapsed=%d ms",
-					GET_CAMERA_LABEL(camno),N, ElapsedTimer::duration_ms(pcgen_ptr->get_elapsed_disparity()), ElapsedTimer::duration_ms(pcgen_ptr->get_elapsed_genpcloud()),
+					GET_CAMERA_LABEL(camno),N, ElapsedTimer::duration_ms(pcgen.get_elapsed_disparity()), ElapsedTimer::duration_ms(pcgen.get_elapsed_genpcloud()),
 					tmr_genpc.elapsed_ms(), tmr_proc.elapsed_ms());
 				
 				if( N == 0  ){
@@ -823,32 +1024,58 @@ bool genpc(rovi::GenPC::Request &req, rovi::GenPC::Response &res)
 				//点群データ変換
 				ROS_INFO(LOG_HEADER"[%c] point cloud data convert start.",GET_CAMERA_LABEL(camno));
 				ElapsedTimer tmr_pcgen_conv;
-				if( ! ypcData->make_point_cloud(pts,true) ){
+				TraceSpan trace_convert("make_outputs",camno);
+				//PointCloud/PointCloud2/depthmap/range gridは点群の1回の走査でまとめて作成する
+				sensor_msgs::PointCloud2 pcdata2;
+				YPCData::PC2Quantization pcdata2_quant;
+				YPCData::Outputs outputs;
+				outputs.point_cloud = &pts;
+				outputs.point_cloud_dense = true;
+				outputs.point_cloud2 = pcdata2_enabled ? &pcdata2 : nullptr;
+				outputs.point_cloud2_dense = pcdata2_dense;
+				outputs.point_cloud2_layout = pcdata2_layout;
+				outputs.point_cloud2_quant = &pcdata2_quant;
+				outputs.depth_image = depthmap_enabled ? depth_imgs[camno].get() : nullptr;
+				outputs.depth_params = depth_params;
+				outputs.rg_floats = &pc_points;
+				const bool converted = ypcData->make_outputs(outputs);
+				if( ! converted ){
 					ROS_ERROR(LOG_HEADER"[%c] point cloud data convert failed.",GET_CAMERA_LABEL(camno));
 				}else{
 					cur_pts[camno]=pts;
 				}
 				
+				trace_convert.end();
+				tmr_pcgen_conv.record("genpc/make_outputs");
 				ROS_INFO(LOG_HEADER"[%c] point cloud data convert finished. proc_tm=%d ms, elapsed=%d ms",
 					GET_CAMERA_LABEL(camno),tmr_pcgen_conv.elapsed_ms(), tmr_proc.elapsed_ms());
 				
 				//downsampling
 				{
-					VoxelLeafSize vx_leaf_size = get_voxel_leaf_size();
-					
-					pre_quantize_points_count_enabled = quantize_count_enabled;
-					
 					ElapsedTimer tmr_downsampling;
+					TraceSpan trace_downsampling("downsampling",camno);
 					ROS_INFO(LOG_HEADER"[%c] downsampling start.",GET_CAMERA_LABEL(camno));
 					sensor_msgs::PointCloud * pts_vx=&pts_vxs[camno];
-					if( ! exec_downsampling( pts, vx_leaf_size, quantize_count_enabled, ds_points,pts_vx) ){
+					if( ! exec_downsampling( pts, vx_leaf_size, quantize_count_enabled, ds_points,pts_vx,ypcData) ){
 						ROS_ERROR(LOG_HEADER"[%c] downsampling failed.",GET_CAMERA_LABEL(camno));
 					}else{
 						//ROS_INFO(LOG_HEADER"point after downsampling. count=%d (%d)",(int)ds_points.data.size()/3,(int)ds_points.data.size());
 					}
 					
-					pre_vx_leaf_size = vx_leaf_size;
+					//再ボクセル化を点数ではなくセル数に比例した時間で行えるよう、ピラミッドを作っておく
+					if( re_voxel_enabled && converted ){
+						ElapsedTimer tmr_pyramid;
+						const float base_leaf = std::max(get_param<float>("genpc/voxelize/recalc/base_leaf",RE_VOXEL_BASE_LEAF_DEFAULT),VOXEL_LEAF_MIN_SIZE);
+						VoxelPyramid &pyramid = pre_vx_pyramids[camno];
+						if( ! ypcData->build_voxel_pyramid(base_leaf,pyramid) ){
+							ROS_ERROR(LOG_HEADER"[%c] voxel pyramid build failed. base_leaf=%g",GET_CAMERA_LABEL(camno),base_leaf);
+						}else{
+							ROS_INFO(LOG_HEADER"[%c] voxel pyramid built. base_leaf=%g, levels=%d, cells=%d, proc_tm=%d ms",
+								GET_CAMERA_LABEL(camno),base_leaf,pyramid.level_count(),pyramid.level_cells(0),tmr_pyramid.elapsed_ms());
+						}
+					}
 					
+					tmr_downsampling.record("genpc/downsampling");
 					const int ds_point_count=ds_points.data.size()/3;
 					ROS_INFO(LOG_HEADER"[%c] downsampling finished. count=%d / %d (%.2f%%), proc_tm=%d ms, elapsed=%d ms",
 						GET_CAMERA_LABEL(camno),ds_point_count , N, N == 0 ? 0 : ds_point_count / (float)N *100,
@@ -859,20 +1086,13 @@ bool genpc(rovi::GenPC::Request &req, rovi::GenPC::Response &res)
 				if( ! depthmap_enabled ){
 					ROS_INFO(LOG_HEADER"[%c] depthmap image make skipped.",GET_CAMERA_LABEL(camno));
 				}else{
-					ROS_INFO(LOG_HEADER"[%c] depthmap image make start.",GET_CAMERA_LABEL(camno));
-					ElapsedTimer tmr_depthmap;
-					
-					cv::Mat *depthimg_mat=&depthimg_mats[camno];
-					if( ! ypcData->make_depth_image(*depthimg_mat) ){
+					//depthmapは点群データ変換で作成済み
+					if( ! converted ){
 						ROS_ERROR(LOG_HEADER"[%c] depthmap image make failed.",GET_CAMERA_LABEL(camno));
 					}else{
-						try{
-							depth_imgs[camno] = cv_bridge::CvImage(std_msgs::Header(),"mono16",*depthimg_mat).toImageMsg();
-						}catch (cv_bridge::Exception& e)	{
-							ROS_ERROR(LOG_HEADER"[%c] depthmap image cv_bridge:exception: %s",GET_CAMERA_LABEL(camno), e.what());
-						}
+						ROS_INFO(LOG_HEADER"[%c] depthmap image made. encoding=%s, base=%g, unit=%g",GET_CAMERA_LABEL(camno),
+							depth_imgs[camno]->encoding.c_str(), depth_params.base, depth_params.unit);
 					}
-					ROS_INFO(LOG_HEADER"[%c] depthmap image make finished. proc_tm=%d ms",GET_CAMERA_LABEL(camno), tmr_depthmap.elapsed_ms());
 				}
 				if( camno ==0 ){
 					res.pc_cnt = N;
@@ -880,8 +1100,8 @@ bool genpc(rovi::GenPC::Request &req, rovi::GenPC::Response &res)
 					res.pc_cnt_r = N;
 				}
 				
-				pc_points = ypcData->to_rg_floats();
-				
+				TraceSpan trace_publish("publish",camno);
+				ElapsedTimer tmr_publish;
 				std_msgs::Int32 pcnt;
 				pcnt.data=N;
 				
@@ -889,10 +1109,19 @@ bool genpc(rovi::GenPC::Request &req, rovi::GenPC::Response &res)
 					//点群データ変換
 					//ROS_INFO(LOG_HEADER"[%c] point cloud data dense make start.",GET_CAMERA_LABEL(camno));
 					//ElapsedTimer tmr_pcgen_conv;
-					sensor_msgs::PointCloud2 pcdata2;
-					if( ! ypcData->make_point_cloud2(pcdata2,pcdata2_dense) ){
+					if( ! converted ){
 						ROS_ERROR(LOG_HEADER"[%c] point cloud data make failed. dense=%d",GET_CAMERA_LABEL(camno),pcdata2_dense);
 					}else{
+						//固定小数点レイアウトの原点/スケールは点群と同じheaderを付けて、点群より先に出しておく
+						if( pcdata2_layout == YPCData::PC2_XYZ16_I8 ){
+							rovi::PC2Quantization quant;
+							quant.header = pcdata2.header;
+							for( int k = 0 ; k < 3 ; k++ ){
+								quant.origin[k] = pcdata2_quant.origin[k];
+							}
+							quant.scale = pcdata2_quant.scale;
+							pub_ps_pc2_quants[camno].publish(quant);
+						}
 						pub_ps_pointclouds2[camno].publish(pcdata2);
 						//ROS_INFO(LOG_HEADER"[%c] point cloud data make finished. point_count=%d size=%dx%d tm=%d",
 						//	GET_CAMERA_LABEL(camno), pcdata2.width * pcdata2.height, pcdata2.width, pcdata2.height, tmr_pcgen_conv.elapsed_ms());
@@ -912,6 +1141,60 @@ bool genpc(rovi::GenPC::Request &req, rovi::GenPC::Response &res)
 				pub_ps_floats[camno].publish(ds_points);
 				pub_depth_imgs[camno].publish(depth_imgs[camno]);
 				pub_ps_alls[camno].publish(pc_points);
+				tmr_publish.record("genpc/publish");
+			}
+			return true;
+		};
+		
+		//前処理. 逐次受信した場合は最後の画像を受け取った時に済ませてある
+		auto preprocess = [&](YPCGeneratorStream &pcgen,const int camno)->bool{
+			if( streamed ){
+				return stream_preprocessed[camno];
+			}
+			TraceSpan trace_preprocess("preprocess",camno);
+			ElapsedTimer tmr_preprocess;
+			const bool preprocessed = pcgen.preprocess();
+			tmr_preprocess.record("genpc/preprocess");
+			return preprocessed;
+		};
+		
+		if( run_parallel ){
+			ROS_INFO(LOG_HEADER"point cloud generation start. left and right cameras in parallel.");
+			
+			bool result_r=false;
+			std::thread thread_r([&](){
+				Trace::set_thread_name("genpc:R");
+				if ( ! preprocess(*pcgen_r_ptr,1) ) {
+					ROS_ERROR(LOG_HEADER"[R] point cloud data generator preprocess failed.");
+				}else{
+					result_r = generate_camera(*pcgen_r_ptr,1);
+				}
+			});
+			
+			bool result_l=false;
+			if ( ! preprocess(*pcgen_ptr,0) ) {
+				ROS_ERROR(LOG_HEADER"[L] point cloud data generator preprocess failed.");
+			}else{
+				result_l = generate_camera(*pcgen_ptr,0);
+			}
+			thread_r.join();
+			result = result_l && result_r;
+			
+		}else if ( ! preprocess(*pcgen_ptr,0) ) {
+			ROS_ERROR(LOG_HEADER"point cloud data generator preprocess failed.");
+			
+		}else{
+			ROS_INFO(LOG_HEADER"point cloud generation start.");
+			
+			result=true;
+			
+			for( int camno=0; camno < CAMERA_NUM; ++camno ){
+				if( camno == 1 && ! calc_right_camera_flg ){
+					continue;
+				}
+				if( ! generate_camera(*pcgen_ptr,camno) ){
+					result=false;
+				}
 			}
 		}
 		
@@ -930,7 +1213,7 @@ bool genpc(rovi::GenPC::Request &req, rovi::GenPC::Response &res)
 	
 	ROS_INFO(LOG_HEADER "publish finished. elapsed=%d ms", tmr_proc.elapsed_ms());
 	
-	//データ保存
+	//データ保存. ファイルへの書き出しは書き出しスレッドで行い、サービスの応答を待たせない
 	if( ! file_dump.empty() ) {
 		const bool pcdata_save_flg = get_param<bool>("genpc/point_cloud/data_save",PC_DATA_SAVE_DEFAULT);
 		const bool pcdata2_save_flg = get_param<bool>("genpc/point_cloud2/data_save",PC_DATA2_SAVE_DEFAULT);
@@ -943,19 +1226,19 @@ bool genpc(rovi::GenPC::Request &req, rovi::GenPC::Response &res)
 				continue;
 			}
 			
-			const YPCData *ypcData=yds_pcs.data()+camno;
+			const char cam_label = GET_CAMERA_LABEL(camno);
+			std::shared_ptr<const YPCData> ypcData=yds_pcs[camno];
 			
 			if( !  pcdata_save_flg ){
-				ROS_INFO(LOG_HEADER"[%c] ply file save skipped.",GET_CAMERA_LABEL(camno));
+				ROS_INFO(LOG_HEADER"[%c] ply file save skipped.",cam_label);
 			}else{
-				ElapsedTimer tmr_save_pcdata;
 				std::string save_file_path;
 				if( camno == 0 ){
 					save_file_path = file_dump + "/test.ply";
 				}else if( camno == 1 ){
 					save_file_path = file_dump + "/test_r.ply";
 				}else{
-					ROS_ERROR(LOG_HEADER"[%c] ply data save failed. unknown camera no. ",GET_CAMERA_LABEL(camno));
+					ROS_ERROR(LOG_HEADER"[%c] ply data save failed. unknown camera no. ",cam_label);
 					break;
 				}
 				
@@ -966,96 +1249,105 @@ bool genpc(rovi::GenPC::Request &req, rovi::GenPC::Response &res)
 					return EXIT_FAILURE;
 				}*/
 				
-				if( ! ypcData->save_ply(save_file_path) ){
-					ROS_ERROR(LOG_HEADER"[%c] ply file save failed. proc_tm=%d ms, path=%s",
-						GET_CAMERA_LABEL(camno),tmr_save_pcdata.elapsed_ms(), save_file_path.c_str());
-				}else{
+				dump_writer.push(save_file_path, [cam_label,ypcData,save_file_path](){
+					ElapsedTimer tmr_save_pcdata;
+					if( ! ypcData->save_ply(save_file_path) ){
+						ROS_ERROR(LOG_HEADER"[%c] ply file save failed. proc_tm=%d ms, path=%s",
+							cam_label,tmr_save_pcdata.elapsed_ms(), save_file_path.c_str());
+						return false;
+					}
 					ROS_INFO(LOG_HEADER"[%c] ply file save succeeded. proc_tm=%d ms, path=%s",
-						GET_CAMERA_LABEL(camno),tmr_save_pcdata.elapsed_ms(), save_file_path.c_str());
-				}
+						cam_label,tmr_save_pcdata.elapsed_ms(), save_file_path.c_str());
+					return true;
+				});
 			}
 			
 			if( pcdata2_dense || !  pcdata2_save_flg ){
-				//ROS_INFO(LOG_HEADER"[%c] non-dense ply file save skipped.",GET_CAMERA_LABEL(camno));
+				//ROS_INFO(LOG_HEADER"[%c] non-dense ply file save skipped.",cam_label);
 			}else{
-				ElapsedTimer tmr_save_pcdata2;
 				std::string save_file_path;
 				if( camno == 0 ){
 					save_file_path = file_dump + "/test2.ply";
 				}else if( camno == 1 ){
 					save_file_path = file_dump + "/test2_r.ply";
 				}else{
-					ROS_ERROR(LOG_HEADER"[%c] non-dense ply data save failed. unknown camera no. ",GET_CAMERA_LABEL(camno));
+					ROS_ERROR(LOG_HEADER"[%c] non-dense ply data save failed. unknown camera no. ",cam_label);
 					break;
 				}
 				
-				if( ! ypcData->save_ply(save_file_path,false) ){
-					ROS_ERROR(LOG_HEADER"[%c] non-dense ply file save failed. proc_tm=%d ms, path=%s",
-						GET_CAMERA_LABEL(camno),tmr_save_pcdata2.elapsed_ms(), save_file_path.c_str());
-				}else{
+				dump_writer.push(save_file_path, [cam_label,ypcData,save_file_path](){
+					ElapsedTimer tmr_save_pcdata2;
+					if( ! ypcData->save_ply(save_file_path,false) ){
+						ROS_ERROR(LOG_HEADER"[%c] non-dense ply file save failed. proc_tm=%d ms, path=%s",
+							cam_label,tmr_save_pcdata2.elapsed_ms(), save_file_path.c_str());
+						return false;
+					}
 					ROS_INFO(LOG_HEADER"[%c] non-dense ply file save succeeded. proc_tm=%d ms, path=%s",
-						GET_CAMERA_LABEL(camno),tmr_save_pcdata2.elapsed_ms(), save_file_path.c_str());
-				}
+						cam_label,tmr_save_pcdata2.elapsed_ms(), save_file_path.c_str());
+					return true;
+				});
 			}
 			//todo:************* pending *************
 			//writePLY(file_dump + "/testRG.ply", pcdP, N, pcgenerator->get_rangegrid(), width, height);
 			//ROS_INFO("after  outPLY");
 			
-			sensor_msgs::PointCloud *pts_vx = &pts_vxs[camno];
-			
-			if( pts_vx->points.empty() || ! voxel_save_flg ){
+			if( pts_vxs[camno].points.empty() || ! voxel_save_flg ){
 				ROS_INFO(LOG_HEADER"voxelized point cloud data save skipped.");
 			}else{
-				ElapsedTimer tmr_save_voxel;
-				
 				std::string save_file_path;
 				if( camno == 0 ){
 					save_file_path = file_dump + "/voxel.ply";
 				}else if( camno == 1 ){
 					save_file_path = file_dump + "/voxel_r.ply";
 				}else{
-					ROS_ERROR(LOG_HEADER"[%c] voxel data save failed. unknown camera no. ",GET_CAMERA_LABEL(camno));
+					ROS_ERROR(LOG_HEADER"[%c] voxel data save failed. unknown camera no. ",cam_label);
 					break;
 				}
 				
-				sensor_msgs::PointCloud2 pts2_vx;
-				sensor_msgs::convertPointCloudToPointCloud2(*pts_vx,pts2_vx);
-				pcl::PointCloud<pcl::PointXYZRGB> pts_vx_pcl;
-				pcl::fromROSMsg(pts2_vx, pts_vx_pcl);
-				
-				pcl::PLYWriter ply_writer;
-				int save_ret = 0;
-				if( save_ret =  ply_writer.write(save_file_path, pts_vx_pcl, true) ){
-					ROS_ERROR(LOG_HEADER"voxelized point cloud data save failed. ret=%d, proc_tm=%d ms, path=%s",
-						save_ret, tmr_save_voxel.elapsed_ms(), save_file_path.c_str());
-				}else{
+				std::shared_ptr<const sensor_msgs::PointCloud> pts_vx = std::make_shared<sensor_msgs::PointCloud>(std::move(pts_vxs[camno]));
+				dump_writer.push(save_file_path, [pts_vx,save_file_path](){
+					ElapsedTimer tmr_save_voxel;
+					if( ! PlyWriter::write(save_file_path, *pts_vx) ){
+						ROS_ERROR(LOG_HEADER"voxelized point cloud data save failed. proc_tm=%d ms, path=%s",
+							tmr_save_voxel.elapsed_ms(), save_file_path.c_str());
+						return false;
+					}
 					ROS_INFO(LOG_HEADER"voxelized point cloud data save succeeded. proc_tm=%d ms, path=%s",
 						tmr_save_voxel.elapsed_ms(), save_file_path.c_str());
-				}
+					return true;
+				});
 			}
 			
-			//depthmap image save
-			cv::Mat * depthimg_mat = &depthimg_mats[camno];
-			if( depthimg_mat->empty() || ! depthmap_save_flg ){
+			//depthmap image save. publish済みのメッセージをそのまま参照する
+			const sensor_msgs::ImageConstPtr depth_img = depth_imgs[camno];
+			if( depth_img->data.empty() || ! depthmap_save_flg ){
 				ROS_INFO(LOG_HEADER"depthmap image save skipped.");
 			}else{
-				ElapsedTimer tmr_save_depthmap;
-				
+				//32FC1はpngに保存できないのでtiffにする
+				const bool depth_float = depth_img->encoding == sensor_msgs::image_encodings::TYPE_32FC1;
+				const std::string ext = depth_float ? ".tif" : ".png";
 				std::string save_file_path;
 				if( camno == 0 ){
-					save_file_path = file_dump + "/depth.png";
+					save_file_path = file_dump + "/depth" + ext;
 				}else if( camno == 1 ){
-					save_file_path = file_dump + "/depth_r.png";
+					save_file_path = file_dump + "/depth_r" + ext;
 				}else{
-					ROS_ERROR(LOG_HEADER"[%c] depthmap image save failed. unknown camera no. ",GET_CAMERA_LABEL(camno));
+					ROS_ERROR(LOG_HEADER"[%c] depthmap image save failed. unknown camera no. ",cam_label);
 					break;
 				}
 				
-				if( ! cv::imwrite(save_file_path,*depthimg_mat) ){
-					ROS_ERROR(LOG_HEADER"depthmap image save failed. proc_tm=%d ms, path=%s", tmr_save_depthmap.elapsed_ms(), save_file_path.c_str());
-				}else {
+				dump_writer.push(save_file_path, [depth_img,depth_float,save_file_path](){
+					ElapsedTimer tmr_save_depthmap;
+					//メッセージのバッファをそのまま参照する
+					const cv::Mat depthimg_mat(depth_img->height, depth_img->width, depth_float ? CV_32FC1 : CV_16UC1,
+						const_cast<unsigned char*>(depth_img->data.data()), depth_img->step);
+					if( ! cv::imwrite(save_file_path,depthimg_mat) ){
+						ROS_ERROR(LOG_HEADER"depthmap image save failed. proc_tm=%d ms, path=%s", tmr_save_depthmap.elapsed_ms(), save_file_path.c_str());
+						return false;
+					}
 					ROS_INFO(LOG_HEADER"depthmap image make succeeded. proc_tm=%d ms, path=%s", tmr_save_depthmap.elapsed_ms(), save_file_path.c_str());
-				}
+					return true;
+				});
 			}
 		}
 	}
@@ -1068,24 +1360,267 @@ bool genpc(rovi::GenPC::Request &req, rovi::GenPC::Response &res)
 		re_vx_monitor_timer.setPeriod(ros::Duration(cur_re_vx_interval));
 		re_vx_monitor_timer.start();
 	}
+	tmr_proc.record("genpc/total");
 	ROS_INFO(LOG_HEADER "node end. elapsed=%d ms", tmr_proc.elapsed_ms());
 	return result;
 }
 
+/**
+ * 逐次受信したスキャンの点群生成器の状態を破棄する. genpc_mutexを取って呼ぶこと.
+ */
+void reset_stream_scan()
+{
+	stream_setup = ScanSetup();
+	stream_preprocessed[0] = stream_preprocessed[1] = false;
+	stream_scan_id = 0;
+}
 
-//============================================= 無名名前空間  end  =============================================
+/**
+ * scan_idが指定されていれば、pattern_frameで受信中のスキャンが揃うのを待ってから点群生成する.
+ * 待っている間も受信スレッドが点群生成器を使うので、genpc_mutexは揃ってから取る.
+ * scan_idが無い要求は点群生成器を作り直すので、受信中のスキャンを打ち切ってから点群生成する.
+ */
+bool run_genpc(const rovi::GenPC::Request &req, rovi::GenPC::Response &res)
+{
+	if( req.scan_id == 0 ){
+		std::lock_guard<std::mutex> locker(genpc_mutex);
+		const uint32_t aborted = pattern_stream.abort();
+		if( aborted != 0 || stream_scan_id != 0 ){
+			ROS_WARN(LOG_HEADER"<stream> scan discarded by a request without scan_id. scan_id=%u",aborted != 0 ? aborted : stream_scan_id);
+		}
+		reset_stream_scan();
+		return exec_genpc(req,res,nullptr);
+	}
+	
+	ElapsedTimer tmr_wait;
+	TraceSpan trace_wait("pattern_stream_wait",req.scan_id);
+	PatternStream::Frames frames;
+	const int timeout = get_param<int>("genpc/pattern_stream/timeout",PATTERN_STREAM_TIMEOUT_DEFAULT);
+	if( ! pattern_stream.take(req.scan_id,timeout,&frames) ){
+		ROS_ERROR(LOG_HEADER"pattern stream receive failed. scan_id=%u, wait_tm=%d ms",req.scan_id,tmr_wait.elapsed_ms());
+		//タイムアウト時は受信スレッドが処理中のことがあるので、ハンドラが抜けるのを待ってから破棄する
+		std::lock_guard<std::mutex> locker(genpc_mutex);
+		if( stream_scan_id == req.scan_id ){
+			reset_stream_scan();
+		}
+		return false;
+	}
+	trace_wait.end();
+	tmr_wait.record("genpc/pattern_stream_wait");
+	ROS_INFO(LOG_HEADER"pattern stream received. scan_id=%u, wait_tm=%d ms",req.scan_id,tmr_wait.elapsed_ms());
+	
+	std::lock_guard<std::mutex> locker(genpc_mutex);
+	if( stream_scan_id != req.scan_id ){
+		//揃った後、ここまでの間にscan_idの無い要求が点群生成器を使った
+		ROS_ERROR(LOG_HEADER"pattern stream scan was discarded. scan_id=%u",req.scan_id);
+		return false;
+	}
+	const bool result = exec_genpc(req,res,&frames);
+	reset_stream_scan();
+	return result;
 }
 
-int main(int argc, char **argv)
+bool genpc(rovi::GenPC::Request &req, rovi::GenPC::Response &res)
+{
+	return run_genpc(req,res);
+}
+
+/**
+ * 同一プロセス内からの呼び出し. パターン画像はycam3dが作った要求をそのまま参照する.
+ */
+bool genpc_in_process(const InProcessService<rovi::GenPC>::RequestConstPtr &req, rovi::GenPC::Response &res)
+{
+	return run_genpc(*req,res);
+}
+
+/**
+ * スキャンの最初の画像を受け取った時に点群生成器を準備する.
+ */
+bool stream_begin(const PatternStream::Frame &frame)
+{
+	std::lock_guard<std::mutex> locker(genpc_mutex);
+	ElapsedTimer tmr;
+	TraceSpan trace_span("stream_begin",frame.scan_id);
+	
+	reset_stream_scan();
+	
+	if( ! prepare_pcgens(frame.imgs[0].cols,frame.imgs[0].rows,&stream_setup) ){
+		ROS_ERROR(LOG_HEADER"<stream> point cloud generator prepare failed. scan_id=%u",frame.scan_id);
+		return false;
+		
+	}else if( ! isready ){
+		ROS_ERROR(LOG_HEADER"<stream> camera calibration data load failed. scan_id=%u",frame.scan_id);
+		return false;
+	}
+	
+	const int required = stream_setup.pcgens[0]->required_frames();
+	if( required != frame.frame_num ){
+		ROS_WARN(LOG_HEADER"<stream> pattern frame count differs from the generator. frame_num=%d, required=%d",frame.frame_num,required);
+	}
+	ROS_INFO(LOG_HEADER"<stream> scan start. scan_id=%u, capt_num=%d, frame_num=%d, parallel=%d, proc_tm=%d ms",
+		frame.scan_id,frame.capt_num,frame.frame_num,stream_setup.run_parallel,tmr.elapsed_ms());
+	stream_scan_id = frame.scan_id;
+	return true;
+}
+
+/**
+ * 以降のハンドラも受信スレッドから呼ばれる. 待っている間に他の要求がスキャンを破棄していれば失敗する.
+ */
+bool stream_frame(const PatternStream::Frame &frame)
+{
+	std::lock_guard<std::mutex> locker(genpc_mutex);
+	if( stream_scan_id != frame.scan_id ){
+		return false;
+	}
+	TraceSpan trace_span("stream_frame",frame.index);
+	for( YPCGeneratorStream *pcgen : stream_setup.pcgens ){
+		for( int camno = 0 ; camno < CAMERA_NUM ; ++camno ){
+			const cv::Mat &img = frame.imgs[camno];
+			if( ! pcgen->set_image(img.data,(size_t)img.step,camno,frame.index) ){
+				ROS_ERROR(LOG_HEADER"<stream> point cloud generator pattern image set failed. scan_id=%u, capt_no=%d, index=%d, camno=%d",
+					frame.scan_id,frame.capt_no,frame.index,camno);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool stream_set_complete(const int capt_no)
+{
+	std::lock_guard<std::mutex> locker(genpc_mutex);
+	if( stream_scan_id == 0 ){
+		return false;
+	}
+	ElapsedTimer tmr;
+	TraceSpan trace_span("flush_images",capt_no);
+	for( YPCGeneratorStream *pcgen : stream_setup.pcgens ){
+		if( ! pcgen->flush_images() ){
+			ROS_ERROR(LOG_HEADER"<stream> <%d> point cloud generator pattern image flush failed.",capt_no);
+			return false;
+		}
+	}
+	ROS_INFO(LOG_HEADER"<stream> <%d> pattern images flushed. proc_tm=%d ms",capt_no,tmr.elapsed_ms());
+	return true;
+}
+
+/**
+ * 全ての画像が揃ったら、サービスの呼び出しを待たずに前処理を行う. 失敗は点群生成時に報告する.
+ */
+bool stream_complete()
+{
+	std::lock_guard<std::mutex> locker(genpc_mutex);
+	if( stream_scan_id == 0 ){
+		return false;
+	}
+	ElapsedTimer tmr;
+	TraceSpan trace_span("stream_preprocess");
+	if( stream_setup.run_parallel ){
+		std::thread thread_r([](){
+			stream_preprocessed[1] = pcgen_r_ptr->preprocess();
+		});
+		stream_preprocessed[0] = pcgen_ptr->preprocess();
+		thread_r.join();
+	}else{
+		stream_preprocessed[0] = pcgen_ptr->preprocess();
+	}
+	tmr.record("genpc/stream_preprocess");
+	ROS_INFO(LOG_HEADER"<stream> preprocess finished. result=%d,%d, proc_tm=%d ms",
+		stream_preprocessed[0],stream_preprocessed[1],tmr.elapsed_ms());
+	return true;
+}
+
+/**
+ * pattern_frameの受信. ycam3dの撮影中に1組ずつ届く.
+ */
+void sub_pattern_frame(const rovi::PatternFrame::ConstPtr &msg)
+{
+	PatternStream::Frame frame;
+	frame.scan_id = msg->scan_id;
+	frame.capt_no = msg->capt_no;
+	frame.capt_num = msg->capt_num;
+	frame.index = msg->index;
+	frame.frame_num = msg->frame_num;
+	
+	const sensor_msgs::Image *imgs[CAMERA_NUM] = { &msg->imgL, &msg->imgR };
+	for( int camno = 0 ; camno < CAMERA_NUM ; ++camno ){
+		if( ! wrap_mono8_image(*imgs[camno],frame.imgs[camno]) ){
+			try {
+				frame.imgs[camno] = cv_bridge::toCvCopy(*imgs[camno], sensor_msgs::image_encodings::MONO8)->image;
+			}catch( cv_bridge::Exception& e ){
+				ROS_ERROR(LOG_HEADER"<stream> pattern frame convert failed. scan_id=%u, index=%d, cv_bridge:exception: %s",
+					frame.scan_id,frame.index,e.what());
+				return;
+			}
+		}
+		frame.seqs[camno] = imgs[camno]->header.seq;
+	}
+	frame.stamp = msg->imgL.header.stamp.toSec();
+	//画像はメッセージのバッファを参照するので、スキャンを引き取るまでメッセージを保持する
+	frame.holder = msg;
+	pattern_stream.push(frame);
+}
+
+ros::ServiceServer svs_genpc;
+
+/**
+ * 処理区間をChrome trace形式で書き出す. nodeletで同じプロセスに居るycam3dの区間も含まれる.
+ */
+bool dump_trace(std_srvs::TriggerRequest &req, std_srvs::TriggerResponse &res)
+{
+	const std::string path = get_param<std::string>("trace/dir",TRACE_DIR_DEFAULT) + "/genpc_trace.json";
+	int event_num = 0;
+	if( ! Trace::dump(path,"genpc",&event_num) ){
+		ROS_ERROR(LOG_HEADER"trace dump failed. path=%s",path.c_str());
+		res.success = false;
+		res.message = "trace dump failed. path=" + path;
+	}else{
+		ROS_INFO(LOG_HEADER"trace dumped. event_num=%d, path=%s",event_num,path.c_str());
+		res.success = true;
+		res.message = path;
+	}
+	return true;
+}
+
+/**
+ * 処理段階毎の分布を定期的にdiagnosticsへ出力する. metrics/prometheus_dirがあればPrometheus形式でも書き出す.
+ * metrics/window回毎に直近の分布の区間を入れ替える(起動からの累積は残す).
+ */
+void publish_metrics(const ros::TimerEvent& e)
+{
+	diagnostic_msgs::DiagnosticArray diag;
+	diag.header.stamp = ros::Time::now();
+	diag.status.push_back(make_stage_diagnostic("rovi: genpc stages","genpc","genpc/"));
+	pub_diagnostics.publish(diag);
+	
+	const std::string prom_dir = get_param<std::string>("metrics/prometheus_dir","");
+	if( ! prom_dir.empty() ){
+		const std::string path = prom_dir + "/rovi_genpc.prom";
+		if( ! StageMetrics::write_prometheus(path,"genpc/") ){
+			ROS_ERROR(LOG_HEADER"prometheus text file write failed. path=%s",path.c_str());
+		}
+	}
+	
+	if( ++metrics_publish_num >= get_param<int>("metrics/window",METRICS_WINDOW_DEFAULT) ){
+		metrics_publish_num = 0;
+		StageMetrics::rotate("genpc/");
+	}
+}
+
+bool setup_node(ros::NodeHandle &n)
 {
-	ros::init(argc, argv, "genpc_node");
-	ros::NodeHandle n;
 	nh = &n;
 	
-	ros::ServiceServer svc1 = n.advertiseService("genpc", genpc);
+	Trace::set_enabled(get_param<bool>("trace/enabled",TRACE_ENABLED_DEFAULT));
+	svs_dump_trace = n.advertiseService("genpc/dump_trace", dump_trace);
+	
+	svs_genpc = n.advertiseService("genpc", genpc);
+	genpc_service_name = n.resolveName("genpc");
+	InProcessService<rovi::GenPC>::advertise(genpc_service_name, genpc_in_process);
 	
 	pub_ps_pointclouds[0]   = n.advertise<sensor_msgs::PointCloud>("ps_pc", 1);
 	pub_ps_pointclouds2[0]   = n.advertise<sensor_msgs::PointCloud2>("ps_pc2", 1);
+	pub_ps_pc2_quants[0]    = n.advertise<rovi::PC2Quantization>("ps_pc2_quant", 1);
 	
 	pub_ps_floats[0]        = n.advertise<rovi::Floats>("ps_floats", 1);
 	pub_depth_imgs[0]       = n.advertise<sensor_msgs::Image>("image_depth", 1);
@@ -1094,17 +1629,118 @@ int main(int argc, char **argv)
 		
 	pub_ps_pointclouds[1]   = n.advertise<sensor_msgs::PointCloud>("ps_pc_r", 1);
 	pub_ps_pointclouds2[1]= n.advertise<sensor_msgs::PointCloud2>("ps_pc2_r", 1);
+	pub_ps_pc2_quants[1]    = n.advertise<rovi::PC2Quantization>("ps_pc2_quant_r", 1);
 	pub_ps_floats[1]        = n.advertise<rovi::Floats>("ps_floats_r", 1);
 	pub_depth_imgs[1]       = n.advertise<sensor_msgs::Image>("image_depth_r", 1);
 	pub_ps_alls[1]          = n.advertise<rovi::Floats>("ps_all_r", 1);
 	pub_pcounts[1]          = n.advertise<std_msgs::Int32>("pcount_r", 1);
 	
 	pub_rep                 = n.advertise<std_msgs::String>("/report", 1);
+	pub_dump_stat           = n.advertise<std_msgs::String>("dump_stat", 1);
+	
+	dump_writer.set_stats_callback(publish_dump_stats);
+	
+	//0以下で出力しない
+	const float metrics_interval = get_param<float>("metrics/interval",METRICS_INTERVAL_DEFAULT);
+	pub_diagnostics = n.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 1);
+	metrics_timer = n.createTimer(ros::Duration(metrics_interval > 0 ? metrics_interval : METRICS_INTERVAL_DEFAULT), publish_metrics);
+	if( metrics_interval <= 0 ){
+		metrics_timer.stop();
+	}
 	
 	re_vx_monitor_timer = nh->createTimer(ros::Duration(RE_VOXEL_INTERVAL_DEFAULT), re_voxelization_monitor);
 	re_vx_monitor_timer.stop();
 	
+	//パターン画像の逐次受信. サービスがスキャンの揃うのを待っている間も受け取れるよう、専用のキューとスレッドで処理する
+	{
+		PatternStream::Handlers handlers;
+		handlers.begin = stream_begin;
+		handlers.frame = stream_frame;
+		handlers.set_complete = stream_set_complete;
+		handlers.complete = stream_complete;
+		pattern_stream.set_handlers(handlers);
+		
+		ros::SubscribeOptions ops = ros::SubscribeOptions::create<rovi::PatternFrame>(
+			"pattern_frame", PATTERN_STREAM_QUEUE_SIZE, sub_pattern_frame, ros::VoidPtr(), &stream_queue);
+		ops.transport_hints = ros::TransportHints().tcpNoDelay();
+		sub_ptn_frame = n.subscribe(ops);
+		
+		stream_spinner.reset(new ros::AsyncSpinner(1, &stream_queue));
+		stream_spinner->start();
+	}
+	
+	return true;
+}
+
+void shutdown_node()
+{
+	InProcessService<rovi::GenPC>::unadvertise(genpc_service_name);
+	svs_genpc.shutdown();
+	svs_dump_trace.shutdown();
+	metrics_timer.stop();
+	re_vx_monitor_timer.stop();
+	
+	sub_ptn_frame.shutdown();
+	if( stream_spinner ){
+		stream_spinner->stop();
+		stream_spinner.reset();
+	}
+	
+	//書き出し待ちのダンプは全て書き出してから終了する
+	ROS_INFO(LOG_HEADER"dump writer shutdown start. queue=%d",dump_writer.get_stats().queue_depth);
+	ElapsedTimer tmr_shutdown;
+	dump_writer.shutdown();
+	ROS_INFO(LOG_HEADER"dump writer shutdown finished. proc_tm=%d ms",tmr_shutdown.elapsed_ms());
+}
+
+
+//============================================= 無名名前空間  end  =============================================
+}
+
+#ifndef ROVI_NODELET
+
+int main(int argc, char **argv)
+{
+	ros::init(argc, argv, "genpc_node");
+	ros::NodeHandle n;
+	
+	if( ! setup_node(n) ){
+		return 1;
+	}
+	
 	ros::spin();
 	
+	shutdown_node();
+	
 	return 0;
 }
+
+#else
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+namespace rovi {
+
+/**
+ * genpc_nodeのnodelet版. ycam3dと同じプロセスに載せると、パターン画像はシリアライズせずに渡される.
+ */
+class GenPCNodelet : public nodelet::Nodelet {
+public:
+	~GenPCNodelet(){
+		shutdown_node();
+	}
+
+private:
+	void onInit() override {
+		if( ! setup_node(getNodeHandle()) ){
+			NODELET_ERROR(LOG_HEADER"error: initialization failed.");
+		}
+	}
+};
+
+}
+
+PLUGINLIB_EXPORT_CLASS(rovi::GenPCNodelet, nodelet::Nodelet)
+
+#endif
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/image_encodings.h>
+#include "Aravis.h"
+
+namespace camera{
+	namespace ycam3d{
+		constexpr int CAM_DIGITAL_GAIN_DEFAULT   = aravis::ycam3d::CAM_DIGITAL_GAIN_DEFAULT;
+		constexpr int CAM_DIGITAL_GAIN_MAX       = aravis::ycam3d::CAM_DIGITAL_GAIN_MAX;
+		constexpr int CAM_DIGITAL_GAIN_MIN       = aravis::ycam3d::CAM_DIGITAL_GAIN_MIN;
+		
+		constexpr int CAM_ANALOG_GAIN_DEFAULT   = aravis::ycam3d::CAM_ANALOG_GAIN_DEFAULT;
+		constexpr int CAM_ANALOG_GAIN_MAX       = aravis::ycam3d::CAM_ANALOG_GAIN_MAX;
+		constexpr int CAM_ANALOG_GAIN_MIN       = aravis::ycam3d::CAM_ANALOG_GAIN_MIN;
+		
+		constexpr int PROJ_INTENSITY_DEFAULT     = aravis::ycam3d::PROJ_INTENSITY_DEFAULT;
+		constexpr int PROJ_INTENSITY_MIN         = aravis::ycam3d::PROJ_INTENSITY_MIN;
+		constexpr int PROJ_INTENSITY_MAX         = aravis::ycam3d::PROJ_INTENSITY_MAX;
+		
+		struct CameraImage {
+			bool result =false;
+			int width = -1;
+			int height = -1;
+			int step = -1;
+			int color_ch = -1;
+			std::chrono::system_clock::time_point dt;
+			
+			std::vector<unsigned char> data;
+			
+			CameraImage(){}
+			
+			CameraImage(const int a_width,const int a_height,const int a_step,const int a_color_ch=1):
+				width(a_width),
+				height(a_height),
+				step(a_step),
+				color_ch(a_color_ch)
+			{
+				
+			}
+				
+			bool valid()const{
+				return width > 0 && height > 0 && color_ch > 0 && step > 0 && data.size() == byte_count();
+			}
+			
+			int byte_count()const{
+				return step * height;
+			}
+			
+			bool alloc(){
+				const int buf_size=byte_count();
+				if( buf_size <= 0 ) { return false; }
+				data.assign(buf_size,0);
+				return data.size() == buf_size;
+			}
+			
+			bool to_mat(cv::Mat &img)const {
+				if( ! result || ! valid() ){ return false; }
+				
+				img=cv::Mat(height,width,CV_8UC1,cv::Scalar(0));
+				memcpy(img.data,data.data(),byte_count());
+				return true;
+			}
+			
+			bool to_ros_img(sensor_msgs::Image &img,const std::string &frame_id=std::string())const{
+				if( ! result || ! valid() ){ return false; }
+				
+				const auto t0 = std::chrono::time_point<std::chrono::high_resolution_clock>{};
+				const auto t1 = this->dt;
+				
+				const auto tstamp = t1 - t0;
+				const int32_t sec = std::chrono::duration_cast<std::chrono::seconds>(tstamp).count();
+				const int32_t nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(tstamp).count() % 1000000000UL;
+				img.header.stamp = ros::Time(sec, nsec);
+				
+				if( ! frame_id.empty() ){
+					img.header.frame_id = frame_id;
+				}
+				img.width = this->width;
+				img.height = this->height;
+				img.encoding = sensor_msgs::image_encodings::MONO8;
+				img.step = this->step;
+				img.is_bigendian = false;
+				img.data.resize(this->byte_count());
+				memcpy(img.data.data(),this->data.data(),this->byte_count());
+				
+				return true;
+			}
+			
+			const CameraImage operator-(const CameraImage &b)const{
+				CameraImage diff;
+				if(this->width == b.width &&
+					this->height == b.height && 
+					this->step == b.step && 
+					this->color_ch == b.color_ch && 
+					this->data.size() == b.data.size()
+				){
+					diff = *this;
+					for (int i=0; i < this->data.size(); i++) {
+						int val = this->data[i] - b.data[i];
+						if (val < 1) { val = 0; }
+						else if (val>255) { val=255; }
+						
+						diff.data[i] = val;
+					}
+				}
+				return diff;
+			}
+		};
+		
+		struct CaptureParameter{
+			int expsr_lv = -1;
+			int gain = -1;
+			int proj_intensity = -1;
+			
+			virtual std::string to_string()const{
+				std::stringstream ss;
+				ss << "expsr_lv=" << expsr_lv;
+				ss << ",gain=" << gain;
+				ss << ",proj_intensity=" << proj_intensity;
+				return ss.str();
+			}
+			
+			virtual bool operator!=(const CaptureParameter &param)const{
+				return ! (*this==param);
+			}
+			
+			virtual bool operator==(const CaptureParameter &param)const{
+				if( this->expsr_lv != param.expsr_lv || 
+				    this->gain != param.gain || 
+				    this->proj_intensity != param.proj_intensity ){
+					return false;
+				}
+				return true;
+			}
+			bool is_different(const CaptureParameter &param){
+				
+				bool ret=false;
+				if(param.expsr_lv < 0 ){
+					//skipped
+				}else if( this->expsr_lv < 0){
+					ret=true;
+				}else if( this->expsr_lv != param.expsr_lv ){
+					ret=true;
+				}
+				
+				if(param.gain < 0 ){
+					//skipped
+				}else if( this->gain < 0){
+					ret=true;
+				}else if( this->gain != param.gain ){
+					ret=true;
+				}
+				
+				if(param.proj_intensity < 0 ){
+					//skipped
+				}else if( this->proj_intensity < 0){
+					ret=true;
+				}else if( this->proj_intensity != param.proj_intensity ){
+					ret=true;
+				}
+				return ret;
+			}
+		};
+		
+		using f_camera_open_finished = std::function<void(const bool result)>;
+		using f_camera_disconnect = std::function<void(void)>;
+		using f_camera_closed = std::function<void(void)>;
+		using f_pattern_img_received = std::function<void(const bool result,const int elapsed, const std::vector<camera::ycam3d::CameraImage> &imgs_l,const std::vector<camera::ycam3d::CameraImage> &imgs_r,const bool timeout,const int expsrLv)>;
+		using f_pattern_frame_received = std::function<void(const int frmidx,const int frame_num,const camera::ycam3d::CameraImage &img_l,const camera::ycam3d::CameraImage &img_r)>;
+		using f_capture_img_received = std::function<void(const bool result,const int elapsed, camera::ycam3d::CameraImage &img_l,const camera::ycam3d::CameraImage &img_r,const bool timeout,const int expsrLv)>;
+		using f_auto_con_limit_exceeded=std::function<void(void)>;
+		using f_ros_error_published=std::function<void(std::string)>;
+	}
+}
+
+/**
+ * ycam3d_nodeに画像を渡すカメラ.
+ * 実機(CameraYCAM3D)と保存済みパターン画像の再生(CameraReplay)があります.
+ * 画像は撮影を要求した後、set_callback_～で登録した関数に別スレッドから渡されます.
+ */
+class iCameraSource {
+public:
+	virtual ~iCameraSource(){}
+	
+	/**
+	 * 解像度("SXGA", "VGA")を指定して初期化します.
+	 */
+	virtual bool init(const std::string &camera_res) = 0;
+	
+	//左右を連結した画像の幅と高さ
+	virtual int width()const = 0;
+	virtual int height()const = 0;
+	
+	virtual bool is_open()const = 0;
+	virtual void open() = 0;
+	virtual void close() = 0;
+	
+	virtual bool is_auto_connect_running() = 0;
+	
+	virtual bool is_busy() = 0;
+	
+	virtual void set_capture_timeout_period(const int timeout) = 0;
+	
+	virtual void set_trigger_timeout_period(const int timeout) = 0;
+	
+	/**
+	 * 1枚撮影します. 画像はf_capture_img_receivedで渡されます.
+	 * @param strobe プロジェクタを点灯するか
+	 */
+	virtual bool capture(const bool strobe) = 0;
+	
+	/**
+	 * パターン撮影します. 画像はf_pattern_frame_receivedで1組ずつ、f_pattern_img_receivedでまとめて渡されます.
+	 * @param multi 位相シフト(マルチ)パターンか
+	 */
+	virtual bool capture_pattern(const bool multi,const bool ptnCangeWaitShort) = 0;
+	
+	/**
+	 * 接続できるまで繰り返し接続します. 接続できたらf_camera_open_finishedが呼ばれます.
+	 */
+	virtual void start_auto_connect(const std::string ipaddr="") = 0;
+	
+	virtual bool get_exposure_time_level_default(int *val)const = 0;
+	
+	virtual bool get_exposure_time_level_min(int *val)const = 0;
+	virtual bool get_exposure_time_level_max(int *val)const = 0;
+	
+	virtual bool get_exposure_time_level(int *val) = 0;
+	virtual bool set_exposure_time_level(const int val) = 0;
+	
+	virtual bool get_gain_digital(int *val) = 0;
+	virtual bool set_gain_digital(const int val) = 0;
+	
+	virtual bool get_gain_analog(int *val) = 0;
+	virtual bool set_gain_analog(const int val) = 0;
+	
+	virtual bool get_projector_intensity(int *val) = 0;
+	virtual bool set_projector_intensity(const int val) = 0;
+	
+	virtual void set_callback_ros_error_published(camera::ycam3d::f_ros_error_published callback) = 0;
+	virtual void set_callback_auto_con_limit_exceeded(camera::ycam3d::f_auto_con_limit_exceeded callback) = 0;
+	
+	virtual bool get_temperature(int *val) = 0;
+	
+	virtual bool get_capture_param(camera::ycam3d::CaptureParameter *capt_param) = 0;
+	virtual bool update_capture_param(const camera::ycam3d::CaptureParameter &capt_param) = 0;
+	
+	virtual void set_callback_camera_open_finished(camera::ycam3d::f_camera_open_finished callback) = 0;
+	
+	virtual void set_callback_camera_disconnect(camera::ycam3d::f_camera_disconnect callback) = 0;
+	
+	virtual void set_callback_camera_closed(camera::ycam3d::f_camera_closed callback) = 0;
+	
+	virtual void set_callback_capture_img_received(camera::ycam3d::f_capture_img_received callback) = 0;
+	
+	virtual void set_callback_pattern_img_received(camera::ycam3d::f_pattern_img_received callback) = 0;
+	
+	//パターン撮影中、画像を1組受信する毎に呼ばれる. 全て揃うのを待たずに画像を渡したい時に使う
+	virtual void set_callback_pattern_frame_received(camera::ycam3d::f_pattern_frame_received callback) = 0;
+	
+};
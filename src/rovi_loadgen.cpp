@@ -0,0 +1,523 @@
+/**
+ * rovi_loadgen: X1(またはpshift_genpcサービス)で撮影～点群生成を繰り返し起動し、
+ * トリガからY1, ps_floats, ps_pc2を受け取るまでの時間と、処理されなかったトリガの数をJSONで出力します.
+ * カメラが無くても、ycam3dを再生(ycam/replay/dir)か疑似デバイス(ycam/emulator/enabled)で起動すれば動きます.
+ *
+ * 使い方: ROS_NAMESPACE=/rovi rosrun rovi rovi_loadgen [オプション]
+ *
+ * ycam3dはX1を1つずつ処理し、処理中に届いたX1は最新の1つだけが待たされます(キュー長1).
+ * Y1がどのトリガに対するものかはこの動きに合わせて決め、待たされずに捨てられたトリガは missed に数えます.
+ * ps_floats, ps_pc2は、受け取った時刻の直後(grace以内の遅れを含む)にY1が返ったトリガに割り当てます.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <ros/ros.h>
+#include <std_msgs/Bool.h>
+#include <std_srvs/Trigger.h>
+#include <sensor_msgs/PointCloud2.h>
+#include "rovi/Floats.h"
+
+#include "StageMetrics.hpp"
+
+#define LOG_HEADER "(rovi_loadgen) "
+
+namespace {
+//============================================= 無名名前空間 start =============================================
+
+const int COUNT_DEFAULT = 50;
+const int WARMUP_DEFAULT = 1;
+const double RATE_DEFAULT = 0; //Hz. 0の時は前のスキャンが終わり次第次のトリガを送る
+const int BURST_DEFAULT = 0;
+const int TIMEOUT_DEFAULT = 10; //sec
+const int GRACE_DEFAULT = 50; //ms
+const int CONNECT_TIMEOUT = 10; //sec
+
+//ycam3d_nodeのexec_point_cloud_generation()がpc_gen_mutexを取れなかった時の応答
+const std::string GENPC_BUSY_MESSAGE = "genpc is busy";
+
+const std::string STAGE_PREFIX = "loadgen/";
+
+struct LoadgenOptions {
+	int count = COUNT_DEFAULT;
+	int warmup = WARMUP_DEFAULT;
+	double rate = RATE_DEFAULT;
+	int burst = BURST_DEFAULT;
+	int timeout = TIMEOUT_DEFAULT;
+	int grace = GRACE_DEFAULT;
+	bool service = false;
+	std::string output_path;
+};
+
+enum Outcome {
+	Outcome_Pending,
+	Outcome_Completed, //Y1=true
+	Outcome_Failed,    //Y1=false
+	Outcome_Missed,    //処理中に次のトリガが届いて捨てられた
+	Outcome_Rejected,  //genpc is busy
+	Outcome_Timeout    //timeout内に応答が無かった
+};
+
+struct TriggerRecord {
+	ros::Time sent;
+	ros::Time done;
+	Outcome outcome = Outcome_Pending;
+	bool floats_received = false;
+	bool pc2_received = false;
+};
+
+/**
+ * トリガとその結果. コールバック(AsyncSpinner)と送信側のスレッドから呼ばれます.
+ */
+class ScanTracker {
+	std::mutex m_mutex; //以下全て 対象
+	std::condition_variable m_cond;
+	const ros::Duration m_timeout;
+	std::vector<TriggerRecord> m_triggers;
+	int m_current = -1; //ycam3dが処理中のトリガ
+	int m_queued = -1;  //ycam3dのX1のキューで待っているトリガ
+	int m_pending = 0;  //サービスの応答待ち
+	int m_unexpected_y1 = 0;
+	std::vector<ros::Time> m_floats;
+	std::vector<ros::Time> m_pc2;
+
+	void resolve(const int idx,const Outcome outcome,const ros::Time &t){
+		m_triggers[idx].outcome = outcome;
+		m_triggers[idx].done = t;
+	}
+
+	//応答の無いトリガをタイムアウトにする
+	void expire(const ros::Time &now){
+		if( m_current < 0 || now - m_triggers[m_current].sent < m_timeout ){
+			return;
+		}
+		resolve(m_current,Outcome_Timeout,now);
+		m_current = m_queued;
+		m_queued = -1;
+	}
+
+	bool idle()const{
+		return m_current < 0 && m_queued < 0 && m_pending == 0;
+	}
+
+public:
+	explicit ScanTracker(const int timeout):m_timeout(timeout){
+	}
+
+	//X1を送った
+	void on_trigger(const ros::Time &t){
+		std::lock_guard<std::mutex> locker(m_mutex);
+		expire(t);
+		const int idx = m_triggers.size();
+		m_triggers.push_back(TriggerRecord());
+		m_triggers.back().sent = t;
+		if( m_current < 0 ){
+			m_current = idx;
+		}else{
+			if( m_queued >= 0 ){
+				resolve(m_queued,Outcome_Missed,t);
+			}
+			m_queued = idx;
+		}
+	}
+
+	void on_y1(const bool result,const ros::Time &t){
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			if( m_current < 0 ){
+				++m_unexpected_y1;
+				return;
+			}
+			resolve(m_current,result ? Outcome_Completed : Outcome_Failed,t);
+			m_current = m_queued;
+			m_queued = -1;
+		}
+		m_cond.notify_all();
+	}
+
+	//サービスを呼んだ. 戻り値は応答を渡す時の番号
+	int on_service_call(const ros::Time &t){
+		std::lock_guard<std::mutex> locker(m_mutex);
+		m_triggers.push_back(TriggerRecord());
+		m_triggers.back().sent = t;
+		++m_pending;
+		return m_triggers.size() - 1;
+	}
+
+	void on_service_response(const int idx,const bool called,const std_srvs::TriggerResponse &res,const ros::Time &t){
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			if( ! called ){
+				resolve(idx,Outcome_Timeout,t);
+			}else if( res.success ){
+				resolve(idx,Outcome_Completed,t);
+			}else if( res.message == GENPC_BUSY_MESSAGE ){
+				resolve(idx,Outcome_Rejected,t);
+			}else{
+				resolve(idx,Outcome_Failed,t);
+			}
+			--m_pending;
+		}
+		m_cond.notify_all();
+	}
+
+	void on_floats(const ros::Time &t){
+		std::lock_guard<std::mutex> locker(m_mutex);
+		m_floats.push_back(t);
+	}
+
+	void on_pc2(const ros::Time &t){
+		std::lock_guard<std::mutex> locker(m_mutex);
+		m_pc2.push_back(t);
+	}
+
+	/**
+	 * 送ったトリガが全て処理されるのを待ちます. timeoutを過ぎたトリガはタイムアウトにします.
+	 */
+	void wait_idle(){
+		std::unique_lock<std::mutex> locker(m_mutex);
+		while( ! idle() ){
+			m_cond.wait_for(locker, std::chrono::milliseconds(100));
+			expire(ros::Time::now());
+		}
+	}
+
+	//ウォームアップ分を捨てる
+	void clear(){
+		std::lock_guard<std::mutex> locker(m_mutex);
+		m_triggers.clear();
+		m_current = m_queued = -1;
+		m_pending = 0;
+		m_unexpected_y1 = 0;
+		m_floats.clear();
+		m_pc2.clear();
+	}
+
+	/**
+	 * 応答までの時間と、ps_floats/ps_pc2までの時間をStageMetricsに積算します.
+	 * ps_floats/ps_pc2は、受信時刻からgrace以内の遅れを許して、それより後に応答が返った最初のトリガに割り当てます.
+	 */
+	void record_latency(const std::string &response_stage,const ros::Duration &grace){
+		std::lock_guard<std::mutex> locker(m_mutex);
+		std::vector<int> done;
+		for( int i = 0 ; i < (int)m_triggers.size() ; ++i ){
+			const TriggerRecord &trig = m_triggers[i];
+			if( trig.outcome == Outcome_Completed || trig.outcome == Outcome_Failed ){
+				done.push_back(i);
+			}
+			if( trig.outcome == Outcome_Completed ){
+				StageMetrics::record(STAGE_PREFIX + response_stage, (trig.done - trig.sent).toSec() * 1000);
+			}
+		}
+		std::sort(done.begin(), done.end(), [this](const int a,const int b){ return m_triggers[a].done < m_triggers[b].done; });
+
+		auto assign = [this,&done,&grace](const std::vector<ros::Time> &events,bool TriggerRecord::*received,const std::string &stage){
+			for( const ros::Time &t : events ){
+				for( const int idx : done ){
+					TriggerRecord &trig = m_triggers[idx];
+					if( trig.done + grace < t || t < trig.sent ){
+						continue;
+					}else if( trig.*received ){
+						continue;
+					}
+					trig.*received = true;
+					StageMetrics::record(STAGE_PREFIX + stage, (t - trig.sent).toSec() * 1000);
+					break;
+				}
+			}
+		};
+		assign(m_floats, &TriggerRecord::floats_received, "ps_floats");
+		assign(m_pc2, &TriggerRecord::pc2_received, "ps_pc2");
+	}
+
+	int count(const Outcome outcome){
+		std::lock_guard<std::mutex> locker(m_mutex);
+		return std::count_if(m_triggers.begin(), m_triggers.end(), [outcome](const TriggerRecord &trig){ return trig.outcome == outcome; });
+	}
+
+	int triggers(){
+		std::lock_guard<std::mutex> locker(m_mutex);
+		return m_triggers.size();
+	}
+
+	int unexpected_y1(){
+		std::lock_guard<std::mutex> locker(m_mutex);
+		return m_unexpected_y1;
+	}
+
+	//最初のトリガから最後の応答まで
+	double elapsed_s(){
+		std::lock_guard<std::mutex> locker(m_mutex);
+		if( m_triggers.empty() ){
+			return 0;
+		}
+		ros::Time last = m_triggers.front().sent;
+		for( const TriggerRecord &trig : m_triggers ){
+			if( trig.outcome != Outcome_Pending && last < trig.done ){
+				last = trig.done;
+			}
+		}
+		return (last - m_triggers.front().sent).toSec();
+	}
+};
+
+/**
+ * X1かpshift_genpcサービスでスキャンを起動します.
+ */
+class ScanTrigger {
+	ros::Publisher m_pub_X1;
+	ros::ServiceClient m_client;
+	ScanTracker &m_tracker;
+	const bool m_service;
+	std::vector<std::thread> m_calls;
+
+	void call(const int idx){
+		std_srvs::Trigger srv;
+		ros::ServiceClient client = m_client;
+		const bool called = client.call(srv);
+		m_tracker.on_service_response(idx, called, srv.response, ros::Time::now());
+	}
+
+public:
+	ScanTrigger(ros::NodeHandle &n,ScanTracker &tracker,const bool service):
+		m_tracker(tracker),
+		m_service(service)
+	{
+		if( m_service ){
+			m_client = n.serviceClient<std_srvs::Trigger>("pshift_genpc");
+		}else{
+			m_pub_X1 = n.advertise<std_msgs::Bool>("X1", 1);
+		}
+	}
+
+	~ScanTrigger(){
+		join();
+	}
+
+	bool wait_connected(const int timeout_sec){
+		if( m_service ){
+			return m_client.waitForExistence(ros::Duration(timeout_sec));
+		}
+		const ros::Time limit = ros::Time::now() + ros::Duration(timeout_sec);
+		while( m_pub_X1.getNumSubscribers() == 0 ){
+			if( ! ros::ok() || limit < ros::Time::now() ){
+				return false;
+			}
+			ros::Duration(0.1).sleep();
+		}
+		return true;
+	}
+
+	/**
+	 * @param wait trueの時は応答を待つ(サービスの時はこのスレッドで呼ぶ)
+	 */
+	void fire(const bool wait){
+		if( ! m_service ){
+			std_msgs::Bool msg;
+			msg.data = true;
+			m_tracker.on_trigger(ros::Time::now());
+			m_pub_X1.publish(msg);
+		}else if( wait ){
+			call(m_tracker.on_service_call(ros::Time::now()));
+		}else{
+			const int idx = m_tracker.on_service_call(ros::Time::now());
+			m_calls.push_back(std::thread(&ScanTrigger::call, this, idx));
+		}
+		if( wait ){
+			m_tracker.wait_idle();
+		}
+	}
+
+	void join(){
+		for( std::thread &th : m_calls ){
+			if( th.joinable() ){
+				th.join();
+			}
+		}
+		m_calls.clear();
+	}
+};
+
+std::string mode_name(const LoadgenOptions &opts){
+	if( opts.burst > 0 ){
+		return "burst";
+	}else if( opts.rate > 0 ){
+		return "rate";
+	}
+	return "closed";
+}
+
+/**
+ * count個のトリガを送ります.
+ *   closed: 前のスキャンの応答を待って次を送る
+ *   rate:   rate[Hz]の間隔で送る(応答は待たない)
+ *   burst:  burst個ずつ rate[Hz]の間隔(0の時は続けて)で送り、全ての応答を待ってから次を送る
+ */
+void run_load(const LoadgenOptions &opts,ScanTrigger &trigger,ScanTracker &tracker){
+	if( opts.burst <= 0 && opts.rate <= 0 ){
+		for( int i = 0 ; i < opts.count && ros::ok() ; ++i ){
+			trigger.fire(true);
+		}
+		return;
+	}
+	const ros::Duration interval(opts.rate > 0 ? 1.0 / opts.rate : 0);
+	ros::Time next = ros::Time::now();
+	for( int i = 0 ; i < opts.count && ros::ok() ; ++i ){
+		const ros::Time now = ros::Time::now();
+		if( now < next ){
+			(next - now).sleep();
+		}
+		trigger.fire(false);
+		next += interval;
+		if( opts.burst > 0 && (i + 1) % opts.burst == 0 ){
+			trigger.join();
+			tracker.wait_idle();
+			next = ros::Time::now();
+		}
+	}
+	trigger.join();
+	tracker.wait_idle();
+}
+
+bool write_report(const LoadgenOptions &opts,ScanTracker &tracker){
+	FILE *fp = opts.output_path.empty() ? stdout : fopen(opts.output_path.c_str(), "w");
+	if( ! fp ){
+		ROS_ERROR(LOG_HEADER"report open failed. path=%s",opts.output_path.c_str());
+		return false;
+	}
+	const int completed = tracker.count(Outcome_Completed);
+	const double elapsed_s = tracker.elapsed_s();
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"mode\": \"%s\",\n  \"trigger\": \"%s\",\n", mode_name(opts).c_str(), opts.service ? "pshift_genpc" : "X1");
+	fprintf(fp, "  \"rate_hz\": %g,\n  \"burst\": %d,\n  \"timeout_s\": %d,\n", opts.rate, opts.burst, opts.timeout);
+	fprintf(fp, "  \"triggers\": %d,\n", tracker.triggers());
+	fprintf(fp, "  \"completed\": %d,\n  \"failed\": %d,\n  \"missed\": %d,\n  \"rejected\": %d,\n  \"timeouts\": %d,\n",
+		completed, tracker.count(Outcome_Failed), tracker.count(Outcome_Missed), tracker.count(Outcome_Rejected), tracker.count(Outcome_Timeout));
+	fprintf(fp, "  \"unexpected_y1\": %d,\n", tracker.unexpected_y1());
+	fprintf(fp, "  \"elapsed_s\": %.6f,\n", elapsed_s);
+	fprintf(fp, "  \"scans_per_s\": %.3f,\n", elapsed_s > 0 ? completed / elapsed_s : 0.0);
+	fprintf(fp, "  \"latency\": {");
+	bool first = true;
+	for( const StageMetrics::Summary &summary : StageMetrics::summaries(STAGE_PREFIX) ){
+		fprintf(fp, "%s\n    \"%s\": {\"unit\": \"%s\", \"count\": %llu, \"mean\": %g, \"p50\": %g, \"p95\": %g, \"p99\": %g, \"max\": %g}",
+			first ? "" : ",", summary.name.substr(STAGE_PREFIX.size()).c_str(), StageMetrics::unit_name(summary.unit),
+			(unsigned long long)summary.count, summary.count == 0 ? 0.0 : summary.sum / summary.count,
+			summary.p50, summary.p95, summary.p99, summary.max);
+		first = false;
+	}
+	fprintf(fp, "\n  }\n}\n");
+
+	const bool written = ! ferror(fp);
+	if( fp != stdout ){
+		return fclose(fp) == 0 && written;
+	}
+	fflush(fp);
+	return written;
+}
+
+void usage(const char *prog){
+	fprintf(stderr,
+		"usage: ROS_NAMESPACE=/rovi %s [options]\n"
+		"  -n, --count N       triggers to send (default %d)\n"
+		"  -w, --warmup N      closed-loop scans before measuring (default %d)\n"
+		"  -r, --rate HZ       send triggers at a fixed rate (default: next trigger after each response)\n"
+		"  -b, --burst N       send N triggers at --rate (or back to back), then wait for all responses\n"
+		"  -s, --service       trigger with the pshift_genpc service instead of X1\n"
+		"  -T, --timeout SEC   response timeout per scan (default %d)\n"
+		"  -g, --grace MS      accept ps_floats/ps_pc2 this late after the response (default %d)\n"
+		"  -o, --output PATH   JSON report path (default stdout)\n",
+		prog, COUNT_DEFAULT, WARMUP_DEFAULT, TIMEOUT_DEFAULT, GRACE_DEFAULT);
+}
+
+bool parse_options(int argc,char **argv,LoadgenOptions *opts){
+	static const struct option long_options[] = {
+		{"count",   required_argument, nullptr, 'n'},
+		{"warmup",  required_argument, nullptr, 'w'},
+		{"rate",    required_argument, nullptr, 'r'},
+		{"burst",   required_argument, nullptr, 'b'},
+		{"service", no_argument,       nullptr, 's'},
+		{"timeout", required_argument, nullptr, 'T'},
+		{"grace",   required_argument, nullptr, 'g'},
+		{"output",  required_argument, nullptr, 'o'},
+		{"help",    no_argument,       nullptr, 'h'},
+		{nullptr, 0, nullptr, 0}
+	};
+	int c;
+	while( (c = getopt_long(argc, argv, "n:w:r:b:sT:g:o:h", long_options, nullptr)) != -1 ){
+		switch( c ){
+		case 'n': opts->count = atoi(optarg); break;
+		case 'w': opts->warmup = atoi(optarg); break;
+		case 'r': opts->rate = atof(optarg); break;
+		case 'b': opts->burst = atoi(optarg); break;
+		case 's': opts->service = true; break;
+		case 'T': opts->timeout = atoi(optarg); break;
+		case 'g': opts->grace = atoi(optarg); break;
+		case 'o': opts->output_path = optarg; break;
+		default:  return false;
+		}
+	}
+	if( optind != argc || opts->count < 1 || opts->warmup < 0 || opts->rate < 0 || opts->burst < 0 || opts->timeout < 1 || opts->grace < 0 ){
+		return false;
+	}
+	return true;
+}
+
+//============================================= 無名名前空間  end  =============================================
+}
+
+int main(int argc, char **argv)
+{
+	//remap引数(__ns:=など)はros::initが取り除く
+	ros::init(argc, argv, "rovi_loadgen", ros::init_options::AnonymousName);
+	LoadgenOptions opts;
+	if( ! parse_options(argc,argv,&opts) ){
+		usage(argv[0]);
+		return 2;
+	}
+	ros::NodeHandle n;
+	ScanTracker tracker(opts.timeout);
+
+	std::vector<ros::Subscriber> subs;
+	if( ! opts.service ){
+		subs.push_back(n.subscribe<std_msgs::Bool>("Y1", 10, [&tracker](const std_msgs::Bool::ConstPtr &msg){
+			tracker.on_y1(msg->data, ros::Time::now());
+		}));
+	}
+	subs.push_back(n.subscribe<rovi::Floats>("ps_floats", 10, [&tracker](const rovi::Floats::ConstPtr &msg){
+		tracker.on_floats(ros::Time::now());
+	}));
+	subs.push_back(n.subscribe<sensor_msgs::PointCloud2>("ps_pc2", 10, [&tracker](const sensor_msgs::PointCloud2::ConstPtr &msg){
+		tracker.on_pc2(ros::Time::now());
+	}));
+	//受信時刻を測るので、送信側とは別のスレッドでコールバックを処理する
+	ros::AsyncSpinner spinner(1);
+	spinner.start();
+
+	ScanTrigger trigger(n,tracker,opts.service);
+	if( ! trigger.wait_connected(CONNECT_TIMEOUT) ){
+		ROS_ERROR(LOG_HEADER"ycam3d not found. trigger=%s",opts.service ? "pshift_genpc" : "X1");
+		return 1;
+	}
+	ROS_INFO(LOG_HEADER"load start. mode=%s, count=%d, rate=%g Hz, burst=%d",mode_name(opts).c_str(),opts.count,opts.rate,opts.burst);
+
+	for( int i = 0 ; i < opts.warmup && ros::ok() ; ++i ){
+		trigger.fire(true);
+	}
+	tracker.clear();
+
+	run_load(opts,trigger,tracker);
+	//応答の後に届くps_floats/ps_pc2を待つ
+	ros::Duration(opts.grace / 1000.0).sleep();
+	spinner.stop();
+
+	tracker.record_latency(opts.service ? "response" : "y1", ros::Duration(opts.grace / 1000.0));
+	ROS_INFO(LOG_HEADER"load finished. triggers=%d, completed=%d, missed=%d, timeouts=%d",
+		tracker.triggers(), tracker.count(Outcome_Completed), tracker.count(Outcome_Missed), tracker.count(Outcome_Timeout));
+	return write_report(opts,tracker) ? 0 : 1;
+}
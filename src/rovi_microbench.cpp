@@ -0,0 +1,427 @@
+/**
+ * rovi_microbench: 点群変換などの処理単位のマイクロベンチマーク(Google Benchmark).
+ * 合成した行列状の点群(VGA/SXGA, 無効点の割合を指定)で、genpc/ycam3d/floats2pcの変換処理を計測します.
+ *
+ * 使い方: rovi_microbench [--nan_density=0,0.3,0.9] [Google Benchmarkのオプション]
+ *   結果をJSONで残す場合は --benchmark_out=<path> --benchmark_out_format=json
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include <ros/time.h>
+#include <sensor_msgs/PointCloud.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/image_encodings.h>
+#include "rovi/Floats.h"
+
+#include "YPCData.hpp"
+#include "VoxelGrid.hpp"
+#include "PointQuantizer.hpp"
+#include "Base64Points.hpp"
+#include "ImageDiff.hpp"
+#include "CameraYCAM3D.hpp"
+
+namespace {
+//============================================= 無名名前空間 start =============================================
+
+struct FrameSize {
+	const char *name;
+	int width;
+	int height;
+};
+
+const std::vector<FrameSize> FRAME_SIZES = {
+	{"VGA", 640, 480},
+	{"SXGA", 1280, 1024},
+};
+
+const std::string NAN_DENSITY_DEFAULT = "0,0.3,0.9";
+//save_plyの出力先. ディスクの速さを含めないようtmpfsに書く
+const std::string PLY_PATH = "/dev/shm/rovi_microbench.ply";
+const float VOXEL_LEAF_SIZE = 1.0f;
+
+/**
+ * 合成点群. 奥行き500mm付近のうねった面を焦点距離1000pxで投影した行列状の点群で、
+ * 無効点(NaN)を指定の割合でランダムに置きます. 乱数の種は固定.
+ */
+std::shared_ptr<const YPCData> make_synthetic_cloud(const int width,const int height,const double nan_density){
+	std::vector<PointCloudCallback::Point3d> points(width * height);
+	std::vector<unsigned char> texture(width * height);
+	std::mt19937 rng(12345);
+	std::uniform_real_distribution<double> uniform(0, 1);
+	int n_valid = 0;
+	const float f = 1000;
+	for( int v = 0 ; v < height ; v++ ){
+		for( int u = 0 ; u < width ; u++ ){
+			const int idx = v * width + u;
+			texture[idx] = (unsigned char)((u + v) & 0xFF);
+			if( uniform(rng) < nan_density ){
+				continue;
+			}
+			const float z = 500 + 20 * std::sin(u * 0.02f) * std::cos(v * 0.03f);
+			points[idx] = PointCloudCallback::Point3d((u - width / 2) * z / f, (v - height / 2) * z / f, z);
+			++n_valid;
+		}
+	}
+	std::shared_ptr<YPCData> cloud = std::make_shared<YPCData>();
+	(*cloud)(texture.data(), width, width, height, points, n_valid);
+	return cloud;
+}
+
+/**
+ * 同じ条件の点群は1回だけ作って使い回します.
+ */
+const YPCData &synthetic_cloud(const FrameSize &size,const double nan_density){
+	static std::map<std::pair<std::string,double>,std::shared_ptr<const YPCData>> clouds;
+	std::shared_ptr<const YPCData> &cloud = clouds[std::make_pair(std::string(size.name),nan_density)];
+	if( ! cloud ){
+		cloud = make_synthetic_cloud(size.width, size.height, nan_density);
+	}
+	return *cloud;
+}
+
+sensor_msgs::PointCloud dense_point_cloud(const YPCData &cloud){
+	sensor_msgs::PointCloud pts;
+	cloud.make_point_cloud(pts, true);
+	return pts;
+}
+
+void set_pixel_counters(benchmark::State &state,const YPCData &cloud){
+	const YPCValidIndex &index = cloud.get_valid_index();
+	state.SetItemsProcessed(state.iterations() * index.width * index.height);
+	state.counters["valid_points"] = cloud.count();
+}
+
+void BM_make_point_cloud(benchmark::State &state,const FrameSize size,const double nan_density,const bool dense){
+	const YPCData &cloud = synthetic_cloud(size, nan_density);
+	for( auto _ : state ){
+		sensor_msgs::PointCloud pts;
+		cloud.make_point_cloud(pts, dense);
+		benchmark::DoNotOptimize(pts.points.data());
+	}
+	set_pixel_counters(state, cloud);
+}
+
+void BM_make_point_cloud2(benchmark::State &state,const FrameSize size,const double nan_density,const bool dense){
+	const YPCData &cloud = synthetic_cloud(size, nan_density);
+	for( auto _ : state ){
+		sensor_msgs::PointCloud2 pts;
+		cloud.make_point_cloud2(pts, dense);
+		benchmark::DoNotOptimize(pts.data.data());
+	}
+	set_pixel_counters(state, cloud);
+}
+
+void BM_make_depth_image(benchmark::State &state,const FrameSize size,const double nan_density){
+	const YPCData &cloud = synthetic_cloud(size, nan_density);
+	for( auto _ : state ){
+		sensor_msgs::Image img;
+		cloud.make_depth_image(img);
+		benchmark::DoNotOptimize(img.data.data());
+	}
+	set_pixel_counters(state, cloud);
+}
+
+void BM_to_rg_floats(benchmark::State &state,const FrameSize size,const double nan_density){
+	const YPCData &cloud = synthetic_cloud(size, nan_density);
+	for( auto _ : state ){
+		rovi::Floats floats = cloud.to_rg_floats();
+		benchmark::DoNotOptimize(floats.data.data());
+	}
+	set_pixel_counters(state, cloud);
+}
+
+void BM_save_ply(benchmark::State &state,const FrameSize size,const double nan_density){
+	const YPCData &cloud = synthetic_cloud(size, nan_density);
+	for( auto _ : state ){
+		if( ! cloud.save_ply(PLY_PATH) ){
+			state.SkipWithError("save_ply failed");
+			break;
+		}
+	}
+	remove(PLY_PATH.c_str());
+	set_pixel_counters(state, cloud);
+}
+
+//genpcのcount_quantize_points()
+void BM_quantize_points(benchmark::State &state,const FrameSize size,const double nan_density){
+	const YPCData &cloud = synthetic_cloud(size, nan_density);
+	const sensor_msgs::PointCloud pts = dense_point_cloud(cloud);
+	for( auto _ : state ){
+		std::vector<float> xyz;
+		PointQuantizer::quantize(pts, xyz);
+		benchmark::DoNotOptimize(xyz.data());
+	}
+	set_pixel_counters(state, cloud);
+}
+
+//点数を固定した量子化. 改善前後を同じ点数で比べるため、一様乱数の点群(乱数の種は固定)を使う
+const std::vector<int> QUANTIZE_POINT_COUNTS = {100000, 1000000, 2600000};
+
+const sensor_msgs::PointCloud &random_point_cloud(const int N){
+	static std::map<int,sensor_msgs::PointCloud> clouds;
+	sensor_msgs::PointCloud &pts = clouds[N];
+	if( (int)pts.points.size() != N ){
+		std::mt19937 rng(12345);
+		std::uniform_real_distribution<float> xy(-300, 300);
+		std::uniform_real_distribution<float> z(400, 600);
+		pts.points.resize(N);
+		for( geometry_msgs::Point32 &pt : pts.points ){
+			pt.x = xy(rng);
+			pt.y = xy(rng);
+			pt.z = z(rng);
+		}
+	}
+	return pts;
+}
+
+/**
+ * 改善前のgenpcのcount_quantize_points()の写し(XYZW配列を全点std::sort).
+ * PointQuantizerとの処理時間の比較用です.
+ */
+struct XYZW{ float x,y,z,w;};
+
+bool operator<(const XYZW& left, const XYZW& right){ return left.w < right.w;}
+
+bool quantize_points_reference(const sensor_msgs::PointCloud &pts, std::vector<float> &xyz){
+	const int N = pts.points.size();
+	if( N <= 0 ){
+		return false;
+	}
+	
+	double X0=0,Y0=0,Z0=0;
+	
+	for (int n = 0 ; n < N ; n++ ) {
+		X0 += pts.points[n].x;
+		Y0 += pts.points[n].y;
+		Z0 += pts.points[n].z;
+	}
+	X0/=N;
+	Y0/=N;
+	Z0/=N;
+	
+	// getting norm from the center and sort by it
+	std::vector<XYZW> norm;
+	norm.resize(N);
+	for (int n = 0; n < N; n++) {
+		float dx = (norm[n].x = pts.points[n].x) - X0;
+		float dy = (norm[n].y = pts.points[n].y) - Y0;
+		float dz = (norm[n].z = pts.points[n].z) - Z0;
+		//  norm[n].w=sqrt(dx*dx+dy*dy+dz*dz);
+		norm[n].w = sqrt(dx*dx + dy*dy);
+	}
+	std::sort(norm.begin(), norm.end());
+	
+	// Quantize points count for Numpy array
+	const double gamma=1.1;
+	const double kn=floor((log10(N)-1)/log10(gamma));
+	const int Qn=N<10? N:floor(10*pow(gamma,kn));
+	xyz.resize(3*Qn);
+	for (int n = 0; n < Qn; n++) {
+		int n3=3*n;
+		xyz[n3++] = norm[n].x;
+		xyz[n3++] = norm[n].y;
+		xyz[n3  ] = norm[n].z;
+	}
+	
+	return true;
+}
+
+void BM_quantize_points_count(benchmark::State &state,const bool reference){
+	const int N = state.range(0);
+	const sensor_msgs::PointCloud &pts = random_point_cloud(N);
+	for( auto _ : state ){
+		std::vector<float> xyz;
+		if( reference ){
+			quantize_points_reference(pts, xyz);
+		}else{
+			PointQuantizer::quantize(pts, xyz);
+		}
+		benchmark::DoNotOptimize(xyz.data());
+	}
+	state.SetItemsProcessed(state.iterations() * N);
+}
+
+//genpcのvoxelizing_pcdata(). 点群から(再ボクセル化)と点群生成結果から(スキャン毎)の両方
+void BM_voxelize_point_cloud(benchmark::State &state,const FrameSize size,const double nan_density){
+	const YPCData &cloud = synthetic_cloud(size, nan_density);
+	const sensor_msgs::PointCloud pts = dense_point_cloud(cloud);
+	const VoxelGrid::LeafSize leaf = {VOXEL_LEAF_SIZE, VOXEL_LEAF_SIZE, VOXEL_LEAF_SIZE};
+	for( auto _ : state ){
+		sensor_msgs::PointCloud pts_vx;
+		VoxelGrid::voxelize(pts, leaf, pts_vx);
+		benchmark::DoNotOptimize(pts_vx.points.data());
+	}
+	set_pixel_counters(state, cloud);
+}
+
+void BM_voxelize_ypcdata(benchmark::State &state,const FrameSize size,const double nan_density){
+	const YPCData &cloud = synthetic_cloud(size, nan_density);
+	const VoxelGrid::LeafSize leaf = {VOXEL_LEAF_SIZE, VOXEL_LEAF_SIZE, VOXEL_LEAF_SIZE};
+	for( auto _ : state ){
+		sensor_msgs::PointCloud pts_vx;
+		cloud.voxelize(leaf, pts_vx);
+		benchmark::DoNotOptimize(pts_vx.points.data());
+	}
+	set_pixel_counters(state, cloud);
+}
+
+//floats2pcの/base64. 有効点を1点16文字で符号化した文字列を復号する
+std::string base64encode_points(const sensor_msgs::PointCloud &pts){
+	static const char kEncodingTable[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string output;
+	output.reserve(pts.points.size() * 16);
+	for( const geometry_msgs::Point32 &pt : pts.points ){
+		const float xyz[3] = {pt.x, pt.y, pt.z};
+		const unsigned char *bytes = reinterpret_cast<const unsigned char*>(xyz);
+		for( int k = 0 ; k < 12 ; k += 3 ){
+			const uint32_t e = (bytes[k] << 16) | (bytes[k+1] << 8) | bytes[k+2];
+			output += kEncodingTable[(e >> 18) & 0x3F];
+			output += kEncodingTable[(e >> 12) & 0x3F];
+			output += kEncodingTable[(e >> 6) & 0x3F];
+			output += kEncodingTable[e & 0x3F];
+		}
+	}
+	return output;
+}
+
+void BM_base64decode(benchmark::State &state,const FrameSize size,const double nan_density){
+	const YPCData &cloud = synthetic_cloud(size, nan_density);
+	const std::string input = base64encode_points(dense_point_cloud(cloud));
+	for( auto _ : state ){
+		std::vector<geometry_msgs::Point32> points;
+		base64decode(input, points);
+		benchmark::DoNotOptimize(points.data());
+	}
+	state.SetBytesProcessed(state.iterations() * input.size());
+	state.counters["valid_points"] = cloud.count();
+}
+
+//ycam3dのパターン画像差分. 画像の中身で処理時間は変わらないので無効点の割合は持たない
+void fill_camera_image(camera::ycam3d::CameraImage &img,const int seed){
+	img.result = true;
+	img.alloc();
+	for( size_t i = 0 ; i < img.data.size() ; i++ ){
+		img.data[i] = (unsigned char)((i * 7 + seed) & 0xFF);
+	}
+}
+
+void BM_camera_image_diff(benchmark::State &state,const FrameSize size){
+	camera::ycam3d::CameraImage img0(size.width, size.height, size.width);
+	camera::ycam3d::CameraImage img1(size.width, size.height, size.width);
+	fill_camera_image(img0, 0);
+	fill_camera_image(img1, 100);
+	for( auto _ : state ){
+		const camera::ycam3d::CameraImage diff = img1 - img0;
+		benchmark::DoNotOptimize(diff.data.data());
+	}
+	state.SetBytesProcessed(state.iterations() * img0.data.size());
+}
+
+void BM_to_diff_img(benchmark::State &state,const FrameSize size){
+	sensor_msgs::Image img0;
+	img0.width = size.width;
+	img0.height = size.height;
+	img0.step = size.width;
+	img0.encoding = sensor_msgs::image_encodings::MONO8;
+	img0.data.resize(size.width * size.height);
+	sensor_msgs::Image img1 = img0;
+	for( size_t i = 0 ; i < img0.data.size() ; i++ ){
+		img0.data[i] = (unsigned char)((i * 7) & 0xFF);
+		img1.data[i] = (unsigned char)((i * 7 + 100) & 0xFF);
+	}
+	for( auto _ : state ){
+		sensor_msgs::Image diff = to_diff_img(img0, img1);
+		benchmark::DoNotOptimize(diff.data.data());
+	}
+	state.SetBytesProcessed(state.iterations() * img0.data.size());
+}
+
+/**
+ * --nan_density=0,0.3,0.9 を取り除いて無効点の割合のリストにします. 残りはGoogle Benchmarkに渡す.
+ */
+std::vector<double> parse_nan_densities(int *argc,char **argv){
+	const std::string prefix = "--nan_density=";
+	std::string list = NAN_DENSITY_DEFAULT;
+	int dst = 1;
+	for( int i = 1 ; i < *argc ; i++ ){
+		const std::string arg = argv[i];
+		if( arg.compare(0, prefix.size(), prefix) == 0 ){
+			list = arg.substr(prefix.size());
+		}else{
+			argv[dst++] = argv[i];
+		}
+	}
+	*argc = dst;
+
+	std::vector<double> densities;
+	size_t pos = 0;
+	while( pos <= list.size() ){
+		const size_t next = std::min(list.find(',', pos), list.size());
+		const std::string item = list.substr(pos, next - pos);
+		if( ! item.empty() ){
+			densities.push_back(std::min(std::max(atof(item.c_str()), 0.0), 1.0));
+		}
+		pos = next + 1;
+	}
+	return densities;
+}
+
+void register_benchmarks(const std::vector<double> &nan_densities){
+	for( const bool reference : {false, true} ){
+		benchmark::internal::Benchmark *bm = benchmark::RegisterBenchmark(reference ? "quantize_points/std_sort" : "quantize_points/radix_sort",
+			[reference](benchmark::State &st){ BM_quantize_points_count(st, reference); });
+		for( const int N : QUANTIZE_POINT_COUNTS ){
+			bm->Arg(N);
+		}
+		bm->Unit(benchmark::kMillisecond);
+	}
+	for( const FrameSize &size : FRAME_SIZES ){
+		for( const double nan : nan_densities ){
+			char suffix[64];
+			snprintf(suffix, sizeof(suffix), "/%s/nan:%g", size.name, nan);
+			auto add = [&suffix](const std::string &name, const std::function<void(benchmark::State&)> &fn){
+				benchmark::RegisterBenchmark((name + suffix).c_str(), fn)->Unit(benchmark::kMillisecond);
+			};
+			add("make_point_cloud/dense", [size,nan](benchmark::State &st){ BM_make_point_cloud(st, size, nan, true); });
+			add("make_point_cloud/organized", [size,nan](benchmark::State &st){ BM_make_point_cloud(st, size, nan, false); });
+			add("make_point_cloud2/dense", [size,nan](benchmark::State &st){ BM_make_point_cloud2(st, size, nan, true); });
+			add("make_point_cloud2/organized", [size,nan](benchmark::State &st){ BM_make_point_cloud2(st, size, nan, false); });
+			add("make_depth_image", [size,nan](benchmark::State &st){ BM_make_depth_image(st, size, nan); });
+			add("to_rg_floats", [size,nan](benchmark::State &st){ BM_to_rg_floats(st, size, nan); });
+			add("save_ply", [size,nan](benchmark::State &st){ BM_save_ply(st, size, nan); });
+			add("count_quantize_points", [size,nan](benchmark::State &st){ BM_quantize_points(st, size, nan); });
+			add("voxelizing_pcdata/point_cloud", [size,nan](benchmark::State &st){ BM_voxelize_point_cloud(st, size, nan); });
+			add("voxelizing_pcdata/ypcdata", [size,nan](benchmark::State &st){ BM_voxelize_ypcdata(st, size, nan); });
+			add("base64decode", [size,nan](benchmark::State &st){ BM_base64decode(st, size, nan); });
+		}
+		benchmark::RegisterBenchmark((std::string("CameraImage::operator-/") + size.name).c_str(),
+			[size](benchmark::State &st){ BM_camera_image_diff(st, size); })->Unit(benchmark::kMillisecond);
+		benchmark::RegisterBenchmark((std::string("to_diff_img/") + size.name).c_str(),
+			[size](benchmark::State &st){ BM_to_diff_img(st, size); })->Unit(benchmark::kMillisecond);
+	}
+}
+
+//============================================= 無名名前空間  end  =============================================
+}
+
+int main(int argc, char **argv)
+{
+	//YPCDataのメッセージのstamp用. マスターには繋がない
+	ros::Time::init();
+	register_benchmarks(parse_nan_densities(&argc, argv));
+	benchmark::Initialize(&argc, argv);
+	if( benchmark::ReportUnrecognizedArguments(argc, argv) ){
+		return 1;
+	}
+	benchmark::RunSpecifiedBenchmarks();
+	return 0;
+}
@@ -0,0 +1,257 @@
+/**
+ * rovi_scene_render: シーン(平面, 箱, 球, 階段, PLYメッシュ)とステレオカメラのキャリブレーションから、
+ * プロジェクタのパターン(GRAYPS4 13枚 / MULTI 14枚)を撮影した左右の画像を合成し、genpcのダンプ(genpc/dump)と同じ形式で書き出します.
+ * 書き出したディレクトリはgenpc_benchやycam3dのリプレイ(/rovi/ycam/replay/dir)にそのまま渡せます.
+ * 点群生成で復元できるはずの点の真値をPLYで書き出します.
+ *
+ * 使い方: rovi_scene_render [オプション] <シーンyaml> <出力ディレクトリ> <パラメータyaml> [<パラメータyaml> ...]
+ *   パラメータyamlは rosparam dump <file> /rovi の形式. 複数指定した場合は後のファイルの値が優先されます.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <getopt.h>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include <sensor_msgs/PointCloud.h>
+
+#include "iPointCloudGenerator.hpp"
+#include "SceneRenderer.hpp"
+#include "PlyWriter.hpp"
+#include "ElapsedTimer.hpp"
+#include "YamlParams.hpp"
+
+#define LOG_HEADER "(rovi_scene_render) "
+#define LOG_INFO(...) fprintf(stderr, LOG_HEADER __VA_ARGS__), fputc('\n', stderr)
+
+namespace {
+//============================================= 無名名前空間 start =============================================
+
+const int WIDTH_DEFAULT = 1280;
+const int HEIGHT_DEFAULT = 1024;
+const int FRAME_INTERVAL_MS_DEFAULT = 60;
+const char *GROUND_TRUTH_NAME = "ground_truth.ply";
+
+struct RenderOptions {
+	std::string sequence; //空の時はpshift_genpc/calc/pcgen_modeで決める
+	int width = 0;
+	int height = 0;
+	std::vector<double> exposures = {1.0};
+	SceneRenderer::Settings settings;
+	int interval_ms = FRAME_INTERVAL_MS_DEFAULT;
+	std::string ground_truth_path;
+	std::string scene_path;
+	std::string output_dir;
+	std::vector<std::string> param_files;
+};
+
+bool parse_exposures(const std::string &text,std::vector<double> *exposures){
+	exposures->clear();
+	std::istringstream is(text);
+	std::string item;
+	while( std::getline(is,item,',') ){
+		const double exposure = atof(item.c_str());
+		if( exposure <= 0 ){
+			return false;
+		}
+		exposures->push_back(exposure);
+	}
+	return ! exposures->empty();
+}
+
+bool make_dir(const std::string &path){
+	struct stat st;
+	if( stat(path.c_str(),&st) == 0 ){
+		return S_ISDIR(st.st_mode);
+	}
+	return mkdir(path.c_str(),0755) == 0 || errno == EEXIST;
+}
+
+/**
+ * genpcのdump_pattern_images()/dump_captseq()と同じ名前と書式で書き出します.
+ * HDR(露光が複数)の時は hdr_<n>_capt<i>_<camno>.pgm と "[n] (i) ..." の行.
+ */
+bool write_pattern_dump(const RenderOptions &opts,const SceneRenderer &renderer,const SceneRenderer::Sequence seq){
+	const int frame_num = renderer.frame_num(seq);
+	const bool hdr = opts.exposures.size() > 1;
+	const double start = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+	std::string captseq;
+	uint32_t frame_seq = 0;
+	for( size_t n = 0 ; n < opts.exposures.size() ; n++ ){
+		ElapsedTimer tmr;
+		for( int i = 0 ; i < frame_num ; i++ ){
+			cv::Mat imgs[2];
+			renderer.render(seq,i,opts.exposures[n],n * frame_num + i,&imgs[0],&imgs[1]);
+			for( int camno = 0 ; camno < 2 ; camno++ ){
+				const std::string path = hdr ?
+					cv::format((opts.output_dir + "/hdr_%d_capt%02d_%d.pgm").c_str(),(int)n,i,camno) :
+					cv::format((opts.output_dir + "/capt%02d_%d.pgm").c_str(),i,camno);
+				if( ! cv::imwrite(path,imgs[camno]) ){
+					LOG_INFO("pattern image write failed. path=%s",path.c_str());
+					return false;
+				}
+			}
+			const double stamp = start + (n * frame_num + i) * opts.interval_ms / 1000.0;
+			char line[96];
+			if( hdr ){
+				snprintf(line,sizeof(line),"[%d] (%d) %u %u %.6f\n",(int)n,i,frame_seq,frame_seq,stamp);
+			}else{
+				snprintf(line,sizeof(line),"(%d) %u %u %.6f\n",i,frame_seq,frame_seq,stamp);
+			}
+			captseq += line;
+			frame_seq++;
+		}
+		LOG_INFO("<%d> pattern images rendered. exposure=%g, frames=%d, proc_tm=%d ms",(int)n,opts.exposures[n],frame_num,tmr.elapsed_ms());
+	}
+
+	const std::string captseq_path = opts.output_dir + "/captseq.log";
+	FILE *fp = fopen(captseq_path.c_str(), "w");
+	if( ! fp ){
+		LOG_INFO("captseq.log open failed. path=%s",captseq_path.c_str());
+		return false;
+	}
+	fputs(captseq.c_str(), fp);
+	return fclose(fp) == 0;
+}
+
+void usage(const char *prog){
+	const SceneRenderer::Settings settings;
+	fprintf(stderr,
+		"usage: %s [options] <scene.yaml> <output_dir> <param.yaml> [<param.yaml> ...]\n"
+		"  -s, --sequence NAME  grayps4 or multi (default from pshift_genpc/calc/pcgen_mode)\n"
+		"  -W, --width N        image width per camera (default calibration width or %d)\n"
+		"  -H, --height N       image height (default calibration height or %d)\n"
+		"  -e, --exposure LIST  comma separated exposure scales. more than one writes HDR dumps (default 1)\n"
+		"  --intensity L        projector white level on albedo 1 (default %g)\n"
+		"  --ambient L          ambient light level on albedo 1 (default %g)\n"
+		"  --noise SIGMA        gaussian noise in gray levels (default %g)\n"
+		"  --saturation L       levels at or above L saturate to 255 (default %g)\n"
+		"  --no-shadow          ignore occlusion between the projector and the scene\n"
+		"  --seed N             noise seed (default %u)\n"
+		"  -i, --interval MS    frame interval recorded in captseq.log (default %d)\n"
+		"  -g, --ground-truth PATH  ground truth PLY (default <output_dir>/%s)\n",
+		prog, WIDTH_DEFAULT, HEIGHT_DEFAULT, settings.projector_level, settings.ambient, settings.noise,
+		settings.saturation, settings.seed, FRAME_INTERVAL_MS_DEFAULT, GROUND_TRUTH_NAME);
+}
+
+bool parse_options(int argc,char **argv,RenderOptions *opts){
+	static const struct option long_options[] = {
+		{"sequence",     required_argument, nullptr, 's'},
+		{"width",        required_argument, nullptr, 'W'},
+		{"height",       required_argument, nullptr, 'H'},
+		{"exposure",     required_argument, nullptr, 'e'},
+		{"intensity",    required_argument, nullptr, 'L'},
+		{"ambient",      required_argument, nullptr, 'A'},
+		{"noise",        required_argument, nullptr, 'N'},
+		{"saturation",   required_argument, nullptr, 'S'},
+		{"no-shadow",    no_argument,       nullptr, 'O'},
+		{"seed",         required_argument, nullptr, 'R'},
+		{"interval",     required_argument, nullptr, 'i'},
+		{"ground-truth", required_argument, nullptr, 'g'},
+		{"help",         no_argument,       nullptr, 'h'},
+		{nullptr, 0, nullptr, 0}
+	};
+	int c;
+	while( (c = getopt_long(argc, argv, "s:W:H:e:i:g:h", long_options, nullptr)) != -1 ){
+		switch( c ){
+		case 's': opts->sequence = optarg; break;
+		case 'W': opts->width = atoi(optarg); break;
+		case 'H': opts->height = atoi(optarg); break;
+		case 'e':
+			if( ! parse_exposures(optarg,&opts->exposures) ){
+				return false;
+			}
+			break;
+		case 'L': opts->settings.projector_level = atof(optarg); break;
+		case 'A': opts->settings.ambient = atof(optarg); break;
+		case 'N': opts->settings.noise = atof(optarg); break;
+		case 'S': opts->settings.saturation = atof(optarg); break;
+		case 'O': opts->settings.shadow = false; break;
+		case 'R': opts->settings.seed = strtoul(optarg, nullptr, 10); break;
+		case 'i': opts->interval_ms = atoi(optarg); break;
+		case 'g': opts->ground_truth_path = optarg; break;
+		default:  return false;
+		}
+	}
+	if( argc - optind < 3 || opts->width < 0 || opts->height < 0 || opts->interval_ms < 0 ||
+		! (opts->sequence.empty() || opts->sequence == "grayps4" || opts->sequence == "multi") ){
+		return false;
+	}
+	opts->scene_path = argv[optind++];
+	opts->output_dir = argv[optind++];
+	while( optind < argc ){
+		opts->param_files.push_back(argv[optind++]);
+	}
+	if( opts->ground_truth_path.empty() ){
+		opts->ground_truth_path = opts->output_dir + "/" + GROUND_TRUTH_NAME;
+	}
+	return true;
+}
+
+//============================================= 無名名前空間  end  =============================================
+}
+
+int main(int argc, char **argv)
+{
+	RenderOptions opts;
+	if( ! parse_options(argc,argv,&opts) ){
+		usage(argv[0]);
+		return 2;
+	}
+
+	YamlParams params;
+	for( const std::string &path : opts.param_files ){
+		std::string error;
+		if( ! params.load(path,&error) ){
+			LOG_INFO("%s",error.c_str());
+			return 1;
+		}
+	}
+	SceneRenderer::ParamSource source;
+	source.get_list = [&params](const std::string &key,std::vector<double> *values){ return params.get(key,values); };
+	source.get_value = [&params](const std::string &key,double *value){ return params.get(key,value); };
+
+	SceneRenderer::Sequence seq = SceneRenderer::SEQ_GRAYPS4;
+	if( opts.sequence == "multi" || (opts.sequence.empty() && params.get_param<int>("pshift_genpc/calc/pcgen_mode",PCGEN_GRAYPS4) == PCGEN_MULTI) ){
+		seq = SceneRenderer::SEQ_MULTI;
+	}
+
+	ElapsedTimer tmr;
+	SceneRenderer renderer;
+	std::string error;
+	if( ! renderer.load_calibration(source,&error) || ! renderer.load_scene(opts.scene_path,&error) ){
+		LOG_INFO("%s",error.c_str());
+		return 1;
+	}
+	renderer.set_settings(opts.settings);
+	const int width = opts.width > 0 ? opts.width : params.get_param<int>("left/remap/width",WIDTH_DEFAULT);
+	const int height = opts.height > 0 ? opts.height : params.get_param<int>("left/remap/height",HEIGHT_DEFAULT);
+	if( ! renderer.prepare(width,height,&error) ){
+		LOG_INFO("%s",error.c_str());
+		return 1;
+	}
+	LOG_INFO("scene prepared. scene=%s, size=%dx%d, sequence=%s, fill_ratio=%.3f, proc_tm=%d ms",
+		opts.scene_path.c_str(),width,height,seq == SceneRenderer::SEQ_MULTI ? "multi" : "grayps4",renderer.fill_ratio(),tmr.elapsed_ms());
+
+	if( ! make_dir(opts.output_dir) ){
+		LOG_INFO("output directory create failed. dir=%s",opts.output_dir.c_str());
+		return 1;
+	}
+	if( ! write_pattern_dump(opts,renderer,seq) ){
+		return 1;
+	}
+
+	sensor_msgs::PointCloud gt;
+	renderer.ground_truth(&gt);
+	if( ! PlyWriter::write(opts.ground_truth_path,gt) ){
+		LOG_INFO("ground truth write failed. path=%s",opts.ground_truth_path.c_str());
+		return 1;
+	}
+	LOG_INFO("finished. dir=%s, ground_truth=%s (%d points), proc_tm=%d ms",
+		opts.output_dir.c_str(),opts.ground_truth_path.c_str(),(int)gt.points.size(),tmr.elapsed_ms());
+	return 0;
+}
@@ -0,0 +1,404 @@
+/**
+ * ycam3d_emulator_bench: 疑似デバイス(YCAM3DEmulator)につないだCameraYCAM3Dでパターン撮影を繰り返し、
+ * 接続/再接続/撮影の処理時間と失敗数をJSONで出力します.
+ * カメラもROSマスターも無しで、Aravis(レジスタ, プロジェクタのUART, 画像ストリーム)から上を実機と同じ順で動かします.
+ *
+ * 使い方: ycam3d_emulator_bench [オプション]
+ * 1回も撮影に成功しなかった時、再接続できなかった時、--min-success に満たない時は終了コード3.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <condition_variable>
+#include <getopt.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <ros/time.h>
+
+#include "CameraYCAM3D.hpp"
+#include "YCAM3DEmulator.hpp"
+#include "ElapsedTimer.hpp"
+#include "Trace.hpp"
+#include "StageMetrics.hpp"
+
+#define LOG_HEADER "(ycam3d_emulator_bench) "
+#define LOG_INFO(...) fprintf(stderr, LOG_HEADER __VA_ARGS__), fputc('\n', stderr)
+
+namespace {
+//============================================= 無名名前空間 start =============================================
+
+const int ITERATIONS_DEFAULT = 20;
+const std::string CAMERA_RES_DEFAULT = "SXGA";
+const int TRIGGER_TIMEOUT_DEFAULT = 3; //sec
+const int OPEN_TIMEOUT_DEFAULT = 60; //sec. 自動接続は5秒毎に再試行する
+const double MIN_SUCCESS_DEFAULT = 0;
+
+struct BenchOptions {
+	int iterations = ITERATIONS_DEFAULT;
+	std::string camera_res = CAMERA_RES_DEFAULT;
+	bool multi = false;
+	bool alternate = false;
+	int trigger_timeout = TRIGGER_TIMEOUT_DEFAULT;
+	int open_timeout = OPEN_TIMEOUT_DEFAULT;
+	//撮影の成功率(0-1)の下限
+	double min_success = MIN_SUCCESS_DEFAULT;
+	YCAM3DEmulator::Settings emulator;
+	std::string output_path;
+	std::string trace_path;
+};
+
+struct BenchCounters {
+	int captures = 0;
+	int succeeded = 0;
+	int failed = 0;      //画像が揃わなかった(欠落, バッファエラー)
+	int timeouts = 0;    //撮影待ちのタイムアウト
+	int rejected = 0;    //capture_pattern()がfalse(未接続など)
+	int disconnects = 0;
+	int reconnects = 0;
+	int open_failures = 0;
+};
+
+/**
+ * カメラのコールバックを待ち合わせます.
+ */
+class CameraEvents {
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	int m_opened = 0;
+	int m_disconnected = 0;
+	int m_pattern_received = 0;
+	bool m_pattern_result = false;
+	bool m_pattern_timeout = false;
+	int m_pattern_elapsed = 0;
+
+public:
+	void on_open_finished(const bool result){
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			if( result ){
+				++m_opened;
+			}
+		}
+		m_cond.notify_all();
+	}
+
+	void on_disconnect(){
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			++m_disconnected;
+		}
+		m_cond.notify_all();
+	}
+
+	void on_pattern_received(const bool result,const int elapsed,const bool timeout){
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			++m_pattern_received;
+			m_pattern_result = result;
+			m_pattern_timeout = timeout;
+			m_pattern_elapsed = elapsed;
+		}
+		m_cond.notify_all();
+	}
+
+	int disconnected(){
+		std::lock_guard<std::mutex> locker(m_mutex);
+		return m_disconnected;
+	}
+
+	//開いたらtrue
+	bool wait_open(iCameraSource &camera,const int timeout_sec){
+		std::unique_lock<std::mutex> locker(m_mutex);
+		return m_cond.wait_for(locker, std::chrono::seconds(timeout_sec), [&camera](){ return camera.is_open(); });
+	}
+
+	//撮影結果を受け取ったらtrue
+	bool wait_pattern(const int received,const int timeout_sec,bool *result,bool *timeout,int *elapsed){
+		std::unique_lock<std::mutex> locker(m_mutex);
+		if( ! m_cond.wait_for(locker, std::chrono::seconds(timeout_sec), [this,received](){ return m_pattern_received > received; }) ){
+			return false;
+		}
+		*result = m_pattern_result;
+		*timeout = m_pattern_timeout;
+		*elapsed = m_pattern_elapsed;
+		return true;
+	}
+
+	int pattern_received(){
+		std::lock_guard<std::mutex> locker(m_mutex);
+		return m_pattern_received;
+	}
+};
+
+std::string json_escape(const std::string &src){
+	std::string dst;
+	for( const char c : src ){
+		if( c == '"' || c == '\\' ){
+			dst += '\\';
+		}
+		dst += c;
+	}
+	return dst;
+}
+
+bool write_report(const BenchOptions &opts,const BenchCounters &counters,const YCAM3DEmulator::Stats &stats,const double elapsed_s){
+	FILE *fp = opts.output_path.empty() ? stdout : fopen(opts.output_path.c_str(), "w");
+	if( ! fp ){
+		LOG_INFO("report open failed. path=%s",opts.output_path.c_str());
+		return false;
+	}
+	const YCAM3DEmulator::Settings &s = opts.emulator;
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"camera_res\": \"%s\",\n", json_escape(opts.camera_res).c_str());
+	fprintf(fp, "  \"pattern\": \"%s\",\n", opts.alternate ? "alternate" : (opts.multi ? "multi" : "phsft"));
+	fprintf(fp, "  \"iterations\": %d,\n", opts.iterations);
+	fprintf(fp, "  \"emulator\": {\"reg_latency_us\": %d, \"uart_reply_latency_ms\": %d, \"trigger_latency_ms\": %d, "
+		"\"frame_loss_rate\": %g, \"frame_error_rate\": %g, \"reg_failure_rate\": %g, \"disconnect_after_frames\": %d, \"connect_failures\": %d, \"seed\": %u},\n",
+		s.reg_latency_us, s.uart_reply_latency_ms, s.trigger_latency_ms, s.frame_loss_rate, s.frame_error_rate, s.reg_failure_rate,
+		s.disconnect_after_frames, s.connect_failures, s.seed);
+	fprintf(fp, "  \"captures\": %d,\n  \"succeeded\": %d,\n  \"failed\": %d,\n  \"timeouts\": %d,\n  \"rejected\": %d,\n",
+		counters.captures, counters.succeeded, counters.failed, counters.timeouts, counters.rejected);
+	fprintf(fp, "  \"disconnects\": %d,\n  \"reconnects\": %d,\n  \"open_failures\": %d,\n",
+		counters.disconnects, counters.reconnects, counters.open_failures);
+	fprintf(fp, "  \"elapsed_s\": %.6f,\n", elapsed_s);
+	fprintf(fp, "  \"scans_per_s\": %.3f,\n", elapsed_s > 0 ? counters.succeeded / elapsed_s : 0.0);
+	fprintf(fp, "  \"device\": {\"reg_reads\": %llu, \"reg_writes\": %llu, \"reg_failures\": %llu, \"uart_commands\": %llu, \"uart_lrc_errors\": %llu, "
+		"\"triggers\": %llu, \"frames_sent\": %llu, \"frames_lost\": %llu, \"frames_error\": %llu, \"connects\": %llu, \"connect_failures\": %llu, \"disconnects\": %llu},\n",
+		(unsigned long long)stats.reg_reads, (unsigned long long)stats.reg_writes, (unsigned long long)stats.reg_failures,
+		(unsigned long long)stats.uart_commands, (unsigned long long)stats.uart_lrc_errors, (unsigned long long)stats.triggers,
+		(unsigned long long)stats.frames_sent, (unsigned long long)stats.frames_lost, (unsigned long long)stats.frames_error,
+		(unsigned long long)stats.connects, (unsigned long long)stats.connect_failures, (unsigned long long)stats.disconnects);
+	fprintf(fp, "  \"stages\": {");
+	bool first = true;
+	for( const StageMetrics::Summary &summary : StageMetrics::summaries() ){
+		fprintf(fp, "%s\n    \"%s\": {\"unit\": \"%s\", \"count\": %llu, \"mean\": %g, \"p50\": %g, \"p95\": %g, \"p99\": %g, \"max\": %g}",
+			first ? "" : ",", json_escape(summary.name).c_str(), StageMetrics::unit_name(summary.unit),
+			(unsigned long long)summary.count, summary.count == 0 ? 0.0 : summary.sum / summary.count,
+			summary.p50, summary.p95, summary.p99, summary.max);
+		first = false;
+	}
+	fprintf(fp, "\n  }\n}\n");
+
+	const bool written = ! ferror(fp);
+	if( fp != stdout ){
+		return fclose(fp) == 0 && written;
+	}
+	fflush(fp);
+	return written;
+}
+
+void usage(const char *prog){
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -n, --iterations N        pattern captures (default %d)\n"
+		"  -r, --resolution RES      SXGA or VGA (default %s)\n"
+		"  -m, --multi               capture the MULTI (PHSFT_3) pattern\n"
+		"  -a, --alternate           switch the projector pattern every capture\n"
+		"  -T, --trigger-timeout SEC pattern capture timeout (default %d)\n"
+		"  -O, --open-timeout SEC    camera open/reconnect timeout (default %d)\n"
+		"      --min-success RATE    fail unless this ratio of captures succeeds (default: at least one)\n"
+		"      --reg-latency US      register access latency\n"
+		"      --uart-latency MS     projector UART reply latency\n"
+		"      --trigger-latency MS  latency from trigger to the first frame\n"
+		"      --loss RATE           frame loss rate (0-1)\n"
+		"      --error RATE          incomplete frame rate (0-1)\n"
+		"      --reg-failure RATE    register access failure rate (0-1)\n"
+		"      --disconnect-after N  drop the connection every N frames\n"
+		"      --connect-failures N  failed connection attempts after each drop\n"
+		"      --seed N              random seed\n"
+		"  -o, --output PATH         JSON report path (default stdout)\n"
+		"  -t, --trace PATH          write stage spans as Chrome trace JSON\n",
+		prog, ITERATIONS_DEFAULT, CAMERA_RES_DEFAULT.c_str(), TRIGGER_TIMEOUT_DEFAULT, OPEN_TIMEOUT_DEFAULT);
+}
+
+enum LongOnlyOption {
+	OPT_REG_LATENCY = 256,
+	OPT_UART_LATENCY,
+	OPT_TRIGGER_LATENCY,
+	OPT_LOSS,
+	OPT_ERROR,
+	OPT_REG_FAILURE,
+	OPT_DISCONNECT_AFTER,
+	OPT_CONNECT_FAILURES,
+	OPT_SEED,
+	OPT_MIN_SUCCESS
+};
+
+bool parse_options(int argc,char **argv,BenchOptions *opts){
+	static const struct option long_options[] = {
+		{"iterations",       required_argument, nullptr, 'n'},
+		{"resolution",       required_argument, nullptr, 'r'},
+		{"multi",            no_argument,       nullptr, 'm'},
+		{"alternate",        no_argument,       nullptr, 'a'},
+		{"trigger-timeout",  required_argument, nullptr, 'T'},
+		{"open-timeout",     required_argument, nullptr, 'O'},
+		{"reg-latency",      required_argument, nullptr, OPT_REG_LATENCY},
+		{"uart-latency",     required_argument, nullptr, OPT_UART_LATENCY},
+		{"trigger-latency",  required_argument, nullptr, OPT_TRIGGER_LATENCY},
+		{"loss",             required_argument, nullptr, OPT_LOSS},
+		{"error",            required_argument, nullptr, OPT_ERROR},
+		{"reg-failure",      required_argument, nullptr, OPT_REG_FAILURE},
+		{"disconnect-after", required_argument, nullptr, OPT_DISCONNECT_AFTER},
+		{"connect-failures", required_argument, nullptr, OPT_CONNECT_FAILURES},
+		{"seed",             required_argument, nullptr, OPT_SEED},
+		{"min-success",      required_argument, nullptr, OPT_MIN_SUCCESS},
+		{"output",           required_argument, nullptr, 'o'},
+		{"trace",            required_argument, nullptr, 't'},
+		{"help",             no_argument,       nullptr, 'h'},
+		{nullptr, 0, nullptr, 0}
+	};
+	YCAM3DEmulator::Settings &s = opts->emulator;
+	int c;
+	while( (c = getopt_long(argc, argv, "n:r:maT:O:o:t:h", long_options, nullptr)) != -1 ){
+		switch( c ){
+		case 'n': opts->iterations = atoi(optarg); break;
+		case 'r': opts->camera_res = optarg; break;
+		case 'm': opts->multi = true; break;
+		case 'a': opts->alternate = true; break;
+		case 'T': opts->trigger_timeout = atoi(optarg); break;
+		case 'O': opts->open_timeout = atoi(optarg); break;
+		case OPT_REG_LATENCY: s.reg_latency_us = atoi(optarg); break;
+		case OPT_UART_LATENCY: s.uart_reply_latency_ms = atoi(optarg); break;
+		case OPT_TRIGGER_LATENCY: s.trigger_latency_ms = atoi(optarg); break;
+		case OPT_LOSS: s.frame_loss_rate = atof(optarg); break;
+		case OPT_ERROR: s.frame_error_rate = atof(optarg); break;
+		case OPT_REG_FAILURE: s.reg_failure_rate = atof(optarg); break;
+		case OPT_DISCONNECT_AFTER: s.disconnect_after_frames = atoi(optarg); break;
+		case OPT_CONNECT_FAILURES: s.connect_failures = atoi(optarg); break;
+		case OPT_SEED: s.seed = (unsigned int)strtoul(optarg, nullptr, 10); break;
+		case OPT_MIN_SUCCESS: opts->min_success = atof(optarg); break;
+		case 'o': opts->output_path = optarg; break;
+		case 't': opts->trace_path = optarg; break;
+		default:  return false;
+		}
+	}
+	if( optind != argc || opts->iterations < 1 || opts->trigger_timeout < 1 || opts->open_timeout < 1 ||
+		opts->min_success < 0 || 1 < opts->min_success ){
+		return false;
+	}else if( opts->camera_res != "SXGA" && opts->camera_res != "VGA" ){
+		return false;
+	}
+	return true;
+}
+
+//============================================= 無名名前空間  end  =============================================
+}
+
+int main(int argc, char **argv)
+{
+	BenchOptions opts;
+	if( ! parse_options(argc,argv,&opts) ){
+		usage(argv[0]);
+		return 2;
+	}
+	//CameraImageのstamp用. マスターには繋がない
+	ros::Time::init();
+	Trace::set_enabled( ! opts.trace_path.empty() );
+	Trace::set_thread_name("ycam3d_emulator_bench");
+
+	const YCAM_RES res = opts.camera_res == "VGA" ? YCAM_RES_VGA : YCAM_RES_SXGA;
+	std::shared_ptr<YCAM3DEmulator> emulator = std::make_shared<YCAM3DEmulator>(res, opts.emulator);
+
+	CameraEvents events;
+	CameraYCAM3D camera;
+	camera.set_emulator(emulator);
+	if( ! camera.init(opts.camera_res) ){
+		LOG_INFO("camera initialization failed.");
+		return 1;
+	}
+	camera.set_trigger_timeout_period(opts.trigger_timeout);
+	camera.set_callback_camera_open_finished([&events](const bool result){ events.on_open_finished(result); });
+	camera.set_callback_camera_disconnect([&events](){ events.on_disconnect(); });
+	camera.set_callback_pattern_img_received([&events](const bool result,const int elapsed,
+		const std::vector<camera::ycam3d::CameraImage> &imgs_l,const std::vector<camera::ycam3d::CameraImage> &imgs_r,const bool timeout,const int expsrLv){
+		events.on_pattern_received(result, elapsed, timeout);
+	});
+
+	BenchCounters counters;
+	{
+		ElapsedTimer tmr;
+		camera.start_auto_connect();
+		if( ! events.wait_open(camera, opts.open_timeout) ){
+			LOG_INFO("camera open timeout. proc_tm=%d ms",tmr.elapsed_ms());
+			camera.close();
+			return 1;
+		}
+		tmr.record("emulator/open");
+		LOG_INFO("camera opened. proc_tm=%d ms",tmr.elapsed_ms());
+	}
+
+	const auto bench_begin = std::chrono::steady_clock::now();
+	for( int i = 0 ; i < opts.iterations ; i++ ){
+		if( ! camera.is_open() ){
+			//切断された時は自動接続を待つ
+			ElapsedTimer tmr;
+			if( ! events.wait_open(camera, opts.open_timeout) ){
+				LOG_INFO("camera reconnect timeout. capture=%d, proc_tm=%d ms",i,tmr.elapsed_ms());
+				++counters.open_failures;
+				break;
+			}
+			tmr.record("emulator/reconnect");
+			++counters.reconnects;
+		}
+
+		const bool multi = opts.alternate ? (i % 2 == 1) : opts.multi;
+		const int received = events.pattern_received();
+		++counters.captures;
+		ElapsedTimer tmr;
+		if( ! camera.capture_pattern(multi, false) ){
+			++counters.rejected;
+			continue;
+		}
+		bool result = false, timeout = false;
+		int elapsed = 0;
+		//撮影スレッドはtrigger_timeoutで必ずコールバックするので、余裕を持って待つ
+		if( ! events.wait_pattern(received, opts.trigger_timeout * 2 + 1, &result, &timeout, &elapsed) ){
+			LOG_INFO("pattern capture callback not received. capture=%d",i);
+			++counters.timeouts;
+			continue;
+		}
+		if( timeout ){
+			++counters.timeouts;
+		}else if( ! result ){
+			++counters.failed;
+		}else{
+			++counters.succeeded;
+			StageMetrics::record("emulator/capture_pattern", elapsed);
+		}
+		tmr.record("emulator/capture_cycle");
+	}
+	const double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - bench_begin).count();
+	counters.disconnects = events.disconnected();
+	LOG_INFO("benchmark finished. captures=%d, succeeded=%d, timeouts=%d, reconnects=%d",
+		counters.captures, counters.succeeded, counters.timeouts, counters.reconnects);
+
+	camera.close();
+
+	if( ! opts.trace_path.empty() ){
+		int event_num = 0;
+		if( ! Trace::dump(opts.trace_path,"ycam3d_emulator_bench",&event_num) ){
+			LOG_INFO("trace dump failed. path=%s",opts.trace_path.c_str());
+		}else{
+			LOG_INFO("trace dumped. path=%s, events=%d",opts.trace_path.c_str(),event_num);
+		}
+	}
+	if( ! write_report(opts,counters,emulator->get_stats(),elapsed_s) ){
+		return 1;
+	}
+	
+	//注入した障害で失敗するのは想定内なので、成功数と再接続だけを判定する
+	if( counters.succeeded == 0 ){
+		LOG_INFO("check failed. no pattern capture succeeded.");
+		return 3;
+	}else if( counters.open_failures > 0 ){
+		LOG_INFO("check failed. camera did not reconnect.");
+		return 3;
+	}else if( counters.succeeded < opts.min_success * opts.iterations ){
+		LOG_INFO("check failed. success rate=%.3f, min_success=%g",counters.succeeded / (double)opts.iterations,opts.min_success);
+		return 3;
+	}
+	return 0;
+}
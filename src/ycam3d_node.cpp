@@ -1,3 +1,4 @@
+#include <atomic>
 #include <chrono>
 #include <thread>
 #include <mutex>
@@ -18,10 +19,18 @@
 #include <cv_bridge/cv_bridge.h>
 #include "iPointCloudGenerator.hpp"
 #include "CameraYCAM3D.hpp"
+#include "CameraReplay.hpp"
+#include "YCAM3DEmulator.hpp"
+#include "SceneRenderer.hpp"
 #include "ElapsedTimer.hpp"
+#include "Trace.hpp"
+#include "StageDiagnostics.hpp"
+#include "InProcessService.hpp"
+#include "ImageDiff.hpp"
 #include "rovi/Floats.h"
 #include "rovi/GenPC.h"
 #include "rovi/ImageFilter.h"
+#include "rovi/PatternFrame.h"
 
 
 //#define DEBUG_DETAIL
@@ -52,9 +61,14 @@ ros::Publisher pub_rects0[2];
 ros::Publisher pub_rects1[2];
 ros::Publisher pub_diffs[2];
 ros::Publisher pub_temperature;
+ros::Publisher pub_ptn_frame;
+ros::Publisher pub_diagnostics;
 
 ros::ServiceClient svc_genpc;
 ros::ServiceClient svc_remap[2];
+//同一プロセス内呼び出し用のサービス名(解決済み)
+std::string genpc_service_name;
+std::string remap_service_names[2];
 
 std::string cam_ipaddr;
 int cam_width = -1;
@@ -76,6 +90,11 @@ const std::string PRM_HDR_CAM_GAIN_D          = "ycam/hdr/camera/Gain";
 const std::string PRM_HDR_PROJ_INTENSITY      = "ycam/hdr/projector/Intensity";
 
 const std::string PRM_CAPT_TIMEOUT_RESET         = "ycam/CaptureTimeoutReset";
+const std::string PRM_PATTERN_STREAM_ENABLED     = "ycam/pattern_stream/enabled";
+const std::string PRM_REPLAY_DIR                 = "ycam/replay/dir";
+const std::string PRM_REPLAY_INTERVAL            = "ycam/replay/interval";
+const std::string PRM_EMULATOR_ENABLED           = "ycam/emulator/enabled";
+const std::string PRM_EMULATOR_SCENE             = "ycam/emulator/scene";
 
 const std::string PRM_CAM_CALIB_MAT_K_LIST[]  = {"left/remap/Kn","right/remap/Kn"};
 
@@ -86,11 +105,21 @@ constexpr int PRM_SW_TRIG_RATE_MIN = 1; //Hz
 constexpr int YCAM_STAND_BY_MODE_CYCLE = 3; //Hz
 
 constexpr int TEMP_MON_INTERVAL_DEFAULT = 5; //Sec
+
+constexpr int PATTERN_STREAM_QUEUE_SIZE = 64;
+
+constexpr int REPLAY_INTERVAL_DEFAULT = -1; //ms. 負の時は撮影時刻の間隔
+
+constexpr bool TRACE_ENABLED_DEFAULT = true;
+const std::string TRACE_DIR_DEFAULT = "/tmp";
+
+constexpr float METRICS_INTERVAL_DEFAULT = 10; //sec
+constexpr int METRICS_WINDOW_DEFAULT = 30; //出力周期の回数. /diagnosticsの分布はこの1～2倍の期間の値
 	
 int pre_ycam_mode = (int)Mode_StandBy;
 
 std::string camera_res;
-std::unique_ptr<CameraYCAM3D> camera_ptr;
+std::unique_ptr<iCameraSource> camera_ptr;
 
 ros::Timer mode_mon_timer;
 int cur_mode_mon_cyc = YCAM_STAND_BY_MODE_CYCLE; //Hz
@@ -115,6 +144,15 @@ std::condition_variable ptn_capt_wait_cv;
 std::thread pc_gen_thread;
 
 bool cur_hdr_enabled=false;
+
+//パターン画像の逐次配信. 撮影中のスキャンと撮影番号(scan_id=0: 配信しない)
+struct PatternStreamContext {
+	uint32_t scan_id = 0;
+	int capt_no = 0;
+	int capt_num = 0;
+};
+std::mutex ptn_stream_mutex;
+PatternStreamContext ptn_stream_ctx;
 	
 int g_node_exit_flg = 0;
 
@@ -219,6 +257,37 @@ void publish_string(ros::Publisher&pub, const std::string &val){
 	pub.publish(rmsg);
 }
 
+/**
+ * genpcの呼び出し. genpcが同じプロセス(nodelet)に居れば要求をシリアライズせずにそのまま渡し、居なければサービスで呼び出す.
+ */
+bool call_genpc(const InProcessService<rovi::GenPC>::RequestConstPtr &req, rovi::GenPC::Response &res){
+	bool found = false;
+	const bool ret = InProcessService<rovi::GenPC>::call(genpc_service_name, req, res, &found);
+	if( found ){
+		return ret;
+	}
+	return svc_genpc.call(*req, res);
+}
+
+/**
+ * remapの呼び出し. call_genpcと同じく、同じプロセスに居れば直接呼び出す.
+ */
+bool call_remap(const int camno, const sensor_msgs::Image &img, sensor_msgs::Image &remap_img){
+	boost::shared_ptr<rovi::ImageFilter::Request> req(new rovi::ImageFilter::Request());
+	req->img = img;
+	rovi::ImageFilter::Response res;
+	
+	bool found = false;
+	bool ret = InProcessService<rovi::ImageFilter>::call(remap_service_names[camno], req, res, &found);
+	if( ! found ){
+		ret = svc_remap[camno].call(*req, res);
+	}
+	if( ret ){
+		remap_img = std::move(res.img);
+	}
+	return ret;
+}
+
 
 bool init(){
 	bool ret=false;
@@ -591,27 +660,6 @@ void on_camera_closed(){
 }
 
 	
-sensor_msgs::Image to_diff_img(const sensor_msgs::Image &src_img,sensor_msgs::Image &dst_img){
-	sensor_msgs::Image diff_img;
-	if( src_img.data.empty() ||
-		src_img.data.size() != dst_img.data.size()
-	){
-		ROS_ERROR(LOG_HEADER"error:camera image size is different");
-	}else{
-		diff_img = src_img;
-		for ( int n=0; n < src_img.data.size(); n++ ) {
-			int val = dst_img.data[n] - src_img.data[n];
-			if (val < 1) { val = 0; }
-			else if (val>255) { val=255; }
-			
-			diff_img.data[n] = val;
-		}
-	}
-	
-	return diff_img;
-}
-
-
 sensor_msgs::Image drawCameraOriginCross(sensor_msgs::Image &inputImg,cv::Point &posCross){
 	const int width = inputImg.width;
 	const int height = inputImg.height;
@@ -727,13 +775,10 @@ void on_capture_image_received(const bool result,const int elapsed, camera::ycam
 		sensor_msgs::Image remap_img_dark;
 		{
 			//remap-bright
-			rovi::ImageFilter remap_img_filter;
-			remap_img_filter.request.img = ros_imgs_brights[i];
 			//ROS_INFO(LOG_HEADER"remap start. camno=%d",i);
-			if( ! svc_remap[i].call(remap_img_filter) ){
+			if( ! call_remap(i,ros_imgs_brights[i],remap_img_bright) ){
 				ROS_ERROR(LOG_HEADER"error:camera image remap failed. camno=%d",i);
 			}else{
-				remap_img_bright = remap_img_filter.response.img;
 				
 				//ROS_INFO(LOG_HEADER"remap end. camno=%d",i);
 				
@@ -786,6 +831,52 @@ void on_pattern_image_received(const bool result,const int proc_tm,const std::ve
 	}
 }
 
+/**
+ * スキャンID. genpcが前回起動時のIDを覚えていても重ならないよう時刻から始め、0は使わない.
+ */
+uint32_t next_scan_id(){
+	static uint32_t scan_id = (uint32_t)std::chrono::system_clock::now().time_since_epoch().count();
+	if( ++scan_id == 0 ){
+		++scan_id;
+	}
+	return scan_id;
+}
+
+void set_pattern_stream(const uint32_t scan_id,const int capt_no,const int capt_num){
+	std::lock_guard<std::mutex> locker(ptn_stream_mutex);
+	ptn_stream_ctx.scan_id = scan_id;
+	ptn_stream_ctx.capt_no = capt_no;
+	ptn_stream_ctx.capt_num = capt_num;
+}
+
+/**
+ * パターン画像を1組受信する毎にpattern_frameへ配信する(カメラの受信スレッド).
+ * nodeletで同じプロセスに居るgenpcにはメッセージがコピーされずに渡る.
+ */
+void on_pattern_frame_received(const int frmidx,const int frame_num,const camera::ycam3d::CameraImage &img_l,const camera::ycam3d::CameraImage &img_r){
+	PatternStreamContext ctx;
+	{
+		std::lock_guard<std::mutex> locker(ptn_stream_mutex);
+		ctx = ptn_stream_ctx;
+	}
+	if( ctx.scan_id == 0 ){
+		return;
+	}
+	TraceSpan trace_span("pattern_frame_publish",frmidx);
+	
+	boost::shared_ptr<rovi::PatternFrame> msg(new rovi::PatternFrame());
+	msg->scan_id = ctx.scan_id;
+	msg->capt_no = ctx.capt_no;
+	msg->capt_num = ctx.capt_num;
+	msg->index = frmidx;
+	msg->frame_num = frame_num;
+	if( ! img_l.to_ros_img(msg->imgL,FRAME_ID) || ! img_r.to_ros_img(msg->imgR,FRAME_ID) ){
+		ROS_ERROR(LOG_HEADER"error:pattern frame convert failed. scan_id=%u, capt_no=%d, index=%d",ctx.scan_id,ctx.capt_no,frmidx);
+		return;
+	}
+	pub_ptn_frame.publish(msg);
+}
+
 bool validate_patten_image_data(const PatternImageData &ptnImgData){
 	if( ptnImgData.imgs_l.empty() ){
 		ROS_ERROR(LOG_HEADER"error:pattern image left is empty.");
@@ -809,6 +900,7 @@ bool exec_point_cloud_generation(std_srvs::TriggerRequest &req, std_srvs::Trigge
 
 	if( ! pc_gen_mutex.try_lock_for(std::chrono::seconds(0)) ){
 		res.success = false;
+		res.message = "genpc is busy";
 		ROS_WARN(LOG_HEADER"genpc is busy");
 		return true;
 	}
@@ -821,6 +913,7 @@ bool exec_point_cloud_generation(std_srvs::TriggerRequest &req, std_srvs::Trigge
 	ROS_INFO(LOG_HEADER"point cloud generation start.");
 	bool result = false;
 	std::lock_guard<std::timed_mutex> locker(pc_gen_mutex,std::adopt_lock);
+	TraceSpan trace_span("pshift_genpc");
 	
 	const PcGenMode pc_gen_mode = (PcGenMode)get_param<int>("pshift_genpc/calc/pcgen_mode",(int)PCGEN_GRAYPS4);
 	
@@ -846,14 +939,24 @@ bool exec_point_cloud_generation(std_srvs::TriggerRequest &req, std_srvs::Trigge
 		bool ptn_capt_success=true;
 		const int ptn_capt_num = cur_capt_params.size();
 		
-		rovi::GenPC genpc_msg;
+		//genpcが同じプロセスに居る場合はこの要求を共有して渡す
+		boost::shared_ptr<rovi::GenPC::Request> genpc_req(new rovi::GenPC::Request());
+		rovi::GenPC::Response genpc_res;
 		std::vector<RosPatternImageData> ros_ptn_imgs;
-		genpc_msg.request.ptn_capt_num = ptn_capt_num;
+		genpc_req->ptn_capt_num = ptn_capt_num;
+		
+		//逐次配信する場合、genpcは撮影中に届いた画像から処理を始めるので要求には画像を載せない
+		const bool ptn_stream_enabled = get_param<bool>(PRM_PATTERN_STREAM_ENABLED,false);
+		if( ptn_stream_enabled ){
+			genpc_req->scan_id = next_scan_id();
+			ROS_INFO(LOG_HEADER"pattern stream enabled. scan_id=%u",genpc_req->scan_id);
+		}
 		
 		for( int n = 0 ; n < ptn_capt_num ; ++n ){
 			tmr.start_lap();
 			
 			ROS_INFO(LOG_HEADER"<%d> pattern capture start. elapsed=%d ms",n,tmr.elapsed_ms());
+			TraceSpan trace_capture("pattern_capture",n);
 			
 			std::unique_lock<std::mutex> lock(ptn_capt_wait_mutex);
 
@@ -866,6 +969,10 @@ bool exec_point_cloud_generation(std_srvs::TriggerRequest &req, std_srvs::Trigge
 				ROS_INFO(LOG_HEADER"<%d> capture parameter updated. %s",n,capt_prm.to_string().c_str());
 			}
 			
+			if( ptn_stream_enabled ){
+				set_pattern_stream(genpc_req->scan_id,n,ptn_capt_num);
+			}
+			
 			if( ! camera_ptr->capture_pattern( pc_gen_mode == PCGEN_MULTI , cur_mode == Mode_Streaming ) ){
 				ROS_ERROR(LOG_HEADER"<%d> pattern catpture failed.",n);
 				res_msg_str << "Capture failed";
@@ -886,8 +993,11 @@ bool exec_point_cloud_generation(std_srvs::TriggerRequest &req, std_srvs::Trigge
 					break;
 				}else{
 					ROS_INFO(LOG_HEADER"<%d> pattern capture finished. proc_tm=%d ms",n,tmr.elapsed_lap_ms());
+					trace_capture.end();
+					tmr.record_lap("ycam3d/pattern_capture");
 					tmr.start_lap();
 					ROS_INFO(LOG_HEADER"<%d> pattern image convert start.", n);
+					TraceSpan trace_convert("image_convert",n);
 						
 					const int capt_num = ptn_img->imgs_l.size();
 					std::vector<sensor_msgs::Image> ros_ptn_imgs_l;
@@ -913,10 +1023,11 @@ bool exec_point_cloud_generation(std_srvs::TriggerRequest &req, std_srvs::Trigge
 						}
 						
 						ros_ptn_imgs_l[i] = img_l;
-						genpc_msg.request.imgL.push_back(img_l);
-						
 						ros_ptn_imgs_r[i] = img_r;
-						genpc_msg.request.imgR.push_back(img_r);
+						if( ! ptn_stream_enabled ){
+							genpc_req->imgL.push_back(img_l);
+							genpc_req->imgR.push_back(img_r);
+						}
 						
 #ifdef DEBUG_PTN_IMG_SAVE
 						char path[256];
@@ -933,6 +1044,7 @@ bool exec_point_cloud_generation(std_srvs::TriggerRequest &req, std_srvs::Trigge
 						ptn_capt_success=false;
 						break;
 					}else{
+						tmr.record_lap("ycam3d/image_convert");
 						ROS_INFO(LOG_HEADER"<%d> pattern image convert finished. proc_tm=%d ms", n, tmr.elapsed_lap_ms());
 						ros_ptn_imgs.push_back({ros_ptn_imgs_l,ros_ptn_imgs_r});
 					}
@@ -940,12 +1052,19 @@ bool exec_point_cloud_generation(std_srvs::TriggerRequest &req, std_srvs::Trigge
 			}
 		}
 		
+		set_pattern_stream(0,0,0);
+		
 		if( ! ptn_capt_success ){
 			ROS_ERROR(LOG_HEADER"error: pattern capture failed.");
 		}else{
 			ROS_INFO(LOG_HEADER"all pattern capture completed. elapsed=%d ms",tmr.elapsed_ms());
 			
-			if( ! svc_genpc.call(genpc_msg) ){
+			TraceSpan trace_genpc("call_genpc",genpc_req->scan_id);
+			ElapsedTimer tmr_genpc;
+			const bool genpc_result = call_genpc(genpc_req,genpc_res);
+			tmr_genpc.record("ycam3d/call_genpc");
+			trace_genpc.end();
+			if( ! genpc_result ){
 				ROS_ERROR(LOG_HEADER"genpc exec failed. elapsed=%d ms", tmr.elapsed_ms());
 				res_msg_str << "Failed to generate point cloud.";
 				
@@ -960,10 +1079,10 @@ bool exec_point_cloud_generation(std_srvs::TriggerRequest &req, std_srvs::Trigge
 				}
 				res_msg_str << ptnImgNum << " images scan complete.";
 				
-				if( genpc_msg.response.pc_cnt_r >= 0 ){
-					res_msg_str << " Generated PointCloud Count. Left=" << genpc_msg.response.pc_cnt << " Right=" << genpc_msg.response.pc_cnt_r;
+				if( genpc_res.pc_cnt_r >= 0 ){
+					res_msg_str << " Generated PointCloud Count. Left=" << genpc_res.pc_cnt << " Right=" << genpc_res.pc_cnt_r;
 				}else{
-					res_msg_str << " Generated PointCloud Count=" << genpc_msg.response.pc_cnt;
+					res_msg_str << " Generated PointCloud Count=" << genpc_res.pc_cnt;
 				}
 				result=true;
 			}
@@ -979,6 +1098,7 @@ bool exec_point_cloud_generation(std_srvs::TriggerRequest &req, std_srvs::Trigge
 					}
 				}
 				ElapsedTimer tmr_pcgen_publish;
+				TraceSpan trace_publish("publish_images",n);
 				
 				ROS_INFO(LOG_HEADER"<%d> pcgen publish start.",n);
 				//画像配信
@@ -986,12 +1106,8 @@ bool exec_point_cloud_generation(std_srvs::TriggerRequest &req, std_srvs::Trigge
 					pub_img_raws[camno].publish(ros_imgs[camno][1]);
 					sensor_msgs::Image remap_ros_img_ptn_0;
 					{
-						rovi::ImageFilter remap_img_filter;
-						remap_img_filter.request.img = ros_imgs[camno][0];
-						if( ! svc_remap[camno].call(remap_img_filter) ){
+						if( ! call_remap(camno,ros_imgs[camno][0],remap_ros_img_ptn_0) ){
 							ROS_ERROR(LOG_HEADER"<%d> error:camera image remap failed. camno=%d, ptn=0",n,camno);
-						}else{
-							remap_ros_img_ptn_0 = remap_img_filter.response.img;
 						}
 						pub_rects0[camno].publish(remap_ros_img_ptn_0);
 						pub_rects[camno].publish(remap_ros_img_ptn_0);
@@ -999,13 +1115,8 @@ bool exec_point_cloud_generation(std_srvs::TriggerRequest &req, std_srvs::Trigge
 					
 					sensor_msgs::Image remap_ros_img_ptn_1;
 					{
-						rovi::ImageFilter remap_img_filter;
-						remap_img_filter.request.img = ros_imgs[camno][1];
-						
-						if( ! svc_remap[camno].call(remap_img_filter) ){
+						if( ! call_remap(camno,ros_imgs[camno][1],remap_ros_img_ptn_1) ){
 							ROS_ERROR(LOG_HEADER"<%d> error:camera image remap failed. camno=%d, ptn=1",n,camno);
-						}else{
-							remap_ros_img_ptn_1 = remap_img_filter.response.img;
 						}
 						pub_rects1[camno].publish(remap_ros_img_ptn_1);
 						pub_rects[camno].publish(remap_ros_img_ptn_1);
@@ -1015,12 +1126,14 @@ bool exec_point_cloud_generation(std_srvs::TriggerRequest &req, std_srvs::Trigge
 						pub_diffs[camno].publish(diff_img);
 					}
 				}
+				tmr_pcgen_publish.record("ycam3d/publish");
 				ROS_INFO(LOG_HEADER"<%d> pcgen publish finished. proc_tm=%d",n,tmr_pcgen_publish.elapsed_ms());
 			}
 		}
 	}
 	
 	publish_bool(pub_Y1,result);
+	tmr.record("ycam3d/total");
 	
 	res.success = result;
 	res.message = res_msg_str.str();
@@ -1095,22 +1208,115 @@ void get_ycam_temperature_task(const ros::TimerEvent& e){
 	exec_get_ycam_temperature();
 }
 
+ros::ServiceServer svs_pshift_genpc;
+ros::ServiceServer svs_dump_trace;
+ros::Subscriber sub_X1;
+ros::Timer metrics_timer;
+int metrics_publish_num = 0; //直近の分布の区間を入れ替えてからの出力回数
+ros::Subscriber sub_get_temperature;
+
+/**
+ * 処理区間をChrome trace形式で書き出す. nodeletで同じプロセスに居るgenpcの区間も含まれる.
+ */
+bool dump_trace(std_srvs::TriggerRequest &req, std_srvs::TriggerResponse &res){
+	const std::string path = get_param<std::string>("trace/dir",TRACE_DIR_DEFAULT) + "/ycam3d_trace.json";
+	int event_num = 0;
+	if( ! Trace::dump(path,"ycam3d",&event_num) ){
+		ROS_ERROR(LOG_HEADER"trace dump failed. path=%s",path.c_str());
+		res.success = false;
+		res.message = "trace dump failed. path=" + path;
+	}else{
+		ROS_INFO(LOG_HEADER"trace dumped. event_num=%d, path=%s",event_num,path.c_str());
+		res.success = true;
+		res.message = path;
+	}
+	return true;
+}
 
-
-//============================================= 無名名前空間  end  =============================================
+/**
+ * 処理段階毎の分布を定期的にdiagnosticsへ出力する. metrics/prometheus_dirがあればPrometheus形式でも書き出す.
+ * metrics/window回毎に直近の分布の区間を入れ替える(起動からの累積は残す).
+ */
+void publish_metrics(const ros::TimerEvent& e){
+	diagnostic_msgs::DiagnosticArray diag;
+	diag.header.stamp = ros::Time::now();
+	diag.status.push_back(make_stage_diagnostic("rovi: ycam3d stages","ycam3d","ycam3d/"));
+	pub_diagnostics.publish(diag);
+	
+	const std::string prom_dir = get_param<std::string>("metrics/prometheus_dir","");
+	if( ! prom_dir.empty() ){
+		const std::string path = prom_dir + "/rovi_ycam3d.prom";
+		if( ! StageMetrics::write_prometheus(path,"ycam3d/") ){
+			ROS_ERROR(LOG_HEADER"prometheus text file write failed. path=%s",path.c_str());
+		}
+	}
+	
+	if( ++metrics_publish_num >= get_param<int>("metrics/window",METRICS_WINDOW_DEFAULT) ){
+		metrics_publish_num = 0;
+		StageMetrics::rotate("ycam3d/");
+	}
 }
 
+/**
+ * 疑似デバイスの撮影画像をシーンファイルから合成した画像にします.
+ * キャリブレーションと位相シフトのパラメータはこのノードのパラメータから読みます.
+ * プロジェクタの明るさ(UART)をalbedo 1の面の白の階調にします.
+ */
+bool set_emulator_scene(YCAM3DEmulator &emulator,const std::string &scene_path){
+	SceneRenderer::ParamSource params;
+	params.get_list = [](const std::string &key,std::vector<double> *values){ return nh->getParam(key,*values); };
+	params.get_value = [](const std::string &key,double *value){ return nh->getParam(key,*value); };
+	
+	ElapsedTimer tmr;
+	std::shared_ptr<SceneRenderer> renderer = std::make_shared<SceneRenderer>();
+	std::string error;
+	if( ! renderer->load_calibration(params,&error) || ! renderer->load_scene(scene_path,&error) ||
+		! renderer->prepare(emulator.width() / 2,emulator.height(),&error) ){
+		ROS_ERROR(LOG_HEADER"error: emulator scene setup failed. %s",error.c_str());
+		return false;
+	}
+	ROS_INFO(LOG_HEADER"emulator scene prepared. scene=%s, fill_ratio=%.3f, proc_tm=%d ms",scene_path.c_str(),renderer->fill_ratio(),tmr.elapsed_ms());
+	
+	std::shared_ptr<std::atomic<uint64_t>> shot = std::make_shared<std::atomic<uint64_t>>(0);
+	emulator.set_frame_source([renderer,shot](const YCAM_PROJ_PTN ptn,const int frmidx,const int frame_num,const int intensity,std::vector<uint8_t> *img){
+		SceneRenderer::Sequence seq = SceneRenderer::SEQ_GRAYPS4;
+		int frame = frmidx;
+		if( ptn == YCAM_PROJ_PTN_PHSFT_3 ){
+			seq = SceneRenderer::SEQ_MULTI;
+		}else if( ptn != YCAM_PROJ_PTN_PHSFT ){
+			frame = intensity > 0 ? 1 : 0; //位相シフト以外は全面を照らす
+		}
+		if( intensity <= 0 ){
+			frame = 0;
+		}
+		frame = std::min(frame,renderer->frame_num(seq) - 1);
+		const double exposure = intensity > 0 ? intensity / renderer->get_settings().projector_level : 1.0;
+		
+		cv::Mat imgs[2];
+		renderer->render(seq,frame,exposure,(*shot)++,&imgs[0],&imgs[1]);
+		const int width = renderer->width();
+		const int height = renderer->height();
+		for( int y = 0 ; y < height ; y++ ){
+			uint8_t *row = img->data() + (size_t)y * width * 2;
+			for( int camno = 0 ; camno < 2 ; camno++ ){
+				const unsigned char *src = imgs[camno].ptr<unsigned char>(y);
+				std::copy(src, src + width, row + camno * width);
+			}
+		}
+	});
+	return true;
+}
 
-int main(int argc, char **argv)
+bool setup_node(ros::NodeHandle &n)
 {
-	ros::init(argc, argv, "ycam3d_node");
-	ros::NodeHandle n;
 	nh = &n;
 	
+	Trace::set_enabled(get_param<bool>("trace/enabled",TRACE_ENABLED_DEFAULT));
+	
 	ROS_INFO(LOG_HEADER"initialization start.");
 	if( ! init() ){
 		ROS_ERROR(LOG_HEADER"error: initialization failed.");
-		return 1;
+		return false;
 	}
 	ROS_INFO(LOG_HEADER"initialization finished");
 	
@@ -1118,11 +1324,31 @@ int main(int argc, char **argv)
 	ROS_INFO(LOG_HEADER"camera: size= %d x %d, resolution=%s", cam_width, cam_height, camera_res.c_str());
 	ROS_INFO(LOG_HEADER"ycam3d: mode=%d, cycle=%d Hz", pre_ycam_mode, cur_mode_mon_cyc);
 	
-	camera_ptr.reset(new CameraYCAM3D());
+	//ダンプディレクトリを指定した時は実機の代わりに保存済みのパターン画像を再生する
+	//疑似デバイスを有効にした時は実機の代わりにAravisを疑似デバイスにつなぐ
+	const std::string replay_dir = get_param<std::string>(PRM_REPLAY_DIR,"");
+	if( ! replay_dir.empty() ){
+		const int replay_interval = get_param<int>(PRM_REPLAY_INTERVAL,REPLAY_INTERVAL_DEFAULT);
+		ROS_INFO(LOG_HEADER"camera replay. dir=%s, interval=%d ms",replay_dir.c_str(),replay_interval);
+		camera_ptr.reset(new CameraReplay(replay_dir,replay_interval));
+	}else if( get_param<bool>(PRM_EMULATOR_ENABLED,false) ){
+		ROS_INFO(LOG_HEADER"camera emulator enabled.");
+		std::shared_ptr<YCAM3DEmulator> emulator = std::make_shared<YCAM3DEmulator>(camera_res == "VGA" ? YCAM_RES_VGA : YCAM_RES_SXGA);
+		//シーンファイルを指定した時は縞模様の代わりに合成したパターン画像を返す
+		const std::string scene_path = get_param<std::string>(PRM_EMULATOR_SCENE,"");
+		if( ! scene_path.empty() && ! set_emulator_scene(*emulator,scene_path) ){
+			return false;
+		}
+		CameraYCAM3D *camera = new CameraYCAM3D();
+		camera->set_emulator(emulator);
+		camera_ptr.reset(camera);
+	}else{
+		camera_ptr.reset(new CameraYCAM3D());
+	}
 	
 	if( ! camera_ptr->init(camera_res) ){
 		ROS_ERROR(LOG_HEADER"error: camera initialization failed.");
-		return 1;
+		return false;
 	}
 	
 	camera_ptr->set_callback_camera_open_finished(on_camera_open_finished);
@@ -1130,6 +1356,7 @@ int main(int argc, char **argv)
 	camera_ptr->set_callback_camera_closed(on_camera_closed);
 	camera_ptr->set_callback_capture_img_received(on_capture_image_received);
 	camera_ptr->set_callback_pattern_img_received(on_pattern_image_received);
+	camera_ptr->set_callback_pattern_frame_received(on_pattern_frame_received);
 	
 	//publishers
 	pub_img_raws[0] = n.advertise<sensor_msgs::Image>("left/image_raw", 1);
@@ -1150,24 +1377,36 @@ int main(int argc, char **argv)
 	pub_diffs[1] = n.advertise<sensor_msgs::Image>("right/diff_rect", 1);
 	
 	pub_temperature = n.advertise<std_msgs::Float32>("ycam/temperature",1);
+	pub_ptn_frame = n.advertise<rovi::PatternFrame>("pattern_frame", PATTERN_STREAM_QUEUE_SIZE);
+	pub_diagnostics = n.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 1);
 	
 	//service servers
-	const ros::ServiceServer svs1 = n.advertiseService("pshift_genpc", exec_point_cloud_generation);
+	svs_pshift_genpc = n.advertiseService("pshift_genpc", exec_point_cloud_generation);
+	svs_dump_trace = n.advertiseService("ycam/dump_trace", dump_trace);
 	
 	//service clients
 	svc_genpc = n.serviceClient<rovi::GenPC>("genpc");
 	svc_remap[0] = n.serviceClient<rovi::ImageFilter>("left/remap");
 	svc_remap[1] = n.serviceClient<rovi::ImageFilter>("right/remap");
+	genpc_service_name = n.resolveName("genpc");
+	remap_service_names[0] = n.resolveName("left/remap");
+	remap_service_names[1] = n.resolveName("right/remap");
 	
 	//subscribers
-	const ros::Subscriber sub1 = n.subscribe<std_msgs::Bool>("X1", 1, sub_exec_point_cloud_generation);
-	const ros::Subscriber sub2 = n.subscribe<std_msgs::Bool>("ycam/get_temperature", 1, sub_get_ycam_temperature);
+	sub_X1 = n.subscribe<std_msgs::Bool>("X1", 1, sub_exec_point_cloud_generation);
+	sub_get_temperature = n.subscribe<std_msgs::Bool>("ycam/get_temperature", 1, sub_get_ycam_temperature);
 	
 	//timers
 	mode_mon_timer = n.createTimer(ros::Duration(1/(float)cur_mode_mon_cyc), mode_monitor_task);
 	cam_open_mon_timer = n.createTimer(ros::Duration(1), cam_open_monitor_task);
 	temp_mon_timer = n.createTimer(ros::Duration(TEMP_MON_INTERVAL_DEFAULT), get_ycam_temperature_task);
 	temp_mon_timer.stop();
+	//0以下で出力しない
+	const float metrics_interval = get_param<float>("metrics/interval",METRICS_INTERVAL_DEFAULT);
+	metrics_timer = n.createTimer(ros::Duration(metrics_interval > 0 ? metrics_interval : METRICS_INTERVAL_DEFAULT), publish_metrics);
+	if( metrics_interval <= 0 ){
+		metrics_timer.stop();
+	}
 
 	camera_ptr->set_callback_ros_error_published([](const std::string message){
 		publish_string(pub_error,message);
@@ -1178,12 +1417,17 @@ int main(int argc, char **argv)
 	});
 	camera_ptr->start_auto_connect(cam_ipaddr);
 	
-	
-	ros::Duration interval(0.01);
-	while( ros::ok() && g_node_exit_flg == 0 ){
-		ros::spinOnce();
-		interval.sleep();
-	}
+	return true;
+}
+
+void shutdown_node()
+{
+	svs_pshift_genpc.shutdown();
+	svs_dump_trace.shutdown();
+	metrics_timer.stop();
+	sub_X1.shutdown();
+	sub_get_temperature.shutdown();
+	temp_mon_timer.stop();
 	
 	mode_mon_timer.stop();
 	printf(LOG_HEADER"mode monitor timer stopped.\n");
@@ -1201,5 +1445,72 @@ int main(int argc, char **argv)
 		camera_ptr.reset();
 		printf(LOG_HEADER"camera terminate finished.\n");
 	}
+}
+
+
+//============================================= 無名名前空間  end  =============================================
+}
+
+
+#ifndef ROVI_NODELET
+
+int main(int argc, char **argv)
+{
+	ros::init(argc, argv, "ycam3d_node");
+	ros::NodeHandle n;
+	
+	if( ! setup_node(n) ){
+		return 1;
+	}
+	
+	ros::Duration interval(0.01);
+	while( ros::ok() && g_node_exit_flg == 0 ){
+		ros::spinOnce();
+		interval.sleep();
+	}
+	
+	shutdown_node();
 	return 0;
 }
+
+#else
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+namespace rovi {
+
+/**
+ * ycam3d_nodeのnodelet版. genpc/remapが同じプロセスに居れば直接呼び出す.
+ * 1プロセスに載せられるのは1台分(1インスタンス)のみ.
+ */
+class YCam3DNodelet : public nodelet::Nodelet {
+public:
+	~YCam3DNodelet(){
+		exit_mon_timer.stop();
+		shutdown_node();
+	}
+
+private:
+	ros::Timer exit_mon_timer;
+	
+	void onInit() override {
+		if( ! setup_node(getNodeHandle()) ){
+			NODELET_ERROR(LOG_HEADER"error: initialization failed.");
+			return;
+		}
+		//カメラの自動接続が上限を超えたら、単体ノードが終了するのと同じくプロセス(nodeletマネージャ)ごと終了する
+		exit_mon_timer = getNodeHandle().createTimer(ros::Duration(0.1), [](const ros::TimerEvent& e){
+			if( g_node_exit_flg != 0 ){
+				ROS_ERROR(LOG_HEADER"node exit requested. shutdown the nodelet manager.");
+				ros::requestShutdown();
+			}
+		});
+	}
+};
+
+}
+
+PLUGINLIB_EXPORT_CLASS(rovi::YCam3DNodelet, nodelet::Nodelet)
+
+#endif
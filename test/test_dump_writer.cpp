@@ -0,0 +1,39 @@
+/**
+ * DumpWriterの終了と再開の確認.
+ * genpcのnodeletを再読み込みした時(shutdown()の後にpush())も、ジョブが書き出されること.
+ */
+#include <gtest/gtest.h>
+
+#include <atomic>
+
+#include "DumpWriter.hpp"
+
+//shutdown()の後に積んだジョブも書き出されること
+TEST(DumpWriter, PushAfterShutdown){
+	DumpWriter writer;
+	std::atomic<int> done(0);
+
+	ASSERT_TRUE(writer.push("first", [&done](){ ++done; return true; }));
+	writer.shutdown();
+	EXPECT_EQ(1, done);
+
+	ASSERT_TRUE(writer.push("second", [&done](){ ++done; return true; }));
+	writer.flush();
+	EXPECT_EQ(2, done);
+	EXPECT_EQ(2u, writer.get_stats().written);
+
+	writer.shutdown();
+	EXPECT_EQ(2, done);
+}
+
+//shutdown()を続けて呼んでも、積んだジョブは全て書き出してから終わること
+TEST(DumpWriter, ShutdownTwice){
+	DumpWriter writer;
+	std::atomic<int> done(0);
+	for( int i = 0 ; i < 3 ; i++ ){
+		ASSERT_TRUE(writer.push("job", [&done](){ ++done; return true; }));
+	}
+	writer.shutdown();
+	writer.shutdown();
+	EXPECT_EQ(3, done);
+}
@@ -0,0 +1,93 @@
+/**
+ * StageMetricsの起動からの累積と直近の分布の確認.
+ * /diagnosticsの分位点は直近の区間だけ、Prometheusの_sum/_countは累積のままであること.
+ */
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+#include "StageMetrics.hpp"
+
+namespace {
+	const StageMetrics::Summary &find_summary(const std::vector<StageMetrics::Summary> &summaries, const std::string &name){
+		for( const StageMetrics::Summary &summary : summaries ){
+			if( summary.name == name ){
+				return summary;
+			}
+		}
+		static const StageMetrics::Summary empty;
+		ADD_FAILURE() << "no stage " << name;
+		return empty;
+	}
+}
+
+//rotate()を2回すると古い値は直近の分布から外れ、累積には残ること
+TEST(StageMetrics, RecentWindowRotates){
+	StageMetrics::clear();
+	for( int i = 0 ; i < 100 ; i++ ){
+		StageMetrics::record("test/stage", 100);
+	}
+	StageMetrics::rotate("test/");
+	StageMetrics::record("test/stage", 10);
+
+	//1つ前の区間の値はまだ直近に含まれる
+	StageMetrics::Summary recent = find_summary(StageMetrics::summaries("test/", true), "test/stage");
+	EXPECT_EQ(101u, recent.recent_count);
+	EXPECT_NEAR(100, recent.p50, 100 * 0.07);
+
+	StageMetrics::rotate("test/");
+	StageMetrics::rotate("test/");
+	StageMetrics::record("test/stage", 10);
+	recent = find_summary(StageMetrics::summaries("test/", true), "test/stage");
+	EXPECT_EQ(1u, recent.recent_count);
+	EXPECT_NEAR(10, recent.p50, 10 * 0.07);
+	EXPECT_NEAR(10, recent.max, 1e-9);
+	EXPECT_EQ(102u, recent.count);
+	EXPECT_NEAR(100 * 100 + 10 + 10, recent.sum, 1e-6);
+
+	const StageMetrics::Summary total = find_summary(StageMetrics::summaries("test/"), "test/stage");
+	EXPECT_EQ(102u, total.recent_count);
+	EXPECT_NEAR(100, total.p50, 100 * 0.07);
+	EXPECT_NEAR(100, total.max, 1e-9);
+}
+
+//rotate()はprefixで始まる段階だけを入れ替えること
+TEST(StageMetrics, RotatePrefixOnly){
+	StageMetrics::clear();
+	StageMetrics::record("a/stage", 5);
+	StageMetrics::record("b/stage", 5);
+	StageMetrics::rotate("a/");
+	StageMetrics::rotate("a/");
+	EXPECT_EQ(0u, find_summary(StageMetrics::summaries("a/", true), "a/stage").recent_count);
+	EXPECT_EQ(1u, find_summary(StageMetrics::summaries("b/", true), "b/stage").recent_count);
+}
+
+//Prometheusの分位点は直近、_sum/_countは累積
+TEST(StageMetrics, PrometheusKeepsCumulativeCount){
+	StageMetrics::clear();
+	for( int i = 0 ; i < 10 ; i++ ){
+		StageMetrics::record("test/stage", 100);
+	}
+	StageMetrics::rotate("test/");
+	StageMetrics::rotate("test/");
+	StageMetrics::record("test/stage", 10);
+
+	char path[] = "/tmp/test_stage_metricsXXXXXX";
+	const int fd = mkstemp(path);
+	ASSERT_GE(fd, 0);
+	close(fd);
+	ASSERT_TRUE(StageMetrics::write_prometheus(path, "test/"));
+	std::ifstream ifs(path);
+	std::stringstream text;
+	text << ifs.rdbuf();
+	remove(path);
+
+	EXPECT_NE(std::string::npos, text.str().find("rovi_stage_latency_ms{stage=\"test/stage\",quantile=\"1\"} 10\n"));
+	EXPECT_NE(std::string::npos, text.str().find("rovi_stage_latency_ms_sum{stage=\"test/stage\"} 1010\n"));
+	EXPECT_NE(std::string::npos, text.str().find("rovi_stage_latency_ms_count{stage=\"test/stage\"} 11\n"));
+}
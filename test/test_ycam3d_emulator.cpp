@@ -0,0 +1,223 @@
+/**
+ * 疑似デバイス(YCAM3DEmulator)につないだCameraYCAM3D/Aravisの動作確認.
+ * プロジェクタのパターン切り替え、温度取得、切断後の自動再接続、UARTのLRCエラーを、実機と同じ経路(レジスタ/UART/画像ストリーム)で確かめます.
+ */
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <ros/time.h>
+
+#include "CameraYCAM3D.hpp"
+#include "YCAM3DEmulator.hpp"
+
+namespace {
+
+const std::string CAMERA_RES = "VGA";
+const int TRIGGER_TIMEOUT = 3; //sec
+//自動接続は5秒毎に再試行する
+const int OPEN_TIMEOUT = 20; //sec
+//GRAYPS4(位相シフト)の撮影枚数
+const int PHSFT_FRAME_NUM = 13;
+
+/**
+ * カメラのコールバックを待ち合わせます.
+ */
+class CameraEvents {
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	int m_disconnected = 0;
+	int m_pattern_received = 0;
+	bool m_pattern_result = false;
+	size_t m_pattern_frames = 0;
+
+public:
+	void notify(){
+		m_cond.notify_all();
+	}
+
+	void on_disconnect(){
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			++m_disconnected;
+		}
+		m_cond.notify_all();
+	}
+
+	void on_pattern_received(const bool result,const std::vector<camera::ycam3d::CameraImage> &imgs_l,const std::vector<camera::ycam3d::CameraImage> &imgs_r){
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			++m_pattern_received;
+			m_pattern_result = result && imgs_l.size() == imgs_r.size();
+			m_pattern_frames = imgs_l.size();
+		}
+		m_cond.notify_all();
+	}
+
+	int disconnected(){
+		std::lock_guard<std::mutex> locker(m_mutex);
+		return m_disconnected;
+	}
+
+	int pattern_received(){
+		std::lock_guard<std::mutex> locker(m_mutex);
+		return m_pattern_received;
+	}
+
+	bool wait_open(iCameraSource &camera,const int timeout_sec){
+		std::unique_lock<std::mutex> locker(m_mutex);
+		return m_cond.wait_for(locker, std::chrono::seconds(timeout_sec), [&camera](){ return camera.is_open(); });
+	}
+
+	bool wait_disconnect(const int timeout_sec){
+		std::unique_lock<std::mutex> locker(m_mutex);
+		return m_cond.wait_for(locker, std::chrono::seconds(timeout_sec), [this](){ return m_disconnected > 0; });
+	}
+
+	/**
+	 * received回目より後の撮影結果を待ちます.
+	 * @return 画像が全て揃った時はtrue. frame_numに枚数
+	 */
+	bool wait_pattern(const int received,size_t *frame_num){
+		std::unique_lock<std::mutex> locker(m_mutex);
+		//撮影スレッドはtrigger_timeoutで必ずコールバックするので、余裕を持って待つ
+		if( ! m_cond.wait_for(locker, std::chrono::seconds(TRIGGER_TIMEOUT * 2 + 1), [this,received](){ return m_pattern_received > received; }) ){
+			return false;
+		}
+		*frame_num = m_pattern_frames;
+		return m_pattern_result;
+	}
+};
+
+class YCAM3DEmulatorTest : public ::testing::Test {
+protected:
+	std::shared_ptr<YCAM3DEmulator> emulator;
+	CameraEvents events;
+	std::unique_ptr<CameraYCAM3D> camera;
+
+	void SetUp() override {
+		ros::Time::init();
+	}
+
+	void TearDown() override {
+		if( camera ){
+			camera->close();
+			camera.reset();
+		}
+	}
+
+	void open(const YCAM3DEmulator::Settings &settings){
+		emulator = std::make_shared<YCAM3DEmulator>(YCAM_RES_VGA, settings);
+		camera.reset(new CameraYCAM3D());
+		camera->set_emulator(emulator);
+		ASSERT_TRUE(camera->init(CAMERA_RES));
+		camera->set_trigger_timeout_period(TRIGGER_TIMEOUT);
+		camera->set_callback_camera_open_finished([this](const bool result){ events.notify(); });
+		camera->set_callback_camera_disconnect([this](){ events.on_disconnect(); });
+		camera->set_callback_pattern_img_received([this](const bool result,const int elapsed,
+			const std::vector<camera::ycam3d::CameraImage> &imgs_l,const std::vector<camera::ycam3d::CameraImage> &imgs_r,const bool timeout,const int expsrLv){
+			events.on_pattern_received(result, imgs_l, imgs_r);
+		});
+		camera->start_auto_connect();
+		ASSERT_TRUE(events.wait_open(*camera, OPEN_TIMEOUT));
+	}
+
+	//パターン撮影. 画像が全て揃った時はtrue
+	bool capture_pattern(const bool multi,size_t *frame_num){
+		const int received = events.pattern_received();
+		if( ! camera->capture_pattern(multi, false) ){
+			return false;
+		}
+		return events.wait_pattern(received, frame_num);
+	}
+};
+
+}
+
+//setProjectorPattern()で切り替えたパターンがプロジェクタに届き、その枚数の画像が揃うこと
+TEST_F(YCAM3DEmulatorTest, ProjectorPattern){
+	open(YCAM3DEmulator::Settings());
+
+	size_t frame_num = 0;
+	ASSERT_TRUE(capture_pattern(false, &frame_num));
+	EXPECT_EQ(YCAM_PROJ_PTN_PHSFT, emulator->projector_pattern());
+	EXPECT_EQ((size_t)PHSFT_FRAME_NUM, frame_num);
+
+	ASSERT_TRUE(capture_pattern(true, &frame_num));
+	EXPECT_EQ(YCAM_PROJ_PTN_PHSFT_3, emulator->projector_pattern());
+	EXPECT_GT(frame_num, (size_t)0);
+
+	ASSERT_TRUE(capture_pattern(false, &frame_num));
+	EXPECT_EQ(YCAM_PROJ_PTN_PHSFT, emulator->projector_pattern());
+
+	const YCAM3DEmulator::Stats stats = emulator->get_stats();
+	EXPECT_EQ(3u, stats.triggers);
+	EXPECT_EQ(0u, stats.uart_lrc_errors);
+}
+
+//温度取得(UART "g")の応答がそのまま読めること
+TEST_F(YCAM3DEmulatorTest, Temperature){
+	YCAM3DEmulator::Settings settings;
+	settings.temperature = 57;
+	settings.uart_reply_latency_ms = 20;
+	open(settings);
+
+	int temperature = -1;
+	ASSERT_TRUE(camera->get_temperature(&temperature));
+	EXPECT_EQ(57, temperature);
+
+	settings.temperature = 38;
+	emulator->set_settings(settings);
+	ASSERT_TRUE(camera->get_temperature(&temperature));
+	EXPECT_EQ(38, temperature);
+}
+
+//disconnect_after_framesで切断された後、自動接続で戻って撮影できること
+TEST_F(YCAM3DEmulatorTest, Reconnect){
+	YCAM3DEmulator::Settings settings;
+	settings.disconnect_after_frames = PHSFT_FRAME_NUM + PHSFT_FRAME_NUM / 2;
+	open(settings);
+
+	size_t frame_num = 0;
+	ASSERT_TRUE(capture_pattern(false, &frame_num));
+	//2回目の撮影の途中で切断される
+	EXPECT_FALSE(capture_pattern(false, &frame_num));
+	ASSERT_TRUE(events.wait_disconnect(OPEN_TIMEOUT));
+
+	ASSERT_TRUE(events.wait_open(*camera, OPEN_TIMEOUT));
+	ASSERT_TRUE(capture_pattern(false, &frame_num));
+	EXPECT_EQ((size_t)PHSFT_FRAME_NUM, frame_num);
+
+	const YCAM3DEmulator::Stats stats = emulator->get_stats();
+	EXPECT_EQ(1u, stats.disconnects);
+	EXPECT_EQ(2u, stats.connects);
+	EXPECT_EQ(1, events.disconnected());
+}
+
+//LRCが合わないUARTの書き込みは数えて捨て、以降のコマンドは通ること
+TEST_F(YCAM3DEmulatorTest, UartLrcError){
+	open(YCAM3DEmulator::Settings());
+	const YCAM3DEmulator::Stats before = emulator->get_stats();
+
+	//温度取得"g\r"の"g"を壊す. 壊れた文字は捨てられ、空行はコマンドにならない
+	UART_DATA_FIELD u;
+	u.dwData = 0;
+	u.b.data = 'g';
+	u.b.data_lrc = u.b.data;
+	ASSERT_TRUE(emulator->write_register(REG_UART, u.dwData));
+	u.b.data = '\r';
+	u.b.data_lrc = ~u.b.data;
+	ASSERT_TRUE(emulator->write_register(REG_UART, u.dwData));
+
+	const YCAM3DEmulator::Stats after = emulator->get_stats();
+	EXPECT_EQ(before.uart_lrc_errors + 1, after.uart_lrc_errors);
+	EXPECT_EQ(before.uart_commands, after.uart_commands);
+
+	int temperature = -1;
+	EXPECT_TRUE(camera->get_temperature(&temperature));
+	EXPECT_EQ(YCAM3DEmulator::Settings().temperature, temperature);
+	EXPECT_EQ(before.uart_commands + 1, emulator->get_stats().uart_commands);
+}
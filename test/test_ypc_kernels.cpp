@@ -0,0 +1,162 @@
+/**
+ * YPCKernels::compact_points()の実装(AVX2 / SSE4.1)がスカラー実装と同じバイト列を出力することの確認.
+ * 実行しているCPUで使える実装(selected_isa()以下)を全て試します.
+ */
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "YPCKernels.hpp"
+
+namespace {
+
+typedef YPCKernels::Point3d Point3d;
+
+const unsigned char SENTINEL = 0xA5;
+
+struct Input {
+	std::vector<Point3d> points;
+	std::vector<unsigned char> gray;
+};
+
+/**
+ * 入力点群を作ります.
+ * @param count      点数
+ * @param nan_ratio  xをNaNにする割合(0..1)
+ * @param seed       乱数の種
+ */
+Input make_input(const int count, const double nan_ratio, const unsigned int seed){
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<float> coord(-1000.0f, 1000.0f);
+	std::uniform_real_distribution<double> ratio(0.0, 1.0);
+	Input input;
+	input.points.resize(count);
+	input.gray.resize(count);
+	for( int i = 0 ; i < count ; i++ ){
+		if( ratio(random) < nan_ratio ){
+			//無効点. y,zは値が入っていても無視されること
+			input.points[i].x = std::numeric_limits<float>::quiet_NaN();
+			input.points[i].y = coord(random);
+		}else{
+			input.points[i] = Point3d(coord(random), coord(random), coord(random));
+			if( i % 7 == 3 ){
+				input.points[i].x = -0.0f;
+			}
+		}
+		input.gray[i] = (unsigned char)(random() & 0xff);
+	}
+	return input;
+}
+
+struct Output {
+	int n = 0;
+	std::vector<float> xyz;
+	std::vector<float> rgb;
+};
+
+Output run(const YPCKernels::Isa isa, const Input &input, const int xyz_step, const int rgb_step, const int max_out){
+	const int count = (int)input.points.size();
+	Output out;
+	//書き込み範囲外が変わらないことも比べるため、出力先は最大点数+1点分を番兵で埋めておく
+	out.xyz.resize((size_t)(count + 1) * xyz_step);
+	out.rgb.resize((size_t)(count + 1) * rgb_step);
+	std::memset(out.xyz.data(), SENTINEL, out.xyz.size() * sizeof(float));
+	std::memset(out.rgb.data(), SENTINEL, out.rgb.size() * sizeof(float));
+	out.n = YPCKernels::compact_points(isa, input.points.data(), input.gray.data(), count,
+		out.xyz.data(), xyz_step, out.rgb.data(), rgb_step, max_out);
+	return out;
+}
+
+int count_valid(const Input &input){
+	int n = 0;
+	for( const Point3d &pt : input.points ){
+		n += std::isnan(pt.x) ? 0 : 1;
+	}
+	return n;
+}
+
+/**
+ * 使える全実装の出力をスカラー実装とmemcmpで比べます.
+ */
+void expect_same_as_scalar(const Input &input, const int xyz_step, const int rgb_step, const int max_out){
+	const Output expected = run(YPCKernels::ISA_SCALAR, input, xyz_step, rgb_step, max_out);
+	ASSERT_EQ(std::min(count_valid(input), std::max(max_out, 0)), expected.n);
+	for( int isa = YPCKernels::ISA_SCALAR + 1 ; isa <= YPCKernels::selected_isa() ; isa++ ){
+		SCOPED_TRACE(YPCKernels::isa_name((YPCKernels::Isa)isa));
+		const Output actual = run((YPCKernels::Isa)isa, input, xyz_step, rgb_step, max_out);
+		EXPECT_EQ(expected.n, actual.n);
+		EXPECT_EQ(0, std::memcmp(expected.xyz.data(), actual.xyz.data(), expected.xyz.size() * sizeof(float)));
+		EXPECT_EQ(0, std::memcmp(expected.rgb.data(), actual.rgb.data(), expected.rgb.size() * sizeof(float)));
+	}
+}
+
+}
+
+TEST(YPCKernels, ScalarOutput){
+	Input input = make_input(5, 0, 1);
+	input.points[1].x = std::numeric_limits<float>::quiet_NaN();
+	input.gray[0] = 0x12;
+	const Output out = run(YPCKernels::ISA_SCALAR, input, 3, 1, 5);
+	ASSERT_EQ(4, out.n);
+	EXPECT_EQ(0, std::memcmp(&input.points[0], &out.xyz[0], sizeof(Point3d)));
+	EXPECT_EQ(0, std::memcmp(&input.points[2], &out.xyz[3], sizeof(Point3d)));
+	uint32_t rgb;
+	std::memcpy(&rgb, &out.rgb[0], sizeof(rgb));
+	EXPECT_EQ(0x121212u, rgb);
+}
+
+//NaNの多い入力. 全部NaN、ほぼNaN、交互、ブロック単位で全部有効/全部無効
+TEST(YPCKernels, NanHeavy){
+	for( const double nan_ratio : {1.0, 0.99, 0.9, 0.5, 0.1, 0.0} ){
+		SCOPED_TRACE(nan_ratio);
+		expect_same_as_scalar(make_input(4099, nan_ratio, 7), 3, 1, 4099);
+	}
+
+	Input alternate = make_input(1001, 0, 11);
+	for( size_t i = 0 ; i < alternate.points.size() ; i += 2 ){
+		alternate.points[i].x = std::numeric_limits<float>::quiet_NaN();
+	}
+	expect_same_as_scalar(alternate, 3, 1, 1001);
+
+	Input blocks = make_input(1003, 0, 13);
+	for( size_t i = 0 ; i < blocks.points.size() ; i++ ){
+		if( (i / 8) % 3 == 1 ){
+			blocks.points[i].x = std::numeric_limits<float>::quiet_NaN();
+		}
+	}
+	expect_same_as_scalar(blocks, 3, 1, 1003);
+}
+
+//SIMDの幅(4, 8点)で割り切れない点数. 端数だけの入力も含む
+TEST(YPCKernels, OddLengths){
+	for( int count = 1 ; count <= 67 ; count++ ){
+		SCOPED_TRACE(count);
+		expect_same_as_scalar(make_input(count, 0.3, 100 + count), 3, 1, count);
+		expect_same_as_scalar(make_input(count, 0.0, 200 + count), 3, 1, count);
+	}
+	expect_same_as_scalar(make_input(640 * 3 + 5, 0.5, 17), 3, 1, 640 * 3 + 5);
+}
+
+//出力点数の上限が途中のブロックや端数で尽きる場合
+TEST(YPCKernels, TailSizes){
+	const Input input = make_input(131, 0.25, 23);
+	const int valid = count_valid(input);
+	for( int max_out = 0 ; max_out <= valid + 2 ; max_out++ ){
+		SCOPED_TRACE(max_out);
+		expect_same_as_scalar(input, 3, 1, max_out);
+	}
+}
+
+//PointCloud2の点間隔(XYZRGB: 8float, xyz+rgb: 4float)で書く場合
+TEST(YPCKernels, StridedOutput){
+	for( const int step : {4, 8} ){
+		SCOPED_TRACE(step);
+		expect_same_as_scalar(make_input(517, 0.4, 29), step, step, 517);
+		expect_same_as_scalar(make_input(64, 0.0, 31), step, step, 40);
+	}
+}